@@ -20,16 +20,31 @@
 #include "session.h"
 #include "PublishMessage.pb.h"
 #include "PublishResponseMessage.pb.h"
+#include "PublishBatchMessage.pb.h"
+#include "PublishBatchResponseMessage.pb.h"
+#include "ConsumeFromQueueMessage.pb.h"
+#include "ConsumeResponseMessage.pb.h"
+#include "ConsumeCreditMessage.pb.h"
+#include "DeliveryMessage.pb.h"
+#include "Delivery.pb.h"
+#include "ClaimMessage.pb.h"
+#include "ClaimResponseMessage.pb.h"
+#include "QueueClaim.pb.h"
+#include "VectorClock.pb.h"
 #include "util.h"
 #include "messageutil.h"
 #include "logging.h"
 #include "responses.h"
+#include "settings.h"
 
 #include <functional>
+#include <stdexcept>
 
 using sopmq::shared::util;
 using sopmq::message::messageutil;
 using sopmq::shared::message::PublishMessageResponse;
+using sopmq::shared::message::ConsumeResponse;
+using sopmq::shared::message::ClaimResponse;
 
 using namespace std::placeholders;
 
@@ -41,7 +56,8 @@ namespace sopmq {
             : _conn(conn), _session(session),
             _dispatcher(std::bind(&authenticated_state::on_unhandled_message, this, _1, _2))
             {
-                
+                _dispatcher.set_reply_timeout(conn->get_io_service(),
+                                              boost::chrono::seconds(settings::instance().defaultTimeout));
             }
             
             authenticated_state::~authenticated_state()
@@ -63,6 +79,12 @@ namespace sopmq {
             
             void authenticated_state::state_entry()
             {
+                //deliveries aren't replies, they arrive whenever the node has messages
+                std::function<void(const shared::net::network_operation_result&, DeliveryMessage_ptr)> deliveryHandler
+                    = std::bind(&authenticated_state::on_delivery, this, _1, _2);
+                
+                _dispatcher.set_handler(deliveryHandler);
+                
                 this->read_next();
             }
             
@@ -129,6 +151,258 @@ namespace sopmq {
                                     });
             }
             
+            void authenticated_state::publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback)
+            {
+                PublishBatchMessage_ptr message = messageutil::make_message<PublishBatchMessage>(_conn->get_next_id(), 0);
+                
+                for (auto& entry : entries)
+                {
+                    PublishMessage* pm = message->add_messages();
+                    pm->set_allocated_identity(messageutil::build_id(0, 0));
+                    pm->set_allocated_message_id(util::uuid_to_bytes(util::random_uuid()));
+                    pm->set_queue_id(entry.queue_id);
+                    pm->set_ttl(entry.ttl);
+                    pm->set_content(entry.data);
+                    
+                    if (entry.store_if_cant_pipe) pm->set_flags(PublishMessage::Flags::PublishMessage_Flags_STORE_IF_PIPE_FAILS);
+                    else pm->set_flags(0);
+                }
+                
+                size_t count = entries.size();
+                
+                auto self(shared_from_this());
+                _conn->send_message(sopmq::message::message_type::MT_PUBLISH_BATCH, message,
+                                    [=] (const shared::net::network_operation_result& result)
+                                    {
+                                        if (result.was_successful())
+                                        {
+                                            std::function<void(const shared::net::network_operation_result&, PublishBatchResponseMessage_ptr)> responseHandler =
+                                                [=] (const shared::net::network_operation_result& result, PublishBatchResponseMessage_ptr response)
+                                                {
+                                                    std::vector<PublishMessageResponse> statuses;
+                                                    statuses.reserve(count);
+                                                    
+                                                    if (result.was_successful() && response->statuses_size() == (int)count)
+                                                    {
+                                                        for (int i = 0; i < response->statuses_size(); ++i)
+                                                        {
+                                                            statuses.push_back((PublishMessageResponse) response->statuses(i));
+                                                        }
+                                                    }
+                                                    else
+                                                    {
+                                                        statuses.assign(count, sopmq::shared::message::PMR_NETWORK_ERROR);
+                                                    }
+                                                    
+                                                    callback(statuses);
+                                                };
+                                            
+                                            _dispatcher.set_handler(responseHandler, message->identity().id());
+                                        }
+                                        else
+                                        {
+                                            if (auto session = self->_session.lock())
+                                            {
+                                                session->connection_error(result);
+                                            }
+                                        }
+                                    });
+            }
+            
+            void authenticated_state::consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                                              std::uint32_t windowBytes, consume_message_callback messageCallback,
+                                              consume_status_callback statusCallback)
+            {
+                ConsumeFromQueueMessage_ptr message = messageutil::make_message<ConsumeFromQueueMessage>(_conn->get_next_id(), 0);
+                message->set_queue_id(queueId);
+                message->set_download_type(claim ? ConsumeFromQueueMessage::CLAIMSTORED : ConsumeFromQueueMessage::PEEKSTORED);
+                message->set_intercept_type(claim ? ConsumeFromQueueMessage::CLAIM : ConsumeFromQueueMessage::PEEK);
+                message->set_credit_messages(windowMessages);
+                message->set_credit_bytes(windowBytes);
+                
+                std::uint32_t subscriptionId = message->identity().id();
+                
+                //the node ends an earlier subscription to the queue when it sees this one
+                _consumers.erase(this->find_consumer(queueId));
+                
+                //messages can follow the response immediately
+                consumer c = { queueId, messageCallback };
+                _consumers[subscriptionId] = c;
+                
+                auto self(shared_from_this());
+                _conn->send_message(sopmq::message::message_type::MT_CONSUME_FROM_QUEUE, message,
+                                    [=] (const shared::net::network_operation_result& result)
+                                    {
+                                        if (result.was_successful())
+                                        {
+                                            std::function<void(const shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> responseHandler =
+                                                [=] (const shared::net::network_operation_result& result, ConsumeResponseMessage_ptr response)
+                                                {
+                                                    ConsumeResponse status = sopmq::shared::message::CR_NETWORK_ERROR;
+                                                    if (result.was_successful())
+                                                    {
+                                                        status = (ConsumeResponse) response->status();
+                                                    }
+                                                    
+                                                    if (status != sopmq::shared::message::CR_OK)
+                                                    {
+                                                        self->_consumers.erase(subscriptionId);
+                                                    }
+                                                    
+                                                    statusCallback(status);
+                                                };
+                                            
+                                            _dispatcher.set_handler(responseHandler, subscriptionId);
+                                        }
+                                        else
+                                        {
+                                            self->_consumers.erase(subscriptionId);
+                                            
+                                            if (auto session = self->_session.lock())
+                                            {
+                                                session->connection_error(result);
+                                            }
+                                        }
+                                    });
+            }
+            
+            void authenticated_state::on_delivery(const shared::net::network_operation_result& result, DeliveryMessage_ptr message)
+            {
+                //a failed read is reported through the read loop
+                if (! result.was_successful()) return;
+                
+                auto iter = _consumers.find(message->subscription_id());
+                if (iter == _consumers.end())
+                {
+                    LOG_SRC(warning) << _conn->endpoint()
+                        << " sent messages for unknown subscription " << message->subscription_id();
+                    return;
+                }
+                
+                //the callback could stop the consumer, so hold on to it
+                consume_message_callback callback = iter->second.callback;
+                
+                std::uint32_t bytes = 0;
+                delivered_message delivered;
+                for (auto& delivery : message->messages())
+                {
+                    delivered.message_id = delivery.message_id();
+                    delivered.data = delivery.content();
+                    delivered.cursor = delivery.has_clock() ? delivery.clock().SerializeAsString() : std::string();
+                    
+                    callback(delivered);
+                    bytes += (std::uint32_t)delivery.content().size();
+                }
+                
+                //frames still on their way after a stop don't get credit back
+                if (_consumers.count(message->subscription_id()) == 0) return;
+                
+                //everything in the frame has been handled, so the node can send as much again
+                ConsumeCreditMessage_ptr credit = messageutil::make_message<ConsumeCreditMessage>(_conn->get_next_id(), 0);
+                credit->set_subscription_id(message->subscription_id());
+                credit->set_messages(message->messages_size());
+                credit->set_bytes(bytes);
+                
+                auto self(shared_from_this());
+                _conn->send_message(sopmq::message::message_type::MT_CONSUME_CREDIT, credit,
+                                    [self] (const shared::net::network_operation_result& result)
+                                    {
+                                        if (! result.was_successful())
+                                        {
+                                            if (auto session = self->_session.lock())
+                                            {
+                                                session->connection_error(result);
+                                            }
+                                        }
+                                    });
+            }
+            
+            void authenticated_state::stop_consuming(const std::string& queueId)
+            {
+                std::uint32_t subscriptionId = this->find_consumer(queueId);
+                if (subscriptionId == 0) return;
+                
+                _consumers.erase(subscriptionId);
+                
+                ConsumeCreditMessage_ptr cancel = messageutil::make_message<ConsumeCreditMessage>(_conn->get_next_id(), 0);
+                cancel->set_subscription_id(subscriptionId);
+                cancel->set_messages(0);
+                cancel->set_bytes(0);
+                cancel->set_cancel(true);
+                
+                auto self(shared_from_this());
+                _conn->send_message(sopmq::message::message_type::MT_CONSUME_CREDIT, cancel,
+                                    [self] (const shared::net::network_operation_result& result)
+                                    {
+                                        if (! result.was_successful())
+                                        {
+                                            if (auto session = self->_session.lock())
+                                            {
+                                                session->connection_error(result);
+                                            }
+                                        }
+                                    });
+            }
+            
+            std::uint32_t authenticated_state::find_consumer(const std::string& queueId) const
+            {
+                for (auto& entry : _consumers)
+                {
+                    if (entry.second.queue_id == queueId) return entry.first;
+                }
+                
+                return 0;
+            }
+            
+            void authenticated_state::claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                                            const std::string& cursor, claim_callback callback)
+            {
+                ClaimMessage_ptr message = messageutil::make_message<ClaimMessage>(_conn->get_next_id(), 0);
+                
+                QueueClaim* claim = message->mutable_claim();
+                claim->set_queue_id(queueId);
+                
+                for (auto& id : messageIds)
+                {
+                    claim->add_message_ids(id);
+                }
+                
+                if (! cursor.empty() && ! claim->mutable_through()->ParseFromString(cursor))
+                {
+                    throw std::invalid_argument("Invalid claim cursor");
+                }
+                
+                auto self(shared_from_this());
+                _conn->send_message(sopmq::message::message_type::MT_CLAIM, message,
+                                    [=] (const shared::net::network_operation_result& result)
+                                    {
+                                        if (result.was_successful())
+                                        {
+                                            std::function<void(const shared::net::network_operation_result&, ClaimResponseMessage_ptr)> responseHandler =
+                                                [=] (const shared::net::network_operation_result& result, ClaimResponseMessage_ptr response)
+                                                {
+                                                    if (result.was_successful())
+                                                    {
+                                                        callback((ClaimResponse) response->status());
+                                                    }
+                                                    else
+                                                    {
+                                                        callback(sopmq::shared::message::CLR_NETWORK_ERROR);
+                                                    }
+                                                };
+                                            
+                                            _dispatcher.set_handler(responseHandler, message->identity().id());
+                                        }
+                                        else
+                                        {
+                                            if (auto session = self->_session.lock())
+                                            {
+                                                session->connection_error(result);
+                                            }
+                                        }
+                                    });
+            }
+            
         }
     }
 }
\ No newline at end of file
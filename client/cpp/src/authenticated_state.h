@@ -24,6 +24,8 @@
 #include "message_ptrs.h"
 
 #include <memory>
+#include <map>
+#include <cstdint>
 
 namespace sopmq {
     namespace client {
@@ -44,14 +46,48 @@ namespace sopmq {
                 virtual void publish_message(const std::string& queueId, bool storeIfCantPipe, int ttl,
                                              const std::string& data, publish_message_callback callback);
                 
+                virtual void publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback);
+                
+                virtual void consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                                     std::uint32_t windowBytes, consume_message_callback messageCallback,
+                                     consume_status_callback statusCallback);
+                
+                virtual void stop_consuming(const std::string& queueId);
+                
+                virtual void claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                                   const std::string& cursor, claim_callback callback);
+                
             private:
                 void on_unhandled_message(Message_ptr message, const std::string& typeName);
                 void read_next();
                 
+                ///
+                /// Hands pushed messages to their consumer and gives the node the
+                /// credit back
+                ///
+                void on_delivery(const shared::net::network_operation_result& result, DeliveryMessage_ptr message);
+                
                 cluster_connection::ptr _conn;
                 std::weak_ptr<session> _session;
                 
                 sopmq::message::message_dispatcher _dispatcher;
+                
+                struct consumer
+                {
+                    std::string queue_id;
+                    consume_message_callback callback;
+                };
+                
+                ///
+                /// Consumers by the id of the consume request they belong to. The node
+                /// keeps one subscription per queue, so there is at most one per queue here
+                ///
+                std::map<std::uint32_t, consumer> _consumers;
+                
+                ///
+                /// The id of the subscription to a queue, or 0 when there isn't one
+                ///
+                std::uint32_t find_consumer(const std::string& queueId) const;
             };
             
         }
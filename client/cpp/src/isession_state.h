@@ -21,6 +21,7 @@
 #include "session_callbacks.h"
 
 #include <memory>
+#include <cstdint>
 
 namespace sopmq {
     namespace client {
@@ -42,6 +43,17 @@ namespace sopmq {
                 
                 virtual void publish_message(const std::string& queueId, bool storeIfCantPipe, int ttl,
                                              const std::string& data, publish_message_callback callback) = 0;
+                
+                virtual void publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback) = 0;
+                
+                virtual void consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                                     std::uint32_t windowBytes, consume_message_callback messageCallback,
+                                     consume_status_callback statusCallback) = 0;
+                
+                virtual void stop_consuming(const std::string& queueId) = 0;
+                
+                virtual void claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                                   const std::string& cursor, claim_callback callback) = 0;
             };
             
         }
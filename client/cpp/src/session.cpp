@@ -78,6 +78,34 @@ namespace sopmq {
             _session_state->publish_message(queueId, storeIfCantPipe, ttl, data, callback);
         }
         
+        void session::publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback)
+        {
+            _session_state->publish_batch(entries, callback);
+        }
+        
+        void session::consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                              std::uint32_t windowBytes, consume_message_callback messageCallback,
+                              consume_status_callback statusCallback)
+        {
+            _session_state->consume(queueId, claim, windowMessages, windowBytes, messageCallback, statusCallback);
+        }
+        
+        void session::stop_consuming(const std::string& queueId)
+        {
+            _session_state->stop_consuming(queueId);
+        }
+        
+        void session::claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                            claim_callback callback)
+        {
+            _session_state->claim(queueId, messageIds, std::string(), callback);
+        }
+        
+        void session::claim_through(const std::string& queueId, const std::string& cursor, claim_callback callback)
+        {
+            _session_state->claim(queueId, std::vector<std::string>(), cursor, callback);
+        }
+        
         void session::protocol_violation()
         {
             LOG_SRC(error) << "protocol violation";
@@ -30,6 +30,7 @@
 #include <string>
 #include <cstdint>
 #include <functional>
+#include <vector>
 
 namespace sopmq {
     namespace client {
@@ -72,6 +73,51 @@ namespace sopmq {
             void publish_message(const std::string& queueId, bool storeIfCantPipe, int ttl,
                                  const std::string& data, publish_message_callback callback);
             
+            ///
+            /// Posts a set of messages in one request. The nodes handle the whole batch
+            /// at once, which is much cheaper than publishing the messages one by one
+            /// \param entries The messages to post
+            /// \param callback Called with a response for each entry, in the same order
+            void publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback);
+            
+            ///
+            /// Starts pulling the messages on a queue. Messages already on the queue come
+            /// first, then messages as they are published. The node holds off once
+            /// windowMessages or windowBytes are waiting on messageCallback, so a slow
+            /// consumer only slows the messages down
+            /// \param queueId The queue to consume
+            /// \param claim Whether messages are removed from the queue as they are
+            /// delivered, or left for other consumers
+            /// \param windowMessages The most messages the node sends ahead
+            /// \param windowBytes The most message data the node sends ahead
+            /// \param messageCallback Called with each message
+            /// \param statusCallback Called once the node accepts or refuses the request
+            void consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                         std::uint32_t windowBytes, consume_message_callback messageCallback,
+                         consume_status_callback statusCallback);
+            
+            ///
+            /// Stops pulling the messages on a queue. Messages the node already sent
+            /// are dropped rather than handed to the consumer
+            /// \param queueId The queue passed to consume()
+            void stop_consuming(const std::string& queueId);
+            
+            ///
+            /// Removes a set of delivered messages from a queue in one request
+            /// \param queueId The queue the messages were delivered from
+            /// \param messageIds The ids of the messages to remove
+            /// \param callback Called once the nodes holding the queue have been told
+            void claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                       claim_callback callback);
+            
+            ///
+            /// Removes a delivered message and everything on the queue before it. Draining
+            /// a queue this way takes one request per batch rather than per message
+            /// \param queueId The queue the messages were delivered from
+            /// \param cursor The cursor of the last message to remove
+            /// \param callback Called once the nodes holding the queue have been told
+            void claim_through(const std::string& queueId, const std::string& cursor, claim_callback callback);
+            
             ///
             /// Indicates a protocol violation happened. Disconnects the connection
             ///
@@ -20,12 +20,50 @@
 
 #include "responses.h"
 #include <functional>
+#include <vector>
+#include <string>
 
 namespace sopmq {
     namespace client {
         
         typedef std::function<void(bool)> authenticate_callback;
         typedef std::function<void(sopmq::shared::message::PublishMessageResponse)> publish_message_callback;
+        typedef std::function<void(const std::vector<sopmq::shared::message::PublishMessageResponse>&)> publish_batch_callback;
+        typedef std::function<void(sopmq::shared::message::ConsumeResponse)> consume_status_callback;
+        
+        typedef std::function<void(sopmq::shared::message::ClaimResponse)> claim_callback;
+        
+        ///
+        /// A message pushed to a consumer
+        ///
+        struct delivered_message
+        {
+            std::string message_id;
+            std::string data;
+            
+            ///
+            /// Pass to session::claim_through() to claim this message and everything
+            /// delivered before it in one go
+            ///
+            std::string cursor;
+        };
+        
+        ///
+        /// Called with each message pushed to a consumer. The message's credit is
+        /// handed back to the node once this returns
+        ///
+        typedef std::function<void(const delivered_message&)> consume_message_callback;
+        
+        ///
+        /// One message in a batch publish
+        ///
+        struct publish_entry
+        {
+            std::string queue_id;
+            bool store_if_cant_pipe;
+            int ttl;
+            std::string data;
+        };
         
     }
 }
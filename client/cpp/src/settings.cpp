@@ -21,10 +21,12 @@ namespace sopmq {
     namespace client {
         
         const uint32_t settings::DEFAULT_MAX_MESSAGE_SIZE = 10485760;
+        const uint32_t settings::DEFAULT_OPERATION_TIMEOUT = 10;
         
         settings::settings()
         {
             maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE;
+            defaultTimeout = DEFAULT_OPERATION_TIMEOUT;
         }
         
         settings::~settings()
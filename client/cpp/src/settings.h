@@ -38,6 +38,11 @@ namespace sopmq {
         public:
             static const uint32_t DEFAULT_MAX_MESSAGE_SIZE;
             
+            ///
+            /// The default time in seconds to wait for a reply from a node
+            ///
+            static const uint32_t DEFAULT_OPERATION_TIMEOUT;
+            
             ///
             /// Returns our singleton instance
             ///
@@ -49,6 +54,12 @@ namespace sopmq {
             ///
             uint32_t maxMessageSize;
             
+            ///
+            /// How long in seconds to wait for a reply from a node before failing
+            /// the request
+            ///
+            uint32_t defaultTimeout;
+            
             
         private:
             settings();
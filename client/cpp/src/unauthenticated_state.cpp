@@ -25,6 +25,7 @@
 #include "util.h"
 #include "messageutil.h"
 #include "network_operation_result.h"
+#include "settings.h"
 
 #include <functional>
 #include <boost/assert.hpp>
@@ -46,6 +47,8 @@ namespace sopmq {
             _dispatcher(std::bind(&unauthenticated_state::on_unhandled_message,
                                   this, _1, _2))
             {
+                _dispatcher.set_reply_timeout(conn->get_io_service(),
+                                              boost::chrono::seconds(settings::instance().defaultTimeout));
             }
             
             unauthenticated_state::~unauthenticated_state()
@@ -99,6 +102,19 @@ namespace sopmq {
                 }
             }
             
+            void unauthenticated_state::on_reply_error(const shared::net::network_operation_result& result)
+            {
+                //network errors are reported through the read and write callbacks,
+                //but nothing else tells us the node stopped answering
+                if (result.get_error_type() == shared::net::ET_TIMEOUT)
+                {
+                    LOG_SRC(error) << _connection->endpoint()
+                        << " timed out waiting for session authorization";
+                    
+                    _authCallback(false);
+                }
+            }
+            
             void unauthenticated_state::on_unhandled_message(Message_ptr message, const std::string& typeName)
             {
                 LOG_SRC(error) << _connection->endpoint()
@@ -111,9 +127,13 @@ namespace sopmq {
                 }
             }
             
-            void unauthenticated_state::on_challenge_response(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr response)
+            void unauthenticated_state::on_challenge_response(const sopmq::shared::net::network_operation_result& result, ChallengeResponseMessage_ptr response)
             {
-                if (!response) return; //error
+                if (!response)
+                {
+                    this->on_reply_error(result);
+                    return;
+                }
                 
                 BOOST_ASSERT(response->has_challenge());
                 
@@ -159,9 +179,13 @@ namespace sopmq {
                 _connection->read_message(_dispatcher, std::bind(&unauthenticated_state::on_message_received, shared_from_this(), _1));
             }
             
-            void unauthenticated_state::on_auth_ack(const sopmq::shared::net::network_operation_result&, AuthAckMessage_ptr response)
+            void unauthenticated_state::on_auth_ack(const sopmq::shared::net::network_operation_result& result, AuthAckMessage_ptr response)
             {
-                if (!response) return; //error
+                if (!response)
+                {
+                    this->on_reply_error(result);
+                    return;
+                }
                 
                 if (response->has_authorized() && response->authorized())
                 {
@@ -181,6 +205,29 @@ namespace sopmq {
                 throw std::logic_error("Call to publish_message() is invalid when the session is unauthenticated");
             }
             
+            void unauthenticated_state::publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback)
+            {
+                throw std::logic_error("Call to publish_batch() is invalid when the session is unauthenticated");
+            }
+            
+            void unauthenticated_state::consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                                                std::uint32_t windowBytes, consume_message_callback messageCallback,
+                                                consume_status_callback statusCallback)
+            {
+                throw std::logic_error("Call to consume() is invalid when the session is unauthenticated");
+            }
+            
+            void unauthenticated_state::stop_consuming(const std::string& queueId)
+            {
+                throw std::logic_error("Call to stop_consuming() is invalid when the session is unauthenticated");
+            }
+            
+            void unauthenticated_state::claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                                              const std::string& cursor, claim_callback callback)
+            {
+                throw std::logic_error("Call to claim() is invalid when the session is unauthenticated");
+            }
+            
         }
     }
 }
\ No newline at end of file
@@ -51,6 +51,17 @@ namespace sopmq {
                 virtual void publish_message(const std::string& queueId, bool storeIfCantPipe, int ttl,
                                              const std::string& data, publish_message_callback callback);
                 
+                virtual void publish_batch(const std::vector<publish_entry>& entries, publish_batch_callback callback);
+                
+                virtual void consume(const std::string& queueId, bool claim, std::uint32_t windowMessages,
+                                     std::uint32_t windowBytes, consume_message_callback messageCallback,
+                                     consume_status_callback statusCallback);
+                
+                virtual void stop_consuming(const std::string& queueId);
+                
+                virtual void claim(const std::string& queueId, const std::vector<std::string>& messageIds,
+                                   const std::string& cursor, claim_callback callback);
+                
             private:
                 void on_unhandled_message(Message_ptr message, const std::string& typeName);
                 
@@ -62,6 +73,11 @@ namespace sopmq {
                 
                 void on_message_received(const shared::net::network_operation_result& result);
                 
+                ///
+                /// Called when a reply we were waiting on won't be coming
+                ///
+                void on_reply_error(const shared::net::network_operation_result& result);
+                
                 cluster_connection::ptr _connection;
                 std::weak_ptr<session> _session;
                 std::string _username;
@@ -40,6 +40,14 @@ namespace sopmq {
             MT_PROXY_PUBLISH,
             MT_PROXY_PUBLISH_RESPONSE,
             MT_STAMP,
+            MT_PUBLISH_BATCH,
+            MT_PUBLISH_BATCH_RESPONSE,
+            MT_PROXY_PUBLISH_BATCH,
+            MT_PROXY_PUBLISH_BATCH_RESPONSE,
+            MT_DELIVERY,
+            MT_CONSUME_CREDIT,
+            MT_CLAIM,
+            MT_CLAIM_RESPONSE,
             
             MT_INVALID_OUT_OF_RANGE
         };
@@ -39,6 +39,12 @@ namespace sopmq {
             
             class CassIteratorDeleter { public: void operator()(CassIterator* p) { if (p) cass_iterator_free(p); } };
             typedef std::unique_ptr<CassIterator, CassIteratorDeleter> CassIteratorPtr;
+            
+            class CassPreparedDeleter { public: void operator()(const CassPrepared* p) { if (p) cass_prepared_free(p); } };
+            typedef std::unique_ptr<const CassPrepared, CassPreparedDeleter> CassPreparedConstPtr;
+            
+            class CassBatchDeleter { public: void operator()(CassBatch* p) { if (p) cass_batch_free(p); } };
+            typedef std::unique_ptr<CassBatch, CassBatchDeleter> CassBatchPtr;
         }
     }
 }
@@ -0,0 +1,263 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "cassandra_driver.h"
+#include "cass_ptrs.h"
+#include "cassandra_storage_async_helpers.h"
+
+#include <sstream>
+#include <map>
+#include <mutex>
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            namespace
+            {
+                cql_value read_value(const CassValue* value)
+                {
+                    if (value == nullptr) return cql_value();
+                    
+                    switch (cass_value_type(value))
+                    {
+                        case CASS_VALUE_TYPE_ASCII:
+                        case CASS_VALUE_TYPE_TEXT:
+                        case CASS_VALUE_TYPE_VARCHAR:
+                        {
+                            CassString s;
+                            if (cass_value_get_string(value, &s) != CASS_OK) return cql_value();
+                            return cql_value::text(std::string(s.data, s.length));
+                        }
+                        
+                        case CASS_VALUE_TYPE_BLOB:
+                        {
+                            CassBytes b;
+                            if (cass_value_get_bytes(value, &b) != CASS_OK) return cql_value();
+                            return cql_value::blob(std::string((const char*)b.data, b.size));
+                        }
+                        
+                        case CASS_VALUE_TYPE_INT:
+                        {
+                            cass_int32_t i;
+                            if (cass_value_get_int32(value, &i) != CASS_OK) return cql_value();
+                            return cql_value::int32(i);
+                        }
+                        
+                        case CASS_VALUE_TYPE_BIGINT:
+                        {
+                            cass_int64_t i;
+                            if (cass_value_get_int64(value, &i) != CASS_OK) return cql_value();
+                            return cql_value::int64(i);
+                        }
+                        
+                        default:
+                            return cql_value();
+                    }
+                }
+                
+                ///
+                /// Fills in the result from a completed future
+                ///
+                void read_result(CassFuture* future, query_result& result)
+                {
+                    result.error = cassasync::future_error(future);
+                    if (result.error)
+                    {
+                        result.no_hosts = cass_future_error_code(future) == CASS_ERROR_LIB_NO_HOSTS_AVAILABLE;
+                        return;
+                    }
+                    
+                    CassResultConstPtr rows(cass_future_get_result(future));
+                    if (! rows) return;
+                    
+                    size_t columns = cass_result_column_count(rows.get());
+                    CassIteratorPtr iter(cass_iterator_from_result(rows.get()));
+                    
+                    while (cass_iterator_next(iter.get()))
+                    {
+                        const CassRow* row = cass_iterator_get_row(iter.get());
+                        
+                        std::vector<cql_value> values;
+                        values.reserve(columns);
+                        for (size_t i = 0; i < columns; ++i)
+                        {
+                            values.push_back(read_value(cass_row_get_column(row, i)));
+                        }
+                        
+                        result.rows.push_back(std::move(values));
+                    }
+                }
+                
+                class cassandra_session : public driver_session,
+                                          public std::enable_shared_from_this<cassandra_session>
+                {
+                public:
+                    explicit cassandra_session(CassSession* session)
+                    : _session(session)
+                    {
+                    }
+                    
+                    virtual ~cassandra_session()
+                    {
+                        //nothing waits for the close, the last one to let go of us may be
+                        //a driver thread
+                        cassasync::when_done(cass_session_close(_session), [](CassFuture*) {});
+                    }
+                    
+                    virtual void prepare(const std::string& cql, prepare_callback callback)
+                    {
+                        auto self = this->shared_from_this();
+                        
+                        cassasync::when_done(cass_session_prepare(_session, cass_string_init(cql.c_str())),
+                                             [self, cql, callback](CassFuture* f) {
+                                                 std::unique_ptr<storage_error> error(cassasync::future_error(f));
+                                                 if (! error)
+                                                 {
+                                                     std::lock_guard<std::mutex> lk(self->_prepared_lock);
+                                                     self->_prepared[cql].reset(cass_future_get_prepared(f));
+                                                 }
+                                                 
+                                                 callback(std::move(error));
+                                             });
+                    }
+                    
+                    virtual void execute(const bound_statement& statement, query_callback callback)
+                    {
+                        CassStatementPtr bound(this->bind(statement));
+                        this->when_done(cass_session_execute(_session, bound.get()), callback);
+                    }
+                    
+                    virtual void execute_batch(const std::vector<bound_statement>& statements, query_callback callback)
+                    {
+                        CassBatchPtr batch(cass_batch_new(CASS_BATCH_TYPE_UNLOGGED));
+                        for (auto& statement : statements)
+                        {
+                            CassStatementPtr bound(this->bind(statement));
+                            cass_batch_add_statement(batch.get(), bound.get());
+                        }
+                        
+                        this->when_done(cass_session_execute_batch(_session, batch.get()), callback);
+                    }
+                
+                private:
+                    CassSession* _session;
+                    
+                    std::mutex _prepared_lock;
+                    
+                    ///
+                    /// Prepared statements by their CQL text
+                    ///
+                    std::map<std::string, CassPreparedConstPtr> _prepared;
+                    
+                    CassStatement* bind(const bound_statement& statement)
+                    {
+                        const CassPrepared* prepared = nullptr;
+                        {
+                            std::lock_guard<std::mutex> lk(_prepared_lock);
+                            
+                            auto iter = _prepared.find(statement.cql);
+                            if (iter != _prepared.end()) prepared = iter->second.get();
+                        }
+                        
+                        CassStatement* bound = prepared != nullptr
+                            ? cass_prepared_bind(prepared)
+                            : cass_statement_new(cass_string_init(statement.cql.c_str()), statement.params.size());
+                        
+                        for (size_t i = 0; i < statement.params.size(); ++i)
+                        {
+                            const cql_value& value = statement.params[i];
+                            switch (value.type)
+                            {
+                                case cql_value::CV_TEXT:
+                                    cass_statement_bind_string(bound, i, cass_string_init(value.bytes.c_str()));
+                                    break;
+                                
+                                case cql_value::CV_BLOB:
+                                    cass_statement_bind_bytes(bound, i, cass_bytes_init((const cass_byte_t*)value.bytes.data(),
+                                                                                        value.bytes.size()));
+                                    break;
+                                
+                                case cql_value::CV_INT32:
+                                    cass_statement_bind_int32(bound, i, (cass_int32_t)value.number);
+                                    break;
+                                
+                                case cql_value::CV_INT64:
+                                    cass_statement_bind_int64(bound, i, value.number);
+                                    break;
+                                
+                                default:
+                                    break;
+                            }
+                        }
+                        
+                        return bound;
+                    }
+                    
+                    void when_done(CassFuture* future, query_callback callback)
+                    {
+                        //the session stays open until the callback is done with it
+                        auto self = this->shared_from_this();
+                        
+                        cassasync::when_done(future, [self, callback](CassFuture* f) {
+                            query_result result;
+                            read_result(f, result);
+                            
+                            callback(result);
+                        });
+                    }
+                };
+            }
+            
+            cassandra_driver::cassandra_driver(const std::vector<std::string>& contactPoints)
+            {
+                _cluster = cass_cluster_new();
+                
+                std::stringstream ipList;
+                bool first = true;
+                for (auto& ip : contactPoints)
+                {
+                    if (! first) ipList << ",";
+                    ipList << ip;
+                    
+                    first = false;
+                }
+                
+                cass_cluster_set_contact_points(_cluster, ipList.str().c_str());
+            }
+            
+            cassandra_driver::~cassandra_driver()
+            {
+                cass_cluster_free(_cluster);
+            }
+            
+            void cassandra_driver::connect(connect_callback callback)
+            {
+                cassasync::when_done(cass_cluster_connect(_cluster), [callback](CassFuture* f) {
+                    if (auto error = cassasync::future_error(f))
+                    {
+                        callback(std::move(error), driver_session::ptr());
+                        return;
+                    }
+                    
+                    callback(nullptr, std::make_shared<cassandra_session>(cass_future_get_session(f)));
+                });
+            }
+            
+        }
+    }
+}
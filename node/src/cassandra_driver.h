@@ -0,0 +1,54 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__cassandra_driver__
+#define __sopmq__cassandra_driver__
+
+#include "storage_driver.h"
+
+#include <cassandra.h>
+
+#include <string>
+#include <vector>
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            ///
+            /// \brief Opens sessions through the cassandra C driver
+            ///
+            class cassandra_driver : public storage_driver
+            {
+            public:
+                ///
+                /// \param contactPoints The storage hosts to find the cluster through
+                ///
+                cassandra_driver(const std::vector<std::string>& contactPoints);
+                virtual ~cassandra_driver();
+                
+                virtual void connect(connect_callback callback);
+            
+            private:
+                CassCluster* _cluster;
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__cassandra_driver__) */
@@ -16,19 +16,21 @@
  */
 
 #include "cassandra_storage.h"
+#include "cassandra_driver.h"
 #include "settings.h"
-#include "cass_ptrs.h"
-#include "cassandra_storage_async_helpers.h"
-
-#include <boost/asio.hpp>
+#include "day_buckets.h"
+#include "logging.h"
 
 #include <string>
-#include <sstream>
 #include <array>
 #include <functional>
 #include <vector>
-
-using std::string;
+#include <map>
+#include <mutex>
+#include <future>
+#include <chrono>
+#include <ctime>
+#include <iterator>
 
 namespace sopmq {
     namespace node {
@@ -36,37 +38,146 @@ namespace sopmq {
             
             const std::string& cassandra_storage::KEYSPACE_NAME = "sopmq";
             
-            cassandra_storage::cassandra_storage()
+            const std::string cassandra_storage::SELECT_USER =
+                "SELECT uname_hash, username, pw_hash, user_level FROM " + KEYSPACE_NAME + ".users WHERE uname_hash = ?;";
+            
+            const std::string cassandra_storage::INSERT_USER =
+                "INSERT INTO " + KEYSPACE_NAME + ".users (uname_hash, username, pw_hash, user_level) VALUES (?, ?, ?, ?);";
+            
+            //rows outlive the lookback window by a day and then expire on their own
+            const std::string cassandra_storage::INSERT_ITEM =
+                "INSERT INTO " + KEYSPACE_NAME + ".stored_items (bucket_key, stored_at, message_id, content) "
+                "VALUES (?, ?, ?, ?) USING TTL "
+                + std::to_string((day_buckets::MAX_LOOKBACK_DAYS + 1) * day_buckets::SECONDS_PER_DAY) + ";";
+            
+            const std::string cassandra_storage::SELECT_ITEMS =
+                "SELECT stored_at, message_id, content FROM " + KEYSPACE_NAME + ".stored_items WHERE bucket_key = ?;";
+            
+            const std::string cassandra_storage::DELETE_ITEM =
+                "DELETE FROM " + KEYSPACE_NAME + ".stored_items WHERE bucket_key = ? AND stored_at = ? AND message_id = ?;";
+            
+            const std::string cassandra_storage::SELECT_LAST_CLAIMED =
+                "SELECT last_claimed_on FROM " + KEYSPACE_NAME + ".queue_data WHERE queue_key = ?;";
+            
+            const std::string cassandra_storage::UPDATE_LAST_CLAIMED =
+                "UPDATE " + KEYSPACE_NAME + ".queue_data SET last_claimed_on = ? WHERE queue_key = ?;";
+            
+            const std::vector<std::string> cassandra_storage::PREPARED_STATEMENTS =
             {
-				_cluster = cass_cluster_new();
-
-				std::stringstream ipList;
-				bool first = true;
-				for (string ip : settings::instance().cassandraSeeds)
-				{
-					if (! first) ipList << ",";
-					ipList << ip;
-
-					first = false;
-				}
+                SELECT_USER, INSERT_USER, INSERT_ITEM, SELECT_ITEMS, DELETE_ITEM,
+                SELECT_LAST_CLAIMED, UPDATE_LAST_CLAIMED
+            };
+            
+            const int cassandra_storage::RECONNECT_INTERVAL_MS;
+            
+            ///
+            /// Tracks a claim while its bucket reads are outstanding
+            ///
+            struct cassandra_storage::claim_state
+            {
+                std::mutex lock;
+                
+                driver_session::ptr session;
+                
+                std::string queue_id;
+                bool remove;
+                std::int64_t today;
+                std::function<void(claim_stored_result&)> callback;
+                
+                std::vector<std::int64_t> days;
                 
-                cass_cluster_set_contact_points(_cluster, ipList.str().c_str());
+                ///
+                /// What was read from each day, in the same order as days
+                ///
+                std::vector<std::vector<stored_message>> read;
+                size_t pending;
+                
+                claim_stored_result result;
+            };
+            
+            namespace
+            {
+                ///
+                /// Opens a session and blocks until it is open
+                ///
+                driver_session::ptr connect_and_wait(storage_driver& driver)
+                {
+                    std::promise<std::unique_ptr<storage_error>> done;
+                    auto future = done.get_future();
+                    driver_session::ptr session;
+                    
+                    driver.connect([&](std::unique_ptr<storage_error> error, driver_session::ptr s) {
+                        session = s;
+                        done.set_value(std::move(error));
+                    });
+                    
+                    if (auto error = future.get()) throw *error;
+                    return session;
+                }
+                
+                ///
+                /// Runs the statement and blocks until it is done
+                ///
+                void execute_and_wait(driver_session& session, const bound_statement& statement)
+                {
+                    std::promise<std::unique_ptr<storage_error>> done;
+                    auto future = done.get_future();
+                    
+                    session.execute(statement, [&](query_result& result) {
+                        done.set_value(std::move(result.error));
+                    });
+                    
+                    if (auto error = future.get()) throw *error;
+                }
+                
+                ///
+                /// Counts down the parts of one operation, keeping the first error
+                ///
+                struct countdown
+                {
+                    std::mutex lock;
+                    size_t pending;
+                    std::unique_ptr<storage_error> error;
+                    
+                    explicit countdown(size_t count)
+                    : pending(count)
+                    {
+                    }
+                    
+                    ///
+                    /// \return True for the last part to finish
+                    ///
+                    bool finished(std::unique_ptr<storage_error> partError)
+                    {
+                        std::lock_guard<std::mutex> lk(lock);
+                        
+                        if (! error) error = std::move(partError);
+                        return --pending == 0;
+                    }
+                };
+            }
+            
+            cassandra_storage::cassandra_storage(std::unique_ptr<storage_driver> driver)
+            : _driver(std::move(driver)), _reconnecting(false), _last_reconnect(0)
+            {
             }
             
             cassandra_storage::~cassandra_storage()
             {
-				cass_cluster_free(_cluster);
+                
             }
             
             cassandra_storage& cassandra_storage::instance()
             {
-                static cassandra_storage instance;
+                static cassandra_storage instance(std::unique_ptr<storage_driver>(
+                    new cassandra_driver(settings::instance().cassandraSeeds)));
+                
                 return instance;
             }
             
             void cassandra_storage::init()
             {
-                const std::array<std::string, 2> CREATE_STATEMENTS =
+                const std::array<std::string, 4> CREATE_STATEMENTS =
                 {
                     "CREATE KEYSPACE IF NOT EXISTS " + KEYSPACE_NAME +
                         " WITH REPLICATION = { 'class' : 'SimpleStrategy', 'replication_factor' : 3 };",
@@ -76,136 +187,394 @@ namespace sopmq {
                         "username varchar, " +
                         "pw_hash varchar, " +
                         "user_level int " +
-                    ");"
+                    ");",
                     
+                    //the day the queue was last claimed through, see day_buckets
+                    "CREATE TABLE IF NOT EXISTS " + KEYSPACE_NAME + ".queue_data (" +
+                        "queue_key blob PRIMARY KEY, " +
+                        "last_claimed_on bigint " +
+                    ");",
+                    
+                    //one partition per queue per day. a row per message rather than a list
+                    //column, so a message written during a claim isn't deleted unread
+                    "CREATE TABLE IF NOT EXISTS " + KEYSPACE_NAME + ".stored_items (" +
+                        "bucket_key blob, " +
+                        "stored_at bigint, " +
+                        "message_id blob, " +
+                        "content blob, " +
+                        "PRIMARY KEY (bucket_key, stored_at, message_id)" +
+                    ");"
                 };
                 
-                CassFuturePtr connect_future(cass_cluster_connect(_cluster));
-                this->throw_on_error(connect_future.get());
+                //a session of its own, the tables aren't there to prepare against yet
+                auto session = connect_and_wait(*_driver);
                 
-                CassSession* session = cass_future_get_session(connect_future.get());
+                for (auto& statement : CREATE_STATEMENTS)
+                {
+                    execute_and_wait(*session, bound_statement(statement));
+                }
+            }
+            
+            void cassandra_storage::create_user(const std::string& usernameHash, const std::string& username,
+                                                const std::string& pwHash, int userLevel)
+            {
+                auto session = this->current();
                 
-                for (auto statement : CREATE_STATEMENTS)
+                execute_and_wait(*session, bound_statement(INSERT_USER, {
+                    cql_value::text(usernameHash),
+                    cql_value::text(username),
+                    cql_value::text(pwHash),
+                    cql_value::int32(userLevel)
+                }));
+            }
+            
+            void cassandra_storage::find_user(const std::string &usernameHash,
+                                              std::function<void(const find_user_result&)> callback)
+            {
+                driver_session::ptr session;
+                try
                 {
-                    this->execute_statement(session, statement);
+                    session = this->current();
+                }
+                catch (const storage_error& e)
+                {
+                    find_user_result result;
+                    result.user_found = false;
+                    result.error.reset(new storage_error(e));
+                    callback(result);
+                    
+                    return;
                 }
                 
-                /* Close the session */
-                CassFuturePtr close_future(cass_session_close(session));
-                cass_future_wait(close_future.get());
+                session->execute(bound_statement(SELECT_USER, { cql_value::text(usernameHash) }),
+                                 [this, session, callback](query_result& qr) {
+                                     find_user_result fur;
+                                     fur.user_found = false;
+                                     
+                                     if (qr.error)
+                                     {
+                                         this->check_connection(qr, session);
+                                         
+                                         fur.error = std::move(qr.error);
+                                         callback(fur);
+                                         
+                                         return;
+                                     }
+                                     
+                                     if (! qr.rows.empty())
+                                     {
+                                         const auto& row = qr.rows.front();
+                                         
+                                         fur.user_found = true;
+                                         fur.account = user_account(row[0].bytes, row[1].bytes, row[2].bytes,
+                                                                    (int)row[3].as_int64(0));
+                                     }
+                                     
+                                     callback(fur);
+                                 });
             }
             
-            void cassandra_storage::execute_statement(CassSession* session, const std::string& statementText)
+            void cassandra_storage::connect()
             {
-                /* Build statement and execute */
-                CassString query = cass_string_init(statementText.c_str());
-                CassStatementPtr statement(cass_statement_new(query, 0));
+                auto session = connect_and_wait(*_driver);
+                
+                std::promise<std::unique_ptr<storage_error>> done;
+                auto future = done.get_future();
+                
+                this->prepare_all(session, [&](std::unique_ptr<storage_error> error) {
+                    done.set_value(std::move(error));
+                });
                 
-                CassFuturePtr result_future(cass_session_execute(session, statement.get()));
-                this->throw_on_error(result_future.get());
+                if (auto error = future.get()) throw *error;
+                
+                std::atomic_store(&_session, session);
+            }
+            
+            bool cassandra_storage::is_connected() const
+            {
+                return (bool)std::atomic_load(&_session);
             }
             
-            void cassandra_storage::throw_on_error(CassFuture* future)
+            void cassandra_storage::prepare_all(driver_session::ptr session, prepare_callback callback)
             {
-                if (cass_future_error_code(future) != CASS_OK) {
-                    /* Handle error */
-                    CassString message = cass_future_error_message(future);
-                    throw storage_error(std::string(message.data, message.length));
+                auto state = std::make_shared<countdown>(PREPARED_STATEMENTS.size());
+                
+                for (auto& statement : PREPARED_STATEMENTS)
+                {
+                    session->prepare(statement, [state, callback](std::unique_ptr<storage_error> error) {
+                        if (! state->finished(std::move(error))) return;
+                        
+                        callback(std::move(state->error));
+                    });
                 }
             }
             
-            void cassandra_storage::create_user(const std::string& usernameHash, const std::string& username,
-                                                const std::string& pwHash, int userLevel)
+            driver_session::ptr cassandra_storage::current()
             {
-                CassFuturePtr connect_future(cass_cluster_connect(_cluster));
-                this->throw_on_error(connect_future.get());
+                auto session = std::atomic_load(&_session);
+                if (session) return session;
                 
-                CassSession* session = cass_future_get_session(connect_future.get());
+                this->reconnect(session);
+                throw storage_error("Not connected to storage");
+            }
+            
+            void cassandra_storage::check_connection(const query_result& result, const driver_session::ptr& session)
+            {
+                if (result.no_hosts)
+                {
+                    this->reconnect(session);
+                }
+            }
+            
+            void cassandra_storage::reconnect(const driver_session::ptr& failed)
+            {
+                //someone got to it first
+                if (std::atomic_load(&_session) != failed) return;
                 
-                std::string insert("INSERT INTO " + KEYSPACE_NAME + ".users"
-                                   "(uname_hash, username, pw_hash, user_level) VALUES (?, ?, ?, ?);");
-                CassString query = cass_string_init(insert.c_str());
-                CassStatementPtr statement(cass_statement_new(query, 4));
+                auto now = std::chrono::steady_clock::now().time_since_epoch();
+                auto last = std::chrono::steady_clock::duration(_last_reconnect.load());
+                if (_last_reconnect != 0 && now - last < std::chrono::milliseconds(RECONNECT_INTERVAL_MS)) return;
                 
-                cass_statement_bind_string(statement.get(), 0, cass_string_init(usernameHash.c_str()));
-                cass_statement_bind_string(statement.get(), 1, cass_string_init(username.c_str()));
-                cass_statement_bind_string(statement.get(), 2, cass_string_init(pwHash.c_str()));
-                cass_statement_bind_int32(statement.get(), 3, userLevel);
+                bool expected = false;
+                if (! _reconnecting.compare_exchange_strong(expected, true)) return;
                 
-                CassFuturePtr result_future(cass_session_execute(session, statement.get()));
-                this->throw_on_error(result_future.get());
+                _last_reconnect = now.count();
                 
-                /* Close the session */
-                CassFuturePtr close_future(cass_session_close(session));
-                cass_future_wait(close_future.get());
+                LOG_SRC(warning) << "reconnecting to storage";
+                
+                //nothing here waits. the steps run as callbacks on the driver's threads,
+                //and requests fail fast until we're done
+                _driver->connect([this](std::unique_ptr<storage_error> error, driver_session::ptr session) {
+                    if (error)
+                    {
+                        LOG_SRC(error) << "unable to reconnect to storage: " << error->what();
+                        _reconnecting = false;
+                        return;
+                    }
+                    
+                    this->prepare_all(session, [this, session](std::unique_ptr<storage_error> error) {
+                        if (error)
+                        {
+                            LOG_SRC(error) << "unable to reconnect to storage: " << error->what();
+                        }
+                        else
+                        {
+                            std::atomic_store(&_session, session);
+                            LOG_SRC(info) << "reconnected to storage";
+                        }
+                        
+                        _reconnecting = false;
+                    });
+                });
             }
             
-            std::string cassandra_storage::get_string_column_value(const CassRow* row, const std::string& colname)
+            void cassandra_storage::store_messages(const std::vector<stored_message>& messages,
+                                                   std::function<void(const store_messages_result&)> callback)
             {
-                const CassValue* value = cass_row_get_column_by_name(row, colname.c_str());
-                if (!value) return "";
+                if (messages.empty())
+                {
+                    callback(store_messages_result());
+                    return;
+                }
                 
-                CassString val_string;
-                cass_value_get_string(value, &val_string);
+                driver_session::ptr session;
+                try
+                {
+                    session = this->current();
+                }
+                catch (const storage_error& e)
+                {
+                    store_messages_result result;
+                    result.error.reset(new storage_error(e));
+                    callback(result);
+                    
+                    return;
+                }
                 
-                return std::string(val_string.data, val_string.length);
+                std::int64_t now = std::chrono::duration_cast<std::chrono::microseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                std::int64_t today = day_buckets::day_of(std::time(nullptr));
+                
+                //everything bound for the same partition goes in one batch
+                std::map<std::string, std::vector<bound_statement>> batches;
+                for (auto& message : messages)
+                {
+                    std::string bucketKey = day_buckets::bucket_key(message.queue_id, today);
+                    
+                    batches[bucketKey].push_back(bound_statement(INSERT_ITEM, {
+                        cql_value::blob(bucketKey),
+                        cql_value::int64(message.stored_at != 0 ? message.stored_at : now),
+                        cql_value::blob(message.message_id),
+                        cql_value::blob(message.content)
+                    }));
+                }
+                
+                auto state = std::make_shared<countdown>(batches.size());
+                
+                for (auto& entry : batches)
+                {
+                    session->execute_batch(entry.second, [this, session, state, callback](query_result& qr) {
+                        this->check_connection(qr, session);
+                        if (! state->finished(std::move(qr.error))) return;
+                        
+                        store_messages_result result;
+                        result.error = std::move(state->error);
+                        callback(result);
+                    });
+                }
             }
             
-            int cassandra_storage::get_int_column_value(const CassRow* row, const std::string& colname)
+            void cassandra_storage::claim_stored_messages(const std::string& queueId, bool remove,
+                                                          std::function<void(claim_stored_result&)> callback)
             {
-                const CassValue* value = cass_row_get_column_by_name(row, colname.c_str());
-                if (!value) return 0;
+                driver_session::ptr session;
+                try
+                {
+                    session = this->current();
+                }
+                catch (const storage_error& e)
+                {
+                    claim_stored_result result;
+                    result.error.reset(new storage_error(e));
+                    callback(result);
                     
-                int ival;
-                cass_value_get_int32(value, &ival);
+                    return;
+                }
                 
-                return ival;
+                session->execute(bound_statement(SELECT_LAST_CLAIMED, { cql_value::blob(day_buckets::queue_key(queueId)) }),
+                                 [this, session, queueId, remove, callback](query_result& qr) {
+                                     if (qr.error)
+                                     {
+                                         this->check_connection(qr, session);
+                                         
+                                         claim_stored_result result;
+                                         result.error = std::move(qr.error);
+                                         callback(result);
+                                         return;
+                                     }
+                                     
+                                     std::int64_t lastClaimedDay = day_buckets::NEVER_CLAIMED;
+                                     if (! qr.rows.empty())
+                                     {
+                                         lastClaimedDay = qr.rows.front()[0].as_int64(day_buckets::NEVER_CLAIMED);
+                                     }
+                                     
+                                     this->read_buckets(session, queueId, remove, lastClaimedDay, callback);
+                                 });
             }
             
-            void cassandra_storage::find_user(const std::string &usernameHash,
-                                              std::function<void(const find_user_result&)> callback)
+            void cassandra_storage::read_buckets(driver_session::ptr session, const std::string& queueId, bool remove,
+                                                 std::int64_t lastClaimedDay, std::function<void(claim_stored_result&)> callback)
             {
-                std::function<void(cassasync::async_query_state&)> cb = [=](cassasync::async_query_state& qstate)
+                auto state = std::make_shared<claim_state>();
+                state->session = session;
+                state->queue_id = queueId;
+                state->remove = remove;
+                state->today = day_buckets::day_of(std::time(nullptr));
+                state->callback = callback;
+                state->days = day_buckets::claim_window(lastClaimedDay, state->today);
+                state->read.resize(state->days.size());
+                state->pending = state->days.size();
+                
+                for (size_t i = 0; i < state->days.size(); ++i)
                 {
-                    if (qstate.error)
-                    {
-                        find_user_result result;
-                        result.user_found = false;
-                        result.error = std::move(qstate.error);
-                        callback(result);
-                        
-                        return;
-                    }
+                    bound_statement statement(SELECT_ITEMS, {
+                        cql_value::blob(day_buckets::bucket_key(queueId, state->days[i]))
+                    });
                     
-                    find_user_result fur;
-                    if (cass_iterator_next(qstate.rows.get()))
-                    {
-                        const CassRow* row = cass_iterator_get_row(qstate.rows.get());
+                    session->execute(statement, [this, state, i](query_result& qr) {
+                        if (qr.error) this->check_connection(qr, state->session);
                         
-                        user_account acct(get_string_column_value(row, "uname_hash"),
-                                          get_string_column_value(row, "username"),
-                                          get_string_column_value(row, "pw_hash"),
-                                          get_int_column_value(row, "user_level"));
+                        std::vector<stored_message> messages;
+                        for (auto& row : qr.rows)
+                        {
+                            stored_message message;
+                            message.queue_id = state->queue_id;
+                            message.stored_at = row[0].as_int64(0);
+                            message.message_id = std::move(row[1].bytes);
+                            message.content = std::move(row[2].bytes);
+                            
+                            messages.push_back(std::move(message));
+                        }
                         
-                        fur.user_found = true;
-                        fur.account = acct;
-                    }
-                    else
+                        {
+                            std::lock_guard<std::mutex> lk(state->lock);
+                            
+                            state->read[i] = std::move(messages);
+                            if (qr.error && ! state->result.error) state->result.error = std::move(qr.error);
+                            
+                            if (--state->pending > 0) return;
+                        }
+                        
+                        //every read is in. nothing is removed unless all of them worked
+                        if (state->result.error || ! state->remove)
+                        {
+                            for (auto& day : state->read)
+                            {
+                                std::move(day.begin(), day.end(), std::back_inserter(state->result.messages));
+                            }
+                            
+                            state->callback(state->result);
+                            return;
+                        }
+                        
+                        this->remove_claimed(state);
+                    });
+                }
+            }
+            
+            void cassandra_storage::remove_claimed(std::shared_ptr<claim_state> state)
+            {
+                std::vector<std::vector<bound_statement>> batches;
+                
+                //only the rows we read are removed, anything stored since stays put
+                for (size_t i = 0; i < state->days.size(); ++i)
+                {
+                    if (state->read[i].empty()) continue;
+                    
+                    std::string bucketKey = day_buckets::bucket_key(state->queue_id, state->days[i]);
+                    
+                    std::vector<bound_statement> batch;
+                    batch.reserve(state->read[i].size());
+                    for (auto& message : state->read[i])
                     {
-                        fur.user_found = false;
+                        batch.push_back(bound_statement(DELETE_ITEM, {
+                            cql_value::blob(bucketKey),
+                            cql_value::int64(message.stored_at),
+                            cql_value::blob(message.message_id)
+                        }));
                     }
                     
-                    callback(fur);
-                };
+                    batches.push_back(std::move(batch));
+                }
+                
+                //the next claim starts reading from today
+                batches.push_back({
+                    bound_statement(UPDATE_LAST_CLAIMED, {
+                        cql_value::int64(state->today),
+                        cql_value::blob(day_buckets::queue_key(state->queue_id))
+                    })
+                });
                 
-                cassasync::async_query_state* qstate = new cassasync::async_query_state();
-                qstate->query = "SELECT * FROM " + KEYSPACE_NAME + ".users WHERE uname_hash = ?";
-                qstate->params.push_back(usernameHash);
-                qstate->result_callback = cb;
+                auto done = std::make_shared<countdown>(batches.size());
                 
-                cassasync::async_query(qstate, _cluster);
+                for (auto& batch : batches)
+                {
+                    state->session->execute_batch(batch, [this, state, done](query_result& qr) {
+                        this->check_connection(qr, state->session);
+                        if (! done->finished(std::move(qr.error))) return;
+                        
+                        state->result.cleanup_error = std::move(done->error);
+                        for (auto& day : state->read)
+                        {
+                            std::move(day.begin(), day.end(), std::back_inserter(state->result.messages));
+                        }
+                        
+                        state->callback(state->result);
+                    });
+                }
             }
             
         }
     }
-}
\ No newline at end of file
+}
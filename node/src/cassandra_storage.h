@@ -18,17 +18,19 @@
 #ifndef __sopmq__cassandra_storage__
 #define __sopmq__cassandra_storage__
 
-#include "cass_ptrs.h"
 #include "user_account.h"
 #include "storage_error.h"
+#include "stored_message.h"
+#include "storage_driver.h"
 
-#include <cassandra.h>
-
-#include <boost/shared_ptr.hpp>
 #include <boost/noncopyable.hpp>
 
 #include <memory>
 #include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <chrono>
 
 namespace sopmq {
     namespace node {
@@ -44,6 +46,37 @@ namespace sopmq {
                 user_account account;
             };
             
+            ///
+            /// The result of the store_messages operation
+            ///
+            struct store_messages_result
+            {
+                std::unique_ptr<storage_error> error;
+            };
+            
+            ///
+            /// The result of the claim_stored_messages operation
+            ///
+            struct claim_stored_result
+            {
+                ///
+                /// Set when the messages couldn't be read. Nothing was removed
+                ///
+                std::unique_ptr<storage_error> error;
+                
+                ///
+                /// Set when the messages were read but removing them afterwards failed.
+                /// Some of them may already be gone from storage, so they still have to
+                /// be delivered
+                ///
+                std::unique_ptr<storage_error> cleanup_error;
+                
+                ///
+                /// The messages read back, oldest day first
+                ///
+                std::vector<stored_message> messages;
+            };
+            
             
             ///
             /// Encapsulates the cassandra storage cluster operations
@@ -57,6 +90,13 @@ namespace sopmq {
                 static cassandra_storage& instance();
                 
             public:
+                ///
+                /// \brief Runs storage through the given driver. Everything but tests uses
+                /// instance(), which talks to the configured cassandra seeds
+                ///
+                explicit cassandra_storage(std::unique_ptr<storage_driver> driver);
+                ~cassandra_storage();
+                
                 ///
                 /// \brief Called to initialize cassandra storage for the first time (synchronous)
                 ///
@@ -76,25 +116,125 @@ namespace sopmq {
                 ///
                 void find_user(const std::string& usernameHash,
                                std::function<void(const find_user_result&)> callback);
-                                 
+                
+                ///
+                /// \brief Opens the node's session and prepares every statement we use
+                /// (synchronous)
+                ///
+                /// Called once at startup so no request pays for the connection handshake
+                /// or a prepare. Everything but init() needs it. A request made while we
+                /// aren't connected fails right away and starts a reconnect in the
+                /// background, as does one that finds no hosts left behind the session
+                ///
+                void connect();
+                
+                ///
+                /// \brief Whether there is a session to run requests on
+                ///
+                bool is_connected() const;
+                
+                ///
+                /// \brief Writes messages to today's bucket for their queues
+                ///
+                /// The writes are sent as one unlogged batch per partition, so a batch of
+                /// messages for the same queue costs a single round trip. The callback
+                /// is called from the driver's thread once every batch has finished
+                ///
+                void store_messages(const std::vector<stored_message>& messages,
+                                    std::function<void(const store_messages_result&)> callback);
+                
+                ///
+                /// \brief Reads back the messages stored for a queue since it was last claimed
+                ///
+                /// Every day bucket in the lookback window is read at once. When remove is
+                /// set the rows that were read are deleted, one unlogged batch per bucket,
+                /// and the queue is marked as claimed through today before the callback is
+                /// called from the driver's thread. A failed removal is reported in
+                /// cleanup_error along with the messages
+                ///
+                void claim_stored_messages(const std::string& queueId, bool remove,
+                                           std::function<void(claim_stored_result&)> callback);
+                
             private:
-				CassCluster* _cluster;
+                std::unique_ptr<storage_driver> _driver;
+                
+                ///
+                /// The session every query runs on, with every statement we use prepared.
+                /// Replaced as a whole when we reconnect, and only read and written with
+                /// std::atomic_load and std::atomic_store. The driver reconnects to the
+                /// hosts behind a session on its own
+                ///
+                driver_session::ptr _session;
+                
+                ///
+                /// Set while a reconnect is underway, so only one runs at a time
+                ///
+                std::atomic<bool> _reconnecting;
+                
+                ///
+                /// When the last reconnect started, as steady_clock ticks
+                ///
+                std::atomic<std::chrono::steady_clock::rep> _last_reconnect;
+                
+                ///
+                /// The least time between reconnects, so a storage cluster that stays
+                /// down isn't flooded with them
+                ///
+                static const int RECONNECT_INTERVAL_MS = 5000;
 
                 ///
                 /// \brief The name of our keyspace
                 ///
                 static const std::string& KEYSPACE_NAME;
                 
-                void execute_statement(CassSession* session, const std::string& statement);
+                static const std::string SELECT_USER;
+                static const std::string INSERT_USER;
+                static const std::string INSERT_ITEM;
+                static const std::string SELECT_ITEMS;
+                static const std::string DELETE_ITEM;
+                static const std::string SELECT_LAST_CLAIMED;
+                static const std::string UPDATE_LAST_CLAIMED;
+                
+                ///
+                /// Every statement connect() prepares
+                ///
+                static const std::vector<std::string> PREPARED_STATEMENTS;
                 
-                void throw_on_error(CassFuture* future);
+                ///
+                /// Prepares every statement in PREPARED_STATEMENTS on the session
+                ///
+                void prepare_all(driver_session::ptr session, prepare_callback callback);
                 
-                std::string get_string_column_value(const CassRow* row, const std::string& colname);
+                ///
+                /// Returns the current session. Never blocks: when there is none a
+                /// reconnect is started and storage_error is thrown
+                ///
+                driver_session::ptr current();
                 
-                int get_int_column_value(const CassRow* row, const std::string& colname);
+                ///
+                /// Starts replacing the session without blocking, unless it has been
+                /// replaced already, another reconnect is underway or the last one was
+                /// too recent
+                ///
+                void reconnect(const driver_session::ptr& failed);
                 
-                cassandra_storage();
-                ~cassandra_storage();
+                ///
+                /// Reconnects if the query failed because the session has no hosts left
+                ///
+                void check_connection(const query_result& result, const driver_session::ptr& session);
+                
+                struct claim_state;
+                
+                ///
+                /// Reads every bucket in the window for the queue at once
+                ///
+                void read_buckets(driver_session::ptr session, const std::string& queueId, bool remove,
+                                  std::int64_t lastClaimedDay, std::function<void(claim_stored_result&)> callback);
+                
+                ///
+                /// Deletes what was read and moves the queue's last claimed day forward
+                ///
+                void remove_claimed(std::shared_ptr<claim_state> state);
             };
             
         }
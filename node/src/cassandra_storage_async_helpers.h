@@ -25,7 +25,6 @@
 
 #include <string>
 #include <functional>
-#include <vector>
 #include <memory>
 
 ///
@@ -34,34 +33,20 @@
 namespace cassasync {
     
     ///
-    /// The current state of an async query running against
-    /// a cassandra datasource
+    /// Called once a future on a long lived session completes. The future is
+    /// freed after the callback returns
     ///
-    struct async_query_state
-    {
-        std::string query;
-        std::vector<std::string> params;
-        std::unique_ptr<sopmq::node::storage::storage_error> error;
-        std::function<void(async_query_state&)> result_callback;
-        
-        sopmq::node::storage::CassFuturePtr connect_future;
-        CassSession* session;
-        sopmq::node::storage::CassStatementPtr statement;
-        sopmq::node::storage::CassFuturePtr result_future;
-        
-        sopmq::node::storage::CassIteratorPtr rows;
-        
-        async_query_state()
-        : session(nullptr)
-        {
-            
-        }
-    };
+    typedef std::function<void(CassFuture*)> future_callback;
     
     ///
-    /// Begins an async cassandra query with the given query state
+    /// Calls the callback from the driver's thread when the future completes
     ///
-    void async_query(async_query_state* qstate, CassCluster* cluster);
+    void when_done(CassFuture* future, future_callback callback);
+    
+    ///
+    /// Returns the error the future completed with, or null if it succeeded
+    ///
+    std::unique_ptr<sopmq::node::storage::storage_error> future_error(CassFuture* future);
     
 }
 
@@ -38,9 +38,11 @@ namespace sopmq {
     namespace node {
         namespace connection {
             
-            connection_in::connection_in(ba::io_service& ioService, const ring& ring)
+            connection_in::connection_in(ba::io_service& ioService, const ring& ring, queue_manager3& queueManager,
+                                         io_service_pool& ioServices, gossiper& gossiper)
             : connection_base(ioService, settings::instance().maxMessageSize),
-            _io_service(ioService), _ring(ring)
+            _io_service(ioService), _ring(ring), _queue_manager(queueManager), _io_services(ioServices),
+            _gossiper(gossiper)
             {
                 
             }
@@ -56,7 +58,8 @@ namespace sopmq {
                 _server = server;
                 _server->connection_started(shared_from_this());
                 
-                auto state = std::make_shared<csunauthenticated>(_io_service, shared_from_this(), _ring);
+                auto state = std::make_shared<csunauthenticated>(_io_service, shared_from_this(), _ring, _queue_manager, _io_services,
+                                                                 _gossiper);
                 state->start();
 
                 //though we are creating it we do NOT own the state, the connection does. 
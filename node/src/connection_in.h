@@ -25,6 +25,9 @@
 #include "messageutil.h"
 #include "connection_base.h"
 #include "ring.h"
+#include "queue_manager.h"
+#include "io_service_pool.h"
+#include "gossiper.h"
 
 #include <boost/weak_ptr.hpp>
 #include <boost/noncopyable.hpp>
@@ -59,7 +62,8 @@ namespace sopmq {
                 typedef std::weak_ptr<connection_in> wptr;
                 
             public:
-                connection_in(boost::asio::io_service& ioService, const ring& ring);
+                connection_in(boost::asio::io_service& ioService, const ring& ring, queue_manager3& queueManager,
+                              io_service_pool& ioServices, gossiper& gossiper);
                 virtual ~connection_in();
                 
                 ///
@@ -80,6 +84,9 @@ namespace sopmq {
             private:
                 boost::asio::io_service& _io_service;
                 const ring& _ring;
+                queue_manager3& _queue_manager;
+                io_service_pool& _io_services;
+                gossiper& _gossiper;
                 server* _server;
                 iconnection_state::wptr _state;
             };
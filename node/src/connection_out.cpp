@@ -16,3 +16,209 @@
  */
 
 #include "connection_out.h"
+
+#include "settings.h"
+#include "logging.h"
+#include "util.h"
+#include "network_error.h"
+
+#include "GetChallengeMessage.pb.h"
+#include "ChallengeResponseMessage.pb.h"
+#include "AnswerChallengeMessage.pb.h"
+#include "AuthAckMessage.pb.h"
+
+#include <boost/lexical_cast.hpp>
+#include <boost/chrono.hpp>
+
+using namespace std::placeholders;
+using sopmq::error::network_error;
+using sopmq::message::messageutil;
+using sopmq::message::network_status_callback;
+using sopmq::node::settings;
+using sopmq::shared::util;
+using sopmq::shared::net::network_operation_result;
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+        namespace connection {
+
+            connection_out::connection_out(ba::io_service& ioService, const shared::net::endpoint& ep)
+            : connection_base(ioService, ep, settings::instance().maxMessageSize),
+            _dispatcher(std::bind(&connection_out::unhandled_message, this, _1, _2)),
+            _ready(false), _failed(false), _in_flight(0), _heartbeat_sent(0)
+            {
+                _dispatcher.set_reply_timeout(ioService, boost::chrono::seconds(settings::instance().defaultTimeout));
+            }
+
+            connection_out::~connection_out()
+            {
+                LOG_SRC(debug) << "~connection_out()";
+            }
+
+            void connection_out::start(network_status_callback readyCallback, network_status_callback closedCallback)
+            {
+                _ready_callback = readyCallback;
+                _closed_callback = closedCallback;
+
+                this->connect(std::bind(&connection_out::after_connect, shared_from_this(), _1));
+            }
+
+            void connection_out::send_one_way(message::message_type type, Message_ptr message)
+            {
+                auto self(shared_from_this());
+                this->send_message(type, message, [self](const network_operation_result& result) {
+                    if (! result.was_successful()) self->fail(result);
+                });
+            }
+            
+            bool connection_out::is_ready() const
+            {
+                return _ready;
+            }
+
+            size_t connection_out::in_flight() const
+            {
+                return _in_flight;
+            }
+
+            bool connection_out::heartbeat_due(std::uint64_t heartbeat)
+            {
+                if (heartbeat <= _heartbeat_sent) return false;
+
+                _heartbeat_sent = heartbeat;
+                return true;
+            }
+
+            void connection_out::shutdown(const network_operation_result& result)
+            {
+                //whoever is shutting us down doesn't need to hear about it
+                _ready_callback = nullptr;
+                _closed_callback = nullptr;
+
+                this->fail(result);
+            }
+
+            void connection_out::after_connect(const network_operation_result& result)
+            {
+                if (! result.was_successful())
+                {
+                    this->fail(result);
+                    return;
+                }
+
+                //identify ourselves as a node. the answer proves we hold the ring key
+                GetChallengeMessage_ptr gcm = messageutil::make_message<GetChallengeMessage>(this->get_next_id(), 0);
+                gcm->set_type(GetChallengeMessage::SERVER);
+
+                std::function<void(const network_operation_result&, ChallengeResponseMessage_ptr)> func
+                    = std::bind(&connection_out::on_challenge_response, this, _1, _2);
+                _dispatcher.set_handler(func, gcm->identity().id());
+
+                auto self(shared_from_this());
+                this->send_message(message::MT_GET_CHALLENGE, gcm, [self](const network_operation_result& result) {
+                    if (! result.was_successful()) self->fail(result);
+                });
+
+                this->read_next();
+            }
+
+            void connection_out::on_challenge_response(const network_operation_result& result, ChallengeResponseMessage_ptr response)
+            {
+                if (! response)
+                {
+                    this->fail(result);
+                    return;
+                }
+
+                AnswerChallengeMessage_ptr acm = messageutil::make_message<AnswerChallengeMessage>(this->get_next_id(), response->identity().id());
+                acm->set_uname_hash(boost::lexical_cast<std::string>(settings::instance().nodeId));
+                acm->set_challenge_response(util::sha256_hex_string(settings::instance().ring_key_hash() + response->challenge()));
+
+                std::function<void(const network_operation_result&, AuthAckMessage_ptr)> func
+                    = std::bind(&connection_out::on_auth_ack, this, _1, _2);
+                _dispatcher.set_handler(func, acm->identity().id());
+
+                auto self(shared_from_this());
+                this->send_message(message::MT_ANSWER_CHALLENGE, acm, [self](const network_operation_result& result) {
+                    if (! result.was_successful()) self->fail(result);
+                });
+            }
+
+            void connection_out::on_auth_ack(const network_operation_result& result, AuthAckMessage_ptr ack)
+            {
+                if (! ack)
+                {
+                    this->fail(result);
+                    return;
+                }
+
+                if (! ack->authorized())
+                {
+                    LOG_SRC(error) << this->endpoint() << " refused our ring key";
+
+                    this->fail(network_operation_result(shared::net::ET_NETWORK,
+                                                        network_error("Authentication refused by node")));
+                    return;
+                }
+
+                _ready = true;
+
+                network_status_callback callback(std::move(_ready_callback));
+                _ready_callback = nullptr;
+
+                if (callback) callback(network_operation_result::success());
+            }
+
+            void connection_out::unhandled_message(Message_ptr message, const std::string& typeName)
+            {
+                LOG_SRC(error) << this->endpoint()
+                    << " protocol violation: unexpected message: "
+                    << typeName;
+
+                this->fail(network_operation_result(shared::net::ET_NETWORK,
+                                                    network_error("Unexpected message received from node")));
+            }
+
+            void connection_out::read_next()
+            {
+                this->read_message(_dispatcher, std::bind(&connection_out::handle_read_result, shared_from_this(), _1));
+            }
+
+            void connection_out::handle_read_result(const network_operation_result& result)
+            {
+                if (_failed) return;
+
+                if (! result.was_successful())
+                {
+                    this->fail(result);
+                }
+                else
+                {
+                    this->read_next();
+                }
+            }
+
+            void connection_out::fail(const network_operation_result& result)
+            {
+                if (_failed) return;
+                _failed = true;
+
+                bool wasReady = _ready;
+                _ready = false;
+
+                this->close();
+
+                //requests still waiting won't be answered on this connection
+                _dispatcher.cancel_all_with_error(result);
+
+                network_status_callback callback(std::move(wasReady ? _closed_callback : _ready_callback));
+                _ready_callback = nullptr;
+                _closed_callback = nullptr;
+
+                if (callback) callback(result);
+            }
+        }
+    }
+}
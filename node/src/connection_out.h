@@ -19,9 +19,17 @@
 #define __sopmq__connection_out__
 
 #include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
 #include <memory>
+#include <functional>
+#include <cstddef>
+#include <cstdint>
 
 #include "connection_base.h"
+#include "message_dispatcher.h"
+#include "message_ptrs.h"
+#include "message_types.h"
+#include "network_operation_result.h"
 
 namespace sopmq {
     namespace error {
@@ -31,19 +39,116 @@ namespace sopmq {
 
 namespace sopmq {
     namespace node {
-        
+
         class server;
-        
+
         namespace connection {
-            
+
             ///
             /// A connection to another SOPMQ node
             ///
+            /// The connection authenticates itself as a server using the ring key and
+            /// then carries any number of requests at once. Each request waits for
+            /// the reply whose in_reply_to matches its id, so replies may come back in
+            /// any order.
+            ///
             class connection_out :  public boost::noncopyable,
                                     public sopmq::shared::net::connection_base,
                                     public std::enable_shared_from_this<connection_out>
             {
+            public:
+                typedef std::shared_ptr<connection_out> ptr;
+                typedef std::weak_ptr<connection_out> wptr;
+
+            public:
+                connection_out(boost::asio::io_service& ioService, const shared::net::endpoint& ep);
+                virtual ~connection_out();
+
+                ///
+                /// \brief Connects and authenticates to the node
+                /// \param readyCallback Called once the connection is authenticated or
+                /// has failed to
+                /// \param closedCallback Called once if the connection fails after it
+                /// became ready
+                ///
+                void start(sopmq::message::network_status_callback readyCallback,
+                           sopmq::message::network_status_callback closedCallback);
+
+                ///
+                /// \brief Sends a request and waits for its reply
+                ///
+                /// The handler is called exactly once, with the reply, or with a null
+                /// message and the error if the connection fails or the node doesn't
+                /// answer within the default timeout
+                ///
+                template <typename ReplyType>
+                void send_request(sopmq::message::message_type type, Message_ptr message, std::uint32_t id,
+                                  std::function<void(const shared::net::network_operation_result&, std::shared_ptr<ReplyType>)> handler)
+                {
+                    ++_in_flight;
+
+                    std::function<void(const shared::net::network_operation_result&, std::shared_ptr<ReplyType>)> replyHandler =
+                        [this, handler](const shared::net::network_operation_result& result, std::shared_ptr<ReplyType> reply)
+                        {
+                            --_in_flight;
+                            handler(result, reply);
+                        };
+
+                    _dispatcher.set_handler(replyHandler, id);
+
+                    auto self(shared_from_this());
+                    this->send_message(type, message, [self](const shared::net::network_operation_result& result) {
+                        if (! result.was_successful()) self->fail(result);
+                    });
+                }
+
+                ///
+                /// \brief Sends a message that isn't answered
+                ///
+                void send_one_way(sopmq::message::message_type type, Message_ptr message);
                 
+                ///
+                /// \brief Whether or not the connection is authenticated and usable
+                ///
+                bool is_ready() const;
+
+                ///
+                /// \brief The number of requests waiting on a reply
+                ///
+                size_t in_flight() const;
+                
+                ///
+                /// \brief Whether our heartbeat with the given clock still has to be sent
+                /// on this connection. Once asked, it counts as sent
+                ///
+                bool heartbeat_due(std::uint64_t heartbeat);
+
+                ///
+                /// \brief Closes the connection, failing everything waiting on it
+                ///
+                void shutdown(const shared::net::network_operation_result& result);
+
+            private:
+                sopmq::message::message_dispatcher _dispatcher;
+                sopmq::message::network_status_callback _ready_callback;
+                sopmq::message::network_status_callback _closed_callback;
+                bool _ready;
+                bool _failed;
+                size_t _in_flight;
+                std::uint64_t _heartbeat_sent;
+
+                void after_connect(const shared::net::network_operation_result& result);
+                void on_challenge_response(const shared::net::network_operation_result& result, ChallengeResponseMessage_ptr response);
+                void on_auth_ack(const shared::net::network_operation_result& result, AuthAckMessage_ptr ack);
+                void unhandled_message(Message_ptr message, const std::string& typeName);
+
+                void read_next();
+                void handle_read_result(const shared::net::network_operation_result& result);
+
+                ///
+                /// Closes the connection and tells whoever is waiting on it
+                ///
+                void fail(const shared::net::network_operation_result& result);
             };
         }
     }
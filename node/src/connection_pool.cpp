@@ -0,0 +1,286 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "connection_pool.h"
+
+#include "logging.h"
+#include "network_error.h"
+
+#include <chrono>
+#include <algorithm>
+
+using sopmq::error::network_error;
+using sopmq::shared::net::network_operation_result;
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+        namespace connection {
+
+            const size_t connection_pool::DEFAULT_POOL_SIZE;
+            const size_t connection_pool::DEFAULT_MAX_IN_FLIGHT;
+            const size_t connection_pool::DEFAULT_MAX_QUEUED;
+            const int connection_pool::MIN_BACKOFF_MS;
+            const int connection_pool::MAX_BACKOFF_MS;
+
+            connection_pool::connection_pool(ba::io_service& ioService, const shared::net::endpoint& ep,
+                                             size_t poolSize, size_t maxInFlight, size_t maxQueued)
+            : _ioService(ioService), _endpoint(ep), _max_in_flight(maxInFlight), _max_queued(maxQueued),
+            _connections(poolSize), _in_flight(0), _reconnect_timer(ioService), _reconnect_pending(false),
+            _backoff(MIN_BACKOFF_MS), _shutdown(false)
+            {
+
+            }
+
+            connection_pool::~connection_pool()
+            {
+                this->shutdown();
+            }
+
+            void connection_pool::submit(request req)
+            {
+                if (_shutdown)
+                {
+                    req.fail(network_operation_result(shared::net::ET_NETWORK,
+                                                      network_error("Connection pool is shut down")));
+                    return;
+                }
+
+                if (_in_flight < _max_in_flight)
+                {
+                    if (connection_out* conn = this->pick_ready())
+                    {
+                        this->launch(*conn, req);
+                        return;
+                    }
+                }
+
+                if (! this->any_connections())
+                {
+                    if (_reconnect_pending)
+                    {
+                        //the node was unreachable last we tried. don't hold the caller up
+                        req.fail(network_operation_result(shared::net::ET_NETWORK,
+                                                          network_error("Node " + _endpoint.host_name() + " is unreachable")));
+                        return;
+                    }
+
+                    this->open_connections();
+                }
+
+                if (_backlog.size() >= _max_queued)
+                {
+                    req.fail(network_operation_result(shared::net::ET_NETWORK,
+                                                      network_error("Too many requests waiting for node " + _endpoint.host_name())));
+                    return;
+                }
+
+                _backlog.push_back(std::move(req));
+            }
+
+            void connection_pool::shutdown()
+            {
+                if (_shutdown) return;
+                _shutdown = true;
+
+                boost::system::error_code ec;
+                _reconnect_timer.cancel(ec);
+
+                network_operation_result result(shared::net::ET_NETWORK, network_error("Connection pool is shut down"));
+
+                std::vector<connection_out::ptr> connections;
+                connections.swap(_connections);
+
+                for (auto& conn : connections)
+                {
+                    if (conn) conn->shutdown(result);
+                }
+
+                this->fail_backlog(result);
+            }
+
+            size_t connection_pool::in_flight() const
+            {
+                return _in_flight;
+            }
+
+            size_t connection_pool::queued() const
+            {
+                return _backlog.size();
+            }
+
+            size_t connection_pool::ready_connections() const
+            {
+                return std::count_if(_connections.begin(), _connections.end(),
+                                     [](const connection_out::ptr& conn) { return conn && conn->is_ready(); });
+            }
+
+            connection_out* connection_pool::pick_ready() const
+            {
+                connection_out* best = nullptr;
+                for (auto& conn : _connections)
+                {
+                    if (! conn || ! conn->is_ready()) continue;
+
+                    if (best == nullptr || conn->in_flight() < best->in_flight())
+                    {
+                        best = conn.get();
+                    }
+                }
+
+                return best;
+            }
+
+            void connection_pool::launch(connection_out& conn, request& req)
+            {
+                ++_in_flight;
+
+                std::weak_ptr<connection_pool> wself(shared_from_this());
+                req.send(conn, [wself] {
+                    if (auto self = wself.lock()) self->request_done();
+                });
+            }
+
+            void connection_pool::request_done()
+            {
+                --_in_flight;
+                this->pump();
+            }
+
+            void connection_pool::pump()
+            {
+                while (! _backlog.empty() && _in_flight < _max_in_flight)
+                {
+                    connection_out* conn = this->pick_ready();
+                    if (conn == nullptr) break;
+
+                    request req(std::move(_backlog.front()));
+                    _backlog.pop_front();
+
+                    this->launch(*conn, req);
+                }
+            }
+
+            void connection_pool::open_connections()
+            {
+                if (_shutdown) return;
+
+                std::weak_ptr<connection_pool> wself(shared_from_this());
+
+                for (size_t slot = 0; slot < _connections.size(); ++slot)
+                {
+                    if (_connections[slot]) continue;
+
+                    connection_out::ptr conn = std::make_shared<connection_out>(_ioService, _endpoint);
+                    _connections[slot] = conn;
+
+                    connection_out* raw = conn.get();
+                    conn->start([wself, slot, raw](const network_operation_result& result) {
+                                    if (auto self = wself.lock()) self->on_ready(slot, raw, result);
+                                },
+                                [wself, slot, raw](const network_operation_result& result) {
+                                    if (auto self = wself.lock()) self->on_closed(slot, raw, result);
+                                });
+                }
+            }
+
+            void connection_pool::on_ready(size_t slot, connection_out* conn, const network_operation_result& result)
+            {
+                if (_shutdown || _connections[slot].get() != conn) return;
+
+                if (result.was_successful())
+                {
+                    _backoff = boost::chrono::milliseconds(MIN_BACKOFF_MS);
+                    this->pump();
+                    return;
+                }
+
+                LOG_SRC(warning) << "unable to connect to node at " << _endpoint.host_name()
+                    << ": " << result.get_error().what();
+
+                _connections[slot].reset();
+                this->schedule_reconnect();
+
+                //nothing left that could send what's waiting
+                if (! this->any_connections())
+                {
+                    this->fail_backlog(result);
+                }
+            }
+
+            void connection_pool::on_closed(size_t slot, connection_out* conn, const network_operation_result& result)
+            {
+                if (_shutdown || _connections[slot].get() != conn) return;
+
+                LOG_SRC(warning) << "lost connection to node at " << _endpoint.host_name()
+                    << ": " << result.get_error().what();
+
+                _connections[slot].reset();
+
+                //a working connection dropping is worth one immediate retry. if that
+                //fails the backoff takes over
+                if (! _reconnect_pending)
+                {
+                    this->open_connections();
+                }
+            }
+
+            bool connection_pool::any_connections() const
+            {
+                return std::any_of(_connections.begin(), _connections.end(),
+                                   [](const connection_out::ptr& conn) { return (bool)conn; });
+            }
+
+            void connection_pool::schedule_reconnect()
+            {
+                if (_reconnect_pending || _shutdown) return;
+                _reconnect_pending = true;
+
+                _reconnect_timer.expires_from_now(std::chrono::milliseconds(_backoff.count()));
+
+                std::weak_ptr<connection_pool> wself(shared_from_this());
+                _reconnect_timer.async_wait([wself](const boost::system::error_code& error) {
+                    if (auto self = wself.lock()) self->after_reconnect_timer(error);
+                });
+
+                _backoff = std::min(_backoff * 2, boost::chrono::milliseconds(MAX_BACKOFF_MS));
+            }
+
+            void connection_pool::after_reconnect_timer(const boost::system::error_code& error)
+            {
+                if (error == ba::error::operation_aborted) return;
+
+                _reconnect_pending = false;
+                this->open_connections();
+            }
+
+            void connection_pool::fail_backlog(const network_operation_result& result)
+            {
+                //failing a request may well submit another one
+                std::deque<request> backlog;
+                backlog.swap(_backlog);
+
+                for (auto& req : backlog)
+                {
+                    req.fail(result);
+                }
+            }
+
+        }
+    }
+}
@@ -0,0 +1,169 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__connection_pool__
+#define __sopmq__connection_pool__
+
+#include "connection_out.h"
+#include "endpoint.h"
+#include "network_operation_result.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/chrono.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        namespace connection {
+
+            ///
+            /// \brief A small set of long lived connections to one other node that
+            /// requests are spread across
+            ///
+            /// Requests are pipelined, each connection carries as many as it is given.
+            /// Once the node has max_in_flight requests outstanding, further requests
+            /// wait in a backlog until replies come back. Connections that fail are
+            /// reopened after a backoff that doubles on each failed attempt.
+            ///
+            /// While the node can't be reached requests fail right away rather than
+            /// waiting for it, so callers can move on to another node.
+            ///
+            /// Only used from the node's IO thread.
+            ///
+            class connection_pool : public boost::noncopyable,
+                                    public std::enable_shared_from_this<connection_pool>
+            {
+            public:
+                typedef std::shared_ptr<connection_pool> ptr;
+
+                ///
+                /// A request waiting to be sent
+                ///
+                struct request
+                {
+                    ///
+                    /// Sends the request on the given connection. done must be called
+                    /// once the request has been answered or has failed
+                    ///
+                    std::function<void(connection_out& conn, std::function<void()> done)> send;
+
+                    ///
+                    /// Called instead of send when the request can't be sent
+                    ///
+                    std::function<void(const shared::net::network_operation_result& error)> fail;
+                };
+
+                static const size_t DEFAULT_POOL_SIZE = 2;
+                static const size_t DEFAULT_MAX_IN_FLIGHT = 256;
+                static const size_t DEFAULT_MAX_QUEUED = 4096;
+
+                static const int MIN_BACKOFF_MS = 100;
+                static const int MAX_BACKOFF_MS = 10000;
+
+            public:
+                connection_pool(boost::asio::io_service& ioService, const shared::net::endpoint& ep,
+                                size_t poolSize = DEFAULT_POOL_SIZE,
+                                size_t maxInFlight = DEFAULT_MAX_IN_FLIGHT,
+                                size_t maxQueued = DEFAULT_MAX_QUEUED);
+                virtual ~connection_pool();
+
+                ///
+                /// \brief Sends the request as soon as a connection and an in flight
+                /// slot are available
+                ///
+                void submit(request req);
+
+                ///
+                /// \brief Closes every connection and fails everything outstanding
+                ///
+                void shutdown();
+
+                ///
+                /// \brief The number of requests waiting on a reply
+                ///
+                size_t in_flight() const;
+
+                ///
+                /// \brief The number of requests waiting to be sent
+                ///
+                size_t queued() const;
+
+                ///
+                /// \brief The number of connections that are authenticated and usable
+                ///
+                size_t ready_connections() const;
+
+            private:
+                boost::asio::io_service& _ioService;
+                shared::net::endpoint _endpoint;
+                size_t _max_in_flight;
+                size_t _max_queued;
+
+                ///
+                /// One slot per pooled connection, empty while it isn't open or opening
+                ///
+                std::vector<connection_out::ptr> _connections;
+
+                size_t _in_flight;
+                std::deque<request> _backlog;
+
+                boost::asio::steady_timer _reconnect_timer;
+                bool _reconnect_pending;
+                boost::chrono::milliseconds _backoff;
+
+                bool _shutdown;
+
+                ///
+                /// Returns the ready connection with the fewest requests outstanding
+                ///
+                connection_out* pick_ready() const;
+
+                void launch(connection_out& conn, request& req);
+                void request_done();
+
+                ///
+                /// Sends backlogged requests for as long as there is room
+                ///
+                void pump();
+
+                void open_connections();
+                void on_ready(size_t slot, connection_out* conn, const shared::net::network_operation_result& result);
+                void on_closed(size_t slot, connection_out* conn, const shared::net::network_operation_result& result);
+
+                ///
+                /// Whether any connection is open or still opening
+                ///
+                bool any_connections() const;
+
+                void schedule_reconnect();
+                void after_reconnect_timer(const boost::system::error_code& error);
+
+                void fail_backlog(const shared::net::network_operation_result& result);
+            };
+
+        }
+    }
+}
+
+#endif /* defined(__sopmq__connection_pool__) */
@@ -0,0 +1,75 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "crypto_pool.h"
+
+#include "settings.h"
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+        
+        crypto_pool& crypto_pool::instance()
+        {
+            static crypto_pool pool(settings::instance().cryptoThreads);
+            return pool;
+        }
+        
+        crypto_pool::crypto_pool(size_t threadCount)
+        : _work(new ba::io_service::work(_ioService))
+        {
+            if (threadCount == 0) threadCount = 1;
+            
+            for (size_t i = 0; i < threadCount; ++i)
+            {
+                _threads.emplace_back([this] { _ioService.run(); });
+            }
+        }
+        
+        crypto_pool::~crypto_pool()
+        {
+            //finish what was already handed to us
+            _work.reset();
+            
+            for (auto& thread : _threads)
+            {
+                thread.join();
+            }
+        }
+        
+        void crypto_pool::post(std::function<void()> job)
+        {
+            _ioService.post(job);
+        }
+        
+        void crypto_pool::check(ba::io_service& replyTo, std::function<bool()> check,
+                                std::function<void(bool)> done)
+        {
+            _ioService.post([&replyTo, check, done] {
+                bool result = check();
+                replyTo.post([done, result] { done(result); });
+            });
+        }
+        
+        size_t crypto_pool::thread_count() const
+        {
+            return _threads.size();
+        }
+        
+    }
+}
@@ -0,0 +1,75 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__crypto_pool__
+#define __sopmq__crypto_pool__
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        
+        ///
+        /// \brief A few threads for the hashing done while authenticating
+        ///
+        /// A login storm means thousands of SHA-256 checks in a few seconds. Done on
+        /// the IO thread they hold up every connection that thread serves, so the
+        /// checks run here and their results are posted back.
+        ///
+        class crypto_pool : public boost::noncopyable
+        {
+        public:
+            ///
+            /// \brief The pool used by the node, sized from settings
+            ///
+            static crypto_pool& instance();
+            
+        public:
+            explicit crypto_pool(size_t threadCount);
+            ~crypto_pool();
+            
+            ///
+            /// \brief Runs the job on one of the pool's threads
+            ///
+            void post(std::function<void()> job);
+            
+            ///
+            /// \brief Runs the check on the pool and calls done with its result on
+            /// the given IO service
+            ///
+            void check(boost::asio::io_service& replyTo, std::function<bool()> check,
+                       std::function<void(bool)> done);
+            
+            size_t thread_count() const;
+            
+        private:
+            boost::asio::io_service _ioService;
+            std::unique_ptr<boost::asio::io_service::work> _work;
+            std::vector<std::thread> _threads;
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__crypto_pool__) */
@@ -25,12 +25,35 @@
 #include "message_types.h"
 #include "util.h"
 #include "quorum_logic.h"
+#include "replication.h"
+#include "hedge_policy.h"
+#include "cassandra_storage.h"
 
 #include "PublishMessage.pb.h"
 #include "PublishResponseMessage.pb.h"
+#include "ProxyPublishMessage.pb.h"
 #include "ProxyPublishResponseMessage.pb.h"
+#include "PublishBatchMessage.pb.h"
+#include "PublishBatchResponseMessage.pb.h"
+#include "ProxyPublishBatchMessage.pb.h"
+#include "ProxyPublishBatchResponseMessage.pb.h"
+#include "StampMessage.pb.h"
+#include "QueueStamp.pb.h"
+#include "ConsumeFromQueueMessage.pb.h"
+#include "ConsumeResponseMessage.pb.h"
+#include "ConsumeCreditMessage.pb.h"
+#include "DeliveryMessage.pb.h"
+#include "ClaimMessage.pb.h"
+#include "ClaimResponseMessage.pb.h"
+#include "QueueClaim.pb.h"
+#include "GossipMessage.pb.h"
+#include "Identifier.pb.h"
 
 #include <functional>
+#include <map>
+#include <array>
+#include <algorithm>
+#include <chrono>
 
 using namespace std::placeholders;
 
@@ -43,9 +66,59 @@ namespace sopmq {
     namespace node {
         namespace connection {
             
+            namespace
+            {
+                ///
+                /// Returns the message to hand to the given node. Queuing on the local node
+                /// moves the content out of the message, and the other nodes in the quorum
+                /// may not have been sent theirs yet, so the local node gets a copy
+                ///
+                PublishMessage_ptr message_for_node(const node::ptr& node, const PublishMessage_ptr& message)
+                {
+                    if (node->is_self()) return std::make_shared<PublishMessage>(*message);
+                    return message;
+                }
+                
+                ///
+                /// Whether a message that couldn't be queued should go to persistent storage
+                ///
+                bool should_store(const PublishMessage& message)
+                {
+                    return (message.flags() & PublishMessage_Flags_STORE_IF_PIPE_FAILS)
+                        && storage::cassandra_storage::instance().is_connected();
+                }
+                
+                storage::stored_message to_stored(const PublishMessage& message)
+                {
+                    storage::stored_message stored;
+                    stored.queue_id = message.queue_id();
+                    stored.message_id = message.message_id();
+                    stored.content = message.content();
+                    
+                    return stored;
+                }
+                
+                ///
+                /// Combines the clocks the quorum gave a message into its final clock
+                ///
+                template <std::size_t RF>
+                vector_clock<RF> quorum_clock(const std::vector<vector_clock<RF>>& clocks)
+                {
+                    vector_clock<RF> result(clocks[0]);
+                    for (size_t i = 1; i < clocks.size(); ++i)
+                    {
+                        result = vector_clock<RF>::max(result, clocks[i]);
+                    }
+                    
+                    return result;
+                }
+            }
+            
             csauthenticated::csauthenticated(boost::asio::io_service& ioService, connection_in::ptr conn,
-                const ring& ring)
-            : _ioService(ioService), _conn(conn), _ring(ring),
+                const ring& ring, queue_manager3& queueManager, io_service_pool& ioServices,
+                gossiper& gossiper, GetChallengeMessage_Type authType)
+            : _ioService(ioService), _conn(conn), _ring(ring), _queue_manager(queueManager), _io_services(ioServices),
+            _gossiper(gossiper), _authType(authType),
             _dispatcher(std::bind(&csauthenticated::unhandled_message, this, _1))
             {
                 LOG_SRC(debug) << "csauthenticated()";
@@ -64,6 +137,50 @@ namespace sopmq {
                 
                 _dispatcher.set_handler(func);
                 
+                std::function<void(const shared::net::network_operation_result&,PublishBatchMessage_ptr)> batchFunc
+                    = std::bind(&csauthenticated::handle_publish_batch_message, this, _1, _2);
+                
+                _dispatcher.set_handler(batchFunc);
+                
+                std::function<void(const shared::net::network_operation_result&,ConsumeFromQueueMessage_ptr)> consumeFunc
+                    = std::bind(&csauthenticated::handle_consume_message, this, _1, _2);
+                
+                _dispatcher.set_handler(consumeFunc);
+                
+                std::function<void(const shared::net::network_operation_result&,ConsumeCreditMessage_ptr)> creditFunc
+                    = std::bind(&csauthenticated::handle_consume_credit_message, this, _1, _2);
+                
+                _dispatcher.set_handler(creditFunc);
+                
+                std::function<void(const shared::net::network_operation_result&,ClaimMessage_ptr)> claimFunc
+                    = std::bind(&csauthenticated::handle_claim_message, this, _1, _2);
+                
+                _dispatcher.set_handler(claimFunc);
+                
+                //only other nodes get to put messages straight into our queues
+                if (_authType == GetChallengeMessage_Type_SERVER)
+                {
+                    std::function<void(const shared::net::network_operation_result&,ProxyPublishMessage_ptr)> proxyFunc
+                        = std::bind(&csauthenticated::handle_proxy_publish_message, this, _1, _2);
+                    
+                    _dispatcher.set_handler(proxyFunc);
+                    
+                    std::function<void(const shared::net::network_operation_result&,ProxyPublishBatchMessage_ptr)> proxyBatchFunc
+                        = std::bind(&csauthenticated::handle_proxy_publish_batch_message, this, _1, _2);
+                    
+                    _dispatcher.set_handler(proxyBatchFunc);
+                    
+                    std::function<void(const shared::net::network_operation_result&,StampMessage_ptr)> stampFunc
+                        = std::bind(&csauthenticated::handle_stamp_message, this, _1, _2);
+                    
+                    _dispatcher.set_handler(stampFunc);
+                    
+                    std::function<void(const shared::net::network_operation_result&,GossipMessage_ptr)> gossipFunc
+                        = std::bind(&csauthenticated::handle_gossip_message, this, _1, _2);
+                    
+                    _dispatcher.set_handler(gossipFunc);
+                }
+                
                 _conn->read_message(_dispatcher, std::bind(&csauthenticated::handle_read_result, shared_from_this(), _1));
             }
             
@@ -97,32 +214,56 @@ namespace sopmq {
                 LOG_SRC(debug) << "handle_post_message(): result: " << (result.was_successful() ? "true" : "false");
                 if (! result.was_successful()) return;
                 
+                if (replication::factor_for_queue(message->queue_id()) == replication::SINGLE_FACTOR)
+                {
+                    this->publish<replication::SINGLE_FACTOR>(message);
+                }
+                else
+                {
+                    this->publish<replication::DEFAULT_FACTOR>(message);
+                }
+            }
+            
+            template <std::size_t RF>
+            void csauthenticated::publish(PublishMessage_ptr message)
+            {
                 try
                 {
-                    std::array<node::ptr, 3> nodes = _ring.find_quorum_for_operation(sopmq::shared::util::murmur_hash3(message->queue_id()));
+                    std::array<node::ptr, RF> nodes = _ring.find_quorum_for_operation<RF>(sopmq::shared::util::murmur_hash3(message->queue_id()));
                     
                     class context
                     {
                     public:
-                        std::vector<vector_clock3> clocks;
+                        std::vector<vector_clock<RF>> clocks;
+                        vector_clock<RF> final_clock;
                     };
                     
-                    quorum_logic<3, context>::ptr logic = std::make_shared<quorum_logic<3, context> >(nodes);
+                    //the replies can come back after the client has gone
+                    auto self(shared_from_this());
+                    
+                    typename quorum_logic<RF, context>::ptr logic = std::make_shared<quorum_logic<RF, context> >(nodes);
+                    
+                    auto& hedging = hedge_policy::instance();
+                    if (hedging.enabled()) logic->set_hedge(_ioService, hedging.delay());
                     
                     // if we can not successfully message a quorum of nodes, this will fire off the failure
-                    logic->set_fail_function([=] {
-                        PublishResponseMessage_ptr response
-                            = messageutil::make_message<PublishResponseMessage>(_conn->get_next_id(), message->identity().id());
-                        
-                        response->set_status(PublishResponseMessage_Status_UNAVAILABLE);
-                        
-                        _conn->send_message(sopmq::message::MT_PUBLISH_RESPONSE, response,
-                                            std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
+                    logic->set_fail_function([self, message] {
+                        self->store_or_fail(message);
                     });
                     
-                    logic->set_function([=](node::ptr node) {
+                    logic->set_function([self, logic, message](node::ptr node) {
                         
-                        node->operations().send_proxy_publish(message, [=](intra::operation_result<ProxyPublishResponseMessage_ptr> result){
+                        auto sent = std::chrono::steady_clock::now();
+                        node->request_started();
+                        
+                        node->operations().send_proxy_publish(message_for_node(node, message),
+                            intra::call_back_on<ProxyPublishResponseMessage_ptr>(self->_ioService, [=](intra::operation_result<ProxyPublishResponseMessage_ptr> result){
+                            
+                            auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent);
+                            
+                            //only a node that queued the message has its latency taken. one
+                            //that fails fast would otherwise look like the quickest
+                            bool answered = false;
                             
                             try
                             {
@@ -130,16 +271,29 @@ namespace sopmq {
                                 
                                 if (result.message()->status() == ProxyPublishResponseMessage_Status_QUEUED)
                                 {
-                                    logic->node_success(node);
+                                    node->request_finished(latency);
+                                    answered = true;
+                                    
+                                    hedge_policy::instance().record(latency);
+                                    
                                     logic->ctx().clocks.push_back(result.message()->clock());
                                     
-                                    if (logic->operation_succeeded())
+                                    if (logic->node_success(node))
                                     {
                                         //we have the result from all nodes, combine and send the message stamp
-                                        vector_clock3 maxClock = vector_clock3::max(logic->ctx().clocks[0], logic->ctx().clocks[1]);
+                                        vector_clock<RF> maxClock = quorum_clock(logic->ctx().clocks);
+                                        logic->ctx().final_clock = maxClock;
                                         
                                         //tell the quorum the resulting message ID
-                                        this->do_stamp_message(logic->successful_nodes(), message, maxClock);
+                                        self->do_stamp_message(logic->successful_nodes(), message, maxClock);
+                                        self->send_publish_response(message->identity().id(), PublishResponseMessage_Status_QUEUED);
+                                    }
+                                    else if (logic->completed())
+                                    {
+                                        //a hedged node answering after the quorum still queued the
+                                        //message, it gets the same stamp as the rest
+                                        std::vector<node::ptr> late(1, node);
+                                        self->do_stamp_message(late, message, logic->ctx().final_clock);
                                     }
                                 }
                                 else
@@ -149,6 +303,7 @@ namespace sopmq {
                                         << node->node_id() << " failed with status "
                                         << result.message()->status();
                                     
+                                    node->request_failed();
                                     logic->node_failed(node);
                                 }
                             }
@@ -158,7 +313,8 @@ namespace sopmq {
                                     << "send_proxy_publish(): node "
                                     << node->node_id() << " failed with error "
                                     << e.what();
-                                    
+                                
+                                if (! answered) node->request_failed();
                                 logic->node_failed(node);
                             }
                             catch (const std::runtime_error& e)
@@ -167,10 +323,11 @@ namespace sopmq {
                                     << "send_proxy_publish(): node "
                                     << node->node_id() << " failed with error "
                                     << e.what();
-                                    
+                                
+                                if (! answered) node->request_failed();
                                 logic->node_failed(node);
                             }
-                        });
+                        }));
                     });
 
                     
@@ -180,19 +337,740 @@ namespace sopmq {
                 {
                     LOG_SRC(error) << "A quorum could not be reached for PUBLISH to " << message->queue_id();
 
-                    PublishResponseMessage_ptr response 
-                        = messageutil::make_message<PublishResponseMessage>(_conn->get_next_id(), message->identity().id());
-
-                    response->set_status(PublishResponseMessage_Status_UNAVAILABLE);
-
-                    _conn->send_message(sopmq::message::MT_PUBLISH_RESPONSE, response, 
-                        std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
+                    this->store_or_fail(message);
                 }
             }
             
-            void csauthenticated::do_stamp_message(std::vector<node::ptr>& nodes, PublishMessage_ptr message, const vector_clock3 &maxClock)
+            void csauthenticated::store_or_fail(PublishMessage_ptr message)
             {
+                std::uint32_t replyTo = message->identity().id();
+                
+                if (! should_store(*message))
+                {
+                    this->send_publish_response(replyTo, PublishResponseMessage_Status_UNAVAILABLE);
+                    return;
+                }
+                
+                auto self(shared_from_this());
+                storage::cassandra_storage::instance().store_messages({ to_stored(*message) },
+                    [self, replyTo](const storage::store_messages_result& result) {
+                        if (result.error)
+                        {
+                            LOG_SRC(error) << "unable to store message: " << result.error->what();
+                        }
+                        
+                        //back from the cassandra driver's thread
+                        auto status = result.error ? PublishResponseMessage_Status_UNAVAILABLE : PublishResponseMessage_Status_STORED;
+                        self->_ioService.post([self, replyTo, status] {
+                            self->send_publish_response(replyTo, status);
+                        });
+                    });
+            }
+            
+            ///
+            /// The part of a publish batch whose queues are held by the same nodes
+            ///
+            struct csauthenticated::publish_group
+            {
+                std::size_t replication_factor;
+                std::vector<int> indexes;
+                std::vector<PublishMessage_ptr> messages;
+                
+                ///
+                /// Per message, whether it was queued and stamped
+                ///
+                std::vector<bool> queued;
+                bool done;
+            };
+            
+            void csauthenticated::handle_publish_batch_message(const shared::net::network_operation_result& result, PublishBatchMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                //tracks the batch across the replica sets it was split over
+                struct batch_context
+                {
+                    std::vector<PublishResponseMessage_Status> statuses;
+                    size_t groups_left;
+                };
+                
+                auto self(shared_from_this());
+                std::uint32_t replyTo = message->identity().id();
+                
+                auto batch = std::make_shared<batch_context>();
+                batch->statuses.assign(message->messages_size(), PublishResponseMessage_Status_UNAVAILABLE);
+                
+                auto respond = [self, batch, replyTo] {
+                    PublishBatchResponseMessage_ptr response
+                        = messageutil::make_message<PublishBatchResponseMessage>(self->_conn->get_next_id(), replyTo);
+                    
+                    for (auto status : batch->statuses)
+                    {
+                        response->add_statuses(status);
+                    }
+                    
+                    self->_conn->send_message(sopmq::message::MT_PUBLISH_BATCH_RESPONSE, response,
+                                              std::bind(&csauthenticated::handle_write_result, self, _1));
+                };
+                
+                //whatever couldn't be queued and asked to be stored goes to storage in one go
+                auto finish = [self, batch, message, respond] {
+                    std::vector<int> storing;
+                    std::vector<storage::stored_message> stored;
+                    
+                    for (int i = 0; i < message->messages_size(); ++i)
+                    {
+                        if (batch->statuses[i] == PublishResponseMessage_Status_UNAVAILABLE && should_store(message->messages(i)))
+                        {
+                            storing.push_back(i);
+                            stored.push_back(to_stored(message->messages(i)));
+                        }
+                    }
+                    
+                    if (stored.empty())
+                    {
+                        respond();
+                        return;
+                    }
+                    
+                    storage::cassandra_storage::instance().store_messages(stored,
+                        [self, batch, storing, respond](const storage::store_messages_result& result) {
+                            if (result.error)
+                            {
+                                LOG_SRC(error) << "unable to store " << storing.size() << " messages: " << result.error->what();
+                            }
+                            
+                            bool ok = ! result.error;
+                            self->_ioService.post([batch, storing, respond, ok] {
+                                if (ok)
+                                {
+                                    for (int i : storing) batch->statuses[i] = PublishResponseMessage_Status_STORED;
+                                }
+                                
+                                respond();
+                            });
+                        });
+                };
+                
+                //messages going to the same nodes share one proxy message to each of them.
+                //groups are keyed by the replication factor followed by the node ids
+                std::map<std::vector<std::uint32_t>, publish_group> groups;
+                
+                try
+                {
+                    for (int i = 0; i < message->messages_size(); ++i)
+                    {
+                        const std::string& queueId = message->messages(i).queue_id();
+                        const auto& nodes = _ring.find_nodes_for_key(sopmq::shared::util::murmur_hash3(queueId));
+                        
+                        std::size_t replicas = replication::factor_for_queue(queueId);
+                        std::vector<std::uint32_t> key(1, (std::uint32_t)replicas);
+                        for (std::size_t r = 0; r < replicas; ++r)
+                        {
+                            key.push_back(nodes[r]->node_id());
+                        }
+                        
+                        publish_group& g = groups[key];
+                        g.replication_factor = replicas;
+                        g.done = false;
+                        g.indexes.push_back(i);
+                        g.messages.push_back(PublishMessage_ptr(message, message->mutable_messages(i)));
+                        g.queued.push_back(false);
+                    }
+                }
+                catch (const unavailable_error& e)
+                {
+                    LOG_SRC(error) << "No nodes are available for PUBLISH_BATCH";
+                    
+                    finish();
+                    return;
+                }
+                
+                if (groups.empty())
+                {
+                    finish();
+                    return;
+                }
+                
+                batch->groups_left = groups.size();
+                
+                for (auto& entry : groups)
+                {
+                    //shared by the callbacks below, which can outlive this loop
+                    auto g = std::make_shared<publish_group>(std::move(entry.second));
+                    
+                    //called once, whether or not the group made its quorum
+                    auto groupDone = [batch, finish, g] {
+                        if (g->done) return;
+                        g->done = true;
+                        
+                        for (size_t i = 0; i < g->messages.size(); ++i)
+                        {
+                            if (g->queued[i]) batch->statuses[g->indexes[i]] = PublishResponseMessage_Status_QUEUED;
+                        }
+                        
+                        if (--batch->groups_left == 0) finish();
+                    };
+                    
+                    if (g->replication_factor == replication::SINGLE_FACTOR)
+                    {
+                        this->publish_group_to_quorum<replication::SINGLE_FACTOR>(g, groupDone);
+                    }
+                    else
+                    {
+                        this->publish_group_to_quorum<replication::DEFAULT_FACTOR>(g, groupDone);
+                    }
+                }
+            }
+            
+            template <std::size_t RF>
+            void csauthenticated::publish_group_to_quorum(std::shared_ptr<publish_group> g, std::function<void()> done)
+            {
+                class context
+                {
+                public:
+                    //per message, the clocks and nodes of the proxies that queued it
+                    std::vector<std::vector<vector_clock<RF>>> clocks;
+                    std::vector<std::vector<node::ptr>> queued_on;
+                    std::vector<vector_clock<RF>> final_clocks;
+                };
+                
+                auto self(shared_from_this());
+                
+                std::array<node::ptr, RF> nodes;
+                try
+                {
+                    nodes = _ring.find_quorum_for_operation<RF>(sopmq::shared::util::murmur_hash3(g->messages[0]->queue_id()));
+                }
+                catch (const unavailable_error& e)
+                {
+                    LOG_SRC(error) << "A quorum could not be reached for PUBLISH_BATCH to " << g->messages[0]->queue_id()
+                        << " and " << (g->messages.size() - 1) << " other queues";
+                    
+                    done();
+                    return;
+                }
+                
+                typename quorum_logic<RF, context>::ptr logic = std::make_shared<quorum_logic<RF, context> >(nodes);
+                logic->ctx().clocks.resize(g->messages.size());
+                logic->ctx().queued_on.resize(g->messages.size());
+                logic->ctx().final_clocks.resize(g->messages.size());
+                
+                auto& hedging = hedge_policy::instance();
+                if (hedging.enabled()) logic->set_hedge(self->_ioService, hedging.delay());
+                
+                //the statuses stay UNAVAILABLE
+                logic->set_fail_function(done);
+                
+                logic->set_function([=](node::ptr node) {
+                    
+                    std::vector<PublishMessage_ptr> nodeMessages;
+                    nodeMessages.reserve(g->messages.size());
+                    for (auto& m : g->messages)
+                    {
+                        nodeMessages.push_back(message_for_node(node, m));
+                    }
+                    
+                    auto sent = std::chrono::steady_clock::now();
+                    node->request_started();
+                    
+                    node->operations().send_proxy_publish_batch(nodeMessages,
+                        intra::call_back_on<ProxyPublishBatchResponseMessage_ptr>(self->_ioService, [=](intra::operation_result<ProxyPublishBatchResponseMessage_ptr> result){
+                        
+                        auto latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - sent);
+                        
+                        std::vector<size_t> queuedHere;
+                        bool reachedQuorum = false;
+                        try
+                        {
+                            result.rethrow_error();
+                            
+                            auto& responses = result.message()->responses();
+                            if (responses.size() != (int)g->messages.size())
+                            {
+                                throw network_error("Proxy batch response has the wrong number of statuses");
+                            }
+                            
+                            //what the node did queue is kept even if it didn't queue everything.
+                            //an entry is stamped once a quorum of nodes have queued it, and
+                            //the copies here get the stamp along with the rest
+                            for (int i = 0; i < responses.size(); ++i)
+                            {
+                                if (responses.Get(i).status() == ProxyPublishResponseMessage_Status_QUEUED)
+                                {
+                                    logic->ctx().clocks[i].push_back(responses.Get(i).clock());
+                                    logic->ctx().queued_on[i].push_back(node);
+                                    queuedHere.push_back(i);
+                                }
+                            }
+                            
+                            if (queuedHere.size() == g->messages.size())
+                            {
+                                node->request_finished(latency);
+                                hedge_policy::instance().record(latency);
+                                reachedQuorum = logic->node_success(node);
+                            }
+                            else
+                            {
+                                //but it doesn't count toward the quorum, the next node is tried
+                                //for the rest
+                                LOG_SRC(warning)
+                                    << "send_proxy_publish_batch(): node "
+                                    << node->node_id() << " queued only " << queuedHere.size()
+                                    << " of " << g->messages.size() << " messages";
+                                
+                                node->request_failed();
+                                logic->node_failed(node);
+                            }
+                        }
+                        catch (const comparison_error& e)
+                        {
+                            LOG_SRC(warning)
+                                << "send_proxy_publish_batch(): node "
+                                << node->node_id() << " failed with error "
+                                << e.what();
+                            
+                            node->request_failed();
+                            logic->node_failed(node);
+                            return;
+                        }
+                        catch (const std::runtime_error& e)
+                        {
+                            LOG_SRC(warning)
+                                << "send_proxy_publish_batch(): node "
+                                << node->node_id() << " failed with error "
+                                << e.what();
+                            
+                            node->request_failed();
+                            logic->node_failed(node);
+                            return;
+                        }
+                        
+                        if (! reachedQuorum)
+                        {
+                            if (! logic->completed()) return;
+                            
+                            //a hedged node answering after the quorum still queued what it
+                            //says it did, those copies get the same stamps as the rest
+                            std::vector<node::ptr> late(1, node);
+                            for (size_t i : queuedHere)
+                            {
+                                if (g->queued[i]) self->do_stamp_message(late, g->messages[i], logic->ctx().final_clocks[i]);
+                            }
+                            
+                            return;
+                        }
+                        
+                        for (size_t i = 0; i < g->messages.size(); ++i)
+                        {
+                            auto& clocks = logic->ctx().clocks[i];
+                            if (clocks.size() < logic->quorum()) continue;
+                            
+                            try
+                            {
+                                vector_clock<RF> maxClock = quorum_clock(clocks);
+                                self->do_stamp_message(logic->ctx().queued_on[i], g->messages[i], maxClock);
+                                logic->ctx().final_clocks[i] = maxClock;
+                                
+                                g->queued[i] = true;
+                            }
+                            catch (const comparison_error& e)
+                            {
+                                LOG_SRC(warning) << "send_proxy_publish_batch(): unable to stamp message for "
+                                    << g->messages[i]->queue_id() << ": " << e.what();
+                            }
+                        }
+                        
+                        done();
+                    }));
+                });
+                
+                logic->run();
+            }
+            
+            void csauthenticated::handle_proxy_publish_message(const shared::net::network_operation_result& result, ProxyPublishMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                _gossiper.note_heartbeat(message->identity());
+                
+                auto self(shared_from_this());
+                std::uint32_t replyTo = message->identity().id();
+                
+                //share the client message with the proxy message rather than copying it out
+                PublishMessage_ptr clientMessage(message, message->mutable_client_message());
+                
+                node::get_self()->operations().send_proxy_publish(clientMessage,
+                    intra::call_back_on<ProxyPublishResponseMessage_ptr>(_ioService,
+                    [self, replyTo](intra::operation_result<ProxyPublishResponseMessage_ptr>& result) {
+                        
+                        ProxyPublishResponseMessage_ptr response;
+                        try
+                        {
+                            result.rethrow_error();
+                            response = result.message();
+                        }
+                        catch (const std::runtime_error& e)
+                        {
+                            LOG_SRC(warning) << "handle_proxy_publish_message(): failed with error " << e.what();
+                            
+                            response = messageutil::make_message<ProxyPublishResponseMessage>(0, 0);
+                            response->set_status(ProxyPublishResponseMessage_Status_NOTHERE);
+                            response->mutable_clock();
+                        }
+                        
+                        response->mutable_identity()->set_id(self->_conn->get_next_id());
+                        response->mutable_identity()->set_in_reply_to(replyTo);
+                        
+                        self->_conn->send_message(sopmq::message::MT_PROXY_PUBLISH_RESPONSE, response,
+                                                  std::bind(&csauthenticated::handle_write_result, self, _1));
+                    }));
+            }
+            
+            void csauthenticated::handle_proxy_publish_batch_message(const shared::net::network_operation_result& result, ProxyPublishBatchMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                _gossiper.note_heartbeat(message->identity());
+                
+                auto self(shared_from_this());
+                std::uint32_t replyTo = message->identity().id();
+                
+                std::vector<PublishMessage_ptr> clientMessages;
+                clientMessages.reserve(message->client_messages_size());
+                for (int i = 0; i < message->client_messages_size(); ++i)
+                {
+                    clientMessages.push_back(PublishMessage_ptr(message, message->mutable_client_messages(i)));
+                }
+                
+                node::get_self()->operations().send_proxy_publish_batch(clientMessages,
+                    intra::call_back_on<ProxyPublishBatchResponseMessage_ptr>(_ioService,
+                    [self, replyTo, message](intra::operation_result<ProxyPublishBatchResponseMessage_ptr>& result) {
+                        
+                        ProxyPublishBatchResponseMessage_ptr response;
+                        try
+                        {
+                            result.rethrow_error();
+                            response = result.message();
+                        }
+                        catch (const std::runtime_error& e)
+                        {
+                            LOG_SRC(warning) << "handle_proxy_publish_batch_message(): failed with error " << e.what();
+                            
+                            response = messageutil::make_message<ProxyPublishBatchResponseMessage>(0, 0);
+                            for (int i = 0; i < message->client_messages_size(); ++i)
+                            {
+                                ProxyPublishResponseMessage* entry = response->add_responses();
+                                entry->set_allocated_identity(messageutil::build_id(0, message->client_messages(i).identity().id()));
+                                entry->set_status(ProxyPublishResponseMessage_Status_NOTHERE);
+                                entry->mutable_clock();
+                            }
+                        }
+                        
+                        response->mutable_identity()->set_id(self->_conn->get_next_id());
+                        response->mutable_identity()->set_in_reply_to(replyTo);
+                        
+                        self->_conn->send_message(sopmq::message::MT_PROXY_PUBLISH_BATCH_RESPONSE, response,
+                                                  std::bind(&csauthenticated::handle_write_result, self, _1));
+                    }));
+            }
+            
+            void csauthenticated::handle_stamp_message(const shared::net::network_operation_result& result, StampMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                _gossiper.note_heartbeat(message->identity());
+                
+                auto& operations = node::get_self()->operations();
+                
+                for (int i = 0; i < message->stamps_size(); ++i)
+                {
+                    try
+                    {
+                        operations.send_stamp(message->stamps(i));
+                    }
+                    catch (const std::runtime_error& e)
+                    {
+                        //one bad stamp shouldn't cost the rest of the batch
+                        LOG_SRC(warning) << "handle_stamp_message(): failed with error " << e.what();
+                    }
+                }
+            }
+            
+            void csauthenticated::handle_gossip_message(const shared::net::network_operation_result& result, GossipMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                GossipMessage_ptr reply = _gossiper.handle_gossip(*message);
+                if (! reply) return;
+                
+                reply->mutable_identity()->set_id(_conn->get_next_id());
+                reply->mutable_identity()->set_in_reply_to(message->identity().id());
+                
+                _conn->send_message(sopmq::message::MT_GOSSIP, reply,
+                                    std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
+            }
+            
+            void csauthenticated::handle_consume_message(const shared::net::network_operation_result& result, ConsumeFromQueueMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                std::uint32_t subscriptionId = message->identity().id();
+                uint128 queueId = sopmq::shared::util::murmur_hash3(message->queue_id());
+                
+                //a client consuming the same queue again is done with the old subscription,
+                //even when this one is refused
+                for (auto& entry : _subscriptions)
+                {
+                    if (entry.second->queue_id() == queueId)
+                    {
+                        this->end_subscription(entry.first);
+                        break;
+                    }
+                }
+                
+                //the messages are only here if we're one of the queue's replicas.
+                //finding one is up to the client
+                bool isReplica = false;
+                try
+                {
+                    const auto& nodes = _ring.find_nodes_for_key(queueId);
+                    size_t replicas = replication::factor_for_queue(message->queue_id());
+                    isReplica = std::any_of(nodes.begin(), nodes.begin() + replicas, [](const node::ptr& n) { return n->is_self(); });
+                }
+                catch (const unavailable_error& e)
+                {
+                    //an empty ring doesn't have us in it either
+                }
+                
+                if (! isReplica)
+                {
+                    LOG_SRC(warning) << "CONSUME from " << message->queue_id() << " sent to a node that doesn't hold it";
+                    
+                    this->send_consume_response(subscriptionId, ConsumeResponseMessage_Status_UNAVAILABLE);
+                    return;
+                }
+                
+                //holding the connection state here would keep it alive through the
+                //subscription it owns. the subscription runs on the thread that owns
+                //the queue, the frames are sent from ours
+                std::weak_ptr<csauthenticated> wself(shared_from_this());
+                auto& connService = _ioService;
+                auto send = [wself, &connService, subscriptionId](DeliveryMessage_ptr frame) {
+                    connService.dispatch([wself, frame, subscriptionId] {
+                        if (auto self = wself.lock())
+                        {
+                            frame->mutable_identity()->set_id(self->_conn->get_next_id());
+                            self->_conn->send_message(sopmq::message::MT_DELIVERY, frame,
+                                [self, subscriptionId](const shared::net::network_operation_result& result) {
+                                    //the consumer can't be reached, so stop taking messages for it
+                                    if (! result.was_successful()) self->end_subscription(subscriptionId);
+                                    
+                                    self->handle_write_result(result);
+                                });
+                        }
+                    });
+                };
+                
+                //the stored messages are the ones still in memory here, plus whatever went
+                //to persistent storage because it couldn't be queued
+                bool claimBacklog = message->download_type() == ConsumeFromQueueMessage_DownloadType_CLAIMSTORED;
+                bool claimNew = message->intercept_type() == ConsumeFromQueueMessage_InterceptType_CLAIM;
+                auto position = message->download_type() == ConsumeFromQueueMessage_DownloadType_NONE
+                    ? queue_subscription::SP_NEW : queue_subscription::SP_OLDEST;
+                
+                auto& queueService = _io_services.for_key(queueId);
+                auto subscription = std::make_shared<queue_subscription>(queueService, _queue_manager, queueId, subscriptionId,
+                                                                         claimBacklog, claimNew, send);
+                _subscriptions[subscriptionId] = subscription;
+                
+                //the client hears it was accepted before the first delivery
+                this->send_consume_response(subscriptionId, ConsumeResponseMessage_Status_OK);
+                
+                std::uint32_t creditMessages = message->credit_messages();
+                std::uint32_t creditBytes = message->credit_bytes();
+                queueService.dispatch([subscription, position, creditMessages, creditBytes] {
+                    subscription->start(position, creditMessages, creditBytes);
+                });
+                
+                if (position == queue_subscription::SP_OLDEST && storage::cassandra_storage::instance().is_connected())
+                {
+                    std::weak_ptr<queue_subscription> wsubscription(subscription);
+                    auto& ioService = queueService;
+                    std::string queueName = message->queue_id();
+                    
+                    storage::cassandra_storage::instance().claim_stored_messages(queueName, claimBacklog,
+                        [wsubscription, &ioService, queueName](storage::claim_stored_result& result) {
+                            if (result.error)
+                            {
+                                LOG_SRC(error) << "unable to read stored messages for " << queueName << ": " << result.error->what();
+                                return;
+                            }
+                            
+                            //what was read may already be partly deleted, so it goes out anyway
+                            if (result.cleanup_error)
+                            {
+                                LOG_SRC(warning) << "unable to remove claimed messages for " << queueName << ": "
+                                    << result.cleanup_error->what();
+                            }
+                            
+                            if (result.messages.empty()) return;
+                            
+                            //back from the cassandra driver's thread
+                            auto messages = std::make_shared<std::vector<storage::stored_message>>(std::move(result.messages));
+                            ioService.post([wsubscription, messages] {
+                                if (auto subscription = wsubscription.lock()) subscription->add_stored(std::move(*messages));
+                            });
+                        });
+                }
+            }
+            
+            void csauthenticated::handle_consume_credit_message(const shared::net::network_operation_result& result, ConsumeCreditMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                auto iter = _subscriptions.find(message->subscription_id());
+                if (iter == _subscriptions.end())
+                {
+                    LOG_SRC(debug) << "credit for unknown subscription " << message->subscription_id();
+                    return;
+                }
+                
+                if (message->cancel())
+                {
+                    this->end_subscription(message->subscription_id());
+                    return;
+                }
+                
+                auto subscription = iter->second;
+                std::uint32_t messages = message->messages();
+                std::uint32_t bytes = message->bytes();
+                
+                _io_services.for_key(subscription->queue_id()).dispatch([subscription, messages, bytes] {
+                    subscription->add_credit(messages, bytes);
+                });
+            }
+            
+            void csauthenticated::handle_claim_message(const shared::net::network_operation_result& result, ClaimMessage_ptr message)
+            {
+                if (! result.was_successful()) return;
+                
+                //another node already sent the claim to every replica, ours is the only
+                //copy left to remove
+                if (_authType == GetChallengeMessage_Type_SERVER)
+                {
+                    _gossiper.note_heartbeat(message->identity());
+                    
+                    node::get_self()->operations().send_claim(message->claim());
+                    return;
+                }
+                
+                ring::replica_list nodes;
+                try
+                {
+                    nodes = _ring.find_nodes_for_key(sopmq::shared::util::murmur_hash3(message->claim().queue_id()));
+                }
+                catch (const unavailable_error& e)
+                {
+                    LOG_SRC(error) << "No nodes are available for CLAIM on " << message->claim().queue_id();
+                    
+                    this->send_claim_response(message->identity().id(), ClaimResponseMessage_Status_UNAVAILABLE);
+                    return;
+                }
+                
+                size_t replicas = replication::factor_for_queue(message->claim().queue_id());
+                for (size_t i = 0; i < replicas; ++i)
+                {
+                    //small rings hand back the same node more than once
+                    if (std::find(nodes.begin(), nodes.begin() + i, nodes[i]) != nodes.begin() + i) continue;
+                    
+                    try
+                    {
+                        nodes[i]->operations().send_claim(message->claim());
+                    }
+                    catch (const std::runtime_error& e)
+                    {
+                        //the node's copies stay until their TTL runs out
+                        LOG_SRC(warning)
+                            << "handle_claim_message(): node "
+                            << nodes[i]->node_id() << " failed with error "
+                            << e.what();
+                    }
+                }
+                
+                this->send_claim_response(message->identity().id(), ClaimResponseMessage_Status_OK);
+            }
+            
+            template <std::size_t RF>
+            void csauthenticated::do_stamp_message(std::vector<node::ptr>& nodes, PublishMessage_ptr message, const vector_clock<RF>& maxClock)
+            {
+                QueueStamp stamp;
+                stamp.set_queue_id(message->queue_id());
+                stamp.set_message_id(message->message_id());
+                maxClock.to_protobuf(stamp.mutable_clock());
+                
+                for (auto& node : nodes)
+                {
+                    try
+                    {
+                        node->operations().send_stamp(stamp);
+                    }
+                    catch (const std::runtime_error& e)
+                    {
+                        //the message is queued on the node either way, it just won't
+                        //be ordered there until its TTL runs out
+                        LOG_SRC(warning)
+                            << "do_stamp_message(): node "
+                            << node->node_id() << " failed with error "
+                            << e.what();
+                    }
+                }
+            }
+            
+            void csauthenticated::send_publish_response(std::uint32_t replyTo, PublishResponseMessage_Status status)
+            {
+                PublishResponseMessage_ptr response
+                    = messageutil::make_message<PublishResponseMessage>(_conn->get_next_id(), replyTo);
+                
+                response->set_status(status);
+                
+                _conn->send_message(sopmq::message::MT_PUBLISH_RESPONSE, response,
+                                    std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
+            }
+            
+            void csauthenticated::send_consume_response(std::uint32_t replyTo, ConsumeResponseMessage_Status status)
+            {
+                ConsumeResponseMessage_ptr response
+                    = messageutil::make_message<ConsumeResponseMessage>(_conn->get_next_id(), replyTo);
+                
+                response->set_status(status);
+                
+                _conn->send_message(sopmq::message::MT_CONSUME_RESPONSE, response,
+                                    std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
+            }
+            
+            void csauthenticated::end_subscription(std::uint32_t subscriptionId)
+            {
+                auto iter = _subscriptions.find(subscriptionId);
+                if (iter == _subscriptions.end()) return;
+                
+                auto subscription = iter->second;
+                _subscriptions.erase(iter);
+                
+                _io_services.for_key(subscription->queue_id()).dispatch([subscription] {
+                    subscription->stop();
+                });
+            }
+            
+            void csauthenticated::send_claim_response(std::uint32_t replyTo, ClaimResponseMessage_Status status)
+            {
+                ClaimResponseMessage_ptr response
+                    = messageutil::make_message<ClaimResponseMessage>(_conn->get_next_id(), replyTo);
+                
+                response->set_status(status);
                 
+                _conn->send_message(sopmq::message::MT_CLAIM_RESPONSE, response,
+                                    std::bind(&csauthenticated::handle_write_result, shared_from_this(), _1));
             }
             
             std::string csauthenticated::get_description() const
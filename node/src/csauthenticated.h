@@ -26,10 +26,25 @@
 #include "message_ptrs.h"
 #include "ring.h"
 #include "vector_clock.h"
+#include "queue_manager.h"
+#include "io_service_pool.h"
+#include "queue_subscription.h"
+#include "gossiper.h"
+
+#include "GetChallengeMessage.pb.h"
+#include "PublishResponseMessage.pb.h"
+#include "ConsumeResponseMessage.pb.h"
+#include "ClaimResponseMessage.pb.h"
 
 #include <boost/noncopyable.hpp>
 #include <boost/asio.hpp>
 
+#include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstddef>
+
 namespace sopmq {
     namespace node {
         namespace connection {
@@ -43,7 +58,8 @@ namespace sopmq {
             {
             public:
                 csauthenticated(boost::asio::io_service& ioService, connection_in::ptr conn,
-                    const ring& ring);
+                    const ring& ring, queue_manager3& queueManager, io_service_pool& ioServices,
+                    gossiper& gossiper, GetChallengeMessage_Type authType);
                 virtual ~csauthenticated();
                 
                 //iconnection_state
@@ -55,8 +71,20 @@ namespace sopmq {
                 boost::asio::io_service& _ioService;
                 connection_in::ptr _conn;
                 const ring& _ring;
+                queue_manager3& _queue_manager;
+                io_service_pool& _io_services;
+                gossiper& _gossiper;
+                GetChallengeMessage_Type _authType;
                 sopmq::message::message_dispatcher _dispatcher;
                 
+                ///
+                /// Queues this connection is consuming from, by the id of the message
+                /// that asked for them. One per queue, a subscription leaves when the
+                /// client cancels it, consumes the same queue again, or a delivery to
+                /// it can't be written
+                ///
+                std::map<std::uint32_t, queue_subscription::ptr> _subscriptions;
+                
                 
                 void unhandled_message(Message_ptr message);
                 
@@ -68,10 +96,96 @@ namespace sopmq {
                 ///
                 void handle_post_message(const shared::net::network_operation_result& result, PublishMessage_ptr message);
                 
+                ///
+                /// Called when the client is posting a set of messages to the ring at once
+                ///
+                void handle_publish_batch_message(const shared::net::network_operation_result& result, PublishBatchMessage_ptr message);
+                
+                ///
+                /// Called when another node is asking us to store its client's message
+                ///
+                void handle_proxy_publish_message(const shared::net::network_operation_result& result, ProxyPublishMessage_ptr message);
+                
+                ///
+                /// Called when another node is asking us to store a set of its clients' messages
+                ///
+                void handle_proxy_publish_batch_message(const shared::net::network_operation_result& result, ProxyPublishBatchMessage_ptr message);
+                
+                ///
+                /// Called when another node is giving us the final clocks for messages it queued with us
+                ///
+                void handle_stamp_message(const shared::net::network_operation_result& result, StampMessage_ptr message);
+                
+                ///
+                /// Called when another node is gossiping with us
+                ///
+                void handle_gossip_message(const shared::net::network_operation_result& result, GossipMessage_ptr message);
+                
+                ///
+                /// Called when the client wants the messages on a queue pushed to it
+                ///
+                void handle_consume_message(const shared::net::network_operation_result& result, ConsumeFromQueueMessage_ptr message);
+                
+                ///
+                /// Called when the client is ready for more of a queue it is consuming
+                ///
+                void handle_consume_credit_message(const shared::net::network_operation_result& result, ConsumeCreditMessage_ptr message);
+                
+                ///
+                /// Called when the client is done with messages, or when another node is
+                /// passing on a client's claim
+                ///
+                void handle_claim_message(const shared::net::network_operation_result& result, ClaimMessage_ptr message);
+                
+                ///
+                /// The part of a publish batch whose queues are held by the same nodes
+                ///
+                struct publish_group;
+                
+                ///
+                /// Sends the message to a quorum of the RF nodes holding its queue
+                ///
+                template <std::size_t RF>
+                void publish(PublishMessage_ptr message);
+                
+                ///
+                /// Sends part of a publish batch to a quorum of the RF nodes holding its
+                /// queues. Calls done once, when the group has been queued or has failed
+                ///
+                template <std::size_t RF>
+                void publish_group_to_quorum(std::shared_ptr<publish_group> group, std::function<void()> done);
+                
                 ///
                 /// Sends a stamp message to the quorum of nodes that we recently published a message to
                 ///
-                void do_stamp_message(std::vector<node::ptr>& nodes, PublishMessage_ptr message, const vector_clock3& maxClock);
+                template <std::size_t RF>
+                void do_stamp_message(std::vector<node::ptr>& nodes, PublishMessage_ptr message, const vector_clock<RF>& maxClock);
+                
+                ///
+                /// Tells the client how its publish went
+                ///
+                void send_publish_response(std::uint32_t replyTo, PublishResponseMessage_Status status);
+                
+                ///
+                /// Writes a message that couldn't be queued to persistent storage when the
+                /// publisher asked for that, otherwise answers that it was unavailable
+                ///
+                void store_or_fail(PublishMessage_ptr message);
+                
+                ///
+                /// Tells the client whether its consume request was accepted
+                ///
+                void send_consume_response(std::uint32_t replyTo, ConsumeResponseMessage_Status status);
+                
+                ///
+                /// Forgets the subscription and stops it on the thread that owns its queue
+                ///
+                void end_subscription(std::uint32_t subscriptionId);
+                
+                ///
+                /// Tells the client whether its claim went out
+                ///
+                void send_claim_response(std::uint32_t replyTo, ClaimResponseMessage_Status status);
             };
             
         }
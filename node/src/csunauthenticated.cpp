@@ -23,6 +23,7 @@
 #include "util.h"
 #include "user_account.h"
 #include "csauthenticated.h"
+#include "crypto_pool.h"
 
 #include "ChallengeResponseMessage.pb.h"
 #include "AnswerChallengeMessage.pb.h"
@@ -47,11 +48,13 @@ namespace sopmq {
             const int csunauthenticated::CHALLENGE_SIZE = 1024;
             
             csunauthenticated::csunauthenticated(ba::io_service& ioService, connection_in::ptr conn,
-                const ring& ring)
-            : _ioService(ioService), _conn(conn), _ring(ring),
+                const ring& ring, queue_manager3& queueManager, io_service_pool& ioServices, gossiper& gossiper)
+            : _ioService(ioService), _conn(conn), _ring(ring), _queue_manager(queueManager), _io_services(ioServices),
+            _gossiper(gossiper),
             _dispatcher(std::bind(&csunauthenticated::unhandled_message, this, _1)),
             _closeAfterTransmission(false)
             {
+                _dispatcher.set_reply_timeout(ioService, boost::chrono::seconds(settings::instance().defaultTimeout));
             }
             
             csunauthenticated::~csunauthenticated()
@@ -102,7 +105,8 @@ namespace sopmq {
                 response->set_authorized(true);
                 _conn->send_message(message::MT_AUTH_ACK, response, std::bind(&csunauthenticated::handle_write_result,
                                                                               shared_from_this(), _1));
-                csauthenticated::ptr authstate = std::make_shared<csauthenticated>(_ioService, _conn, _ring);
+                csauthenticated::ptr authstate = std::make_shared<csauthenticated>(_ioService, _conn, _ring, _queue_manager,
+                                                                                   _io_services, _gossiper, _authType);
                 _conn->change_state(authstate);
             }
 
@@ -115,16 +119,25 @@ namespace sopmq {
                                                                               shared_from_this(), _1));
             }
             
-            void csunauthenticated::handle_answer_challenge_message(const shared::net::network_operation_result&, AnswerChallengeMessage_ptr message)
+            void csunauthenticated::handle_answer_challenge_message(const shared::net::network_operation_result& result, AnswerChallengeMessage_ptr message)
             {
-                if (!message) return; //error
+                if (!message)
+                {
+                    //don't hold on to connections that never answer the challenge
+                    if (result.get_error_type() == shared::net::ET_TIMEOUT)
+                    {
+                        _conn->handle_error(result.get_error());
+                    }
+                    
+                    return;
+                }
                 
                 LOG_SRC(debug) << "handle_answer_challenge_message()";
                 auto self(shared_from_this());
 
                 std::function<void(bool)> authCallback = [=](bool authd) {
-                    //remember this is coming back from the libuv stuff inside the cassandra
-                    //driver, so we need to get back into our IO thread
+                    //remember this is coming back from the crypto pool or the libuv stuff
+                    //inside the cassandra driver, so we need to get back into our IO thread
                     
                     if (authd)
                     {
@@ -159,14 +172,16 @@ namespace sopmq {
                 }
                 else
                 {
-                    if (message->challenge_response() == util::sha256_hex_string(settings::instance().ring_key_hash() + _challenge))
-                    {
-                        self->successful_auth(message);
-                    }
-                    else
-                    {
-                        self->failed_auth(message);
-                    }
+                    std::string expected(settings::instance().ring_key_hash() + _challenge);
+                    
+                    crypto_pool::instance().check(_ioService,
+                        [message, expected] {
+                            return message->challenge_response() == util::sha256_hex_string(expected);
+                        },
+                        [self, message](bool authd) {
+                            if (authd) self->successful_auth(message);
+                            else self->failed_auth(message);
+                        });
                 }
             }
             
@@ -24,6 +24,9 @@
 #include "message_ptrs.h"
 #include "network_operation_result.h"
 #include "ring.h"
+#include "queue_manager.h"
+#include "io_service_pool.h"
+#include "gossiper.h"
 
 #include "GetChallengeMessage.pb.h"
 
@@ -50,7 +53,8 @@ namespace sopmq {
 
             public:
                 csunauthenticated(boost::asio::io_service& ioService, connection_in::ptr conn,
-                    const ring& ring);
+                    const ring& ring, queue_manager3& queueManager, io_service_pool& ioServices,
+                    gossiper& gossiper);
                 virtual ~csunauthenticated();
                 
 
@@ -70,6 +74,9 @@ namespace sopmq {
                 connection_in::ptr _conn;
                 sopmq::message::message_dispatcher _dispatcher;
                 const ring& _ring;
+                queue_manager3& _queue_manager;
+                io_service_pool& _io_services;
+                gossiper& _gossiper;
                 GetChallengeMessage_Type _authType;
                 
                 std::string _challenge;
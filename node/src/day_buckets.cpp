@@ -0,0 +1,79 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "day_buckets.h"
+
+#include "util.h"
+
+#include <algorithm>
+
+using sopmq::shared::util;
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            const std::int64_t day_buckets::MAX_LOOKBACK_DAYS;
+            const std::int64_t day_buckets::SECONDS_PER_DAY;
+            const std::int64_t day_buckets::NEVER_CLAIMED;
+            
+            std::int64_t day_buckets::day_of(std::time_t time)
+            {
+                return (std::int64_t)time / SECONDS_PER_DAY;
+            }
+            
+            std::vector<std::int64_t> day_buckets::claim_window(std::int64_t lastClaimedDay, std::int64_t today)
+            {
+                //a clock that went backwards still reads today
+                std::int64_t first = std::min(std::max(lastClaimedDay, today - MAX_LOOKBACK_DAYS), today);
+                
+                std::vector<std::int64_t> days;
+                days.reserve(today - first + 1);
+                
+                for (std::int64_t day = first; day <= today; ++day)
+                {
+                    days.push_back(day);
+                }
+                
+                return days;
+            }
+            
+            std::string day_buckets::queue_key(const std::string& queueId)
+            {
+                return to_bytes(util::murmur_hash3(queueId));
+            }
+            
+            std::string day_buckets::bucket_key(const std::string& queueId, std::int64_t day)
+            {
+                return to_bytes(util::murmur_hash3(queueId + "/" + std::to_string(day)));
+            }
+            
+            std::string day_buckets::to_bytes(const uint128& hash)
+            {
+                std::string bytes(16, '\0');
+                for (int i = 0; i < 8; ++i)
+                {
+                    bytes[i] = (char)(hash.hi >> (56 - i * 8));
+                    bytes[i + 8] = (char)(hash.lo >> (56 - i * 8));
+                }
+                
+                return bytes;
+            }
+            
+        }
+    }
+}
@@ -0,0 +1,92 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__day_buckets__
+#define __sopmq__day_buckets__
+
+#include "uint128.h"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            ///
+            /// \brief Maps stored messages onto the per day partitions from
+            /// docs/Cassandra Storage.txt
+            ///
+            /// A message stored for queue Y on day D lands in the partition keyed by
+            /// Murmur3("Y/D"), so a claim only has to read the days since the queue
+            /// was last claimed instead of scanning everything the queue ever stored.
+            ///
+            class day_buckets
+            {
+            public:
+                ///
+                /// The furthest back a claim looks for stored messages. Messages in
+                /// older buckets are left to expire
+                ///
+                static const std::int64_t MAX_LOOKBACK_DAYS = 30;
+                
+                static const std::int64_t SECONDS_PER_DAY = 24 * 60 * 60;
+                
+                ///
+                /// Returned by the queue lookup when the queue has never been claimed
+                ///
+                static const std::int64_t NEVER_CLAIMED = -1;
+                
+            public:
+                ///
+                /// \brief The day (in UTC days since the epoch) that the given time falls on
+                ///
+                static std::int64_t day_of(std::time_t time);
+                
+                ///
+                /// \brief The days a claim made today has to read, oldest first
+                ///
+                /// Starts at the day the queue was last claimed, or the start of the
+                /// lookback window if that is further back or the queue was never claimed
+                ///
+                static std::vector<std::int64_t> claim_window(std::int64_t lastClaimedDay, std::int64_t today);
+                
+                ///
+                /// \brief The partition key of the queue's bookkeeping row, Murmur3("Y")
+                ///
+                static std::string queue_key(const std::string& queueId);
+                
+                ///
+                /// \brief The partition key of the messages stored for the queue on the
+                /// given day, Murmur3("Y/D")
+                ///
+                static std::string bucket_key(const std::string& queueId, std::int64_t day);
+                
+            private:
+                ///
+                /// The hash as 16 big endian bytes
+                ///
+                static std::string to_bytes(const uint128& hash);
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__day_buckets__) */
@@ -0,0 +1,162 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__expiry_scheduler__
+#define __sopmq__expiry_scheduler__
+
+#include "queue_manager.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/chrono.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+
+namespace sopmq {
+    namespace node {
+
+        ///
+        /// Runs a single timer that wakes up when the earliest message in the
+        /// queue_manager is due to expire
+        /// \tparam RF Replication factor
+        ///
+        template <size_t RF>
+        class expiry_scheduler : public boost::noncopyable
+        {
+        public:
+            typedef typename queue_manager<RF>::time_point time_point;
+
+        public:
+            expiry_scheduler(boost::asio::io_service& ioService, queue_manager<RF>& queueManager)
+            : _strand(ioService), _timer(ioService), _queue_manager(queueManager),
+            _armed_for(time_point::max().time_since_epoch().count()), _stopping(false)
+            {
+
+            }
+
+            virtual ~expiry_scheduler()
+            {
+                _queue_manager.set_expiry_callback(typename queue_manager<RF>::expiry_callback());
+            }
+
+            ///
+            /// \brief Starts listening for deadline changes and arms the timer
+            ///
+            void start()
+            {
+                _stopping = false;
+
+                _queue_manager.set_expiry_callback(std::bind(&expiry_scheduler::deadline_moved, this,
+                                                             std::placeholders::_1));
+
+                _strand.post(std::bind(&expiry_scheduler::schedule, this, _queue_manager.next_deadline()));
+            }
+
+            ///
+            /// \brief Stops the scheduler. Any pending wait is cancelled
+            ///
+            void stop()
+            {
+                _stopping = true;
+
+                _queue_manager.set_expiry_callback(typename queue_manager<RF>::expiry_callback());
+                _strand.post(std::bind(&expiry_scheduler::do_stop, this));
+            }
+
+        private:
+            ///
+            /// Serializes all access to the timer
+            ///
+            boost::asio::io_service::strand _strand;
+
+            boost::asio::steady_timer _timer;
+            queue_manager<RF>& _queue_manager;
+
+            ///
+            /// The deadline the timer is currently waiting for, as a count since
+            /// the steady clock epoch so it can be read from any thread
+            ///
+            std::atomic<typename time_point::rep> _armed_for;
+
+            std::atomic<bool> _stopping;
+
+            ///
+            /// Called from any thread when a queue picks up an earlier deadline
+            ///
+            void deadline_moved(time_point deadline)
+            {
+                if (deadline.time_since_epoch().count() < _armed_for.load())
+                {
+                    _strand.post(std::bind(&expiry_scheduler::schedule_if_earlier, this, deadline));
+                }
+            }
+
+            void schedule_if_earlier(time_point deadline)
+            {
+                if (deadline.time_since_epoch().count() < _armed_for.load())
+                {
+                    this->schedule(deadline);
+                }
+            }
+
+            ///
+            /// Arms the timer for the given deadline, replacing any pending wait
+            ///
+            void schedule(time_point deadline)
+            {
+                if (_stopping) return;
+
+                _armed_for = deadline.time_since_epoch().count();
+
+                if (deadline == time_point::max())
+                {
+                    //nothing to expire. we'll be told when something is
+                    _timer.cancel();
+                    return;
+                }
+
+                auto wait = boost::chrono::duration_cast<boost::chrono::nanoseconds>(deadline - boost::chrono::steady_clock::now());
+
+                _timer.expires_from_now(std::chrono::nanoseconds(wait.count() > 0 ? wait.count() : 0));
+                _timer.async_wait(_strand.wrap(std::bind(&expiry_scheduler::on_timer, this, std::placeholders::_1)));
+            }
+
+            void on_timer(const boost::system::error_code& error)
+            {
+                if (error == boost::asio::error::operation_aborted || _stopping) return;
+
+                this->schedule(_queue_manager.expire_due(boost::chrono::steady_clock::now()));
+            }
+
+            void do_stop()
+            {
+                _armed_for = time_point::max().time_since_epoch().count();
+                _timer.cancel();
+            }
+        };
+
+        ///
+        /// Expiry scheduler def for RF = 3
+        ///
+        typedef expiry_scheduler<3> expiry_scheduler3;
+    }
+}
+
+#endif /* defined(__sopmq__expiry_scheduler__) */
@@ -17,9 +17,6 @@
 
 #include "failure_detector.h"
 
-
-#include <numeric>
-
 namespace bc = boost::chrono;
 
 namespace sopmq {
@@ -27,8 +24,9 @@ namespace sopmq {
 
         failure_detector::failure_detector(int failureThreshold, bc::milliseconds initialValue)
             : _failure_threshold(failureThreshold), 
-            _last_heartbeat(bc::steady_clock::now()),
-            _intervals(SAMPLE_SIZE, SAMPLE_SIZE, initialValue.count())
+            _last_heartbeat(bc::steady_clock::now().time_since_epoch().count()),
+            _intervals(SAMPLE_SIZE, SAMPLE_SIZE, initialValue.count()),
+            _interval_total(initialValue.count() * SAMPLE_SIZE)
         {
 
         }
@@ -42,8 +40,10 @@ namespace sopmq {
             auto now = bc::steady_clock::now();
 
             bc::milliseconds interval = this->current_interval(now);
-            _last_heartbeat = now;
+            _last_heartbeat = now.time_since_epoch().count();
 
+            //the buffer is always full, so this pushes the oldest interval out
+            _interval_total += interval.count() - _intervals.front();
             _intervals.push_back(interval.count());
         }
 
@@ -64,6 +64,11 @@ namespace sopmq {
             }
         }
 
+        bc::steady_clock::time_point failure_detector::last_heartbeat() const
+        {
+            return bc::steady_clock::time_point(bc::steady_clock::duration(_last_heartbeat.load()));
+        }
+
         float failure_detector::current_phi(bc::steady_clock::time_point compareTo) const
         {
             //based on the simplification in apache cassandra
@@ -78,12 +83,12 @@ namespace sopmq {
 
         float failure_detector::current_interval_average() const
         {
-            return std::accumulate(_intervals.begin(), _intervals.end(), 0) / (float) SAMPLE_SIZE;
+            return _interval_total / (float) SAMPLE_SIZE;
         }
 
         bc::milliseconds failure_detector::current_interval(bc::steady_clock::time_point compareTo) const
         {
-            return bc::duration_cast<bc::milliseconds>(compareTo - _last_heartbeat);
+            return bc::duration_cast<bc::milliseconds>(compareTo - this->last_heartbeat());
         }
     }
 }
\ No newline at end of file
@@ -21,6 +21,8 @@
 #include <boost/chrono/system_clocks.hpp>
 #include <boost/circular_buffer.hpp>
 
+#include <atomic>
+
 namespace sopmq {
     namespace node {
 
@@ -33,6 +35,9 @@ namespace sopmq {
         /// However like the apache cassandra implementation, this one uses an exponential distribution.
         /// There is a bit of information on this class in the docs directory
         ///
+        /// Heartbeats must come from one thread at a time, but the state can be
+        /// interpreted from any thread while they do
+        ///
         class failure_detector
         {
         public:
@@ -87,14 +92,19 @@ namespace sopmq {
             int _failure_threshold;
 
             ///
-            /// The last time heartbeat() was called
+            /// The last time heartbeat() was called, as steady_clock ticks
             ///
-            boost::chrono::steady_clock::time_point _last_heartbeat;
+            std::atomic<boost::chrono::steady_clock::rep> _last_heartbeat;
 
             ///
             /// The history of heartbeat intervals we have received from the node
             ///
             boost::circular_buffer<boost::chrono::milliseconds::rep> _intervals;
+            
+            ///
+            /// The sum of _intervals, kept as they come and go
+            ///
+            std::atomic<boost::chrono::milliseconds::rep> _interval_total;
 
 
             ///
@@ -17,20 +17,337 @@
 
 #include "gossiper.h"
 
+#include "messageutil.h"
+#include "operation_result.h"
+#include "logging.h"
+
+#include "GossipMessage.pb.h"
+#include "GossipNodeData.pb.h"
+#include "NodeClock.pb.h"
+#include "Identifier.pb.h"
+
+#include <unordered_set>
+#include <vector>
+#include <algorithm>
+
+using sopmq::message::messageutil;
+
+namespace ba = boost::asio;
+
 namespace sopmq {
     namespace node {
-        
+
+        namespace
+        {
+            node_clock from_protobuf(const NodeClock& clock)
+            {
+                node_clock result;
+                result.node_id = clock.node_id();
+                result.generation = clock.generation();
+                result.clock = clock.clock();
+
+                return result;
+            }
+
+            void send_over_network(const node::ptr& peer, GossipMessage_ptr message,
+                                   std::function<void(GossipMessage_ptr)> replied)
+            {
+                try
+                {
+                    peer->operations().send_gossip(message, [replied](intra::operation_result<GossipMessage_ptr>& result) {
+                        GossipMessage_ptr reply;
+                        try
+                        {
+                            result.rethrow_error();
+                            reply = result.message();
+                        }
+                        catch (const std::runtime_error& e)
+                        {
+                            LOG_SRC(debug) << "gossip went unanswered: " << e.what();
+                        }
+
+                        replied(reply);
+                    });
+                }
+                catch (const std::logic_error& e)
+                {
+                    //a node we have no connections to yet
+                    LOG_SRC(warning) << "unable to gossip with node " << peer->node_id() << ": " << e.what();
+                }
+            }
+
+            void push_over_network(const node::ptr& peer, GossipMessage_ptr message)
+            {
+                try
+                {
+                    peer->operations().push_gossip(message);
+                }
+                catch (const std::logic_error& e)
+                {
+                    LOG_SRC(warning) << "unable to gossip with node " << peer->node_id() << ": " << e.what();
+                }
+            }
+        }
+
         const int gossiper::GOSSIP_INTERVAL_MS;
+        const int gossiper::MAX_DATA_PER_MESSAGE;
 
-        gossiper::gossiper(const ring& ring)
-            : _ring(ring)
+        gossiper::gossiper(ba::io_service& ioService, const ring& ring, node::ptr self, size_t fanout)
+            : gossiper(ioService, ring, self, fanout, &send_over_network, &push_over_network)
         {
-            
+
+        }
+
+        gossiper::gossiper(ba::io_service& ioService, const ring& ring, node::ptr self, size_t fanout,
+                           exchange_function exchange, push_function push)
+            : _ioService(ioService), _ring(ring), _self(self), _fanout(std::max<size_t>(fanout, 1)),
+            _exchange(exchange), _push(push), _timer(ioService), _stopping(false),
+            _engine((unsigned)std::chrono::system_clock::now().time_since_epoch().count() ^ self->node_id())
+        {
+            //every start is a new generation, so the ring takes our heartbeats from
+            //the beginning again instead of ignoring them as old
+            node_clock start = _self->heartbeat_clock();
+            start.generation = (std::uint32_t)std::chrono::duration_cast<std::chrono::seconds>(
+                std::chrono::system_clock::now().time_since_epoch()).count();
+            start.clock = 0;
+
+            _self->observe_heartbeat(start);
         }
 
         gossiper::~gossiper()
         {
         }
 
+        void gossiper::start()
+        {
+            _stopping = false;
+
+            auto self(shared_from_this());
+            _ioService.post([self] { self->schedule_tick(); });
+        }
+
+        void gossiper::stop()
+        {
+            _stopping = true;
+
+            auto self(shared_from_this());
+            _ioService.post([self] {
+                boost::system::error_code ec;
+                self->_timer.cancel(ec);
+
+                //let a few nodes know we're going instead of leaving the ring to
+                //notice. gossip takes it from there
+                self->_self->beat(true);
+
+                std::vector<node::ptr> peers;
+                for (auto& node : self->_ring.nodes())
+                {
+                    if (node != self->_self && node->is_alive()) peers.push_back(node);
+                }
+
+                self->pick(peers, self->_fanout);
+
+                for (size_t i = 0; i < std::min(peers.size(), self->_fanout); ++i)
+                {
+                    GossipMessage_ptr message = messageutil::make_message<GossipMessage>(0, 0);
+                    add_data(*message, self->_self);
+
+                    self->_push(peers[i], message);
+                }
+            });
+        }
+
+        void gossiper::schedule_tick()
+        {
+            if (_stopping) return;
+
+            _timer.expires_from_now(std::chrono::milliseconds(GOSSIP_INTERVAL_MS));
+
+            std::weak_ptr<gossiper> wself(shared_from_this());
+            _timer.async_wait([wself](const boost::system::error_code& error) {
+                if (auto self = wself.lock()) self->after_tick_timer(error);
+            });
+        }
+
+        void gossiper::after_tick_timer(const boost::system::error_code& error)
+        {
+            if (error == ba::error::operation_aborted || _stopping) return;
+
+            this->tick();
+            this->schedule_tick();
+        }
+
+        void gossiper::tick()
+        {
+            _self->beat();
+
+            std::vector<node::ptr> up;
+            std::vector<node::ptr> down;
+            for (auto& node : _ring.nodes())
+            {
+                if (node == _self) continue;
+
+                if (node->is_alive()) up.push_back(node);
+                else down.push_back(node);
+            }
+
+            this->pick(up, _fanout);
+            for (size_t i = 0; i < std::min(up.size(), _fanout); ++i)
+            {
+                this->gossip_with(up[i]);
+            }
+
+            //the more of the ring is down the more likely we try one of them. like
+            //cassandra, a ring that is mostly up rarely spends a message on them
+            if (! down.empty() && _engine() % (up.size() + 1) < down.size())
+            {
+                this->gossip_with(down[_engine() % down.size()]);
+            }
+        }
+
+        void gossiper::pick(std::vector<node::ptr>& nodes, size_t count)
+        {
+            for (size_t i = 0; i < count && i + 1 < nodes.size(); ++i)
+            {
+                std::swap(nodes[i], nodes[i + _engine() % (nodes.size() - i)]);
+            }
+        }
+
+        void gossiper::gossip_with(const node::ptr& peer)
+        {
+            GossipMessage_ptr message = messageutil::make_message<GossipMessage>(0, 0);
+            this->add_digests(*message);
+
+            std::weak_ptr<gossiper> wself(shared_from_this());
+            _exchange(peer, message, [wself, peer](GossipMessage_ptr reply) {
+                if (auto self = wself.lock()) self->handle_reply(peer, reply);
+            });
+        }
+
+        void gossiper::handle_reply(const node::ptr& peer, GossipMessage_ptr reply)
+        {
+            //no answer is no heartbeat, the failure detector takes it from there
+            if (! reply) return;
+
+            this->apply(*reply);
+
+            if (reply->digests_size() == 0) return;
+
+            GossipMessage_ptr push = messageutil::make_message<GossipMessage>(0, 0);
+            for (auto& digest : reply->digests())
+            {
+                node::ptr node = digest.node_id() == _self->node_id() ? _self : _ring.find_node(digest.node_id());
+                if (! node) continue;
+
+                if (from_protobuf(digest) < node->heartbeat_clock())
+                {
+                    if (! add_data(*push, node)) break;
+                }
+            }
+
+            if (push->data_size() > 0) _push(peer, push);
+        }
+
+        GossipMessage_ptr gossiper::handle_gossip(const GossipMessage& message)
+        {
+            this->apply(message);
+
+            //pushes answer our digests, there's nothing to say back
+            if (message.digests_size() == 0) return GossipMessage_ptr();
+
+            GossipMessage_ptr reply = messageutil::make_message<GossipMessage>(0, 0);
+            std::unordered_set<std::uint32_t> seen;
+
+            for (auto& digest : message.digests())
+            {
+                seen.insert(digest.node_id());
+
+                node::ptr node = digest.node_id() == _self->node_id() ? _self : _ring.find_node(digest.node_id());
+                if (! node) continue;
+
+                node_clock theirs = from_protobuf(digest);
+                node_clock ours = node->heartbeat_clock();
+
+                if (theirs < ours)
+                {
+                    add_data(*reply, node);
+                }
+                else if (ours < theirs && node != _self)
+                {
+                    //ask for what they have past ours
+                    ours.to_protobuf(reply->add_digests());
+                }
+            }
+
+            //and tell them about the nodes they didn't know to ask about
+            if (seen.count(_self->node_id()) == 0) add_data(*reply, _self);
+
+            for (auto& node : _ring.nodes())
+            {
+                if (seen.count(node->node_id()) == 0 && node != _self) add_data(*reply, node);
+            }
+
+            return reply;
+        }
+
+        void gossiper::note_heartbeat(const Identifier& identity)
+        {
+            if (! identity.has_heartbeat()) return;
+
+            const NodeClock& beat = identity.heartbeat();
+            if (beat.node_id() == _self->node_id()) return;
+
+            if (node::ptr node = _ring.find_node(beat.node_id()))
+            {
+                node->observe_heartbeat(from_protobuf(beat));
+            }
+        }
+
+        size_t gossiper::fanout() const
+        {
+            return _fanout;
+        }
+
+        void gossiper::apply(const GossipMessage& message)
+        {
+            for (auto& data : message.data())
+            {
+                //nobody knows our heartbeat better than we do
+                if (data.clock().node_id() == _self->node_id()) continue;
+
+                if (node::ptr node = _ring.find_node(data.clock().node_id()))
+                {
+                    node->observe_heartbeat(from_protobuf(data.clock()),
+                                            data.status() == GossipNodeData_Status_SHUTDOWN);
+                }
+            }
+        }
+
+        void gossiper::add_digests(GossipMessage& message) const
+        {
+            _self->heartbeat_clock().to_protobuf(message.add_digests());
+
+            for (auto& node : _ring.nodes())
+            {
+                if (node != _self) node->heartbeat_clock().to_protobuf(message.add_digests());
+            }
+        }
+
+        bool gossiper::add_data(GossipMessage& message, const node::ptr& node)
+        {
+            if (message.data_size() >= MAX_DATA_PER_MESSAGE) return false;
+
+            GossipNodeData* data = message.add_data();
+
+            //read together, so the status goes with the heartbeat it came with
+            bool shuttingDown = false;
+            node_clock beat = node->heartbeat_clock(&shuttingDown);
+            beat.to_protobuf(data->mutable_clock());
+
+            if (shuttingDown) data->set_status(GossipNodeData_Status_SHUTDOWN);
+
+            return true;
+        }
+
     }
-}
\ No newline at end of file
+}
@@ -16,6 +16,19 @@
  */
 
 #include "ring.h"
+#include "node.h"
+#include "message_ptrs.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <memory>
+#include <functional>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <cstddef>
 
 #ifndef __sopmq__gossiper__
 #define __sopmq__gossiper__
@@ -24,27 +37,152 @@ namespace sopmq {
     namespace node {
 
         ///
-        /// Class that manages gossip between nodes and sends gossip at 
+        /// Class that manages gossip between nodes and sends gossip at
         /// regular intervals
         ///
-        class gossiper
+        /// Every round our own heartbeat is advanced and we gossip with a few up
+        /// nodes picked at random. Gossip goes back and forth in three steps. We
+        /// send digests: the newest heartbeat we know of for every node. The node
+        /// answers with the heartbeats it has that are newer than ours, and digests
+        /// for the ones it has older. We then push what it asked for. Only the
+        /// heartbeats one side is missing cross the wire, so a ring that has
+        /// settled just trades digests.
+        ///
+        /// A newer heartbeat for a node is what feeds its failure detector. Down
+        /// nodes are gossiped with now and then too, so we notice them coming back.
+        ///
+        /// Our heartbeat also rides on the messages we send other nodes anyway (see
+        /// remote_node_operations), so a node we're busy with hears from us without
+        /// waiting for gossip to come around to it
+        ///
+        class gossiper : public boost::noncopyable,
+                         public std::enable_shared_from_this<gossiper>
         {
         public:
+            typedef std::shared_ptr<gossiper> ptr;
+
+            ///
+            /// Sends gossip to a node and waits for its answer. The callback gets the
+            /// answer, or null if none came
+            ///
+            typedef std::function<void(const node::ptr& peer, GossipMessage_ptr message,
+                                       std::function<void(GossipMessage_ptr)> replied)> exchange_function;
+
+            ///
+            /// Sends gossip to a node that isn't answered
+            ///
+            typedef std::function<void(const node::ptr& peer, GossipMessage_ptr message)> push_function;
+
             ///
             /// How often we try to gossip with a random node
             ///
             static const int GOSSIP_INTERVAL_MS = 1000;
 
+            ///
+            /// The most heartbeats sent in one message
+            ///
+            static const int MAX_DATA_PER_MESSAGE = 512;
+
         public:
-            gossiper(const ring& ring);
+            ///
+            /// Gossips over the connections node::operations() gives
+            ///
+            gossiper(boost::asio::io_service& ioService, const ring& ring, node::ptr self, size_t fanout);
+
+            ///
+            /// Gossips with the given functions, which can be called from any thread
+            ///
+            gossiper(boost::asio::io_service& ioService, const ring& ring, node::ptr self, size_t fanout,
+                     exchange_function exchange, push_function push);
+
             virtual ~gossiper();
 
+            ///
+            /// \brief Starts gossiping every GOSSIP_INTERVAL_MS
+            ///
+            void start();
+
+            ///
+            /// \brief Tells a few nodes we're shutting down and stops gossiping
+            ///
+            void stop();
+
+            ///
+            /// \brief Advances our heartbeat and gossips with fanout up nodes. Called
+            /// by the timer once started
+            ///
+            void tick();
+
+            ///
+            /// \brief Takes gossip sent by another node. Can be called from any thread
+            /// \return The answer to send back, or null if the message doesn't want one
+            ///
+            GossipMessage_ptr handle_gossip(const GossipMessage& message);
+
+            ///
+            /// \brief Takes the heartbeat another node carried on a message, if it
+            /// carried one. Can be called from any thread
+            ///
+            void note_heartbeat(const Identifier& identity);
+
+            ///
+            /// \brief The number of up nodes gossiped with each round
+            ///
+            size_t fanout() const;
+
         private:
+            boost::asio::io_service& _ioService;
             const ring& _ring;
+            node::ptr _self;
+            size_t _fanout;
+            exchange_function _exchange;
+            push_function _push;
+
+            boost::asio::steady_timer _timer;
+            std::atomic<bool> _stopping;
+
+            ///
+            /// Picks who to gossip with. Only used from the IO thread
+            ///
+            std::default_random_engine _engine;
+
+            void schedule_tick();
+            void after_tick_timer(const boost::system::error_code& error);
+
+            ///
+            /// Picks up to count of the nodes in the vector at random, moving them to
+            /// the front
+            ///
+            void pick(std::vector<node::ptr>& nodes, size_t count);
+
+            ///
+            /// Starts gossip with the node
+            ///
+            void gossip_with(const node::ptr& peer);
+
+            ///
+            /// Takes the node's answer to our digests and pushes what it asked for
+            ///
+            void handle_reply(const node::ptr& peer, GossipMessage_ptr reply);
+
+            ///
+            /// Takes the heartbeats the message carries
+            ///
+            void apply(const GossipMessage& message);
+
+            ///
+            /// Adds a digest for us and every node in the ring
+            ///
+            void add_digests(GossipMessage& message) const;
+
+            ///
+            /// Adds the node's heartbeat, unless the message is full
+            ///
+            static bool add_data(GossipMessage& message, const node::ptr& node);
         };
 
     }
 }
 
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,102 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "hedge_policy.h"
+
+#include "settings.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace sopmq {
+    namespace node {
+        
+        const std::uint64_t hedge_policy::MIN_SAMPLES;
+        const std::uint64_t hedge_policy::WINDOW;
+        const std::size_t hedge_policy::BUCKETS;
+        
+        hedge_policy& hedge_policy::instance()
+        {
+            static hedge_policy policy(std::chrono::milliseconds(settings::instance().hedgeDelayMs),
+                                       settings::instance().hedgePercentile);
+            return policy;
+        }
+        
+        hedge_policy::hedge_policy(std::chrono::microseconds delay, double percentile)
+        : _delay(delay), _percentile(percentile), _counts(), _total(0)
+        {
+            
+        }
+        
+        bool hedge_policy::enabled() const
+        {
+            return _delay.count() > 0;
+        }
+        
+        void hedge_policy::record(std::chrono::microseconds latency)
+        {
+            if (! this->enabled() || _percentile <= 0) return;
+            
+            std::size_t bucket = bucket_for(latency);
+            
+            std::lock_guard<std::mutex> lock(_lock);
+            
+            ++_counts[bucket];
+            if (++_total < WINDOW) return;
+            
+            _total = 0;
+            for (auto& count : _counts)
+            {
+                count /= 2;
+                _total += count;
+            }
+        }
+        
+        std::chrono::microseconds hedge_policy::delay() const
+        {
+            if (_percentile <= 0) return _delay;
+            
+            std::lock_guard<std::mutex> lock(_lock);
+            
+            if (_total < MIN_SAMPLES) return _delay;
+            
+            std::uint64_t wanted = (std::uint64_t)std::ceil(_total * std::min(_percentile, 1.0));
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < BUCKETS; ++i)
+            {
+                seen += _counts[i];
+                if (seen >= wanted) return bucket_limit(i);
+            }
+            
+            return bucket_limit(BUCKETS - 1);
+        }
+        
+        std::size_t hedge_policy::bucket_for(std::chrono::microseconds latency)
+        {
+            if (latency.count() <= 1) return 0;
+            
+            std::size_t bucket = (std::size_t)(std::log2((double)latency.count()) * 4);
+            return std::min(bucket, BUCKETS - 1);
+        }
+        
+        std::chrono::microseconds hedge_policy::bucket_limit(std::size_t bucket)
+        {
+            return std::chrono::microseconds((std::int64_t)std::ceil(std::exp2((bucket + 1) / 4.0)));
+        }
+        
+    }
+}
@@ -0,0 +1,100 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__hedge_policy__
+#define __sopmq__hedge_policy__
+
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        
+        ///
+        /// \brief Decides how long a quorum operation waits before it is also sent
+        /// to a spare replica
+        ///
+        /// The delay is either fixed or follows a percentile of how long replicas
+        /// have recently taken to answer. Reply times go into a histogram with
+        /// four buckets per doubling. Its counts are halved as it fills so older
+        /// replies fade out.
+        ///
+        class hedge_policy : public boost::noncopyable
+        {
+        public:
+            ///
+            /// \brief The policy used by the node, set up from settings
+            ///
+            static hedge_policy& instance();
+            
+            ///
+            /// The replies needed before the percentile is trusted over the fixed delay
+            ///
+            static const std::uint64_t MIN_SAMPLES = 100;
+            
+            ///
+            /// The replies kept before the counts are halved
+            ///
+            static const std::uint64_t WINDOW = 4096;
+            
+        public:
+            ///
+            /// \param delay How long to wait before hedging, and the delay used until
+            /// enough replies have been seen for the percentile. Zero turns hedging off
+            /// \param percentile Hedge once the quorum is slower than this fraction of
+            /// recent replies, such as 0.95. Zero always waits the fixed delay
+            ///
+            hedge_policy(std::chrono::microseconds delay, double percentile);
+            
+            ///
+            /// \brief Whether operations should be hedged at all
+            ///
+            bool enabled() const;
+            
+            ///
+            /// \brief Notes how long a replica took to answer
+            ///
+            void record(std::chrono::microseconds latency);
+            
+            ///
+            /// \brief How long to wait for a quorum before sending to another replica
+            ///
+            std::chrono::microseconds delay() const;
+            
+        private:
+            static const std::size_t BUCKETS = 96;
+            
+            std::chrono::microseconds _delay;
+            double _percentile;
+            
+            mutable std::mutex _lock;
+            std::array<std::uint64_t, BUCKETS> _counts;
+            std::uint64_t _total;
+            
+            static std::size_t bucket_for(std::chrono::microseconds latency);
+            static std::chrono::microseconds bucket_limit(std::size_t bucket);
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__hedge_policy__) */
@@ -22,8 +22,11 @@
 #include "message_ptrs.h"
 #include "operation_result.h"
 
+#include <boost/asio.hpp>
+
 #include <functional>
 #include <memory>
+#include <vector>
 
 namespace sopmq {
     namespace node {
@@ -35,6 +38,22 @@ namespace sopmq {
                 typedef std::function<void(operation_result<ReturnMessageType>&)> type;
             };
             
+            ///
+            /// Wraps an operation callback so that it runs on the given io_service.
+            /// Operations call back from whichever thread finished them, which for
+            /// the local node is the thread that owns the queue
+            ///
+            template <typename ReturnMessageType>
+            typename return_message_callback_t<ReturnMessageType>::type
+                call_back_on(boost::asio::io_service& ioService,
+                             typename return_message_callback_t<ReturnMessageType>::type callback)
+            {
+                return [&ioService, callback](operation_result<ReturnMessageType>& result) {
+                    operation_result<ReturnMessageType> copy(result);
+                    ioService.dispatch([callback, copy]() mutable { callback(copy); });
+                };
+            }
+            
             ///
             /// Interface to intranode operations. Used to simplify the implementation of
             /// executing operations between nodes on the ring
@@ -52,12 +71,36 @@ namespace sopmq {
                 virtual void send_gossip(GossipMessage_ptr message,
                                          return_message_callback_t<GossipMessage_ptr>::type responseCallback) = 0;
                 
+                ///
+                /// Sends gossip the node asked for in its answer to ours. It isn't answered
+                ///
+                virtual void push_gossip(GossipMessage_ptr message) = 0;
+                
                 ///
                 /// Sends a proxy publish message to this node and registers for a callback when the status is available
                 ///
                 virtual void send_proxy_publish(PublishMessage_ptr clientMessage,
                                                 return_message_callback_t<ProxyPublishResponseMessage_ptr>::type responseCallback) = 0;
                 
+                ///
+                /// Sends a set of client messages to this node in one proxy message and registers
+                /// for a callback when their statuses are available
+                ///
+                virtual void send_proxy_publish_batch(const std::vector<PublishMessage_ptr>& clientMessages,
+                                                      return_message_callback_t<ProxyPublishBatchResponseMessage_ptr>::type responseCallback) = 0;
+                
+                ///
+                /// Sends the final vector clock for a message this node queued. Stamps are
+                /// not acknowledged
+                ///
+                virtual void send_stamp(const QueueStamp& stamp) = 0;
+                
+                ///
+                /// Removes messages a consumer is done with from this node's copy of the
+                /// queue. Claims are not acknowledged
+                ///
+                virtual void send_claim(const QueueClaim& claim) = 0;
+                
                 inode_operations();
                 virtual ~inode_operations();
             };
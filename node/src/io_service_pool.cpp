@@ -0,0 +1,103 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "io_service_pool.h"
+
+#include <algorithm>
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+        
+        io_service_pool::io_service_pool(size_t threadCount)
+        : _next(0)
+        {
+            if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+            
+            for (size_t i = 0; i < threadCount; ++i)
+            {
+                _services.emplace_back(new ba::io_service(1));
+                _work.emplace_back(new ba::io_service::work(*_services.back()));
+            }
+        }
+        
+        io_service_pool::~io_service_pool()
+        {
+            this->stop();
+        }
+        
+        void io_service_pool::start()
+        {
+            for (auto& service : _services)
+            {
+                ba::io_service* s = service.get();
+                _threads.emplace_back([s] { s->run(); });
+            }
+        }
+        
+        void io_service_pool::stop()
+        {
+            _work.clear();
+            
+            for (auto& service : _services)
+            {
+                service->stop();
+            }
+            
+            this->join();
+        }
+        
+        void io_service_pool::join()
+        {
+            for (auto& thread : _threads)
+            {
+                if (thread.joinable()) thread.join();
+            }
+            
+            _threads.clear();
+        }
+        
+        ba::io_service& io_service_pool::next()
+        {
+            return *_services[_next++ % _services.size()];
+        }
+        
+        ba::io_service& io_service_pool::for_key(const uint128& key)
+        {
+            //the same bits the queue manager picks its lock shards with. with a power
+            //of two threads each one has its shards to itself
+            return *_services[key.hi % _services.size()];
+        }
+        
+        ba::io_service& io_service_pool::at(size_t index)
+        {
+            return *_services.at(index);
+        }
+        
+        size_t io_service_pool::size() const
+        {
+            return _services.size();
+        }
+        
+        void io_service_pool::dispatch(const uint128& key, std::function<void()> func)
+        {
+            this->for_key(key).dispatch(std::move(func));
+        }
+        
+    }
+}
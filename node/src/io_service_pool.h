@@ -0,0 +1,100 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__io_service_pool__
+#define __sopmq__io_service_pool__
+
+#include "uint128.h"
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        
+        ///
+        /// \brief One io_service per thread for the node's network and queue work
+        ///
+        /// Connections are handed out round robin and stay on the io_service they
+        /// were given for their whole life. Every queue is owned by one io_service
+        /// picked from its id, and anything that touches the queue's subscribers
+        /// runs there, so a queue's deliveries never race each other across threads.
+        ///
+        class io_service_pool : public boost::noncopyable
+        {
+        public:
+            ///
+            /// \param threadCount The number of io_services and threads. 0 uses one
+            /// per core
+            ///
+            explicit io_service_pool(size_t threadCount);
+            ~io_service_pool();
+            
+            ///
+            /// \brief Starts a thread running each io_service
+            ///
+            void start();
+            
+            ///
+            /// \brief Stops every io_service, abandoning the work still queued, and
+            /// waits for the threads to exit
+            ///
+            void stop();
+            
+            ///
+            /// \brief Waits for the threads to exit
+            ///
+            void join();
+            
+            ///
+            /// \brief The io_service to give the next new connection
+            ///
+            boost::asio::io_service& next();
+            
+            ///
+            /// \brief The io_service that owns the given queue
+            ///
+            boost::asio::io_service& for_key(const uint128& key);
+            
+            boost::asio::io_service& at(size_t index);
+            
+            size_t size() const;
+            
+            ///
+            /// \brief Runs the function on the io_service that owns the queue. If we're
+            /// already on that io_service's thread it runs before this returns
+            ///
+            void dispatch(const uint128& key, std::function<void()> func);
+            
+        private:
+            std::vector<std::unique_ptr<boost::asio::io_service>> _services;
+            std::vector<std::unique_ptr<boost::asio::io_service::work>> _work;
+            std::vector<std::thread> _threads;
+            std::atomic<size_t> _next;
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__io_service_pool__) */
@@ -19,15 +19,21 @@
 
 #include "PublishMessage.pb.h"
 #include "ProxyPublishResponseMessage.pb.h"
+#include "ProxyPublishBatchResponseMessage.pb.h"
 #include "VectorClock.pb.h"
+#include "QueueStamp.pb.h"
+#include "QueueClaim.pb.h"
 
 #include "node.h"
+#include "replication.h"
 #include "util.h"
 #include "messageutil.h"
 #include "operation_result.h"
 
 #include <stdexcept>
 #include <memory>
+#include <map>
+#include <atomic>
 
 using node = sopmq::node::node;
 
@@ -37,8 +43,9 @@ namespace sopmq {
     namespace node {
         namespace intra {
             
-            local_node_operations::local_node_operations(ring& ring, node& node, node_clock& clock)
-            : _ring(ring), _node(node), _clock(clock)
+            local_node_operations::local_node_operations(ring& ring, node& node, node_clock& clock,
+                                                         queue_manager3& queueManager, io_service_pool* ioServices)
+            : _ring(ring), _node(node), _clock(clock), _queue_manager(queueManager), _io_services(ioServices)
             {
                 
             }
@@ -54,36 +61,162 @@ namespace sopmq {
                 throw std::logic_error("Refusing to gossip to self");
             }
             
+            void local_node_operations::push_gossip(GossipMessage_ptr message)
+            {
+                throw std::logic_error("Refusing to gossip to self");
+            }
+            
             void local_node_operations::send_proxy_publish(PublishMessage_ptr clientMessage,
                                                            return_message_callback_t<ProxyPublishResponseMessage_ptr>::type responseCallback)
             {
-                auto queueIdHash = util::murmur_hash3(clientMessage->queue_id());
-                auto messageId = util::uuid_from_bytes(clientMessage->message_id());
+                this->on_queue_thread(util::murmur_hash3(clientMessage->queue_id()), [this, clientMessage, responseCallback] {
+                    ProxyPublishResponseMessage_ptr response
+                        = sopmq::message::messageutil::make_message<ProxyPublishResponseMessage>(0, clientMessage->identity().id());
+                    
+                    this->queue_message(*clientMessage, *response);
+                    
+                    //send the response back to the caller
+                    operation_result<ProxyPublishResponseMessage_ptr> result(response);
+                    responseCallback(result);
+                });
+            }
+            
+            void local_node_operations::send_proxy_publish_batch(const std::vector<PublishMessage_ptr>& clientMessages,
+                                                                 return_message_callback_t<ProxyPublishBatchResponseMessage_ptr>::type responseCallback)
+            {
+                ProxyPublishBatchResponseMessage_ptr response
+                    = sopmq::message::messageutil::make_message<ProxyPublishBatchResponseMessage>(0, 0);
+                
+                for (auto& clientMessage : clientMessages)
+                {
+                    ProxyPublishResponseMessage* entry = response->add_responses();
+                    entry->set_allocated_identity(sopmq::message::messageutil::build_id(0, clientMessage->identity().id()));
+                }
+                
+                if (_io_services == nullptr)
+                {
+                    for (size_t i = 0; i < clientMessages.size(); ++i)
+                    {
+                        this->queue_message(*clientMessages[i], *response->mutable_responses((int)i));
+                    }
+                    
+                    operation_result<ProxyPublishBatchResponseMessage_ptr> result(response);
+                    responseCallback(result);
+                    return;
+                }
+                
+                //the batch can span queues owned by different threads. each thread fills
+                //in its own entries and whichever finishes last answers
+                std::map<boost::asio::io_service*, std::vector<int>> byThread;
+                for (size_t i = 0; i < clientMessages.size(); ++i)
+                {
+                    byThread[&_io_services->for_key(util::murmur_hash3(clientMessages[i]->queue_id()))].push_back((int)i);
+                }
+                
+                auto finish = [response, responseCallback] {
+                    operation_result<ProxyPublishBatchResponseMessage_ptr> result(response);
+                    responseCallback(result);
+                };
+                
+                if (byThread.empty())
+                {
+                    finish();
+                    return;
+                }
+                
+                auto remaining = std::make_shared<std::atomic<size_t>>(byThread.size());
+                std::vector<PublishMessage_ptr> messages(clientMessages);
+                
+                for (auto& entry : byThread)
+                {
+                    std::vector<int> indexes(std::move(entry.second));
+                    entry.first->dispatch([this, messages, indexes, response, remaining, finish] {
+                        for (int i : indexes)
+                        {
+                            this->queue_message(*messages[i], *response->mutable_responses(i));
+                        }
+                        
+                        if (--*remaining == 0) finish();
+                    });
+                }
+            }
+            
+            void local_node_operations::queue_message(PublishMessage& clientMessage, ProxyPublishResponseMessage& response)
+            {
+                auto queueIdHash = util::murmur_hash3(clientMessage.queue_id());
+                auto messageId = util::uuid_from_bytes(clientMessage.message_id());
+                
+                //clientMessage.mutable_content will be std::moved
+                _queue_manager.enqueue_message(queueIdHash, messageId, clientMessage.mutable_content(), clientMessage.ttl());
+                
+                response.set_status(ProxyPublishResponseMessage_Status_QUEUED);
                 
-                //clientMessage->mutable_content will be std::moved
-                _queue_manager.enqueue_message(queueIdHash, messageId, clientMessage->mutable_content(), clientMessage->ttl());
+                const auto& nodes = _ring.find_nodes_for_key(queueIdHash);
+                size_t replicas = replication::factor_for_queue(clientMessage.queue_id());
+                VectorClock* outClock = response.mutable_clock();
+                
+                std::lock_guard<std::mutex> lock(_clock_lock);
                 
                 //update our component of the vector clock
                 ++_clock.clock;
                 
-                //send the response back to the caller
-                ProxyPublishResponseMessage_ptr response
-                    = sopmq::message::messageutil::make_message<ProxyPublishResponseMessage>(0, clientMessage->identity().id());
-                
                 //share our knowlege of the clocks that handle this queue including ours that is now updated
-                auto nodes = _ring.find_nodes_for_key(queueIdHash);
+                for (size_t i = 0; i < replicas; ++i)
+                {
+                    nodes[i]->clock().to_protobuf(outClock->add_clocks());
+                }
+            }
+            
+            void local_node_operations::send_stamp(const QueueStamp& stamp)
+            {
+                auto queueIdHash = util::murmur_hash3(stamp.queue_id());
+                auto messageId = util::uuid_from_bytes(stamp.message_id());
+                //a queue with fewer replicas leaves the rest of the clock empty
+                vector_clock<3> clock(stamp.clock());
+                
+                //stamping calls the queue's subscribers, which live on its thread
+                this->on_queue_thread(queueIdHash, [this, queueIdHash, messageId, clock] {
+                    _queue_manager.stamp_message(queueIdHash, messageId, clock);
+                });
+            }
+            
+            void local_node_operations::send_claim(const QueueClaim& claim)
+            {
+                auto queueIdHash = util::murmur_hash3(claim.queue_id());
                 
-                std::unique_ptr<VectorClock> outClock(new VectorClock());
-                for (auto node : nodes)
+                std::vector<boost::uuids::uuid> ids;
+                ids.reserve(claim.message_ids_size());
+                for (auto& id : claim.message_ids())
                 {
-                    node->clock().to_protobuf(outClock->add_clocks());
+                    ids.push_back(util::uuid_from_bytes(id));
                 }
                 
-                response->set_allocated_clock(outClock.get());
-                outClock.release();
+                bool hasThrough = claim.has_through();
+                vector_clock<3> through;
+                if (hasThrough) through = vector_clock<3>(claim.through());
+                
+                this->on_queue_thread(queueIdHash, [this, queueIdHash, ids, hasThrough, through] {
+                    if (! ids.empty())
+                    {
+                        _queue_manager.claim_messages(queueIdHash, ids);
+                    }
+                    
+                    if (hasThrough)
+                    {
+                        _queue_manager.claim_through(queueIdHash, through);
+                    }
+                });
+            }
+            
+            void local_node_operations::on_queue_thread(const uint128& queueId, std::function<void()> func)
+            {
+                if (_io_services == nullptr)
+                {
+                    func();
+                    return;
+                }
                 
-                operation_result<ProxyPublishResponseMessage_ptr> result(response);
-                responseCallback(result);
+                _io_services->dispatch(queueId, std::move(func));
             }
             
         }
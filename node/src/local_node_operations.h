@@ -22,6 +22,9 @@
 #include "queue_manager.h"
 #include "node_clock.h"
 #include "ring.h"
+#include "io_service_pool.h"
+
+#include <mutex>
 
 namespace sopmq {
     namespace node {
@@ -33,10 +36,15 @@ namespace sopmq {
             ///
             /// Executes operations on the local node
             ///
+            /// Given an io_service_pool, the work for each queue runs on the io_service
+            /// that owns it and callbacks are made from there. Without one everything
+            /// runs before the call returns
+            ///
             class local_node_operations : public inode_operations
             {
             public:
-                local_node_operations(ring& ring, ::sopmq::node::node& node, node_clock& clock);
+                local_node_operations(ring& ring, ::sopmq::node::node& node, node_clock& clock,
+                                      queue_manager3& queueManager, io_service_pool* ioServices = nullptr);
                 virtual ~local_node_operations();
                 
                 ///
@@ -45,14 +53,42 @@ namespace sopmq {
                 virtual void send_gossip(GossipMessage_ptr message,
                                          return_message_callback_t<GossipMessage_ptr>::type responseCallback);
                 
+                ///
+                /// Throws for the same reason
+                ///
+                virtual void push_gossip(GossipMessage_ptr message);
+                
                 virtual void send_proxy_publish(PublishMessage_ptr clientMessage,
                                                 return_message_callback_t<ProxyPublishResponseMessage_ptr>::type responseCallback);
                 
+                virtual void send_proxy_publish_batch(const std::vector<PublishMessage_ptr>& clientMessages,
+                                                      return_message_callback_t<ProxyPublishBatchResponseMessage_ptr>::type responseCallback);
+                
+                virtual void send_stamp(const QueueStamp& stamp);
+                
+                virtual void send_claim(const QueueClaim& claim);
+                
             private:
                 ring& _ring;
                 node& _node;
                 node_clock& _clock;
-                queue_manager3 _queue_manager;
+                queue_manager3& _queue_manager;
+                io_service_pool* _io_services;
+                
+                ///
+                /// Queues on different threads all tick our clock
+                ///
+                std::mutex _clock_lock;
+                
+                ///
+                /// Queues the client message and fills in the response to the proxy
+                ///
+                void queue_message(PublishMessage& clientMessage, ProxyPublishResponseMessage& response);
+                
+                ///
+                /// Runs the function on the thread that owns the queue
+                ///
+                void on_queue_thread(const uint128& queueId, std::function<void()> func);
             };
             
         }
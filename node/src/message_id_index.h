@@ -0,0 +1,218 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__message_id_index__
+#define __sopmq__message_id_index__
+
+#include <boost/uuid/uuid.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+namespace sopmq {
+    namespace node {
+
+        ///
+        /// \brief Open addressed hash index of messages by their id
+        ///
+        /// The index is intrusive in that it stores only the message pointers
+        /// themselves and reads the key back out of the message with id(). All
+        /// slots live in a single flat array so inserts and removals don't allocate
+        /// once the table has grown to the working size of the queue.
+        ///
+        /// \tparam Ptr A raw or smart pointer to a type with an id() member
+        ///
+        template <typename Ptr>
+        class message_id_index
+        {
+        public:
+            message_id_index()
+            : _count(0)
+            {
+            }
+
+            message_id_index(message_id_index&& other)
+            : _slots(std::move(other._slots)), _count(other._count)
+            {
+                other._count = 0;
+            }
+
+            message_id_index& operator=(message_id_index&& other)
+            {
+                _slots = std::move(other._slots);
+                _count = other._count;
+                other._count = 0;
+
+                return *this;
+            }
+
+            ///
+            /// \brief Adds the given message to the index
+            /// \return False if a message with the same id is already indexed
+            ///
+            bool insert(Ptr message)
+            {
+                if ((_count + 1) * 2 > _slots.size())
+                {
+                    this->grow();
+                }
+
+                size_t pos = this->find_slot(message->id());
+                if (_slots[pos])
+                {
+                    return false;
+                }
+
+                _slots[pos] = std::move(message);
+                ++_count;
+
+                return true;
+            }
+
+            ///
+            /// \brief Returns the message with the given id or a null pointer
+            ///
+            Ptr find(const boost::uuids::uuid& id) const
+            {
+                if (_count == 0)
+                {
+                    return Ptr();
+                }
+
+                return _slots[this->find_slot(id)];
+            }
+
+            ///
+            /// \brief Removes the message with the given id from the index
+            /// \return The removed message or a null pointer if it wasn't found
+            ///
+            Ptr erase(const boost::uuids::uuid& id)
+            {
+                if (_count == 0)
+                {
+                    return Ptr();
+                }
+
+                size_t mask = _slots.size() - 1;
+                size_t hole = this->find_slot(id);
+                Ptr removed = std::move(_slots[hole]);
+                if (! removed)
+                {
+                    return removed;
+                }
+
+                _slots[hole] = Ptr();
+
+                --_count;
+
+                //backward shift the rest of the probe run so that lookups
+                //never need tombstones
+                size_t next = (hole + 1) & mask;
+                while (_slots[next])
+                {
+                    size_t home = this->hash(_slots[next]->id()) & mask;
+                    if (((next - home) & mask) >= ((next - hole) & mask))
+                    {
+                        _slots[hole] = std::move(_slots[next]);
+                        _slots[next] = Ptr();
+                        hole = next;
+                    }
+
+                    next = (next + 1) & mask;
+                }
+
+                return removed;
+            }
+
+            ///
+            /// \brief Calls the given function for every indexed message
+            ///
+            template <typename F>
+            void for_each(F func) const
+            {
+                for (const Ptr& slot : _slots)
+                {
+                    if (slot) func(slot);
+                }
+            }
+
+            ///
+            /// \brief The number of indexed messages
+            ///
+            size_t size() const
+            {
+                return _count;
+            }
+
+            ///
+            /// \brief Removes all messages from the index
+            ///
+            void clear()
+            {
+                _slots.clear();
+                _count = 0;
+            }
+
+        private:
+            static const size_t MIN_CAPACITY = 16;
+
+            std::vector<Ptr> _slots;
+            size_t _count;
+
+            static size_t hash(const boost::uuids::uuid& id)
+            {
+                return boost::hash<boost::uuids::uuid>()(id);
+            }
+
+            ///
+            /// Returns the slot holding the given id, or the empty slot where
+            /// it would be placed
+            ///
+            size_t find_slot(const boost::uuids::uuid& id) const
+            {
+                size_t mask = _slots.size() - 1;
+                size_t pos = this->hash(id) & mask;
+
+                while (_slots[pos] && _slots[pos]->id() != id)
+                {
+                    pos = (pos + 1) & mask;
+                }
+
+                return pos;
+            }
+
+            void grow()
+            {
+                std::vector<Ptr> old(_slots.empty() ? MIN_CAPACITY : _slots.size() * 2);
+                old.swap(_slots);
+
+                for (Ptr& slot : old)
+                {
+                    if (slot)
+                    {
+                        _slots[this->find_slot(slot->id())] = std::move(slot);
+                    }
+                }
+            }
+        };
+
+    }
+}
+
+#endif /* defined(__sopmq__message_id_index__) */
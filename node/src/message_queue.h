@@ -19,6 +19,9 @@
 #define __sopmq__message_queue__
 
 #include "queued_message.h"
+#include "ordered_message_buffer.h"
+#include "message_id_index.h"
+#include "timing_wheel.h"
 #include "message_not_found_error.h"
 #include "vector_clock.h"
 #include "uint128.h"
@@ -31,8 +34,6 @@
 
 #include <string>
 #include <cstdint>
-#include <unordered_map>
-#include <map>
 #include <vector>
 #include <algorithm>
 #include <thread>
@@ -43,64 +44,43 @@ namespace bmp = boost::multiprecision;
 namespace sopmq {
     namespace node {
 
-        ///
-        /// Message map for queued_message by id.
-        /// \tparam RF Replication factor
-        ///
-        template <size_t RF>
-        struct message_map_t
-        {
-            typedef std::unordered_map<boost::uuids::uuid, queued_message<RF>, boost::hash<boost::uuids::uuid>> type;
-        };
-
-        ///
-        /// Priority queue for queued_message sorted by vclock
-        /// \tparam RF Replication factor
-        ///
-        template <size_t RF>
-        struct message_queue_t
-        {
-            typedef std::multimap<vector_clock<RF>, typename queued_message<RF>::ptr> type;
-        };
-        
-        ///
-        /// Map between a message ID and its handle
-        /// \tparam RF Replication factor
-        ///
-        template <size_t RF>
-        struct message_index_t
-        {
-            typedef std::unordered_map<boost::uuids::uuid, typename message_queue_t<RF>::type::iterator, boost::hash<boost::uuids::uuid>> type;
-        };
-
         ///
         /// \brief Queue for incoming messages from producers
         ///
         template <size_t RF>
         class message_queue : public ::sopmq::shared::movable_noncopyable
         {
-        private:
+        public:
             typedef queued_message<RF> queued_messageX;
+            typedef typename queued_messageX::ptr queued_message_ptr;
+            
+            ///
+            /// Wheel used to schedule message expiry across many queues
+            ///
+            typedef timing_wheel<queued_messageX> expiry_wheel;
             
         public:
             ///
             /// \brief CTOR
             /// \param queueId The hex representation of the murmur hash of this queues name
+            /// \param wheel The wheel to schedule message expirations on, or null if
+            /// messages will only be expired by calling expire_messages()
             ///
-            message_queue(const uint128& queueId)
+            message_queue(const uint128& queueId, expiry_wheel* wheel = nullptr)
                 : _queue_id(queueId), _created_on(boost::chrono::steady_clock::now()), _total_message_size(0),
-            _ttl_set(false), _ttl(0), _queue_lock(new std::mutex())
+            _wheel(wheel), _has_claim_cursor(false), _queue_lock(new std::mutex())
             {
 
             }
             
             message_queue(message_queue&& other)
             : _queue_id(other._queue_id), _created_on(other._created_on), _total_message_size(other._total_message_size),
-            _ttl_set(other._ttl_set), _ttl(other._ttl), _last_message_received(other._last_message_received),
+            _wheel(other._wheel), _last_message_received(other._last_message_received),
             _unstamped_messages(std::move(other._unstamped_messages)), _queued_messages(std::move(other._queued_messages)),
-            _message_index(std::move(other._message_index)), _queue_lock(std::move(other._queue_lock))
+            _message_index(std::move(other._message_index)), _claim_cursor(other._claim_cursor),
+            _has_claim_cursor(other._has_claim_cursor), _queue_lock(std::move(other._queue_lock))
             {
-                
+                this->adopt_messages();
             }
             
             message_queue& operator=(message_queue&& other)
@@ -108,14 +88,17 @@ namespace sopmq {
                 _queue_id = other._queue_id;
                 _created_on = other._created_on;
                 _total_message_size = other._total_message_size;
-                _ttl_set = other._ttl_set;
-                _ttl = other._ttl;
+                _wheel = other._wheel;
                 _last_message_received = other._last_message_received;
                 _unstamped_messages = std::move(other._unstamped_messages);
                 _queued_messages = std::move(other._queued_messages);
                 _message_index = std::move(other._message_index);
+                _claim_cursor = other._claim_cursor;
+                _has_claim_cursor = other._has_claim_cursor;
                 _queue_lock = std::move(other._queue_lock);
                 
+                this->adopt_messages();
+                
                 return *this;
             }
             
@@ -130,195 +113,304 @@ namespace sopmq {
             ///
             /// Places the message into the unstamped collection and takes ownership of the data
             /// \brief Places the message into the unstamped collection
-			/// \param id The unique ID of this message
-			/// \param data The binary payload for the message
-			/// \param ttlSecs The number of seconds this message should live in the queue
+            /// \param id The unique ID of this message
+            /// \param data The binary payload for the message
+            /// \param ttlSecs The number of seconds this message should live in the queue
+            /// \return The time the message is due to expire
             ///
-            void enqueue(boost::uuids::uuid id, std::string* data, uint32_t ttlSecs)
+            boost::chrono::steady_clock::time_point enqueue(boost::uuids::uuid id, std::string* data, uint32_t ttlSecs)
             {
-				if (! _ttl_set)
-				{
-					_ttl_set = true;
-					_ttl = ttlSecs;
-				}
+                auto message = std::make_shared<queued_messageX>(id, data, ttlSecs);
                 
                 std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                _total_message_size += queued_messageX::calc_size(data->length());
-                _unstamped_messages.insert(typename message_map_t<RF>::type::value_type(id, queued_messageX(id, data)));
+                if (! _unstamped_messages.insert(message))
+                {
+                    return boost::chrono::steady_clock::time_point::max();
+                }
+                
+                _total_message_size += message->size();
+                _last_message_received = message->local_time();
+                this->schedule_expiry(message.get());
+                
+                return message->expires_at();
             }
             
             ///
             /// \brief Sets the vector clock for the given message
             /// \param id The id of the message to set the clock on
             /// \param vclock The clock to set on the message
+            /// \param stamped If given, set to the message that was stamped
             /// \return Whether or not the message was found to set the stamp
             ///
-            bool stamp(boost::uuids::uuid id, vector_clock<RF> vclock)
+            bool stamp(boost::uuids::uuid id, vector_clock<RF> vclock, queued_message_ptr* stamped = nullptr)
             {
                 std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                typedef typename message_map_t<RF>::type::iterator IterType;
-                
-                auto iter = _unstamped_messages.find(id);
-                if (iter != _unstamped_messages.end())
+                queued_message_ptr message = _unstamped_messages.erase(id);
+                if (! message)
                 {
-					auto message = std::make_shared<queued_messageX>(std::move(iter->second));
-					message->update_local_timestamp();
-
-                    
-                    //hint that this will probably be the element proceeding the last
-                    typename message_queue_t<RF>::type::iterator pos;
-                    if (_queued_messages.size() > 0)
-                    {
-                        pos = _queued_messages.insert(_queued_messages.end()--,
-                                                      typename message_queue_t<RF>::type::value_type(vclock, message));
-                    }
-                    else
-                    {
-                        pos = _queued_messages.insert(typename message_queue_t<RF>::type::value_type(vclock, message));
-                    }
-                    
-                    _message_index.insert( typename message_index_t<RF>::type::value_type(id, pos) );
-                    _unstamped_messages.erase(iter);
-                    
-                    return true;
-                }
-                else
-                {
-					return false;
+                    return false;
                 }
+                
+                //the message's TTL restarts once it is stamped
+                message->set_vclock(vclock);
+                message->update_local_timestamp();
+                this->schedule_expiry(message.get());
+                
+                _message_index.insert(message.get());
+                if (stamped != nullptr) *stamped = message;
+                _queued_messages.insert(vclock, std::move(message));
+                
+                return true;
             }
 
-			///
-			/// \brief Expires messages that are beyond their TTL
-			///
-			void expire_messages()
-			{
+            ///
+            /// \brief Expires messages that are beyond their TTL by checking every message
+            /// in the queue. Queues attached to a wheel have their messages expired
+            /// through remove_expired() instead
+            ///
+            void expire_messages()
+            {
                 std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                auto ttlSecs = boost::chrono::seconds(_ttl);
+                auto now = boost::chrono::steady_clock::now();
                 
-                for(auto it = _queued_messages.begin(), ite = _queued_messages.end(); it != ite;)
+                std::vector<queued_messageX*> expired;
+                _queued_messages.for_each([&](const queued_message_ptr& message) {
+                    if (message->expires_at() < now) expired.push_back(message.get());
+                });
+                
+                for (auto message : expired)
                 {
-                    if(it->second->age() > ttlSecs)
-                    {
-                        _total_message_size -= queued_messageX::calc_size(it->second->data().length());
-                        it = _queued_messages.erase(it);
-                    }
-                    else
-                    {
-                        //we can stop since these are in order
-                        break;
-                    }
+                    this->cancel_expiry(message);
+                    _message_index.erase(message->id());
+                    _total_message_size -= message->size();
+                    _queued_messages.remove(message);
                 }
                 
                 //also check unstamped for expirations
-                for(auto it = _unstamped_messages.begin(), ite = _unstamped_messages.end(); it != ite;)
+                std::vector<boost::uuids::uuid> expiredIds;
+                _unstamped_messages.for_each([&](const queued_message_ptr& message) {
+                    if (message->expires_at() < now) expiredIds.push_back(message->id());
+                });
+                
+                for (const auto& id : expiredIds)
                 {
-                    if(it->second.age() > ttlSecs)
-                    {
-                        _total_message_size -= queued_messageX::calc_size(it->second.data().length());
-                        it = _unstamped_messages.erase(it);
-                    }
-                    else
-                    {
-                        ++it;
-                    }
+                    queued_message_ptr message = _unstamped_messages.erase(id);
+                    this->cancel_expiry(message.get());
+                    _total_message_size -= message->size();
                 }
-			}
+            }
+            
+            ///
+            /// \brief Removes a message that the expiry wheel has already unscheduled
+            /// \return Whether or not the message was still in this queue
+            ///
+            bool remove_expired(queued_messageX* message)
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                if (_unstamped_messages.find(message->id()).get() == message)
+                {
+                    _total_message_size -= message->size();
+                    _unstamped_messages.erase(message->id());
+                    
+                    return true;
+                }
+                
+                if (_message_index.find(message->id()) == message)
+                {
+                    _total_message_size -= message->size();
+                    _message_index.erase(message->id());
+                    _queued_messages.remove(message);
+                    
+                    return true;
+                }
+                
+                return false;
+            }
             
 
-			///
-			/// \brief The total memory size of all messages in this queue in bytes
-			///
-			uint32_t memory_size()
-			{
+            ///
+            /// \brief The total memory size of all messages in this queue in bytes
+            ///
+            uint32_t memory_size()
+            {
                 std::lock_guard<std::mutex> lock(*_queue_lock);
-				return _total_message_size;
-			}
+                return _total_message_size;
+            }
             
             ///
             /// \brief The Total number of stamped and unstamped messages in the queue
             ///
             size_t total_count()
             {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
                 return _unstamped_messages.size() + _queued_messages.size();
             }
             
             ///
             /// \brief Peeks messages greater than the given vclock
             ///
-            std::vector<typename queued_message<RF>::ptr> peek(vector_clock<RF> lastMessage)
+            std::vector<queued_message_ptr> peek(vector_clock<RF> lastMessage)
             {
-                std::lock_guard<std::mutex> lock(_queue_lock);
+                std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                std::vector<typename queued_message<RF>::ptr> messages;
+                std::vector<queued_message_ptr> messages;
                 
-                auto start = _queued_messages.find(lastMessage);
+                _queued_messages.for_each_after(lastMessage,
+                                                [&](const queued_message_ptr& message) { messages.push_back(message); });
                 
-                std::transform(start,
-                               _queued_messages.end(),
-                               std::back_inserter(messages),
-                               [](const std::pair<vector_clock<RF>, typename queued_messageX::ptr>& p) { return p.second; });
+                return messages;
+            }
+            
+            ///
+            /// \brief Peeks up to the given number of messages or bytes in clock order
+            /// \param after Only messages with a clock greater than this are returned.
+            /// Pass null to start from the oldest message
+            /// \param maxMessages The most messages to return
+            /// \param maxBytes The most message data to return. The first message is
+            /// always returned however big it is
+            ///
+            /// Messages with the same clock as the last one returned are always
+            /// included, otherwise the next call could never reach them
+            ///
+            std::vector<queued_message_ptr> peek(const vector_clock<RF>* after, size_t maxMessages, size_t maxBytes)
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                std::vector<queued_message_ptr> messages;
+                size_t bytes = 0;
+                
+                _queued_messages.visit_after(after, [&](const queued_message_ptr& message) {
+                    bool full = messages.size() >= maxMessages
+                        || (! messages.empty() && bytes + message->data().size() > maxBytes);
+                    
+                    if (full && (messages.empty() || !(message->clock() == messages.back()->clock()))) return false;
+                    
+                    bytes += message->data().size();
+                    messages.push_back(message);
+                    return true;
+                });
                 
                 return messages;
             }
             
+            ///
+            /// \brief Returns the clock of the newest stamped message
+            /// \return Whether there was a message to get the clock from
+            ///
+            bool back_clock(vector_clock<RF>& clock)
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                if (_queued_messages.empty()) return false;
+                
+                clock = _queued_messages.back()->clock();
+                return true;
+            }
+            
             ///
             /// \brief Peeks all messages
             ///
-            std::vector<typename queued_message<RF>::ptr> peekAll()
+            std::vector<queued_message_ptr> peekAll()
             {
                 std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                std::vector<typename queued_message<RF>::ptr> messages;
+                std::vector<queued_message_ptr> messages;
+                messages.reserve(_queued_messages.size());
                 
-                std::transform(_queued_messages.begin(),
-                               _queued_messages.end(),
-                               std::back_inserter(messages),
-                               [](const std::pair<vector_clock<RF>, typename queued_messageX::ptr>& p) { return p.second; });
+                _queued_messages.for_each([&](const queued_message_ptr& message) { messages.push_back(message); });
                 
                 return messages;
             }
             
             ///
             /// Removes a message from the queue
+            /// \return Whether or not the message was found
             ///
-            void claim(boost::uuids::uuid messageId)
+            bool claim(boost::uuids::uuid messageId)
             {
-                std::lock_guard<std::mutex> lock(_queue_lock);
+                std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                auto iter = _message_index.find(messageId);
-                if (iter != _message_index.end())
+                return this->claim_locked(messageId);
+            }
+            
+            ///
+            /// Removes a set of messages from the queue under one lock
+            /// \return The number of messages that were found
+            ///
+            size_t claim(const std::vector<boost::uuids::uuid>& messageIds)
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                size_t claimed = 0;
+                for (auto& id : messageIds)
+                {
+                    if (this->claim_locked(id)) ++claimed;
+                }
+                
+                return claimed;
+            }
+            
+            ///
+            /// \brief Removes every stamped message up to and including the given clock
+            /// and moves the claim cursor up to it
+            /// \return The number of messages removed
+            ///
+            size_t claim_through(const vector_clock<RF>& clock)
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                size_t claimed = _queued_messages.remove_through(clock, [this](const queued_message_ptr& message) {
+                    _message_index.erase(message->id());
+                    this->cancel_expiry(message.get());
+                    _total_message_size -= message->size();
+                });
+                
+                if (! _has_claim_cursor || _claim_cursor < clock)
                 {
-                    _total_message_size -= queued_messageX::calc_size(iter->second->data().length());
-                    _queued_messages.erase(*iter);
-                    _message_index.erase(messageId);
+                    _claim_cursor = clock;
+                    _has_claim_cursor = true;
                 }
+                
+                return claimed;
             }
             
             ///
-            /// Time when the next message in this queue is due to expire
+            /// \brief Gets the furthest clock claimed through with claim_through()
+            /// \return Whether anything has been claimed that way
+            ///
+            bool claim_cursor(vector_clock<RF>& clock) const
+            {
+                std::lock_guard<std::mutex> lock(*_queue_lock);
+                
+                if (! _has_claim_cursor) return false;
+                
+                clock = _claim_cursor;
+                return true;
+            }
+            
+            ///
+            /// Time when the next message in this queue is due to expire. Since
+            /// every message has its own TTL this checks all of them
             ///
             boost::chrono::steady_clock::time_point next_expiry() const
             {
                 boost::chrono::steady_clock::time_point nextpoint
                     = boost::chrono::steady_clock::time_point::max();
                 
-                std::lock_guard<std::mutex> lock(_queue_lock);
+                std::lock_guard<std::mutex> lock(*_queue_lock);
                 
-                auto it = _queued_messages.begin();
-                if (it != _queued_messages.end())
-                {
-                    nextpoint = std::min(nextpoint, it->second.local_time() + boost::chrono::seconds(_ttl));
-                }
+                auto earliest = [&](const queued_message_ptr& message) {
+                    nextpoint = std::min(nextpoint, message->expires_at());
+                };
                 
+                _queued_messages.for_each(earliest);
+                _unstamped_messages.for_each(earliest);
                 
-                for (auto kvp : _unstamped_messages)
-                {
-                    nextpoint = std::min(nextpoint, kvp->second.local_time() + boost::chrono::seconds(_ttl));
-                }
+                return nextpoint;
             }
             
         private:
@@ -333,20 +425,14 @@ namespace sopmq {
             boost::chrono::steady_clock::time_point _created_on;
             
             ///
-			/// The total size of all the messages in this queue
-			///
-			uint32_t _total_message_size;
-
+            /// The total size of all the messages in this queue
             ///
-            /// Whether or not the TTL has been set yet
-            ///
-            bool _ttl_set;
+            uint32_t _total_message_size;
 
             ///
-            /// The TTL of all messages in this queue based on the TTL of the first message
-            /// received
+            /// Wheel that messages are scheduled on for expiry
             ///
-            uint32_t _ttl;
+            expiry_wheel* _wheel;
 
             ///
             /// The last time a message was received for this queue
@@ -357,23 +443,69 @@ namespace sopmq {
             /// Messages that have been put on the queue, but haven't been assigned
             /// a vector clock yet
             ///
-            typename message_map_t<RF>::type _unstamped_messages;
+            message_id_index<queued_message_ptr> _unstamped_messages;
 
             ///
-            /// Messages that are actively in the queue and can be claimed
+            /// Messages that are actively in the queue and can be claimed, in
+            /// vector clock order
             ///
-            typename message_queue_t<RF>::type _queued_messages;
+            ordered_message_buffer<RF> _queued_messages;
             
             ///
-            /// Message index from UUID to handle that can be used to reference
-            /// messages in _queued_messages
+            /// Message index from UUID to the stamped messages owned by
+            /// _queued_messages
             ///
-            typename message_index_t<RF>::type _message_index;
+            message_id_index<queued_messageX*> _message_index;
+            
+            ///
+            /// The furthest clock a consumer has claimed everything up to
+            ///
+            vector_clock<RF> _claim_cursor;
+            bool _has_claim_cursor;
             
             ///
             /// Lock that protects all collections managed by this queue
             ///
             std::unique_ptr<std::mutex> _queue_lock;
+            
+            void schedule_expiry(queued_messageX* message)
+            {
+                if (_wheel == nullptr) return;
+                
+                message->set_owner(this);
+                _wheel->schedule(message, message->expires_at());
+            }
+            
+            void cancel_expiry(queued_messageX* message)
+            {
+                if (_wheel != nullptr) _wheel->cancel(message);
+            }
+            
+            bool claim_locked(const boost::uuids::uuid& messageId)
+            {
+                queued_messageX* message = _message_index.erase(messageId);
+                if (message == nullptr)
+                {
+                    return false;
+                }
+                
+                this->cancel_expiry(message);
+                _total_message_size -= message->size();
+                _queued_messages.remove(message);
+                
+                return true;
+            }
+            
+            ///
+            /// Points the messages back at this queue after a move
+            ///
+            void adopt_messages()
+            {
+                auto adopt = [this](const queued_message_ptr& message) { message->set_owner(this); };
+                
+                _queued_messages.for_each(adopt);
+                _unstamped_messages.for_each(adopt);
+            }
         };
 
         ///
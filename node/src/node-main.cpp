@@ -18,6 +18,8 @@
 #include "settings.h"
 #include "server.h"
 #include "uint128.h"
+#include "cassandra_storage.h"
+#include "io_service_pool.h"
 
 #include <boost/program_options.hpp>
 #include <boost/log/trivial.hpp>
@@ -57,6 +59,16 @@ bool process_options(int argc, char* argv[])
         ("max_message_size", po::value<uint32_t>()->default_value(DEFAULT_MAX_MESSAGE_SIZE), "the maximum size of any message")
         ("phi_failure_threshold", po::value<int>()->default_value(DEFAULT_PHI_FAILURE_THRESHOLD), "the default threshold at which we consider a node failed")
         ("unit_test_username", po::value<string>()->default_value(""), "Username that will be allowed to log in unconditionally to perform unit testing")
+        ("user_cache_size", po::value<uint32_t>()->default_value(settings::DEFAULT_USER_CACHE_SIZE), "the most user accounts to keep in memory for logins, 0 to disable")
+        ("user_cache_ttl", po::value<uint32_t>()->default_value(settings::DEFAULT_USER_CACHE_TTL), "seconds a cached user account is used before it is read again, and so how long a changed password or disabled user can still log in")
+        ("user_cache_negative_ttl", po::value<uint32_t>()->default_value(settings::DEFAULT_USER_CACHE_NEGATIVE_TTL), "seconds an unknown user is remembered as unknown")
+        ("crypto_threads", po::value<uint32_t>()->default_value(settings::DEFAULT_CRYPTO_THREADS), "threads checking authentication hashes")
+        ("io_threads", po::value<uint32_t>()->default_value(settings::DEFAULT_IO_THREADS), "threads serving connections and queues, 0 for one per core")
+        ("vnodes", po::value<uint32_t>()->default_value(settings::DEFAULT_VNODES), "tokens each node owns on the ring, must match across the ring")
+        ("single_replica_queues", po::value<vector<string> >()->multitoken(), "queue name prefixes kept on one node only, must match across the ring")
+        ("hedge_delay_ms", po::value<uint32_t>()->default_value(settings::DEFAULT_HEDGE_DELAY_MS), "milliseconds before a slow publish also goes to the spare replica, 0 to disable")
+        ("hedge_percentile", po::value<float>()->default_value(settings::DEFAULT_HEDGE_PERCENTILE), "hedge publishes slower than this fraction of recent replica replies, 0 for the fixed delay")
+        ("gossip_fanout", po::value<uint32_t>()->default_value(settings::DEFAULT_GOSSIP_FANOUT), "up nodes to gossip with each round")
     ;
     
     try
@@ -116,6 +128,20 @@ bool process_options(int argc, char* argv[])
         settings::instance().maxMessageSize = vm["max_message_size"].as<uint32_t>();
         settings::instance().phiFailureThreshold = vm["phi_failure_threshold"].as<int>();
         settings::instance().unitTestUsername = vm["unit_test_username"].as<string>();
+        settings::instance().userCacheSize = vm["user_cache_size"].as<uint32_t>();
+        settings::instance().userCacheTtl = vm["user_cache_ttl"].as<uint32_t>();
+        settings::instance().userCacheNegativeTtl = vm["user_cache_negative_ttl"].as<uint32_t>();
+        settings::instance().cryptoThreads = vm["crypto_threads"].as<uint32_t>();
+        settings::instance().ioThreads = vm["io_threads"].as<uint32_t>();
+        settings::instance().vnodes = vm["vnodes"].as<uint32_t>();
+        settings::instance().hedgeDelayMs = vm["hedge_delay_ms"].as<uint32_t>();
+        settings::instance().hedgePercentile = vm["hedge_percentile"].as<float>();
+        settings::instance().gossipFanout = vm["gossip_fanout"].as<uint32_t>();
+        
+        if (vm.count("single_replica_queues"))
+        {
+            settings::instance().singleReplicaPrefixes = vm["single_replica_queues"].as<vector<string> >();
+        }
     }
     catch (const po::error& e)
     {
@@ -154,13 +180,27 @@ int main(int argc, char* argv[])
     
     print_option_summary();
     
-    boost::asio::io_service ioService;
+    if (! settings::instance().cassandraSeeds.empty())
+    {
+        try
+        {
+            storage::cassandra_storage::instance().connect();
+        }
+        catch (const storage::storage_error& e)
+        {
+            BOOST_LOG_TRIVIAL(fatal) << "Unable to connect to storage: " << e.what();
+            return 1;
+        }
+    }
+    
+    io_service_pool ioServices(settings::instance().ioThreads);
     
-    sopmq::node::server s(ioService, settings::instance().port);
+    sopmq::node::server s(ioServices, settings::instance().port);
     
     s.start();
     
-    ioService.run();
+    ioServices.start();
+    ioServices.join();
     
     return 0;
 }
@@ -20,25 +20,50 @@
 #include "settings.h"
 #include "gossiper.h"
 #include "local_node_operations.h"
+#include "remote_node_operations.h"
 #include "ring.h"
+#include "util.h"
+
+#include <boost/lexical_cast.hpp>
 
 #include <memory>
+#include <algorithm>
 
 namespace bc = boost::chrono;
 
 using sopmq::node::settings;
+using sopmq::shared::util;
 using sopmq::node::intra::inode_operations;
 
 namespace sopmq {
     namespace node {
         
+        const std::uint64_t node::LATENCY_WEIGHT;
+        
         node::node(std::uint32_t nodeId, uint128 rangeStart,
                    shared::net::endpoint endPoint)
         : _node_id(nodeId), _range_start(rangeStart), _endpoint(endPoint),
         _failure_detector(settings::instance().phiFailureThreshold, bc::milliseconds(gossiper::GOSSIP_INTERVAL_MS)),
-        _forced_failure(false)
+        _forced_failure(false), _shutting_down(false), _latency_estimate(0), _in_flight(0)
         {
+            _heartbeat.node_id = nodeId;
+            _heartbeat.generation = 0;
+            _heartbeat.clock = 0;
+            
+            _clock.node_id = nodeId;
+            _clock.generation = 0;
+            _clock.clock = 0;
+            
+            uint32_t vnodes = std::max<uint32_t>(settings::instance().vnodes, 1);
             
+            _tokens.reserve(vnodes);
+            _tokens.push_back(rangeStart);
+            
+            std::string base(boost::lexical_cast<std::string>(rangeStart) + "/");
+            for (uint32_t i = 1; i < vnodes; ++i)
+            {
+                _tokens.push_back(util::murmur_hash3(base + std::to_string(i)));
+            }
         }
         
         node::~node()
@@ -56,6 +81,11 @@ namespace sopmq {
             return _range_start;
         }
         
+        const std::vector<uint128>& node::tokens() const
+        {
+            return _tokens;
+        }
+        
         shared::net::endpoint node::endpoint() const
         {
             return _endpoint;
@@ -77,6 +107,7 @@ namespace sopmq {
         void node::heartbeat()
         {
             _failure_detector.heartbeat();
+            _forced_failure = false;
         }
         
         void node::set_failed()
@@ -84,27 +115,63 @@ namespace sopmq {
             _forced_failure = true;
         }
         
+        node_clock node::heartbeat_clock(bool* shuttingDown) const
+        {
+            std::lock_guard<std::mutex> lock(_heartbeat_lock);
+            
+            if (shuttingDown) *shuttingDown = _shutting_down;
+            return _heartbeat;
+        }
+        
+        bool node::observe_heartbeat(const node_clock& beat, bool shuttingDown)
+        {
+            std::lock_guard<std::mutex> lock(_heartbeat_lock);
+            
+            //a restart starts counting again under a higher generation
+            if (! (_heartbeat < beat)) return false;
+            
+            _heartbeat.generation = beat.generation;
+            _heartbeat.clock = beat.clock;
+            _shutting_down = shuttingDown;
+            
+            if (shuttingDown)
+            {
+                this->set_failed();
+            }
+            else
+            {
+                this->heartbeat();
+            }
+            
+            return true;
+        }
+        
+        node_clock node::beat(bool shuttingDown)
+        {
+            std::lock_guard<std::mutex> lock(_heartbeat_lock);
+            
+            ++_heartbeat.clock;
+            _shutting_down = shuttingDown;
+            
+            return _heartbeat;
+        }
+        
         sopmq::node::intra::inode_operations& node::operations()
         {
             if (_operations_handler)
             {
                 return *_operations_handler;
             }
+            else if (is_self())
+            {
+                //this is a local operation, ops should've been constructed already
+                throw std::logic_error("tried to return non-constructed operations for a local node");
+            }
             else
             {
-                //we dont have a handler yet to make calls.
-                //determine the type of handler we need and create it
-                if (is_self())
-                {
-                    //this is a local operation, ops should've been constructed already
-                    throw std::logic_error("tried to return non-constructed operations for a local node");
-                }
-                else
-                {
-                    
-                }
-                
-                return *_operations_handler;
+                //remote operations need the IO service their connections run on, so
+                //whoever adds the node to the ring has to set them up
+                throw std::logic_error("tried to return non-constructed operations for a remote node");
             }
         }
         
@@ -117,14 +184,72 @@ namespace sopmq {
             return self;
         }
         
-        void node::init_local_operations(sopmq::node::ring& ring)
+        void node::init_local_operations(sopmq::node::ring& ring, queue_manager3& queueManager,
+                                         io_service_pool* ioServices)
+        {
+            _operations_handler.reset(new sopmq::node::intra::local_node_operations(ring, *this, _clock, queueManager,
+                                                                                    ioServices));
+        }
+        
+        void node::init_remote_operations(boost::asio::io_service& ioService)
         {
-            _operations_handler.reset(new sopmq::node::intra::local_node_operations(ring, *this, _clock));
+            _operations_handler.reset(new sopmq::node::intra::remote_node_operations(ioService, _endpoint));
         }
         
         node_clock& node::clock()
         {
             return _clock;
         }
+        
+        void node::request_started()
+        {
+            _in_flight.fetch_add(1, std::memory_order_relaxed);
+        }
+        
+        void node::request_finished(std::chrono::microseconds latency)
+        {
+            _in_flight.fetch_sub(1, std::memory_order_relaxed);
+            
+            this->add_latency_sample(latency.count() > 0 ? (std::uint64_t)latency.count() : 1);
+        }
+        
+        void node::request_failed()
+        {
+            _in_flight.fetch_sub(1, std::memory_order_relaxed);
+            
+            auto timeout = std::chrono::seconds(settings::instance().defaultTimeout);
+            this->add_latency_sample((std::uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(timeout).count());
+        }
+        
+        void node::add_latency_sample(std::uint64_t sample)
+        {
+            std::uint64_t current = _latency_estimate.load(std::memory_order_relaxed);
+            std::uint64_t updated;
+            
+            do
+            {
+                //the first answer sets the estimate outright
+                updated = current == 0
+                    ? sample
+                    : current - current / LATENCY_WEIGHT + sample / LATENCY_WEIGHT;
+            }
+            while (! _latency_estimate.compare_exchange_weak(current, updated, std::memory_order_relaxed));
+        }
+        
+        std::uint64_t node::latency_estimate() const
+        {
+            return _latency_estimate.load(std::memory_order_relaxed);
+        }
+        
+        std::uint32_t node::in_flight() const
+        {
+            return _in_flight.load(std::memory_order_relaxed);
+        }
+        
+        std::uint64_t node::request_cost() const
+        {
+            //a node we haven't heard from yet looks as cheap as can be, so it gets tried
+            return (this->latency_estimate() + 1) * (this->in_flight() + 1);
+        }
     }
-}
\ No newline at end of file
+}
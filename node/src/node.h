@@ -25,10 +25,15 @@
 #include "node_clock.h"
 
 #include <memory>
+#include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/chrono.hpp>
 
 #include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
 #include <cstdint>
 
 
@@ -36,6 +41,10 @@ namespace sopmq {
     namespace node {
         
         class ring;
+        class io_service_pool;
+        
+        template <size_t RF>
+        class queue_manager;
         
         ///
         /// Represents a node that we're aware of in our ring that can service
@@ -62,6 +71,13 @@ namespace sopmq {
             ///
             uint128 range_start() const;
             
+            ///
+            /// Returns the points on the ring this node owns. The first is the range
+            /// start, the others are derived from it so that every node in the ring
+            /// works out the same ones
+            ///
+            const std::vector<uint128>& tokens() const;
+            
             ///
             /// Returns the endpoint to reach this node
             ///
@@ -89,6 +105,28 @@ namespace sopmq {
             ///
             void set_failed();
             
+            ///
+            /// Returns the newest heartbeat we know of from this node: the generation
+            /// it is running under and how many times it has beaten since it started
+            /// \param shuttingDown If given, set to whether that heartbeat said the node
+            /// is shutting down
+            ///
+            node_clock heartbeat_clock(bool* shuttingDown = nullptr) const;
+            
+            ///
+            /// Takes a heartbeat of this node heard through gossip or carried on one of
+            /// its messages. One newer than we had counts as a heartbeat, or marks the
+            /// node failed if it says the node is shutting down
+            /// \return Whether the heartbeat was newer than the one we had
+            ///
+            bool observe_heartbeat(const node_clock& beat, bool shuttingDown = false);
+            
+            ///
+            /// Advances the heartbeat of the node we are running as. Only its gossiper
+            /// does this
+            ///
+            node_clock beat(bool shuttingDown = false);
+            
             ///
             /// Returns an interface to operations that can be performed on this node
             ///
@@ -100,15 +138,58 @@ namespace sopmq {
             static node::ptr get_self();
             
             ///
-            /// Creates inode_operations to perform tasks on the local node
+            /// Creates inode_operations to perform tasks on the local node. Given the
+            /// node's io_services, each queue's work runs on the one that owns it
             ///
-            void init_local_operations(ring& ring);
+            void init_local_operations(ring& ring, queue_manager<3>& queueManager,
+                                       io_service_pool* ioServices = nullptr);
+            
+            ///
+            /// Creates inode_operations to perform tasks on this node over the network.
+            /// Connections to the node are opened when the first operation is sent
+            ///
+            void init_remote_operations(boost::asio::io_service& ioService);
             
             ///
             /// Returns the clock associated with this node
             ///
             node_clock& clock();
             
+            ///
+            /// Notes that a request was sent to this node
+            ///
+            void request_started();
+            
+            ///
+            /// Notes that a request sent to this node was answered successfully
+            /// after the given time
+            ///
+            void request_finished(std::chrono::microseconds latency);
+            
+            ///
+            /// Notes that a request sent to this node failed. However quickly it
+            /// failed, it counts as a request that took the whole operation timeout,
+            /// so a node that fails fast doesn't look like the cheapest one to use
+            ///
+            void request_failed();
+            
+            ///
+            /// Returns the moving average of how long this node has taken to answer
+            /// requests, in microseconds. 0 until it has answered one
+            ///
+            std::uint64_t latency_estimate() const;
+            
+            ///
+            /// Returns the number of requests sent to this node not yet answered
+            ///
+            std::uint32_t in_flight() const;
+            
+            ///
+            /// Returns how costly sending this node another request looks, from its
+            /// latency and the requests already waiting on it. Lower is better
+            ///
+            std::uint64_t request_cost() const;
+            
             
         private:
             ///
@@ -121,6 +202,11 @@ namespace sopmq {
             ///
             uint128 _range_start;
             
+            ///
+            /// Our points on the ring, one per virtual node
+            ///
+            std::vector<uint128> _tokens;
+            
             ///
             /// The endpoint to contact this node at
             ///
@@ -139,12 +225,41 @@ namespace sopmq {
             ///
             /// Whether or not this node has been forced into down status
             ///
-            bool _forced_failure;
+            std::atomic<bool> _forced_failure;
             
             ///
             /// The clock for this node
             ///
             node_clock _clock;
+            
+            ///
+            /// Heartbeats come from the gossiper and from any connection a message
+            /// of the node's arrives on
+            ///
+            mutable std::mutex _heartbeat_lock;
+            
+            ///
+            /// The newest heartbeat we know of
+            ///
+            node_clock _heartbeat;
+            bool _shutting_down;
+            
+            ///
+            /// Each new latency moves the estimate 1 / LATENCY_WEIGHT of the way to it
+            ///
+            static const std::uint64_t LATENCY_WEIGHT = 8;
+            
+            void add_latency_sample(std::uint64_t sample);
+            
+            ///
+            /// Moving average of the node's request latency in microseconds
+            ///
+            std::atomic<std::uint64_t> _latency_estimate;
+            
+            ///
+            /// Requests sent to this node that haven't been answered
+            ///
+            std::atomic<std::uint32_t> _in_flight;
         };
     }
 }
@@ -132,6 +132,7 @@ int do_create_user()
     }
     
     try {
+        cassandra_storage::instance().connect();
         user_account::create(args[0], args[1], userLevel);
     } catch (const std::exception& e) {
         BOOST_LOG_TRIVIAL(fatal) << "error creating user: " << e.what();
@@ -0,0 +1,439 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__ordered_message_buffer__
+#define __sopmq__ordered_message_buffer__
+
+#include "queued_message.h"
+#include "vector_clock.h"
+
+#include <array>
+#include <deque>
+#include <memory>
+#include <cstddef>
+#include <utility>
+
+namespace sopmq {
+    namespace node {
+
+        ///
+        /// \brief Stamped messages kept sorted by vector clock in contiguous chunks
+        ///
+        /// Messages are almost always stamped in clock order, so the common case is
+        /// an append to the tail. Out of order stamps are placed with a binary search
+        /// and shift the tail down by one slot. Removed messages leave a tombstone that
+        /// keeps its clock so searches stay valid; tombstones are trimmed from the
+        /// ends and compacted away once they outnumber the live messages.
+        ///
+        /// Chunks emptied from the front are recycled onto the tail so a queue in
+        /// steady state doesn't touch the allocator at all.
+        ///
+        /// \tparam RF Replication factor
+        ///
+        template <size_t RF>
+        class ordered_message_buffer
+        {
+        public:
+            typedef queued_message<RF> queued_messageX;
+            typedef typename queued_messageX::ptr message_ptr;
+
+            ///
+            /// Number of messages stored in each contiguous chunk
+            ///
+            static const size_t CHUNK_SIZE = 16;
+
+        public:
+            ordered_message_buffer()
+            : _head(0), _size(0), _live(0)
+            {
+            }
+
+            ordered_message_buffer(ordered_message_buffer&& other)
+            : _chunks(std::move(other._chunks)), _spare(std::move(other._spare)),
+            _head(other._head), _size(other._size), _live(other._live)
+            {
+                other._head = other._size = other._live = 0;
+            }
+
+            ordered_message_buffer& operator=(ordered_message_buffer&& other)
+            {
+                _chunks = std::move(other._chunks);
+                _spare = std::move(other._spare);
+                _head = other._head;
+                _size = other._size;
+                _live = other._live;
+                other._head = other._size = other._live = 0;
+
+                return *this;
+            }
+
+            ///
+            /// \brief Inserts the message after all messages with a clock less than
+            /// or equal to the given clock
+            ///
+            void insert(const vector_clock<RF>& clock, message_ptr message)
+            {
+                if (_size == 0 || !(clock < this->at(_size - 1).clock))
+                {
+                    //fast path, the message is in order
+                    this->push_back();
+                    entry& e = this->at(_size - 1);
+                    e.clock = clock;
+                    e.message = std::move(message);
+                }
+                else
+                {
+                    size_t pos = this->upper_bound(clock);
+
+                    this->push_back();
+                    for (size_t i = _size - 1; i > pos; --i)
+                    {
+                        this->at(i) = std::move(this->at(i - 1));
+                    }
+
+                    entry& e = this->at(pos);
+                    e.clock = clock;
+                    e.message = std::move(message);
+                }
+
+                ++_live;
+            }
+
+            ///
+            /// \brief Removes the given message, which must have been inserted with
+            /// the clock it currently holds
+            /// \return Whether or not the message was found
+            ///
+            bool remove(const queued_messageX* message)
+            {
+                const vector_clock<RF>& clock = message->clock();
+
+                size_t pos = this->lower_bound(clock);
+                while (pos < _size && !(clock < this->at(pos).clock) && this->at(pos).message.get() != message)
+                {
+                    ++pos;
+                }
+
+                if (pos >= _size || this->at(pos).message.get() != message)
+                {
+                    //vector clocks from mismatched quorums aren't strictly ordered,
+                    //so fall back to looking at everything
+                    for (pos = 0; pos < _size; ++pos)
+                    {
+                        if (this->at(pos).message.get() == message) break;
+                    }
+
+                    if (pos == _size) return false;
+                }
+
+                this->at(pos).message.reset();
+                --_live;
+
+                this->trim();
+
+                return true;
+            }
+
+            ///
+            /// \brief Removes every live message with a clock less than or equal to
+            /// the given clock in one pass
+            /// \param func Called with each message before it is removed
+            /// \return The number of messages removed
+            ///
+            template <typename F>
+            size_t remove_through(const vector_clock<RF>& clock, F func)
+            {
+                size_t end = this->upper_bound(clock);
+                size_t removed = 0;
+
+                for (size_t pos = 0; pos < end; ++pos)
+                {
+                    entry& e = this->at(pos);
+                    if (! e.message) continue;
+
+                    func(e.message);
+                    e.message.reset();
+                    ++removed;
+                }
+
+                _live -= removed;
+                this->trim();
+
+                return removed;
+            }
+
+            ///
+            /// \brief Returns the oldest live message. The buffer must not be empty
+            ///
+            const message_ptr& front() const
+            {
+                return this->at(0).message;
+            }
+
+            ///
+            /// \brief Returns the newest live message. The buffer must not be empty
+            ///
+            const message_ptr& back() const
+            {
+                return this->at(_size - 1).message;
+            }
+
+            ///
+            /// \brief Removes and returns the oldest live message. The buffer must
+            /// not be empty
+            ///
+            message_ptr pop_front()
+            {
+                message_ptr message = std::move(this->at(0).message);
+                --_live;
+
+                this->trim();
+
+                return message;
+            }
+
+            ///
+            /// \brief Calls the given function for every live message in order
+            ///
+            template <typename F>
+            void for_each(F func) const
+            {
+                this->for_each_from(0, func);
+            }
+
+            ///
+            /// \brief Calls the given function in order for every live message
+            /// with a clock greater than the given clock
+            ///
+            template <typename F>
+            void for_each_after(const vector_clock<RF>& clock, F func) const
+            {
+                this->for_each_from(this->upper_bound(clock), func);
+            }
+
+            ///
+            /// \brief Calls the given function in order for every live message with
+            /// a clock greater than the given clock, or from the start when there is
+            /// no clock, until it returns false
+            ///
+            template <typename F>
+            void visit_after(const vector_clock<RF>* clock, F func) const
+            {
+                size_t pos = clock == nullptr ? 0 : this->upper_bound(*clock);
+                for (; pos < _size; ++pos)
+                {
+                    const entry& e = this->at(pos);
+                    if (e.message && !func(e.message)) return;
+                }
+            }
+
+            ///
+            /// \brief The number of live messages in the buffer
+            ///
+            size_t size() const
+            {
+                return _live;
+            }
+
+            bool empty() const
+            {
+                return _live == 0;
+            }
+
+        private:
+            struct entry
+            {
+                vector_clock<RF> clock;
+                message_ptr message;
+            };
+
+            typedef std::array<entry, CHUNK_SIZE> chunk;
+
+            ///
+            /// Chunks in order. The first live slot is _head in the first chunk. A deque
+            /// so the front chunk can be let go of without moving the rest
+            ///
+            std::deque<std::unique_ptr<chunk>> _chunks;
+
+            ///
+            /// A single empty chunk kept around for reuse
+            ///
+            std::unique_ptr<chunk> _spare;
+
+            size_t _head;
+
+            ///
+            /// Number of occupied slots including tombstones
+            ///
+            size_t _size;
+
+            ///
+            /// Number of slots holding a message
+            ///
+            size_t _live;
+
+            entry& at(size_t pos)
+            {
+                size_t slot = _head + pos;
+                return (*_chunks[slot / CHUNK_SIZE])[slot % CHUNK_SIZE];
+            }
+
+            const entry& at(size_t pos) const
+            {
+                size_t slot = _head + pos;
+                return (*_chunks[slot / CHUNK_SIZE])[slot % CHUNK_SIZE];
+            }
+
+            size_t lower_bound(const vector_clock<RF>& clock) const
+            {
+                size_t first = 0, count = _size;
+                while (count > 0)
+                {
+                    size_t step = count / 2;
+                    if (this->at(first + step).clock < clock)
+                    {
+                        first += step + 1;
+                        count -= step + 1;
+                    }
+                    else
+                    {
+                        count = step;
+                    }
+                }
+
+                return first;
+            }
+
+            size_t upper_bound(const vector_clock<RF>& clock) const
+            {
+                size_t first = 0, count = _size;
+                while (count > 0)
+                {
+                    size_t step = count / 2;
+                    if (!(clock < this->at(first + step).clock))
+                    {
+                        first += step + 1;
+                        count -= step + 1;
+                    }
+                    else
+                    {
+                        count = step;
+                    }
+                }
+
+                return first;
+            }
+
+            template <typename F>
+            void for_each_from(size_t pos, F& func) const
+            {
+                for (; pos < _size; ++pos)
+                {
+                    const entry& e = this->at(pos);
+                    if (e.message) func(e.message);
+                }
+            }
+
+            ///
+            /// Adds an empty slot to the end of the buffer
+            ///
+            void push_back()
+            {
+                if (_head + _size == _chunks.size() * CHUNK_SIZE)
+                {
+                    if (_spare)
+                    {
+                        _chunks.push_back(std::move(_spare));
+                    }
+                    else
+                    {
+                        _chunks.emplace_back(new chunk());
+                    }
+                }
+
+                ++_size;
+            }
+
+            ///
+            /// Drops tombstones from both ends and compacts when they make up
+            /// the majority of the buffer
+            ///
+            void trim()
+            {
+                while (_size > 0 && !this->at(0).message)
+                {
+                    ++_head;
+                    --_size;
+
+                    if (_head == CHUNK_SIZE)
+                    {
+                        this->release_front_chunk();
+                    }
+                }
+
+                while (_size > 0 && !this->at(_size - 1).message)
+                {
+                    --_size;
+                }
+
+                if (_size == 0)
+                {
+                    _head = 0;
+                    if (! _chunks.empty()) _spare = std::move(_chunks.front());
+                    _chunks.clear();
+                    return;
+                }
+
+                if (_size - _live > _live && _size > CHUNK_SIZE)
+                {
+                    this->compact();
+                }
+            }
+
+            void compact()
+            {
+                size_t out = 0;
+                for (size_t in = 0; in < _size; ++in)
+                {
+                    if (this->at(in).message)
+                    {
+                        if (in != out) this->at(out) = std::move(this->at(in));
+                        ++out;
+                    }
+                }
+
+                _size = out;
+
+                while (_chunks.size() > 1 && (_head + _size) <= (_chunks.size() - 1) * CHUNK_SIZE)
+                {
+                    _spare = std::move(_chunks.back());
+                    _chunks.pop_back();
+                }
+            }
+
+            void release_front_chunk()
+            {
+                _spare = std::move(_chunks.front());
+                _chunks.pop_front();
+                _head = 0;
+            }
+        };
+
+    }
+}
+
+#endif /* defined(__sopmq__ordered_message_buffer__) */
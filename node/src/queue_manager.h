@@ -23,11 +23,17 @@
 #include "uint128.h"
 #include "movable_noncopyable.h"
 
-#include <boost/heap/fibonacci_heap.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/chrono.hpp>
 
-#include <thread>
+#include <mutex>
+#include <atomic>
 #include <unordered_map>
-#include <tuple>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <algorithm>
 
 namespace sopmq {
     namespace node {
@@ -35,17 +41,59 @@ namespace sopmq {
         ///
         /// Manages all the queues in memory on a node
         ///
+        /// Queues are spread over a power of two number of shards by their id. Each
+        /// shard has its own reader/writer lock so that operations on existing
+        /// queues only take a shared lock, and producers working on different
+        /// shards never contend with each other.
+        ///
+        /// Every message is scheduled on its shard's timing wheel with its own TTL
+        /// when it is enqueued, and rescheduled when it is stamped. Expiring
+        /// messages only touches the ones that are due.
+        ///
         template <size_t RF>
         class queue_manager : public shared::movable_noncopyable
         {
         public:
             typedef message_queue<RF> message_queueX;
             typedef vector_clock<RF> vector_clockX;
+            typedef boost::chrono::steady_clock::time_point time_point;
+            
+            ///
+            /// Called when a message is scheduled to expire before the time
+            /// expire_due() last asked to be called again
+            ///
+            typedef std::function<void(time_point)> expiry_callback;
+            
+            typedef typename message_queueX::queued_message_ptr queued_message_ptr;
+            
+            ///
+            /// Called with each message stamped on a queue that has subscribers. It
+            /// runs with the queue's shard locked and must not call back into us
+            ///
+            typedef std::function<void(const queued_message_ptr&)> stamp_listener;
+            
+            ///
+            /// The default number of shards used to spread out queue locks
+            ///
+            static const size_t DEFAULT_SHARD_COUNT = 64;
             
         public:
-            queue_manager()
+            ///
+            /// \brief CTOR
+            /// \param shardCount The number of lock shards, rounded up to a power of two
+            ///
+            queue_manager(size_t shardCount = DEFAULT_SHARD_COUNT)
+            : _wakeup_at(time_point::max().time_since_epoch().count()), _next_listener_id(1)
             {
+                size_t count = 1;
+                while (count < shardCount) count <<= 1;
+                
+                for (size_t i = 0; i < count; ++i)
+                {
+                    _shards.emplace_back(new shard());
+                }
                 
+                _shard_mask = count - 1;
             }
             
             virtual ~queue_manager()
@@ -54,28 +102,25 @@ namespace sopmq {
             }
             
             ///
-            /// Returns a queue for the queue id
+            /// Returns a queue for the queue id. The reference is only guaranteed to
+            /// stay valid until the queue has been expired and removed
             ///
             message_queueX& get_queue(const uint128& queueId)
             {
-                std::lock_guard<std::mutex> lock(_list_lock);
+                shard& s = this->shard_for(queueId);
                 
-                auto qiter = _queues.find(queueId);
-                if (qiter == _queues.end())
                 {
-                    typename expiry_heap_t::handle_type t;
-                    auto iter = _queues.emplace(queueId, queue_tuple_t(message_queueX(queueId), t));
-                    queue_tuple_t& val = iter.first->second;
-                    message_queueX& queue = std::get<0>(val);
-                    auto handle = _queues_by_expiration.push(&queue);
-                    std::get<1>(val) = handle;
+                    boost::shared_lock<boost::shared_mutex> lock(s.lock);
                     
-                    return queue;
-                }
-                else
-                {
-                    return std::get<0>(qiter->second);
+                    auto qiter = s.queues.find(queueId);
+                    if (qiter != s.queues.end())
+                    {
+                        return qiter->second;
+                    }
                 }
+                
+                std::lock_guard<boost::shared_mutex> lock(s.lock);
+                return this->find_or_create(s, queueId);
             }
             
             ///
@@ -84,9 +129,12 @@ namespace sopmq {
             void enqueue_message(const uint128& queueId, const boost::uuids::uuid& messageId,
                                  std::string* data, uint32_t ttlSecs)
             {
-                auto& queue = this->get_queue(queueId);
+                time_point deadline;
+                this->with_queue(queueId, [&](message_queueX& queue) {
+                    deadline = queue.enqueue(messageId, data, ttlSecs);
+                });
                 
-                queue.enqueue(messageId, data, ttlSecs);
+                this->deadline_scheduled(deadline);
             }
             
             
@@ -96,20 +144,374 @@ namespace sopmq {
             void stamp_message(const uint128& queueId, const boost::uuids::uuid& messageId,
                                const vector_clockX& clock)
             {
-                auto& queue = this->get_queue(queueId);
-                queue.stamp(messageId, clock);
+                //stamping restarts the message's TTL which can only push its
+                //deadline out, so there is no need to wake the scheduler
+                shard& s = this->shard_for(queueId);
+                
+                this->with_queue(queueId, [&](message_queueX& queue) {
+                    queued_message_ptr stamped;
+                    if (! queue.stamp(messageId, clock, &stamped)) return;
+                    
+                    //the shard lock is held, so the listeners can't change under us
+                    auto liter = s.listeners.find(queueId);
+                    if (liter == s.listeners.end()) return;
+                    
+                    for (auto& listener : liter->second)
+                    {
+                        listener.second(stamped);
+                    }
+                });
+            }
+            
+            ///
+            /// \brief Registers a function to be called whenever a message on the
+            /// queue is stamped
+            /// \return An id to pass to unsubscribe()
+            ///
+            size_t subscribe(const uint128& queueId, stamp_listener listener)
+            {
+                shard& s = this->shard_for(queueId);
+                
+                std::lock_guard<boost::shared_mutex> lock(s.lock);
+                
+                size_t id = _next_listener_id++;
+                s.listeners[queueId].emplace_back(id, std::move(listener));
+                
+                return id;
+            }
+            
+            ///
+            /// \brief Removes a listener registered with subscribe()
+            ///
+            void unsubscribe(const uint128& queueId, size_t listenerId)
+            {
+                shard& s = this->shard_for(queueId);
+                
+                std::lock_guard<boost::shared_mutex> lock(s.lock);
+                
+                auto liter = s.listeners.find(queueId);
+                if (liter == s.listeners.end()) return;
+                
+                auto& listeners = liter->second;
+                listeners.erase(std::remove_if(listeners.begin(), listeners.end(),
+                                               [listenerId](const std::pair<size_t, stamp_listener>& l) { return l.first == listenerId; }),
+                                listeners.end());
+                
+                if (listeners.empty()) s.listeners.erase(liter);
+            }
+            
+            ///
+            /// \brief Peeks stamped messages in clock order without creating the queue
+            /// \see message_queue::peek
+            ///
+            std::vector<queued_message_ptr> peek(const uint128& queueId, const vector_clockX* after,
+                                                 size_t maxMessages, size_t maxBytes)
+            {
+                std::vector<queued_message_ptr> messages;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    messages = queue.peek(after, maxMessages, maxBytes);
+                });
+                
+                return messages;
+            }
+            
+            ///
+            /// \brief Removes a stamped message from its queue
+            /// \return Whether or not the message was still there
+            ///
+            bool claim_message(const uint128& queueId, const boost::uuids::uuid& messageId)
+            {
+                bool claimed = false;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    claimed = queue.claim(messageId);
+                });
+                
+                return claimed;
+            }
+            
+            ///
+            /// \brief Removes a set of stamped messages from their queue at once
+            /// \return The number of messages that were still there
+            ///
+            size_t claim_messages(const uint128& queueId, const std::vector<boost::uuids::uuid>& messageIds)
+            {
+                size_t claimed = 0;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    claimed = queue.claim(messageIds);
+                });
+                
+                return claimed;
+            }
+            
+            ///
+            /// \brief Removes every stamped message on the queue up to and including
+            /// the given clock
+            /// \return The number of messages removed
+            ///
+            size_t claim_through(const uint128& queueId, const vector_clockX& clock)
+            {
+                size_t claimed = 0;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    claimed = queue.claim_through(clock);
+                });
+                
+                return claimed;
+            }
+            
+            ///
+            /// \brief Gets the furthest clock the queue has been claimed through
+            /// \return Whether the queue exists and has been claimed that way
+            ///
+            bool claim_cursor(const uint128& queueId, vector_clockX& clock)
+            {
+                bool found = false;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    found = queue.claim_cursor(clock);
+                });
+                
+                return found;
+            }
+            
+            ///
+            /// \brief Gets the clock of the newest stamped message on the queue
+            /// \return Whether or not the queue had a stamped message
+            ///
+            bool back_clock(const uint128& queueId, vector_clockX& clock)
+            {
+                bool found = false;
+                this->with_existing_queue(queueId, [&](message_queueX& queue) {
+                    found = queue.back_clock(clock);
+                });
+                
+                return found;
+            }
+            
+            ///
+            /// \brief Expires every message that is due and removes queues that are
+            /// left empty
+            /// \return The next time this should be called
+            ///
+            time_point expire_due(time_point now)
+            {
+                //anything scheduled while we look for the next deadline has to be
+                //reported, otherwise it could be missed by the scan below
+                _wakeup_at = time_point::max().time_since_epoch().count();
+                
+                for (auto& sp : _shards)
+                {
+                    shard& s = *sp;
+                    
+                    //holding the shard exclusively keeps queue operations, which take
+                    //the queue lock before the wheel lock, out of the way
+                    std::lock_guard<boost::shared_mutex> lock(s.lock);
+                    
+                    s.wheel.advance(now, [&](typename message_queueX::queued_messageX* message) {
+                        message_queueX* queue = message->owner();
+                        queue->remove_expired(message);
+                        
+                        if (queue->total_count() == 0)
+                        {
+                            s.queues.erase(queue->queue_id());
+                        }
+                    });
+                }
+                
+                time_point next = this->next_deadline();
+                
+                std::lock_guard<std::mutex> lock(_callback_lock);
+                if (next.time_since_epoch().count() < _wakeup_at.load())
+                {
+                    _wakeup_at = next.time_since_epoch().count();
+                }
+                
+                return next;
+            }
+            
+            ///
+            /// \brief The earliest time any message is due to expire
+            ///
+            time_point next_deadline()
+            {
+                time_point next = time_point::max();
+                
+                for (auto& s : _shards)
+                {
+                    next = std::min(next, s->wheel.next_expiry());
+                }
+                
+                return next;
+            }
+            
+            ///
+            /// \brief Sets the function to call when an earlier expiry deadline is
+            /// scheduled. Pass an empty function to clear it
+            ///
+            void set_expiry_callback(expiry_callback callback)
+            {
+                std::lock_guard<std::mutex> lock(_callback_lock);
+                _expiry_callback = callback;
+                _wakeup_at = time_point::max().time_since_epoch().count();
+            }
+            
+            ///
+            /// \brief The number of lock shards
+            ///
+            size_t shard_count() const
+            {
+                return _shards.size();
+            }
+            
+            ///
+            /// \brief The total number of queues across all shards
+            ///
+            size_t queue_count()
+            {
+                size_t count = 0;
+                for (auto& s : _shards)
+                {
+                    boost::shared_lock<boost::shared_mutex> lock(s->lock);
+                    count += s->queues.size();
+                }
+                
+                return count;
+            }
+            
+            ///
+            /// \brief The total number of messages waiting to expire
+            ///
+            size_t scheduled_count()
+            {
+                size_t count = 0;
+                for (auto& s : _shards)
+                {
+                    count += s->wheel.size();
+                }
+                
+                return count;
             }
             
             
         private:
-            typedef boost::heap::fibonacci_heap<message_queueX*> expiry_heap_t;
-            typedef std::pair<message_queueX, typename expiry_heap_t::handle_type> queue_tuple_t;
-            typedef std::unordered_map<uint128, queue_tuple_t> queue_map_t;
+            typedef std::unordered_map<uint128, message_queueX> queue_map_t;
             
-            std::mutex _list_lock;
+            ///
+            /// A set of queues sharing a lock and an expiry wheel
+            ///
+            struct shard
+            {
+                ///
+                /// Protects the queue map. Held shared for operations on existing queues
+                ///
+                boost::shared_mutex lock;
+                
+                ///
+                /// Declared before the queues so it outlives the messages scheduled on it
+                ///
+                typename message_queueX::expiry_wheel wheel;
+                
+                queue_map_t queues;
+                
+                ///
+                /// Subscribers by queue. Kept apart from the queues so that they outlive
+                /// a queue being emptied and removed
+                ///
+                std::unordered_map<uint128, std::vector<std::pair<size_t, stamp_listener>>> listeners;
+            };
             
-            queue_map_t _queues;
-            expiry_heap_t _queues_by_expiration;
+            std::vector<std::unique_ptr<shard>> _shards;
+            size_t _shard_mask;
+            
+            ///
+            /// When the scheduler expects to call expire_due() next. Deadlines before
+            /// this have to be passed to the expiry callback
+            ///
+            std::atomic<boost::chrono::steady_clock::rep> _wakeup_at;
+            
+            std::mutex _callback_lock;
+            expiry_callback _expiry_callback;
+            
+            std::atomic<size_t> _next_listener_id;
+            
+            shard& shard_for(const uint128& queueId)
+            {
+                //queue ids are murmur hashes, so any bits will do. the map inside
+                //the shard buckets mostly on the low word so use the high one here
+                return *_shards[queueId.hi & _shard_mask];
+            }
+            
+            ///
+            /// Returns the queue for the given id, creating it if needed. The
+            /// shard must be exclusively locked
+            ///
+            message_queueX& find_or_create(shard& s, const uint128& queueId)
+            {
+                auto qiter = s.queues.find(queueId);
+                if (qiter != s.queues.end())
+                {
+                    return qiter->second;
+                }
+                
+                auto iter = s.queues.emplace(queueId, message_queueX(queueId, &s.wheel));
+                return iter.first->second;
+            }
+            
+            ///
+            /// Lets the scheduler know about a deadline earlier than it planned to wake
+            ///
+            void deadline_scheduled(time_point deadline)
+            {
+                auto count = deadline.time_since_epoch().count();
+                if (count >= _wakeup_at.load(std::memory_order_relaxed)) return;
+                
+                std::lock_guard<std::mutex> lock(_callback_lock);
+                
+                if (count >= _wakeup_at.load()) return;
+                _wakeup_at = count;
+                
+                if (_expiry_callback) _expiry_callback(deadline);
+            }
+            
+            ///
+            /// Runs the given function against the queue while holding the shard
+            /// lock shared so the queue can't be removed out from under it. The
+            /// exclusive lock is only taken when the queue has to be created
+            ///
+            template <typename F>
+            void with_queue(const uint128& queueId, F func)
+            {
+                shard& s = this->shard_for(queueId);
+                
+                {
+                    boost::shared_lock<boost::shared_mutex> lock(s.lock);
+                    
+                    auto qiter = s.queues.find(queueId);
+                    if (qiter != s.queues.end())
+                    {
+                        func(qiter->second);
+                        return;
+                    }
+                }
+                
+                std::lock_guard<boost::shared_mutex> lock(s.lock);
+                func(this->find_or_create(s, queueId));
+            }
+            
+            ///
+            /// Runs the given function against the queue if it exists
+            ///
+            template <typename F>
+            void with_existing_queue(const uint128& queueId, F func)
+            {
+                shard& s = this->shard_for(queueId);
+                
+                boost::shared_lock<boost::shared_mutex> lock(s.lock);
+                
+                auto qiter = s.queues.find(queueId);
+                if (qiter != s.queues.end())
+                {
+                    func(qiter->second);
+                }
+            }
         };
         
         typedef queue_manager<3> queue_manager3;
@@ -0,0 +1,282 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "queue_subscription.h"
+
+#include "messageutil.h"
+#include "util.h"
+#include "logging.h"
+
+#include "DeliveryMessage.pb.h"
+#include "Delivery.pb.h"
+#include "VectorClock.pb.h"
+
+#include <algorithm>
+#include <iterator>
+
+using sopmq::message::messageutil;
+using sopmq::shared::util;
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+
+        const size_t queue_subscription::MAX_FRAME_MESSAGES;
+        const size_t queue_subscription::MAX_FRAME_BYTES;
+        const size_t queue_subscription::MAX_LATE_MESSAGES;
+        const std::uint64_t queue_subscription::MAX_CREDIT;
+
+        queue_subscription::queue_subscription(ba::io_service& ioService, queue_manager3& queueManager,
+                                               const uint128& queueId, std::uint32_t subscriptionId,
+                                               bool claimBacklog, bool claimNew, send_function send)
+        : _ioService(ioService), _queue_manager(queueManager), _queue_id(queueId),
+        _subscription_id(subscriptionId), _claim_backlog(claimBacklog), _claim_new(claimNew),
+        _send(send), _listener_id(0), _has_cursor(false), _has_backlog(false),
+        _credit_messages(0), _credit_bytes(0), _delivered(0), _pump_pending(false),
+        _stopped(false)
+        {
+
+        }
+
+        queue_subscription::~queue_subscription()
+        {
+            //also waits out a listener call that is running right now
+            if (_listener_id != 0) _queue_manager.unsubscribe(_queue_id, _listener_id);
+        }
+
+        void queue_subscription::start(start_position position, std::uint32_t creditMessages, std::uint32_t creditBytes)
+        {
+            if (_stopped) return;
+
+            _self = shared_from_this();
+            _credit_messages = creditMessages;
+            _credit_bytes = creditBytes;
+
+            _has_backlog = _queue_manager.back_clock(_queue_id, _backlog_end);
+            if (position == SP_NEW && _has_backlog)
+            {
+                _cursor = _backlog_end;
+                _has_cursor = true;
+            }
+            else if (position == SP_OLDEST)
+            {
+                //a consumer that claimed through a clock is done with everything before it
+                _has_cursor = _queue_manager.claim_cursor(_queue_id, _cursor);
+            }
+
+            //the destructor unsubscribes before we go away, so the listener can hold
+            //on to us directly
+            _listener_id = _queue_manager.subscribe(_queue_id, [this](const queued_message_ptr& message) {
+                this->on_stamped(message);
+            });
+
+            this->pump();
+        }
+
+        void queue_subscription::add_credit(std::uint32_t messages, std::uint32_t bytes)
+        {
+            _credit_messages = std::min<std::int64_t>(_credit_messages + messages, MAX_CREDIT);
+            _credit_bytes = std::min<std::int64_t>(_credit_bytes + bytes, MAX_CREDIT);
+
+            this->pump();
+        }
+
+        void queue_subscription::add_stored(std::vector<storage::stored_message> messages)
+        {
+            if (_stopped) return;
+
+            std::move(messages.begin(), messages.end(), std::back_inserter(_stored));
+
+            this->pump();
+        }
+
+        void queue_subscription::stop()
+        {
+            _stopped = true;
+
+            if (_listener_id != 0)
+            {
+                _queue_manager.unsubscribe(_queue_id, _listener_id);
+                _listener_id = 0;
+            }
+
+            _late.clear();
+            _stored.clear();
+        }
+
+        std::uint32_t queue_subscription::subscription_id() const
+        {
+            return _subscription_id;
+        }
+
+        const uint128& queue_subscription::queue_id() const
+        {
+            return _queue_id;
+        }
+
+        std::uint64_t queue_subscription::delivered() const
+        {
+            return _delivered;
+        }
+
+        void queue_subscription::on_stamped(const queued_message_ptr& message)
+        {
+            //the queue lock is held here, so only note the message and come back
+            //to it from the IO loop
+            if (_has_cursor && !(_cursor < message->clock()))
+            {
+                //the cursor has already passed where this landed, peeking won't find it
+                if (_late.size() >= MAX_LATE_MESSAGES)
+                {
+                    LOG_SRC(warning) << "subscription " << _subscription_id
+                        << " has too many out of order messages waiting, dropping the oldest";
+
+                    _late.pop_front();
+                }
+
+                _late.push_back(message);
+            }
+
+            if (this->has_credit()) this->schedule_pump();
+        }
+
+        void queue_subscription::schedule_pump()
+        {
+            if (_pump_pending) return;
+            _pump_pending = true;
+
+            std::weak_ptr<queue_subscription> wself(_self);
+            _ioService.post([wself] {
+                if (auto self = wself.lock()) self->pump();
+            });
+        }
+
+        void queue_subscription::pump()
+        {
+            _pump_pending = false;
+            if (_stopped) return;
+
+            DeliveryMessage_ptr frame;
+            size_t frameBytes = 0;
+
+            while (! _stored.empty() && this->has_credit())
+            {
+                storage::stored_message message(std::move(_stored.front()));
+                _stored.pop_front();
+
+                //stored messages have no clock, there is nothing to claim through
+                Delivery* delivery = this->new_delivery(message.content, frame, frameBytes);
+                delivery->set_message_id(message.message_id);
+
+                this->send_if_full(frame, frameBytes);
+            }
+
+            while (! _late.empty() && this->has_credit())
+            {
+                queued_message_ptr message(std::move(_late.front()));
+                _late.pop_front();
+
+                this->add_to_frame(message, frame, frameBytes);
+            }
+
+            while (this->has_credit())
+            {
+                size_t maxMessages = (size_t)std::min<std::int64_t>(_credit_messages, MAX_FRAME_MESSAGES);
+                size_t maxBytes = (size_t)std::min<std::int64_t>(_credit_bytes, MAX_FRAME_BYTES);
+
+                auto messages = _queue_manager.peek(_queue_id, _has_cursor ? &_cursor : nullptr, maxMessages, maxBytes);
+                if (messages.empty()) break;
+
+                _cursor = messages.back()->clock();
+                _has_cursor = true;
+
+                for (auto& message : messages)
+                {
+                    this->add_to_frame(message, frame, frameBytes);
+                }
+            }
+
+            this->send_frame(frame, frameBytes);
+        }
+
+        bool queue_subscription::has_credit() const
+        {
+            return _credit_messages > 0 && _credit_bytes > 0;
+        }
+
+        bool queue_subscription::is_backlog(const queued_message_ptr& message) const
+        {
+            return _has_backlog && !(_backlog_end < message->clock());
+        }
+
+        bool queue_subscription::add_to_frame(const queued_message_ptr& message, DeliveryMessage_ptr& frame, size_t& frameBytes)
+        {
+            bool claim = this->is_backlog(message) ? _claim_backlog : _claim_new;
+
+            //another consumer got to it first, or it expired
+            if (claim && ! _queue_manager.claim_message(_queue_id, message->id())) return false;
+
+            Delivery* delivery = this->new_delivery(message->data(), frame, frameBytes);
+            delivery->set_allocated_message_id(util::uuid_to_bytes(message->id()));
+            message->clock().to_protobuf(delivery->mutable_clock());
+
+            this->send_if_full(frame, frameBytes);
+
+            return true;
+        }
+
+        Delivery* queue_subscription::new_delivery(const std::string& content, DeliveryMessage_ptr& frame, size_t& frameBytes)
+        {
+            if (! frame)
+            {
+                frame = messageutil::make_message<DeliveryMessage>(0, 0);
+                frame->set_subscription_id(_subscription_id);
+            }
+
+            Delivery* delivery = frame->add_messages();
+            delivery->set_content(content);
+
+            frameBytes += content.size();
+
+            --_credit_messages;
+            _credit_bytes -= content.size();
+            ++_delivered;
+
+            return delivery;
+        }
+
+        void queue_subscription::send_if_full(DeliveryMessage_ptr& frame, size_t& frameBytes)
+        {
+            if (frame->messages_size() >= (int)MAX_FRAME_MESSAGES || frameBytes >= MAX_FRAME_BYTES)
+            {
+                this->send_frame(frame, frameBytes);
+            }
+        }
+
+        void queue_subscription::send_frame(DeliveryMessage_ptr& frame, size_t& frameBytes)
+        {
+            if (! frame) return;
+
+            _send(frame);
+
+            frame.reset();
+            frameBytes = 0;
+        }
+
+    }
+}
@@ -0,0 +1,234 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__queue_subscription__
+#define __sopmq__queue_subscription__
+
+#include "queue_manager.h"
+#include "vector_clock.h"
+#include "message_ptrs.h"
+#include "uint128.h"
+#include "stored_message.h"
+
+#include <boost/asio.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+
+        ///
+        /// \brief Streams the messages on one queue to a consumer
+        ///
+        /// The subscription first walks the messages already stamped on the queue
+        /// with a cursor over their clocks, then pushes messages as they are stamped.
+        /// A stamp that lands behind the cursor is remembered and sent on the next
+        /// pump so it isn't skipped. Messages read back from persistent storage are
+        /// older than anything on the queue and go out ahead of it.
+        ///
+        /// Nothing is sent without credit. The consumer grants a number of messages
+        /// and bytes up front and more as it works through what it was sent, so a
+        /// slow consumer leaves its messages in the queue instead of in our write
+        /// buffers. The last message sent may take the byte credit below zero.
+        ///
+        /// Only used from the IO thread that owns the queue, which is also where
+        /// the queue's stamps are made.
+        ///
+        class queue_subscription : public boost::noncopyable,
+                                   public std::enable_shared_from_this<queue_subscription>
+        {
+        public:
+            typedef std::shared_ptr<queue_subscription> ptr;
+
+            ///
+            /// Sends a frame of messages to the consumer
+            ///
+            typedef std::function<void(DeliveryMessage_ptr)> send_function;
+
+            ///
+            /// Where the subscription starts reading the queue from
+            ///
+            enum start_position
+            {
+                ///
+                /// Only messages stamped after the subscription starts
+                ///
+                SP_NEW,
+
+                ///
+                /// Everything still on the queue past where it was last claimed through
+                ///
+                SP_OLDEST
+            };
+
+            ///
+            /// The most messages sent in one DeliveryMessage
+            ///
+            static const size_t MAX_FRAME_MESSAGES = 64;
+
+            ///
+            /// The most message data sent in one DeliveryMessage
+            ///
+            static const size_t MAX_FRAME_BYTES = 256 * 1024;
+
+            ///
+            /// The most stamps behind the cursor we hold on to. Past this the oldest
+            /// are dropped, they're still on the queue for other consumers
+            ///
+            static const size_t MAX_LATE_MESSAGES = 1024;
+
+            ///
+            /// The most credit a consumer can hold, so grants can't overflow it
+            ///
+            static const std::uint64_t MAX_CREDIT = 1ULL << 32;
+
+        public:
+            ///
+            /// \param subscriptionId Sent with every delivery so the consumer can tell
+            /// its subscriptions apart
+            /// \param claimBacklog Whether messages already on the queue when we start
+            /// are removed as they are sent rather than left for other consumers
+            /// \param claimNew Whether messages stamped after we start are removed as
+            /// they are sent
+            ///
+            queue_subscription(boost::asio::io_service& ioService, queue_manager3& queueManager,
+                               const uint128& queueId, std::uint32_t subscriptionId,
+                               bool claimBacklog, bool claimNew, send_function send);
+            virtual ~queue_subscription();
+
+            ///
+            /// \brief Starts listening to the queue and sends whatever the initial
+            /// credit allows
+            ///
+            void start(start_position position, std::uint32_t creditMessages, std::uint32_t creditBytes);
+
+            ///
+            /// \brief Grants the consumer more credit and sends what it now allows
+            ///
+            void add_credit(std::uint32_t messages, std::uint32_t bytes);
+
+            ///
+            /// \brief Sends messages read back from persistent storage ahead of the queue
+            ///
+            void add_stored(std::vector<storage::stored_message> messages);
+
+            ///
+            /// \brief Stops listening to the queue and drops whatever hasn't been sent.
+            /// Nothing more is sent after this, whatever credit arrives
+            ///
+            void stop();
+
+            std::uint32_t subscription_id() const;
+
+            const uint128& queue_id() const;
+
+            ///
+            /// \brief The number of messages sent to the consumer so far
+            ///
+            std::uint64_t delivered() const;
+
+        private:
+            typedef queue_manager3::queued_message_ptr queued_message_ptr;
+
+            boost::asio::io_service& _ioService;
+            queue_manager3& _queue_manager;
+            uint128 _queue_id;
+            std::uint32_t _subscription_id;
+            bool _claim_backlog;
+            bool _claim_new;
+            send_function _send;
+
+            ///
+            /// Set once started. The listener may still be running while we're being
+            /// destroyed elsewhere, when shared_from_this() would throw
+            ///
+            std::weak_ptr<queue_subscription> _self;
+
+            size_t _listener_id;
+
+            ///
+            /// The clock of the last message we read from the queue
+            ///
+            vector_clock3 _cursor;
+            bool _has_cursor;
+
+            ///
+            /// The clock of the newest message on the queue when we started. Anything
+            /// at or before it is backlog
+            ///
+            vector_clock3 _backlog_end;
+            bool _has_backlog;
+
+            ///
+            /// Messages that were stamped behind the cursor
+            ///
+            std::deque<queued_message_ptr> _late;
+
+            ///
+            /// Messages from persistent storage that haven't been sent yet
+            ///
+            std::deque<storage::stored_message> _stored;
+
+            std::int64_t _credit_messages;
+            std::int64_t _credit_bytes;
+            std::uint64_t _delivered;
+
+            bool _pump_pending;
+            bool _stopped;
+
+            ///
+            /// Called by the queue manager as messages are stamped
+            ///
+            void on_stamped(const queued_message_ptr& message);
+
+            ///
+            /// Sends messages for as long as there is credit and something to send
+            ///
+            void pump();
+
+            void schedule_pump();
+
+            bool has_credit() const;
+            bool is_backlog(const queued_message_ptr& message) const;
+
+            ///
+            /// Claims the message if we're meant to and adds it to the frame
+            /// \return Whether the message was added
+            ///
+            bool add_to_frame(const queued_message_ptr& message, DeliveryMessage_ptr& frame, size_t& frameBytes);
+
+            ///
+            /// Adds a delivery carrying the content to the frame, starting a new frame
+            /// if there isn't one, and charges it against the credit
+            ///
+            Delivery* new_delivery(const std::string& content, DeliveryMessage_ptr& frame, size_t& frameBytes);
+
+            void send_if_full(DeliveryMessage_ptr& frame, size_t& frameBytes);
+
+            void send_frame(DeliveryMessage_ptr& frame, size_t& frameBytes);
+        };
+
+    }
+}
+
+#endif /* defined(__sopmq__queue_subscription__) */
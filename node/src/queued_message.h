@@ -19,6 +19,7 @@
 #define __sopmq__queued_message__
 
 #include "vector_clock.h"
+#include "timing_wheel.h"
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/chrono.hpp>
@@ -30,13 +31,16 @@
 
 namespace sopmq {
     namespace node {
+        
+        template <size_t RF>
+        class message_queue;
 
         ///
         /// A message that is queued for delivery to a subscriber
         /// \tparam RF The replication factor for this message
         ///
         template <size_t RF>
-        class queued_message
+        class queued_message : public timing_wheel_hook
         {
         public:
             typedef std::shared_ptr<queued_message<RF>> ptr;
@@ -46,15 +50,16 @@ namespace sopmq {
             /// Constructs a new queued message from the data pointer and
             /// takes ownership of the data
             ///
-            queued_message(boost::uuids::uuid id, std::string* data)
-                : _id(id), _data(std::move(*data)), _local_time(boost::chrono::steady_clock::now())
+            queued_message(boost::uuids::uuid id, std::string* data, uint32_t ttlSecs = 0)
+                : _id(id), _data(std::move(*data)), _local_time(boost::chrono::steady_clock::now()),
+                _ttl_secs(ttlSecs), _owner(nullptr)
             {
             }
 
             ///
             /// Sets the vector clock value for this message
             ///
-            void set_vclock(vector_clock<RF>& mclock)
+            void set_vclock(const vector_clock<RF>& mclock)
             {
                 _vclock = mclock;
             }
@@ -92,6 +97,35 @@ namespace sopmq {
                 return _local_time;
             }
             
+            ///
+            /// The number of seconds this message lives after its local time
+            ///
+            uint32_t ttl() const
+            {
+                return _ttl_secs;
+            }
+            
+            ///
+            /// The time this message is due to expire
+            ///
+            boost::chrono::steady_clock::time_point expires_at() const
+            {
+                return _local_time + boost::chrono::seconds(_ttl_secs);
+            }
+            
+            ///
+            /// The queue this message is scheduled for expiry from, if any
+            ///
+            message_queue<RF>* owner() const
+            {
+                return _owner;
+            }
+            
+            void set_owner(message_queue<RF>* owner)
+            {
+                _owner = owner;
+            }
+            
             ///
             /// The amount of time that this message has existed on this machine
             ///
@@ -130,7 +164,9 @@ namespace sopmq {
             boost::uuids::uuid _id;
             std::string _data;
             boost::chrono::steady_clock::time_point _local_time;
+            uint32_t _ttl_secs;
             vector_clock<RF> _vclock;
+            message_queue<RF>* _owner;
         };
     }
 }
@@ -21,11 +21,15 @@
 #include "node.h"
 
 #include <boost/noncopyable.hpp>
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
 
 #include <vector>
 #include <memory>
 #include <array>
 #include <functional>
+#include <algorithm>
+#include <cstddef>
 
 namespace sopmq {
     namespace node {
@@ -33,16 +37,39 @@ namespace sopmq {
         ///
         /// Encapsulates quorum retry and failure logic
         ///
+        /// The operation goes to a quorum of the nodes first and to the rest only
+        /// if one of those fails. With hedging on, a quorum that hasn't answered
+        /// within the hedge delay also sends to the next node and takes the first
+        /// quorum of successes. That way one slow but live replica doesn't set the
+        /// operation's latency. Replies after the quorum is reached are reported
+        /// as late and don't complete or fail the operation again.
+        ///
+        /// The functions usually hold on to the quorum_logic that runs them. They
+        /// are let go of once the operation completes or fails, since nothing is
+        /// sent after that, so the quorum_logic goes away with the last reply.
+        ///
+        /// Only used from one IO thread, which is also where the hedge timer runs
+        ///
         template <std::size_t RF, typename Context>
-        class quorum_logic : public boost::noncopyable
+        class quorum_logic : public boost::noncopyable,
+                             public std::enable_shared_from_this<quorum_logic<RF, Context>>
         {
         public:
             typedef std::shared_ptr<quorum_logic> ptr;
             
+            ///
+            /// \param allNodes The nodes to try in order. Null entries, which the ring
+            /// uses for nodes it has already listed, are skipped
+            ///
             quorum_logic(const std::array<node::ptr, RF>& allNodes)
-            : _all_nodes(allNodes), _lastNode(0)
+            : _all_nodes(allNodes), _lastNode(0), _completed(false), _gave_up(false),
+            _sending(0), _release_pending(false), _hedged(0)
             {
-                
+                //a ring smaller than RF lists fewer distinct nodes. for testing purposes
+                //a quorum of all of them is enough
+                std::size_t distinct = std::count_if(_all_nodes.begin(), _all_nodes.end(),
+                                                     [](const node::ptr& n) { return (bool)n; });
+                _quorum = std::min(RF / 2 + 1, distinct);
             }
             
             ///
@@ -53,10 +80,7 @@ namespace sopmq {
             {
                 if (RF - _failed_nodes.size() > (RF / 2))
                 {
-                    if (_lastNode + 1 < RF)
-                    {
-                        return true;
-                    }
+                    return this->has_next();
                 }
                 
                 return false;
@@ -67,10 +91,12 @@ namespace sopmq {
             ///
             void run()
             {
-                for (int i = 0; i < RF - (RF / 2); ++i)
+                for (std::size_t i = 0; i < _quorum; ++i)
                 {
-                    _function(_all_nodes[_lastNode++]);
+                    if (! this->send_next()) break;
                 }
+                
+                this->arm_hedge();
             }
             
             ///
@@ -81,6 +107,16 @@ namespace sopmq {
                 _function = function;
             }
             
+            ///
+            /// Sends to the next node whenever the delay passes without a quorum of
+            /// successes. Must be set before run()
+            ///
+            void set_hedge(boost::asio::io_service& ioService, boost::asio::steady_timer::duration delay)
+            {
+                _hedge_timer.reset(new boost::asio::steady_timer(ioService));
+                _hedge_delay = delay;
+            }
+            
             ///
             /// Retrieves our context object
             ///
@@ -92,9 +128,27 @@ namespace sopmq {
             ///
             /// Marks an operation for a given node as successful
             ///
-            void node_success(node::ptr node)
+            /// \return True for the success that reaches the quorum, which the caller
+            /// should complete the operation on. False before that and for late
+            /// replies after it
+            ///
+            bool node_success(node::ptr node)
             {
+                if (_completed || _gave_up) return false;
+                
                 _success_nodes.push_back(node);
+                if (! this->operation_succeeded()) return false;
+                
+                _completed = true;
+                this->release();
+                
+                if (_hedge_timer)
+                {
+                    boost::system::error_code ec;
+                    _hedge_timer->cancel(ec);
+                }
+                
+                return true;
             }
             
             ///
@@ -102,15 +156,24 @@ namespace sopmq {
             ///
             void node_failed(node::ptr node)
             {
+                //a hedged request failing after the quorum answered changes nothing,
+                //and neither does one after we gave up
+                if (_completed || _gave_up) return;
+                
                 _failed_nodes.push_back(node);
                 
                 if (can_continue())
                 {
-                    _function(_all_nodes[_lastNode++]);
+                    this->send_next();
                 }
-                else
+                else if (! this->quorum_possible())
                 {
-                    _fail_function();
+                    _gave_up = true;
+                    
+                    std::function<void()> failFunction(std::move(_fail_function));
+                    this->release();
+                    
+                    if (failFunction) failFunction();
                 }
             }
             
@@ -119,7 +182,31 @@ namespace sopmq {
             ///
             bool operation_succeeded() const
             {
-                return _success_nodes.size() > RF / 2;
+                return _success_nodes.size() >= _quorum;
+            }
+            
+            ///
+            /// The number of successes that make up the quorum
+            ///
+            std::size_t quorum() const
+            {
+                return _quorum;
+            }
+            
+            ///
+            /// Whether the quorum has been reached and further replies are late
+            ///
+            bool completed() const
+            {
+                return _completed;
+            }
+            
+            ///
+            /// The number of nodes sent to because the quorum was slow to answer
+            ///
+            std::size_t hedged() const
+            {
+                return _hedged;
             }
             
             ///
@@ -147,7 +234,122 @@ namespace sopmq {
             std::vector<node::ptr> _success_nodes;
             std::vector<node::ptr> _failed_nodes;
             
-            int _lastNode;
+            std::size_t _lastNode;
+            std::size_t _quorum;
+            bool _completed;
+            bool _gave_up;
+            
+            ///
+            /// The number of calls to the function running right now, which can't
+            /// be let go of until they return
+            ///
+            std::size_t _sending;
+            bool _release_pending;
+            
+            std::unique_ptr<boost::asio::steady_timer> _hedge_timer;
+            boost::asio::steady_timer::duration _hedge_delay;
+            std::size_t _hedged;
+            
+            ///
+            /// Whether there is a node left that hasn't been sent to
+            ///
+            bool has_next() const
+            {
+                for (std::size_t i = _lastNode; i < RF; ++i)
+                {
+                    if (_all_nodes[i]) return true;
+                }
+                
+                return false;
+            }
+            
+            ///
+            /// Whether the nodes still waiting to answer could make up a quorum
+            ///
+            bool quorum_possible() const
+            {
+                std::size_t listed = 0;
+                for (auto& node : _all_nodes)
+                {
+                    if (node) ++listed;
+                }
+                
+                return listed - _failed_nodes.size() >= _quorum;
+            }
+            
+            bool send_next()
+            {
+                if (_completed || _gave_up) return false;
+                
+                while (_lastNode < RF)
+                {
+                    const node::ptr& node = _all_nodes[_lastNode++];
+                    if (node)
+                    {
+                        ++_sending;
+                        try
+                        {
+                            _function(node);
+                        }
+                        catch (...)
+                        {
+                            this->sent();
+                            throw;
+                        }
+                        
+                        this->sent();
+                        return true;
+                    }
+                }
+                
+                return false;
+            }
+            
+            void sent()
+            {
+                if (--_sending == 0 && _release_pending) this->release();
+            }
+            
+            ///
+            /// Lets go of the functions, which breaks the cycle through any of them
+            /// holding on to us
+            ///
+            void release()
+            {
+                if (_sending > 0)
+                {
+                    _release_pending = true;
+                    return;
+                }
+                
+                _release_pending = false;
+                _function = nullptr;
+                _fail_function = nullptr;
+            }
+            
+            void arm_hedge()
+            {
+                if (! _hedge_timer || _completed || _gave_up || ! this->has_next()) return;
+                
+                _hedge_timer->expires_from_now(_hedge_delay);
+                
+                std::weak_ptr<quorum_logic> wself(this->shared_from_this());
+                _hedge_timer->async_wait([wself](const boost::system::error_code& error) {
+                    if (error == boost::asio::error::operation_aborted) return;
+                    if (auto self = wself.lock()) self->on_hedge_timer();
+                });
+            }
+            
+            void on_hedge_timer()
+            {
+                if (_completed || _gave_up) return;
+                
+                if (this->send_next())
+                {
+                    ++_hedged;
+                    this->arm_hedge();
+                }
+            }
         };
         
     }
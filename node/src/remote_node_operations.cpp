@@ -0,0 +1,332 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "remote_node_operations.h"
+
+#include "PublishMessage.pb.h"
+#include "ProxyPublishMessage.pb.h"
+#include "ProxyPublishResponseMessage.pb.h"
+#include "ProxyPublishBatchMessage.pb.h"
+#include "ProxyPublishBatchResponseMessage.pb.h"
+#include "GossipMessage.pb.h"
+#include "StampMessage.pb.h"
+#include "QueueStamp.pb.h"
+#include "ClaimMessage.pb.h"
+#include "QueueClaim.pb.h"
+#include "Identifier.pb.h"
+
+#include "messageutil.h"
+#include "message_types.h"
+#include "network_error.h"
+#include "operation_result.h"
+#include "logging.h"
+#include "node.h"
+
+#include <memory>
+
+using sopmq::error::network_error;
+using sopmq::message::messageutil;
+using sopmq::node::connection::connection_out;
+using sopmq::node::connection::connection_pool;
+using sopmq::shared::net::network_operation_result;
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace node {
+        namespace intra {
+            
+            namespace
+            {
+                ///
+                /// Hands the reply, or the reason there isn't one, to the caller
+                ///
+                template <typename ReplyType>
+                void deliver(const network_operation_result& result, std::shared_ptr<ReplyType> reply,
+                             const typename return_message_callback_t<std::shared_ptr<ReplyType>>::type& callback)
+                {
+                    if (reply)
+                    {
+                        operation_result<std::shared_ptr<ReplyType>> opResult(reply);
+                        callback(opResult);
+                    }
+                    else
+                    {
+                        operation_result<std::shared_ptr<ReplyType>> opResult([result] {
+                            result.rethrow();
+                            throw network_error("Node did not reply");
+                        });
+                        
+                        callback(opResult);
+                    }
+                }
+                
+                ///
+                /// Carries our heartbeat on a message to the node, so that it hears from
+                /// us without waiting on gossip. Each beat only goes once per connection
+                ///
+                void piggyback_heartbeat(connection_out& conn, Identifier& identity)
+                {
+                    node_clock beat = node::get_self()->heartbeat_clock();
+                    
+                    //not gossiping yet, there's nothing to carry
+                    if (beat.generation == 0) return;
+                    
+                    if (conn.heartbeat_due(beat.clock))
+                    {
+                        beat.to_protobuf(identity.mutable_heartbeat());
+                    }
+                }
+            }
+            
+            remote_node_operations::remote_node_operations(boost::asio::io_service& ioService, const shared::net::endpoint& ep)
+            : _ioService(ioService), _pool(std::make_shared<connection_pool>(ioService, ep)),
+            _stamps(std::make_shared<pending_stamps>())
+            {
+                
+            }
+            
+            remote_node_operations::~remote_node_operations()
+            {
+                _pool->shutdown();
+            }
+            
+            const int remote_node_operations::MAX_BATCHED_STAMPS;
+            
+            const connection_pool& remote_node_operations::pool() const
+            {
+                return *_pool;
+            }
+            
+            void remote_node_operations::send_gossip(GossipMessage_ptr message,
+                                                     return_message_callback_t<GossipMessage_ptr>::type responseCallback)
+            {
+                connection_pool::request req;
+                
+                req.send = [message, responseCallback](connection_out& conn, std::function<void()> done) {
+                    message->mutable_identity()->set_id(conn.get_next_id());
+                    message->mutable_identity()->set_in_reply_to(0);
+                    
+                    conn.send_request<GossipMessage>(sopmq::message::MT_GOSSIP, message, message->identity().id(),
+                        [responseCallback, done](const network_operation_result& result, GossipMessage_ptr reply) {
+                            done();
+                            deliver(result, reply, responseCallback);
+                        });
+                };
+                
+                req.fail = [responseCallback](const network_operation_result& result) {
+                    deliver(result, GossipMessage_ptr(), responseCallback);
+                };
+                
+                this->submit(std::move(req));
+            }
+            
+            void remote_node_operations::push_gossip(GossipMessage_ptr message)
+            {
+                connection_pool::request req;
+                
+                req.send = [message](connection_out& conn, std::function<void()> done) {
+                    message->mutable_identity()->set_id(conn.get_next_id());
+                    conn.send_one_way(sopmq::message::MT_GOSSIP, message);
+                    done();
+                };
+                
+                req.fail = [](const network_operation_result& result) {
+                    //the node will ask again the next time gossip comes around to it
+                    LOG_SRC(debug) << "unable to push gossip: " << result.get_error().what();
+                };
+                
+                this->submit(std::move(req));
+            }
+            
+            void remote_node_operations::send_proxy_publish(PublishMessage_ptr clientMessage,
+                                                            return_message_callback_t<ProxyPublishResponseMessage_ptr>::type responseCallback)
+            {
+                connection_pool::request req;
+                
+                req.send = [clientMessage, responseCallback](connection_out& conn, std::function<void()> done) {
+                    ProxyPublishMessage_ptr proxy = messageutil::make_message<ProxyPublishMessage>(conn.get_next_id(), 0);
+                    piggyback_heartbeat(conn, *proxy->mutable_identity());
+                    
+                    std::function<void(const network_operation_result&, ProxyPublishResponseMessage_ptr)> handler
+                        = [responseCallback, done](const network_operation_result& result, ProxyPublishResponseMessage_ptr reply) {
+                            done();
+                            deliver(result, reply, responseCallback);
+                        };
+                    
+                    //the same client message goes to every node in the quorum. it is
+                    //serialized as it's sent, so lend it to the proxy message instead
+                    //of copying the content into each one
+                    proxy->set_allocated_client_message(clientMessage.get());
+                    try
+                    {
+                        conn.send_request<ProxyPublishResponseMessage>(sopmq::message::MT_PROXY_PUBLISH, proxy,
+                                                                       proxy->identity().id(), handler);
+                    }
+                    catch (...)
+                    {
+                        (void)proxy->release_client_message();
+                        throw;
+                    }
+                    
+                    //hands the lent message back without freeing it, the caller still owns it
+                    (void)proxy->release_client_message();
+                };
+                
+                req.fail = [responseCallback](const network_operation_result& result) {
+                    deliver(result, ProxyPublishResponseMessage_ptr(), responseCallback);
+                };
+                
+                this->submit(std::move(req));
+            }
+            
+            void remote_node_operations::send_proxy_publish_batch(const std::vector<PublishMessage_ptr>& clientMessages,
+                                                                  return_message_callback_t<ProxyPublishBatchResponseMessage_ptr>::type responseCallback)
+            {
+                connection_pool::request req;
+                
+                req.send = [clientMessages, responseCallback](connection_out& conn, std::function<void()> done) {
+                    ProxyPublishBatchMessage_ptr proxy = messageutil::make_message<ProxyPublishBatchMessage>(conn.get_next_id(), 0);
+                    piggyback_heartbeat(conn, *proxy->mutable_identity());
+                    
+                    std::function<void(const network_operation_result&, ProxyPublishBatchResponseMessage_ptr)> handler
+                        = [responseCallback, done](const network_operation_result& result, ProxyPublishBatchResponseMessage_ptr reply) {
+                            done();
+                            deliver(result, reply, responseCallback);
+                        };
+                    
+                    //lent the same way as a single proxy publish
+                    auto lent = proxy->mutable_client_messages();
+                    lent->Reserve((int)clientMessages.size());
+                    for (auto& clientMessage : clientMessages)
+                    {
+                        lent->AddAllocated(clientMessage.get());
+                    }
+                    
+                    try
+                    {
+                        conn.send_request<ProxyPublishBatchResponseMessage>(sopmq::message::MT_PROXY_PUBLISH_BATCH, proxy,
+                                                                            proxy->identity().id(), handler);
+                    }
+                    catch (...)
+                    {
+                        while (! lent->empty()) (void)lent->ReleaseLast();
+                        throw;
+                    }
+                    
+                    //the messages are still owned by the caller
+                    while (! lent->empty()) (void)lent->ReleaseLast();
+                };
+                
+                req.fail = [responseCallback](const network_operation_result& result) {
+                    deliver(result, ProxyPublishBatchResponseMessage_ptr(), responseCallback);
+                };
+                
+                this->submit(std::move(req));
+            }
+            
+            void remote_node_operations::send_stamp(const QueueStamp& stamp)
+            {
+                auto stamps(_stamps);
+                std::weak_ptr<connection_pool> wpool(_pool);
+                auto& ioService = _ioService;
+                
+                _ioService.dispatch([stamps, wpool, &ioService, stamp] {
+                    add_stamp(ioService, stamps, wpool, stamp);
+                });
+            }
+            
+            void remote_node_operations::add_stamp(ba::io_service& ioService, std::shared_ptr<pending_stamps> stamps,
+                                                   std::weak_ptr<connection_pool> wpool, const QueueStamp& stamp)
+            {
+                if (! stamps->message)
+                {
+                    stamps->message = messageutil::make_message<StampMessage>(0, 0);
+                    ioService.post([stamps, wpool] { flush_stamps(*stamps, wpool); });
+                }
+                
+                stamps->message->add_stamps()->CopyFrom(stamp);
+                
+                if (stamps->message->stamps_size() >= MAX_BATCHED_STAMPS)
+                {
+                    //the posted flush will find nothing left to send
+                    flush_stamps(*stamps, wpool);
+                }
+            }
+            
+            void remote_node_operations::submit(connection_pool::request req)
+            {
+                //the pool is only used from its own IO thread
+                auto pool(_pool);
+                _ioService.dispatch([pool, req]() mutable { pool->submit(std::move(req)); });
+            }
+            
+            void remote_node_operations::flush_stamps(pending_stamps& stamps, std::weak_ptr<connection_pool> wpool)
+            {
+                StampMessage_ptr batch;
+                batch.swap(stamps.message);
+                
+                if (! batch) return;
+                
+                auto pool = wpool.lock();
+                if (! pool) return;
+                
+                connection_pool::request req;
+                
+                req.send = [batch](connection_out& conn, std::function<void()> done) {
+                    batch->mutable_identity()->set_id(conn.get_next_id());
+                    piggyback_heartbeat(conn, *batch->mutable_identity());
+                    conn.send_one_way(sopmq::message::MT_STAMP, batch);
+                    done();
+                };
+                
+                req.fail = [batch](const network_operation_result& result) {
+                    //the messages stay unstamped on the node until their TTL runs out
+                    LOG_SRC(warning) << "unable to send " << batch->stamps_size() << " stamps: "
+                        << result.get_error().what();
+                };
+                
+                pool->submit(std::move(req));
+            }
+            
+            void remote_node_operations::send_claim(const QueueClaim& claim)
+            {
+                ClaimMessage_ptr message = messageutil::make_message<ClaimMessage>(0, 0);
+                message->mutable_claim()->CopyFrom(claim);
+                
+                connection_pool::request req;
+                
+                req.send = [message](connection_out& conn, std::function<void()> done) {
+                    message->mutable_identity()->set_id(conn.get_next_id());
+                    piggyback_heartbeat(conn, *message->mutable_identity());
+                    conn.send_one_way(sopmq::message::MT_CLAIM, message);
+                    done();
+                };
+                
+                req.fail = [message](const network_operation_result& result) {
+                    //the node keeps its copies until they expire
+                    LOG_SRC(warning) << "unable to send claim for " << message->claim().queue_id() << ": "
+                        << result.get_error().what();
+                };
+                
+                this->submit(std::move(req));
+            }
+            
+        }
+    }
+}
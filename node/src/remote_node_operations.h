@@ -0,0 +1,108 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__remote_node_operations__
+#define __sopmq__remote_node_operations__
+
+#include "inode_operations.h"
+#include "connection_pool.h"
+#include "endpoint.h"
+
+#include <boost/asio.hpp>
+
+#include <memory>
+
+namespace sopmq {
+    namespace node {
+        namespace intra {
+            
+            ///
+            /// Executes operations on another node in the ring over a pool of
+            /// connections to it
+            ///
+            /// Operations can be sent from any thread. They are handed to the IO
+            /// thread the connections run on, and callbacks are made from there
+            ///
+            class remote_node_operations : public inode_operations
+            {
+            public:
+                remote_node_operations(boost::asio::io_service& ioService, const shared::net::endpoint& ep);
+                virtual ~remote_node_operations();
+                
+                virtual void send_gossip(GossipMessage_ptr message,
+                                         return_message_callback_t<GossipMessage_ptr>::type responseCallback);
+                
+                virtual void push_gossip(GossipMessage_ptr message);
+                
+                virtual void send_proxy_publish(PublishMessage_ptr clientMessage,
+                                                return_message_callback_t<ProxyPublishResponseMessage_ptr>::type responseCallback);
+                
+                virtual void send_proxy_publish_batch(const std::vector<PublishMessage_ptr>& clientMessages,
+                                                      return_message_callback_t<ProxyPublishBatchResponseMessage_ptr>::type responseCallback);
+                
+                ///
+                /// Stamps are held until the IO thread is done with the work in front of
+                /// it and then sent together in one StampMessage
+                ///
+                virtual void send_stamp(const QueueStamp& stamp);
+                
+                ///
+                /// Claims already arrive batched, so each one goes straight out in its
+                /// own ClaimMessage
+                ///
+                virtual void send_claim(const QueueClaim& claim);
+                
+                ///
+                /// Returns the connections to the node
+                ///
+                const connection::connection_pool& pool() const;
+                
+                ///
+                /// The most stamps sent in one message
+                ///
+                static const int MAX_BATCHED_STAMPS = 1024;
+                
+            private:
+                ///
+                /// Stamps waiting to be sent. Shared with the posted flush so that it
+                /// can run after we're gone
+                ///
+                struct pending_stamps
+                {
+                    StampMessage_ptr message;
+                };
+                
+                boost::asio::io_service& _ioService;
+                connection::connection_pool::ptr _pool;
+                std::shared_ptr<pending_stamps> _stamps;
+                
+                static void add_stamp(boost::asio::io_service& ioService, std::shared_ptr<pending_stamps> stamps,
+                                      std::weak_ptr<connection::connection_pool> wpool, const QueueStamp& stamp);
+                
+                static void flush_stamps(pending_stamps& stamps, std::weak_ptr<connection::connection_pool> wpool);
+                
+                ///
+                /// Submits the request to the pool from its IO thread
+                ///
+                void submit(connection::connection_pool::request req);
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__remote_node_operations__) */
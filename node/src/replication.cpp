@@ -0,0 +1,43 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "replication.h"
+
+#include "settings.h"
+#include "ring.h"
+
+namespace sopmq {
+    namespace node {
+        
+        const std::size_t replication::DEFAULT_FACTOR;
+        const std::size_t replication::SINGLE_FACTOR;
+        
+        static_assert(replication::DEFAULT_FACTOR <= ring::MAX_REPLICATION_FACTOR,
+                      "the ring doesn't work out enough replicas for the default factor");
+        
+        std::size_t replication::factor_for_queue(const std::string& queueId)
+        {
+            for (auto& prefix : settings::instance().singleReplicaPrefixes)
+            {
+                if (queueId.compare(0, prefix.size(), prefix) == 0) return SINGLE_FACTOR;
+            }
+            
+            return DEFAULT_FACTOR;
+        }
+        
+    }
+}
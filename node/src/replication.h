@@ -0,0 +1,62 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__replication__
+#define __sopmq__replication__
+
+#include <string>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        
+        ///
+        /// Decides how many nodes hold each queue
+        ///
+        /// Queues are held by three nodes unless their name starts with one of
+        /// settings::singleReplicaPrefixes, in which case they only live on their
+        /// primary. That suits traffic where losing a message with its node is fine,
+        /// such as ephemeral group chat, and saves two replica writes per publish.
+        /// The request path is compiled once for each factor and picks one with
+        /// factor_for_queue
+        ///
+        class replication
+        {
+        public:
+            ///
+            /// The replication factor of queues not matching a single replica prefix
+            ///
+            static const std::size_t DEFAULT_FACTOR = 3;
+            
+            ///
+            /// The replication factor of queues matching a single replica prefix
+            ///
+            static const std::size_t SINGLE_FACTOR = 1;
+            
+            ///
+            /// Returns the number of nodes that hold the given queue
+            ///
+            static std::size_t factor_for_queue(const std::string& queueId);
+            
+        private:
+            replication();
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__replication__) */
@@ -21,13 +21,10 @@
 #include "id_conflict_error.h"
 #include "unavailable_error.h"
 
-#include <boost/assert.hpp>
 #include <boost/lexical_cast.hpp>
 
 #include <string>
 #include <algorithm>
-#include <chrono>
-#include <random>
 
 using namespace std;
 
@@ -38,9 +35,11 @@ using sopmq::error::unavailable_error;
 namespace sopmq {
     namespace node {
         
+        const std::size_t ring::MAX_REPLICATION_FACTOR;
+        
         ring::ring()
+        : _current(build_snapshot(std::vector<node::ptr>()))
         {
-            
         }
         
         ring::~ring()
@@ -50,157 +49,144 @@ namespace sopmq {
         
         void ring::add_node(node::ptr node)
         {
-            this->check_no_conflict(node);
-            
-            _ring_by_range.emplace(node->range_start(), node);
-            _nodes_by_id.emplace(node->node_id(), node);
-        }
-        
-        void ring::check_no_conflict(node::ptr newNode) const
-        {
-            auto idIter = _nodes_by_id.find(newNode->node_id());
-            if (idIter != _nodes_by_id.end())
-            {
-                //id conflict
-                throw id_conflict_error("the node id " +
-                                        boost::lexical_cast<std::string>(newNode->node_id()) +
-                                        " is already taken");
-            }
-            
-            auto iter = _ring_by_range.find(newNode->range_start());
-            if (iter != _ring_by_range.end())
-            {
-                //range conflict
-                throw range_conflict_error("the range " +
-                                           boost::lexical_cast<std::string>(newNode->range_start()) +
-                                           " which node " +
-                                           boost::lexical_cast<std::string>(newNode->node_id()) +
-                                           " is proposing to handle " +
-                                           " is already handled by node " +
-                                           boost::lexical_cast<std::string>(iter->second->node_id()));
-            }
-        }
-        
-        node::ptr ring::find_primary_node_for_key(uint128 key) const
-        {
-            if (_ring_by_range.empty())
-            {
-                throw unavailable_error("There are no nodes in the ring");
-            }
+            std::lock_guard<std::mutex> lock(_write_lock);
             
-            const_ring_iterator secondaryIter = this->find_secondary_node(key);
-            const_ring_iterator primaryIter = this->find_primary_node(secondaryIter);
+            snapshot_ptr current = std::atomic_load(&_current);
+            this->check_no_conflict(*current, node);
             
-            BOOST_ASSERT(primaryIter != _ring_by_range.end());
+            std::vector<node::ptr> nodes(current->nodes);
+            nodes.push_back(node);
             
-            return primaryIter->second;
+            std::atomic_store(&_current, build_snapshot(std::move(nodes)));
         }
         
-        std::array<node::ptr, 3> ring::find_nodes_for_key(uint128 key) const
+        ring::snapshot_ptr ring::build_snapshot(std::vector<node::ptr> nodes)
         {
-            if (_ring_by_range.empty())
+            std::vector<std::pair<uint128, node::ptr>> owners;
+            for (auto& node : nodes)
             {
-                throw unavailable_error("There are no nodes in the ring");
+                for (auto& token : node->tokens())
+                {
+                    owners.emplace_back(token, node);
+                }
             }
             
-            const_ring_iterator secondaryIter = this->find_secondary_node(key);
-            const_ring_iterator primaryIter = this->find_primary_node(secondaryIter);
-            const_ring_iterator tertiaryIter = this->find_tertiary_node(secondaryIter);
-            
-            BOOST_ASSERT(primaryIter != _ring_by_range.end());
-            BOOST_ASSERT(secondaryIter != _ring_by_range.end());
-            BOOST_ASSERT(tertiaryIter != _ring_by_range.end());
-            
-            auto ret = std::array<node::ptr, 3>();
-            
-			ret[0] = primaryIter->second;
-			ret[1] = secondaryIter->second;
-			ret[2] = tertiaryIter->second;
-
-            return ret;
-        }
-        
-        std::array<node::ptr, 3> ring::find_quorum_for_operation(uint128 key) const
-        {
-            auto nodes = this->find_nodes_for_key(key);
+            std::sort(owners.begin(), owners.end(),
+                      [](const std::pair<uint128, node::ptr>& a, const std::pair<uint128, node::ptr>& b) {
+                          return a.first < b.first;
+                      });
             
-            unsigned seed = std::chrono::system_clock::now().time_since_epoch().count();
+            std::shared_ptr<snapshot> snap = std::make_shared<snapshot>();
+            snap->tokens.reserve(owners.size());
+            snap->replicas.reserve(owners.size());
             
-            shuffle(nodes.begin(), nodes.end(), std::default_random_engine(seed));
-            
-            //add nodes until we reach a quorum
-            std::array<node::ptr, 3> outNodes;
-            int i = 0;
-            for (auto node : nodes)
+            //keys from a token up to the next one are primary on the token's node,
+            //then go to the next nodes clockwise that aren't already holding them.
+            //a ring with fewer nodes than replicas doubles up
+            size_t wanted = std::min<size_t>(MAX_REPLICATION_FACTOR, nodes.size());
+            for (size_t i = 0; i < owners.size(); ++i)
             {
-                if (node->is_alive())
+                replica_list replicas;
+                size_t found = 0;
+                
+                for (size_t step = 0; step < owners.size() && found < wanted; ++step)
+                {
+                    const node::ptr& candidate = owners[(i + step) % owners.size()].second;
+                    if (std::find(replicas.begin(), replicas.begin() + found, candidate) == replicas.begin() + found)
+                    {
+                        replicas[found++] = candidate;
+                    }
+                }
+                
+                for (size_t j = found; j < replicas.size(); ++j)
                 {
-                    outNodes[i++] = node;
+                    replicas[j] = replicas[j % found];
                 }
+                
+                snap->tokens.push_back(owners[i].first);
+                snap->replicas.push_back(replicas);
             }
             
-            if (i < 2)
+            for (auto& node : nodes)
             {
-                throw unavailable_error("No quorum of nodes is up and available for key "
-                                        + boost::lexical_cast<std::string>(key));
+                snap->nodes_by_id.emplace(node->node_id(), node);
             }
             
-            //compress the list. for testing purposes, we allow the
-            //quorum to be just a single node as long as the ring
-            //isnt aware that other nodes are down that should be up
-            if (outNodes[0] == outNodes[1])
-            {
-                outNodes[1] = nullptr;
-            }
+            snap->nodes = std::move(nodes);
             
-            if (outNodes[1] == outNodes[2])
+            return snap;
+        }
+        
+        void ring::check_no_conflict(const snapshot& current, node::ptr newNode) const
+        {
+            auto idIter = current.nodes_by_id.find(newNode->node_id());
+            if (idIter != current.nodes_by_id.end())
             {
-                outNodes[2] = nullptr;
+                //id conflict
+                throw id_conflict_error("the node id " +
+                                        boost::lexical_cast<std::string>(newNode->node_id()) +
+                                        " is already taken");
             }
             
-            if (outNodes[0] == outNodes[2])
+            for (auto& token : newNode->tokens())
             {
-                outNodes[2] = nullptr;
+                auto iter = std::lower_bound(current.tokens.begin(), current.tokens.end(), token);
+                if (iter != current.tokens.end() && *iter == token)
+                {
+                    //range conflict
+                    const node::ptr& existing = current.replicas[iter - current.tokens.begin()][0];
+                    throw range_conflict_error("the range " +
+                                               boost::lexical_cast<std::string>(token) +
+                                               " which node " +
+                                               boost::lexical_cast<std::string>(newNode->node_id()) +
+                                               " is proposing to handle " +
+                                               " is already handled by node " +
+                                               boost::lexical_cast<std::string>(existing->node_id()));
+                }
             }
-            
-            return outNodes;
         }
         
-        ring::const_ring_iterator ring::find_secondary_node(uint128 key) const
+        ring::replica_list ring::replicas_for_key(uint128 key) const
         {
-            auto iter = _ring_by_range.upper_bound(key); //find the secondary node
+            snapshot_ptr snap = std::atomic_load(&_current);
+            const snapshot& current = *snap;
             
-            if (iter == _ring_by_range.end()) //wrap around
+            if (current.tokens.empty())
             {
-                iter = _ring_by_range.begin();
+                throw unavailable_error("There are no nodes in the ring");
             }
             
-            return iter;
+            //the primary is the owner of the last token at or before the key. keys
+            //before the first token wrap around to the last one
+            auto iter = std::upper_bound(current.tokens.begin(), current.tokens.end(), key);
+            size_t primary = iter == current.tokens.begin()
+                ? current.tokens.size() - 1
+                : (iter - current.tokens.begin()) - 1;
+            
+            return current.replicas[primary];
         }
         
-        ring::const_ring_iterator ring::find_primary_node(const_ring_iterator secondaryIter) const
+        std::vector<node::ptr> ring::nodes() const
         {
-            if (secondaryIter == _ring_by_range.begin()) //special case, we need to wrap to the end of the ring
-            {
-                secondaryIter = _ring_by_range.end();
-            }
-            
-            secondaryIter--; //find the primary
-            
-            return secondaryIter;
+            return std::atomic_load(&_current)->nodes;
         }
         
-        ring::const_ring_iterator ring::find_tertiary_node(const_ring_iterator secondaryIter) const
+        node::ptr ring::find_node(std::uint32_t nodeId) const
         {
-            secondaryIter++; //find the tertiary
-            
-            if (secondaryIter == _ring_by_range.end())
-            {
-                //wrap around
-                secondaryIter = _ring_by_range.begin();
-            }
+            snapshot_ptr current = std::atomic_load(&_current);
             
-            return secondaryIter;
+            auto iter = current->nodes_by_id.find(nodeId);
+            return iter == current->nodes_by_id.end() ? node::ptr() : iter->second;
+        }
+        
+        node::ptr ring::find_primary_node_for_key(uint128 key) const
+        {
+            return this->replicas_for_key(key)[0];
+        }
+        
+        ring::replica_list ring::find_nodes_for_key(uint128 key) const
+        {
+            return this->replicas_for_key(key);
         }
     }
-}
\ No newline at end of file
+}
@@ -21,11 +21,20 @@
 #include "node.h"
 #include "endpoint.h"
 #include "uint128.h"
+#include "unavailable_error.h"
 
-#include <map>
 #include <unordered_map>
 #include <boost/noncopyable.hpp>
+#include <boost/lexical_cast.hpp>
 #include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <string>
+#include <cstddef>
 
 
 namespace sopmq {
@@ -34,8 +43,35 @@ namespace sopmq {
         ///
         /// Represents the ring as we currently understand it
         ///
+        /// Each node owns one or more tokens on the ring (see settings::vnodes), and
+        /// keys from a token up to the next one are primary on the token's node.
+        /// With many tokens per node the ring is cut into many small ranges, which
+        /// evens out how many keys each node gets and spreads a node's keys over
+        /// the whole ring. The secondary and tertiary are the next distinct nodes
+        /// clockwise, so the replicas are never two tokens of the same node.
+        ///
+        /// Lookups read an immutable snapshot of the ring: the tokens in a sorted
+        /// array and the replica set for each token worked out ahead of time.
+        /// Readers take a reference to the current snapshot with an atomic load
+        /// and never wait on a change. A change to the ring builds a new snapshot
+        /// and publishes it in place of the old one, which is freed once the last
+        /// reader holding it lets go. Lookups hand back copies, so nothing they
+        /// return points into a snapshot
+        ///
         class ring : public boost::noncopyable
         {
+        public:
+            ///
+            /// The most replicas the ring works out for a key. Queues with a smaller
+            /// replication factor are held by the first nodes of the same list
+            ///
+            static const std::size_t MAX_REPLICATION_FACTOR = 3;
+            
+            ///
+            /// The nodes that hold a key, in order of preference
+            ///
+            typedef std::array<node::ptr, MAX_REPLICATION_FACTOR> replica_list;
+            
         public:
             ring();
             virtual ~ring();
@@ -45,57 +81,154 @@ namespace sopmq {
             ///
             void add_node(node::ptr node);
             
+            ///
+            /// Returns every node in the ring
+            ///
+            std::vector<node::ptr> nodes() const;
+            
+            ///
+            /// Finds the node with the given ID, or null if it isn't in the ring
+            ///
+            node::ptr find_node(std::uint32_t nodeId) const;
+            
             ///
             /// Finds the node that we believe to be primary for the given key
             ///
             node::ptr find_primary_node_for_key(uint128 key) const;
             
             ///
-            /// Finds the primary, secondary, and tertiary nodes for the given key
+            /// Finds the primary, secondary, and tertiary nodes for the given key. A
+            /// queue replicated RF times lives on the first RF of them
             ///
-            std::array<node::ptr, 3> find_nodes_for_key(uint128 key) const;
+            replica_list find_nodes_for_key(uint128 key) const;
             
             ///
-            /// Finds a quorum of up nodes to fulfil a request for the given key.
-            /// The order of nodes returned are randomized. The first two nodes should be
-            /// tried first followed by the last
+            /// Finds a quorum of up nodes to fulfil a request for the given key on a
+            /// queue replicated RF times. The first RF / 2 + 1 nodes should be tried
+            /// first followed by the rest.
+            ///
+            /// Each place in the order goes to the cheaper of two nodes picked at
+            /// random from those left, going by their request_cost(). Fast replicas
+            /// are preferred, but every caller doesn't pile onto the same one the
+            /// moment it looks fastest. Doesn't allocate
             ///
             /// \throws unavailable_error If a quorum for this key is not known to be up
             ///
-            std::array<node::ptr, 3> find_quorum_for_operation(uint128 key) const;
+            template <std::size_t RF>
+            std::array<node::ptr, RF> find_quorum_for_operation(uint128 key) const
+            {
+                static_assert(RF > 0 && RF <= MAX_REPLICATION_FACTOR, "replication factor not supported by the ring");
+                
+                replica_list nodes = this->replicas_for_key(key);
+                
+                static thread_local std::default_random_engine engine(
+                    (unsigned)std::chrono::system_clock::now().time_since_epoch().count());
+                
+                //only up nodes can make the quorum
+                std::array<std::size_t, RF> order;
+                std::size_t found = 0;
+                for (std::size_t i = 0; i < RF; ++i)
+                {
+                    if (nodes[i]->is_alive())
+                    {
+                        order[found++] = i;
+                    }
+                }
+                
+                if (found <= RF / 2)
+                {
+                    throw sopmq::error::unavailable_error("No quorum of nodes is up and available for key "
+                                                          + boost::lexical_cast<std::string>(key));
+                }
+                
+                for (std::size_t pos = 0; pos + 1 < found; ++pos)
+                {
+                    std::size_t left = found - pos;
+                    std::size_t first = pos + engine() % left;
+                    std::size_t second = pos + (first - pos + 1 + engine() % (left - 1)) % left;
+                    
+                    if (nodes[order[second]]->request_cost() < nodes[order[first]]->request_cost())
+                    {
+                        first = second;
+                    }
+                    
+                    std::swap(order[pos], order[first]);
+                }
+                
+                std::array<node::ptr, RF> outNodes;
+                for (std::size_t i = 0; i < found; ++i)
+                {
+                    outNodes[i] = nodes[order[i]];
+                }
+                
+                //compress the list. for testing purposes, we allow the
+                //quorum to be just a single node as long as the ring
+                //isnt aware that other nodes are down that should be up
+                for (std::size_t i = 1; i < RF; ++i)
+                {
+                    if (std::find(outNodes.begin(), outNodes.begin() + i, outNodes[i]) != outNodes.begin() + i)
+                    {
+                        outNodes[i] = nullptr;
+                    }
+                }
+                
+                return outNodes;
+            }
             
         private:
-            typedef std::map<uint128, node::ptr>::const_iterator const_ring_iterator;
-            
-            ///
-            /// Map to the ring, sorted by the range start of each node
             ///
-            std::map<uint128, node::ptr> _ring_by_range;
+            /// The ring at one point in time. Never changed once published
+            ///
+            struct snapshot
+            {
+                ///
+                /// Every token of every node, sorted
+                ///
+                std::vector<uint128> tokens;
+                
+                ///
+                /// The primary, secondary and tertiary nodes for keys in the range
+                /// starting at the token at the same index
+                ///
+                std::vector<replica_list> replicas;
+                
+                ///
+                /// Every node in the ring, once each
+                ///
+                std::vector<node::ptr> nodes;
+                
+                ///
+                /// Map between the node ID and the node
+                ///
+                std::unordered_map<std::uint32_t, node::ptr> nodes_by_id;
+            };
+            
+            typedef std::shared_ptr<const snapshot> snapshot_ptr;
             
             ///
-            /// Map between the node ID and the node
+            /// Only read and written with std::atomic_load and std::atomic_store
             ///
-            std::unordered_map<std::uint32_t, node::ptr> _nodes_by_id;
+            snapshot_ptr _current;
             
             ///
-            /// Finds the location of the secondary node on the ring
+            /// Serializes changes to the ring
             ///
-            const_ring_iterator find_secondary_node(uint128 key) const;
+            std::mutex _write_lock;
             
             ///
-            /// Finds the location of the primary node on the ring
+            /// Returns the replica set for the key from the current snapshot
             ///
-            const_ring_iterator find_primary_node(const_ring_iterator secondaryIter) const;
+            replica_list replicas_for_key(uint128 key) const;
             
             ///
-            /// Finds the location of the tertiary node on the ring given the iter to the secondary
+            /// Checks to make sure adding this node doesn't conflict with any other node
             ///
-            const_ring_iterator find_tertiary_node(const_ring_iterator secondaryIter) const;
-        
+            void check_no_conflict(const snapshot& current, node::ptr newNode) const;
+            
             ///
-            /// Checks to make sure adding this node doesn't conflict with any other node
+            /// Works out the replica sets for the given nodes
             ///
-            void check_no_conflict(node::ptr newNode) const;
+            static snapshot_ptr build_snapshot(std::vector<node::ptr> nodes);
         };
         
     }
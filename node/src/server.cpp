@@ -25,6 +25,7 @@
 
 #include "network_error.h"
 #include "logging.h"
+#include "settings.h"
 
 namespace ba = boost::asio;
 using sopmq::error::network_error;
@@ -32,29 +33,36 @@ using sopmq::error::network_error;
 namespace sopmq {
     namespace node {
         
-        server::server(ba::io_service& ioService, unsigned short port)
-        : _ioService(ioService), _port(port), _endpoint(ba::ip::tcp::v4(), _port),
-        _acceptor(_ioService, _endpoint), _stopping(false)
+        server::server(io_service_pool& ioServices, unsigned short port)
+        : _io_services(ioServices), _port(port), _endpoint(ba::ip::tcp::v4(), _port),
+        _acceptor(ioServices.at(0), _endpoint), _stopping(false), _expiry_scheduler(ioServices.at(0), _queue_manager)
         {
-            BOOST_LOG_TRIVIAL(info) << "starting mq services on TCP/" << _port;
+            BOOST_LOG_TRIVIAL(info) << "starting mq services on TCP/" << _port
+                << " with " << _io_services.size() << " IO threads";
             
             //add ourselves to the ring
             auto self = node::get_self();
-            self->init_local_operations(_ring);
+            self->init_local_operations(_ring, _queue_manager, &_io_services);
             _ring.add_node(self);
+            
+            _gossiper = std::make_shared<gossiper>(ioServices.at(0), _ring, self, settings::instance().gossipFanout);
         }
         
         void server::start()
         {
+            _expiry_scheduler.start();
+            _gossiper->start();
             this->accept_new();
         }
         
         void server::accept_new()
         {
-            connection::connection_in::ptr conn = std::make_shared<connection::connection_in>(_ioService, _ring);
+            ba::io_service& connService = _io_services.next();
+            connection::connection_in::ptr conn = std::make_shared<connection::connection_in>(connService, _ring, _queue_manager,
+                                                                                             _io_services, *_gossiper);
             
             _acceptor.async_accept(conn->get_socket(),
-                                   boost::bind(&server::handle_accept, this, conn,
+                                   boost::bind(&server::handle_accept, this, conn, boost::ref(connService),
                                                boost::asio::placeholders::error));
         }
         
@@ -62,21 +70,19 @@ namespace sopmq {
         {
             _stopping = true;
             _acceptor.close();
+            _expiry_scheduler.stop();
+            _gossiper->stop();
         }
         
-        void server::handle_accept(connection::connection_in::ptr conn, const boost::system::error_code& error)
+        void server::handle_accept(connection::connection_in::ptr conn, ba::io_service& connService,
+                                   const boost::system::error_code& error)
         {
             if (_stopping) return;
 
             if (! error)
             {
-                try {
-                    conn->start(this);
-                    
-                } catch (const network_error& e) {
-                    LOG_SRC(error) << "exception thrown when trying to start connection: " << e.what();
-                    
-                }
+                //the connection lives on its own IO thread from here on
+                connService.post([this, conn] { this->start_connection(conn); });
                 
                 this->accept_new();
             }
@@ -87,13 +93,26 @@ namespace sopmq {
             }
         }
         
+        void server::start_connection(connection::connection_in::ptr conn)
+        {
+            try {
+                conn->start(this);
+                
+            } catch (const network_error& e) {
+                LOG_SRC(error) << "exception thrown when trying to start connection: " << e.what();
+                
+            }
+        }
+        
         void server::connection_started(connection::connection_in::ptr conn)
         {
+            std::lock_guard<std::mutex> lock(_connections_lock);
             _connections.insert(conn);
         }
         
         void server::connection_terminated(connection::connection_in::ptr conn)
         {
+            std::lock_guard<std::mutex> lock(_connections_lock);
             _connections.erase(conn);
         }
         
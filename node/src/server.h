@@ -20,10 +20,15 @@
 
 #include "connection_in.h"
 #include "ring.h"
+#include "queue_manager.h"
+#include "expiry_scheduler.h"
+#include "io_service_pool.h"
+#include "gossiper.h"
 
 #include <boost/asio.hpp>
 #include <boost/noncopyable.hpp>
 #include <set>
+#include <mutex>
 
 namespace sopmq {
     namespace node {
@@ -31,10 +36,13 @@ namespace sopmq {
         ///
         /// Server that listens for and manages connections
         ///
+        /// Connections are accepted on the first io_service of the pool and then
+        /// spread across all of them
+        ///
         class server : public boost::noncopyable
         {
         public:
-            server(boost::asio::io_service& ioService, unsigned short port);
+            server(io_service_pool& ioServices, unsigned short port);
             
             ///
             /// Starts this server to accept new connections
@@ -57,17 +65,28 @@ namespace sopmq {
             void connection_terminated(connection::connection_in::ptr conn);
             
         private:
-            boost::asio::io_service& _ioService;
+            io_service_pool& _io_services;
             unsigned short _port;
             boost::asio::ip::tcp::endpoint _endpoint;
             boost::asio::ip::tcp::acceptor _acceptor;
+            
+            ///
+            /// Connections start and end on their own IO threads
+            ///
+            std::mutex _connections_lock;
             std::set<connection::connection_in::ptr> _connections;
+            
             bool _stopping;
             ring _ring;
+            queue_manager3 _queue_manager;
+            expiry_scheduler3 _expiry_scheduler;
+            gossiper::ptr _gossiper;
             
             
             void accept_new();
-            void handle_accept(connection::connection_in::ptr conn, const boost::system::error_code& error);
+            void handle_accept(connection::connection_in::ptr conn, boost::asio::io_service& connService,
+                               const boost::system::error_code& error);
+            void start_connection(connection::connection_in::ptr conn);
         };
         
     }
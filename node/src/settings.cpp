@@ -26,6 +26,15 @@ namespace sopmq {
         const uint32_t settings::DEFAULT_MAX_MESSAGE_SIZE = 10485760;
         const uint32_t settings::DEFAULT_OPERATION_TIMEOUT = 5;
         const float settings::DEFAULT_PHI_FAILURE_THRESHOLD = 8.0f;
+        const uint32_t settings::DEFAULT_USER_CACHE_SIZE = 100000;
+        const uint32_t settings::DEFAULT_USER_CACHE_TTL = 30;
+        const uint32_t settings::DEFAULT_USER_CACHE_NEGATIVE_TTL = 10;
+        const uint32_t settings::DEFAULT_CRYPTO_THREADS = 2;
+        const uint32_t settings::DEFAULT_IO_THREADS = 0;
+        const uint32_t settings::DEFAULT_VNODES = 1;
+        const uint32_t settings::DEFAULT_HEDGE_DELAY_MS = 0;
+        const float settings::DEFAULT_HEDGE_PERCENTILE = 0.95f;
+        const uint32_t settings::DEFAULT_GOSSIP_FANOUT = 2;
         
         
         settings::settings()
@@ -33,6 +42,15 @@ namespace sopmq {
             maxMessageSize = DEFAULT_MAX_MESSAGE_SIZE;
             defaultTimeout = DEFAULT_OPERATION_TIMEOUT;
             phiFailureThreshold = DEFAULT_PHI_FAILURE_THRESHOLD;
+            userCacheSize = DEFAULT_USER_CACHE_SIZE;
+            userCacheTtl = DEFAULT_USER_CACHE_TTL;
+            userCacheNegativeTtl = DEFAULT_USER_CACHE_NEGATIVE_TTL;
+            cryptoThreads = DEFAULT_CRYPTO_THREADS;
+            ioThreads = DEFAULT_IO_THREADS;
+            vnodes = DEFAULT_VNODES;
+            hedgeDelayMs = DEFAULT_HEDGE_DELAY_MS;
+            hedgePercentile = DEFAULT_HEDGE_PERCENTILE;
+            gossipFanout = DEFAULT_GOSSIP_FANOUT;
         }
         
         settings::~settings()
@@ -58,6 +58,51 @@ namespace sopmq {
             ///
             static const float DEFAULT_PHI_FAILURE_THRESHOLD;
             
+            ///
+            /// The default number of user accounts kept in memory for logins
+            ///
+            static const uint32_t DEFAULT_USER_CACHE_SIZE;
+            
+            ///
+            /// The default time in seconds a cached user account is trusted
+            ///
+            static const uint32_t DEFAULT_USER_CACHE_TTL;
+            
+            ///
+            /// The default time in seconds an unknown user is remembered as unknown
+            ///
+            static const uint32_t DEFAULT_USER_CACHE_NEGATIVE_TTL;
+            
+            ///
+            /// The default number of threads checking authentication hashes
+            ///
+            static const uint32_t DEFAULT_CRYPTO_THREADS;
+            
+            ///
+            /// The default number of IO threads, 0 runs one per core
+            ///
+            static const uint32_t DEFAULT_IO_THREADS;
+            
+            ///
+            /// The default number of tokens each node owns on the ring
+            ///
+            static const uint32_t DEFAULT_VNODES;
+            
+            ///
+            /// The default time in milliseconds before a publish is hedged, 0 is off
+            ///
+            static const uint32_t DEFAULT_HEDGE_DELAY_MS;
+            
+            ///
+            /// The default percentile of replica reply times a publish is hedged at
+            ///
+            static const float DEFAULT_HEDGE_PERCENTILE;
+            
+            ///
+            /// The default number of up nodes gossiped with each round
+            ///
+            static const uint32_t DEFAULT_GOSSIP_FANOUT;
+            
             ///
             /// Returns our singleton instance
             ///
@@ -112,6 +157,67 @@ namespace sopmq {
             ///
             int phiFailureThreshold;
             
+            ///
+            /// The most user accounts kept in memory for logins. 0 turns the cache off
+            ///
+            uint32_t userCacheSize;
+            
+            ///
+            /// How long in seconds a cached user account is used before it is read again.
+            /// Users are changed by nodetool straight in storage and nothing tells the
+            /// nodes, so this is also how long a node can keep accepting a password that
+            /// was changed or a user that was disabled
+            ///
+            uint32_t userCacheTtl;
+            
+            ///
+            /// How long in seconds a user that wasn't found is remembered as unknown.
+            /// Bounds how long a user created by nodetool waits to be able to log in
+            ///
+            uint32_t userCacheNegativeTtl;
+            
+            ///
+            /// The number of threads checking authentication hashes off the IO thread
+            ///
+            uint32_t cryptoThreads;
+            
+            ///
+            /// The number of threads, each with its own io_service, serving connections
+            /// and queues. 0 runs one per core
+            ///
+            uint32_t ioThreads;
+            
+            ///
+            /// The number of tokens each node owns on the ring. Every node in the ring
+            /// must use the same value, and changing it moves queues between nodes
+            ///
+            uint32_t vnodes;
+            
+            ///
+            /// Queues whose names start with any of these are kept on one node instead
+            /// of three. Must match across the ring
+            ///
+            std::vector<std::string> singleReplicaPrefixes;
+            
+            ///
+            /// How long in milliseconds a publish waits for its quorum before also going
+            /// to the spare replica. 0 never sends to the spare unless a replica fails
+            ///
+            uint32_t hedgeDelayMs;
+            
+            ///
+            /// Once enough replies have been seen, publishes are hedged when their quorum
+            /// is slower than this fraction of recent replica replies instead of after
+            /// hedgeDelayMs. 0 keeps the fixed delay
+            ///
+            float hedgePercentile;
+            
+            ///
+            /// How many up nodes each round of gossip goes to. More spreads news
+            /// faster for more traffic
+            ///
+            uint32_t gossipFanout;
+            
             ///
             /// A username that can be used to log in to perform unit tests without needing
             /// a backing cassandra store
@@ -0,0 +1,187 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__storage_driver__
+#define __sopmq__storage_driver__
+
+#include "storage_error.h"
+
+#include <boost/noncopyable.hpp>
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            ///
+            /// A value bound to a statement or read back from a row
+            ///
+            struct cql_value
+            {
+                enum value_type
+                {
+                    ///
+                    /// A missing column, or one that couldn't be read
+                    ///
+                    CV_NULL,
+                    CV_TEXT,
+                    CV_BLOB,
+                    CV_INT32,
+                    CV_INT64
+                };
+                
+                value_type type;
+                
+                ///
+                /// The value of a text or blob
+                ///
+                std::string bytes;
+                
+                ///
+                /// The value of an int or bigint
+                ///
+                std::int64_t number;
+                
+                cql_value() : type(CV_NULL), number(0) {}
+                
+                static cql_value text(const std::string& s) { return cql_value(CV_TEXT, s, 0); }
+                static cql_value blob(const std::string& b) { return cql_value(CV_BLOB, b, 0); }
+                static cql_value int32(std::int32_t i) { return cql_value(CV_INT32, std::string(), i); }
+                static cql_value int64(std::int64_t i) { return cql_value(CV_INT64, std::string(), i); }
+                
+                ///
+                /// The number, or the given value when this isn't one
+                ///
+                std::int64_t as_int64(std::int64_t missing) const
+                {
+                    return type == CV_INT32 || type == CV_INT64 ? number : missing;
+                }
+            
+            private:
+                cql_value(value_type t, const std::string& b, std::int64_t n) : type(t), bytes(b), number(n) {}
+            };
+            
+            ///
+            /// A CQL statement and the values bound to its markers. Statements the
+            /// session has prepared run as prepared statements
+            ///
+            struct bound_statement
+            {
+                std::string cql;
+                std::vector<cql_value> params;
+                
+                bound_statement() {}
+                bound_statement(const std::string& c) : cql(c) {}
+                bound_statement(const std::string& c, std::vector<cql_value> p) : cql(c), params(std::move(p)) {}
+            };
+            
+            ///
+            /// What a statement or batch came back with
+            ///
+            struct query_result
+            {
+                ///
+                /// Set when the query failed
+                ///
+                std::unique_ptr<storage_error> error;
+                
+                ///
+                /// Set when the query failed because the session has no hosts left
+                /// to send it to
+                ///
+                bool no_hosts;
+                
+                ///
+                /// The rows read, each with its columns in the order they were selected
+                ///
+                std::vector<std::vector<cql_value>> rows;
+                
+                query_result() : no_hosts(false) {}
+            };
+            
+            ///
+            /// Called once a query completes, possibly from a driver thread
+            ///
+            typedef std::function<void(query_result&)> query_callback;
+            
+            ///
+            /// Called once a prepare completes with the error it failed with, if any
+            ///
+            typedef std::function<void(std::unique_ptr<storage_error>)> prepare_callback;
+            
+            ///
+            /// \brief A session open against the storage cluster
+            ///
+            /// Closed once the last reference to it is let go. Everything that runs on
+            /// a session holds a reference until its callback has returned, so the
+            /// requests still running on a replaced session get to finish
+            ///
+            class driver_session : public boost::noncopyable
+            {
+            public:
+                typedef std::shared_ptr<driver_session> ptr;
+                
+                virtual ~driver_session() {}
+                
+                ///
+                /// Prepares the statement so later runs of the same CQL skip the parse
+                ///
+                virtual void prepare(const std::string& cql, prepare_callback callback) = 0;
+                
+                ///
+                /// Runs a single statement
+                ///
+                virtual void execute(const bound_statement& statement, query_callback callback) = 0;
+                
+                ///
+                /// Runs the statements as one unlogged batch
+                ///
+                virtual void execute_batch(const std::vector<bound_statement>& statements, query_callback callback) = 0;
+            };
+            
+            ///
+            /// Called once a connect completes with either an error or the new session
+            ///
+            typedef std::function<void(std::unique_ptr<storage_error>, driver_session::ptr)> connect_callback;
+            
+            ///
+            /// \brief Opens sessions to the storage cluster
+            ///
+            /// The seam between cassandra_storage and the cassandra driver, so the storage
+            /// logic can run against a stand in
+            ///
+            class storage_driver : public boost::noncopyable
+            {
+            public:
+                virtual ~storage_driver() {}
+                
+                ///
+                /// \brief Opens a session without blocking
+                ///
+                virtual void connect(connect_callback callback) = 0;
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__storage_driver__) */
@@ -0,0 +1,54 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__stored_message__
+#define __sopmq__stored_message__
+
+#include <string>
+#include <cstdint>
+
+namespace sopmq {
+    namespace node {
+        namespace storage {
+            
+            ///
+            /// A message written to persistent storage because it couldn't be queued
+            ///
+            struct stored_message
+            {
+                std::string queue_id;
+                std::string message_id;
+                std::string content;
+                
+                ///
+                /// When the message was written, in microseconds since the epoch. Orders
+                /// the messages inside a day bucket
+                ///
+                std::int64_t stored_at;
+                
+                stored_message()
+                : stored_at(0)
+                {
+                    
+                }
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__stored_message__) */
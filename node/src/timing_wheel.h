@@ -0,0 +1,373 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__timing_wheel__
+#define __sopmq__timing_wheel__
+
+#include <boost/noncopyable.hpp>
+#include <boost/chrono.hpp>
+
+#include <array>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+
+        template <typename T>
+        class timing_wheel;
+
+        ///
+        /// \brief Intrusive list links for items scheduled on a timing_wheel
+        ///
+        /// Copying a hook never copies its links, so an item can be copied or moved
+        /// while it isn't scheduled without corrupting the wheel.
+        ///
+        class timing_wheel_hook
+        {
+        public:
+            timing_wheel_hook()
+            : _prev(nullptr), _next(nullptr), _tick(0)
+            {
+            }
+
+            timing_wheel_hook(const timing_wheel_hook&)
+            : _prev(nullptr), _next(nullptr), _tick(0)
+            {
+            }
+
+            timing_wheel_hook& operator=(const timing_wheel_hook&)
+            {
+                return *this;
+            }
+
+            ///
+            /// \brief Whether or not this item is currently scheduled on a wheel
+            ///
+            bool is_scheduled() const
+            {
+                return _next != nullptr;
+            }
+
+        private:
+            template <typename T>
+            friend class timing_wheel;
+
+            timing_wheel_hook* _prev;
+            timing_wheel_hook* _next;
+
+            ///
+            /// The wheel tick this item expires on
+            ///
+            uint64_t _tick;
+        };
+
+        ///
+        /// \brief Hierarchical timing wheel for expiring large numbers of items with
+        /// TTLs ranging from a fraction of a second to months
+        ///
+        /// The first level has one slot per tick. Each following level has slots that
+        /// span a full rotation of the level below it, and its items cascade down a
+        /// level each time that lower level wraps. Scheduling and cancelling are O(1)
+        /// and advancing the wheel costs O(expired) plus the cascades.
+        ///
+        /// All operations are thread safe. The expiry callback passed to advance() is
+        /// run with the wheel locked and must not call back into the wheel.
+        ///
+        /// \tparam T The scheduled type which must derive from timing_wheel_hook
+        ///
+        template <typename T>
+        class timing_wheel : public boost::noncopyable
+        {
+        public:
+            typedef boost::chrono::steady_clock::time_point time_point;
+            typedef boost::chrono::steady_clock::duration duration;
+
+            ///
+            /// The default resolution of the wheel
+            ///
+            static const int DEFAULT_TICK_MS = 100;
+
+        public:
+            ///
+            /// \brief CTOR
+            /// \param tickLength The resolution of the wheel. Items never expire early
+            /// but may expire up to one tick late
+            ///
+            timing_wheel(duration tickLength = boost::chrono::milliseconds(DEFAULT_TICK_MS))
+            : _start(boost::chrono::steady_clock::now()), _tick_length(tickLength), _current(0), _count(0)
+            {
+                for (auto& level : _levels)
+                {
+                    for (auto& slot : level)
+                    {
+                        slot._prev = slot._next = &slot;
+                    }
+                }
+            }
+
+            ///
+            /// \brief Schedules the item to expire at the given time, replacing any
+            /// previous schedule
+            ///
+            void schedule(T* item, time_point deadline)
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+
+                timing_wheel_hook* hook = item;
+                if (hook->is_scheduled())
+                {
+                    this->unlink(hook);
+                }
+                else
+                {
+                    ++_count;
+                }
+
+                hook->_tick = this->tick_for(deadline);
+                this->place(hook);
+            }
+
+            ///
+            /// \brief Removes the item from the wheel if it is scheduled
+            ///
+            void cancel(T* item)
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+
+                timing_wheel_hook* hook = item;
+                if (hook->is_scheduled())
+                {
+                    this->unlink(hook);
+                    --_count;
+                }
+            }
+
+            ///
+            /// \brief Expires every item due at or before the given time
+            /// \param now The current time
+            /// \param onExpired Called with each expired item after it has been removed
+            /// \return The number of expired items
+            ///
+            template <typename F>
+            size_t advance(time_point now, F onExpired)
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+
+                if (now < _start) return 0;
+                uint64_t target = (uint64_t)((now - _start) / _tick_length);
+
+                size_t expired = 0;
+                while (_current <= target)
+                {
+                    if (_count == 0)
+                    {
+                        //nothing can cascade or expire, jump straight to the target
+                        _current = target + 1;
+                        break;
+                    }
+
+                    uint64_t tick = _current;
+                    size_t index = tick & LEVEL0_MASK;
+
+                    if (index == 0)
+                    {
+                        this->cascade(tick);
+                    }
+
+                    timing_wheel_hook& slot = _levels[0][index];
+                    while (slot._next != &slot)
+                    {
+                        timing_wheel_hook* hook = slot._next;
+                        this->unlink(hook);
+                        --_count;
+                        ++expired;
+
+                        onExpired(static_cast<T*>(hook));
+                    }
+
+                    ++_current;
+                }
+
+                return expired;
+            }
+
+            ///
+            /// \brief The next time advance() needs to be called. This is either the
+            /// tick of the next item in the first level or when the next cascade happens
+            ///
+            time_point next_expiry() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+
+                if (_count == 0) return time_point::max();
+
+                //a cascade is due, which may bring items into the first level
+                if ((_current & LEVEL0_MASK) == 0) return this->time_for(_current);
+
+                uint64_t tick = _current;
+                do
+                {
+                    const timing_wheel_hook& slot = _levels[0][tick & LEVEL0_MASK];
+                    if (slot._next != &slot) break;
+
+                    ++tick;
+                }
+                while ((tick & LEVEL0_MASK) != 0);
+
+                return this->time_for(tick);
+            }
+
+            ///
+            /// \brief The number of scheduled items
+            ///
+            size_t size() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                return _count;
+            }
+
+        private:
+            static const int LEVEL0_BITS = 8;
+            static const int LEVELN_BITS = 6;
+            static const int NUM_LEVELS = 4;
+            static const size_t LEVEL0_SIZE = 1 << LEVEL0_BITS;
+            static const size_t LEVELN_SIZE = 1 << LEVELN_BITS;
+            static const uint64_t LEVEL0_MASK = LEVEL0_SIZE - 1;
+            static const uint64_t LEVELN_MASK = LEVELN_SIZE - 1;
+
+            ///
+            /// Number of ticks the whole wheel spans. Anything further out is parked
+            /// in the last slot of the top level and cascades down from there
+            ///
+            static const uint64_t MAX_SPAN = (uint64_t)1 << (LEVEL0_BITS + LEVELN_BITS * (NUM_LEVELS - 1));
+
+            mutable std::mutex _lock;
+
+            time_point _start;
+            duration _tick_length;
+
+            ///
+            /// The next tick to be processed
+            ///
+            uint64_t _current;
+
+            size_t _count;
+
+            ///
+            /// Slot list heads. Only the first LEVELN_SIZE slots are used above level 0
+            ///
+            std::array<std::array<timing_wheel_hook, LEVEL0_SIZE>, NUM_LEVELS> _levels;
+
+            time_point time_for(uint64_t tick) const
+            {
+                return _start + _tick_length * (duration::rep)tick;
+            }
+
+            uint64_t tick_for(time_point deadline) const
+            {
+                if (deadline <= _start) return 0;
+
+                //round up so items are never expired early
+                duration offset = deadline - _start;
+                uint64_t tick = (uint64_t)(offset / _tick_length);
+                if (_tick_length * (duration::rep)tick < offset) ++tick;
+
+                return tick;
+            }
+
+            void place(timing_wheel_hook* hook)
+            {
+                uint64_t tick = hook->_tick < _current ? _current : hook->_tick;
+                uint64_t delta = tick - _current;
+
+                if (delta >= MAX_SPAN)
+                {
+                    delta = MAX_SPAN - 1;
+                    tick = _current + delta;
+                }
+
+                timing_wheel_hook* slot;
+                if (delta < LEVEL0_SIZE)
+                {
+                    slot = &_levels[0][tick & LEVEL0_MASK];
+                }
+                else
+                {
+                    int level = 1;
+                    int shift = LEVEL0_BITS;
+                    while (delta >= ((uint64_t)1 << (shift + LEVELN_BITS)))
+                    {
+                        ++level;
+                        shift += LEVELN_BITS;
+                    }
+
+                    slot = &_levels[level][(tick >> shift) & LEVELN_MASK];
+                }
+
+                hook->_prev = slot->_prev;
+                hook->_next = slot;
+                slot->_prev->_next = hook;
+                slot->_prev = hook;
+            }
+
+            void unlink(timing_wheel_hook* hook)
+            {
+                hook->_prev->_next = hook->_next;
+                hook->_next->_prev = hook->_prev;
+                hook->_prev = hook->_next = nullptr;
+            }
+
+            ///
+            /// Moves items from the upper levels down as the level below them wraps
+            ///
+            void cascade(uint64_t tick)
+            {
+                int shift = LEVEL0_BITS;
+                for (int level = 1; level < NUM_LEVELS; ++level)
+                {
+                    size_t index = (tick >> shift) & LEVELN_MASK;
+                    timing_wheel_hook& slot = _levels[level][index];
+
+                    //detach the whole list first since items may land back on this level
+                    timing_wheel_hook* hook = slot._next;
+                    slot._prev->_next = nullptr;
+                    slot._prev = slot._next = &slot;
+
+                    while (hook != nullptr && hook != &slot)
+                    {
+                        timing_wheel_hook* next = hook->_next;
+                        this->place(hook);
+                        hook = next;
+                    }
+
+                    //only continue upwards when this level has wrapped as well
+                    if (index != 0) break;
+
+                    shift += LEVELN_BITS;
+                }
+            }
+        };
+
+        template <typename T>
+        const int timing_wheel<T>::DEFAULT_TICK_MS;
+
+    }
+}
+
+#endif /* defined(__sopmq__timing_wheel__) */
@@ -19,6 +19,9 @@
 
 #include "util.h"
 #include "cassandra_storage.h"
+#include "user_cache.h"
+#include "settings.h"
+#include "crypto_pool.h"
 
 #include <cryptopp/sha.h>
 
@@ -53,56 +56,59 @@ namespace sopmq {
                                          const std::string& passwordChallengeHashHexString,
                                          std::function<void(bool)> authCallback)
         {
-            auto userLookupCb = [=](const storage::find_user_result& fur)
+            auto userLookupCb = [=](bool found, const user_account& account)
             {
-                if (!fur.user_found || fur.account.user_level() == 0)
+                if (!found || account.user_level() == 0)
                 {
                     authCallback(false);
+                    return;
                 }
                 
                 //we need to take the sha256 of the stored password hash and the
                 //auth challenge and compare that to the challenge response that
-                //was passed in
-                CryptoPP::SHA256 sha;
-                
-                unsigned char goodHash[CryptoPP::SHA256::DIGESTSIZE];
-                std::string goodPwHashAndChallenge(fur.account.pw_hash() + challengeBytes);
-                
-                sha.CalculateDigest(&goodHash[0], (unsigned char*)goodPwHashAndChallenge.c_str(),
-                                    goodPwHashAndChallenge.length());
-                
-                goodPwHashAndChallenge = util::hex_encode(goodHash, CryptoPP::SHA256::DIGESTSIZE);
-                
-                if (goodPwHashAndChallenge == passwordChallengeHashHexString)
-                {
-                    authCallback(true);
-                }
-                else
-                {
-                    authCallback(false);
-                }
+                //was passed in. that happens off the IO thread, whoever asked
+                //gets called back from the crypto pool
+                std::string pwHash(account.pw_hash());
+                crypto_pool::instance().post([=] {
+                    CryptoPP::SHA256 sha;
+                    
+                    unsigned char goodHash[CryptoPP::SHA256::DIGESTSIZE];
+                    std::string goodPwHashAndChallenge(pwHash + challengeBytes);
+                    
+                    sha.CalculateDigest(&goodHash[0], (unsigned char*)goodPwHashAndChallenge.c_str(),
+                                        goodPwHashAndChallenge.length());
+                    
+                    goodPwHashAndChallenge = util::hex_encode(goodHash, CryptoPP::SHA256::DIGESTSIZE);
+                    
+                    authCallback(goodPwHashAndChallenge == passwordChallengeHashHexString);
+                });
             };
             
-            cassandra_storage::instance().find_user(nameHashHexString, userLookupCb);
+            user_account::cache().find(nameHashHexString, userLookupCb);
         }
         
         void user_account::find(const std::string& nameHashHexString,
                                 std::function<void(bool, user_account)> findCallback)
         {
-            auto userLookupCb = [=](const storage::find_user_result& fur)
-            {
-                if (!fur.user_found)
-                {
-                    findCallback(false, user_account());
-                }
-                else
-                {
-                    findCallback(true, fur.account);
-                }
-                
-            };
+            user_account::cache().find(nameHashHexString, [=](bool found, const user_account& account) {
+                findCallback(found, account);
+            });
+        }
+        
+        user_cache& user_account::cache()
+        {
+            static user_cache cache(settings::instance().userCacheSize,
+                                    boost::chrono::seconds(settings::instance().userCacheTtl),
+                                    boost::chrono::seconds(settings::instance().userCacheNegativeTtl),
+                                    [](const std::string& nameHash, user_cache::fetch_callback callback) {
+                                        cassandra_storage::instance().find_user(nameHash, [callback](const storage::find_user_result& fur) {
+                                            if (fur.error) callback(user_cache::FS_ERROR, user_account());
+                                            else if (fur.user_found) callback(user_cache::FS_FOUND, fur.account);
+                                            else callback(user_cache::FS_NOT_FOUND, user_account());
+                                        });
+                                    });
             
-            cassandra_storage::instance().find_user(nameHashHexString, userLookupCb);
+            return cache;
         }
         
         user_account::user_account()
@@ -24,6 +24,8 @@
 namespace sopmq {
     namespace node {
         
+        class user_cache;
+        
         ///
         /// A user account on this sopmq cluster
         ///
@@ -55,6 +57,11 @@ namespace sopmq {
             static void find(const std::string& nameHashHexString,
                              std::function<void(bool, user_account)> findCallback);
             
+            ///
+            /// \brief The cache that lookups go through
+            ///
+            static user_cache& cache();
+            
         public:
             user_account();
             user_account(const std::string& nameHash, const std::string& userName,
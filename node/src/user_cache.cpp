@@ -0,0 +1,170 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "user_cache.h"
+
+namespace sopmq {
+    namespace node {
+        
+        user_cache::user_cache(size_t maxEntries, boost::chrono::milliseconds ttl,
+                               boost::chrono::milliseconds negativeTtl, fetch_function fetch)
+        : _max_entries(maxEntries), _ttl(ttl), _negative_ttl(negativeTtl), _fetch(fetch), _stats()
+        {
+            
+        }
+        
+        void user_cache::find(const std::string& nameHash, find_callback callback)
+        {
+            {
+                std::unique_lock<std::mutex> lock(_lock);
+                
+                auto iter = _entries.find(nameHash);
+                if (iter != _entries.end())
+                {
+                    if (clock::now() < iter->second.expires)
+                    {
+                        _lru.splice(_lru.begin(), _lru, iter->second.lru);
+                        
+                        bool found = iter->second.found;
+                        user_account account(iter->second.account);
+                        
+                        if (found) ++_stats.hits;
+                        else ++_stats.negative_hits;
+                        
+                        lock.unlock();
+                        callback(found, account);
+                        return;
+                    }
+                    
+                    this->erase(iter);
+                }
+                
+                auto pending = _pending.find(nameHash);
+                if (pending != _pending.end())
+                {
+                    ++_stats.merged;
+                    pending->second.callbacks.push_back(callback);
+                    return;
+                }
+                
+                ++_stats.misses;
+                
+                pending_lookup& lookup = _pending[nameHash];
+                lookup.callbacks.push_back(callback);
+                lookup.stale = false;
+            }
+            
+            _fetch(nameHash, [this, nameHash](fetch_status status, const user_account& account) {
+                this->on_fetched(nameHash, status, account);
+            });
+        }
+        
+        void user_cache::on_fetched(const std::string& nameHash, fetch_status status, const user_account& account)
+        {
+            std::vector<find_callback> callbacks;
+            
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                
+                auto pending = _pending.find(nameHash);
+                if (pending == _pending.end()) return;
+                
+                callbacks.swap(pending->second.callbacks);
+                bool stale = pending->second.stale;
+                _pending.erase(pending);
+                
+                if (status != FS_ERROR && ! stale)
+                {
+                    this->store(nameHash, status == FS_FOUND, account);
+                }
+            }
+            
+            //a storage error looks like an unknown user to the callers, same as before
+            //there was a cache
+            bool found = status == FS_FOUND;
+            for (auto& callback : callbacks)
+            {
+                callback(found, account);
+            }
+        }
+        
+        void user_cache::invalidate(const std::string& nameHash)
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            
+            auto iter = _entries.find(nameHash);
+            if (iter != _entries.end()) this->erase(iter);
+            
+            auto pending = _pending.find(nameHash);
+            if (pending != _pending.end()) pending->second.stale = true;
+        }
+        
+        void user_cache::clear()
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            
+            _entries.clear();
+            _lru.clear();
+            
+            for (auto& pending : _pending)
+            {
+                pending.second.stale = true;
+            }
+        }
+        
+        user_cache::stats user_cache::get_stats() const
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            return _stats;
+        }
+        
+        size_t user_cache::size() const
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            return _entries.size();
+        }
+        
+        void user_cache::store(const std::string& nameHash, bool found, const user_account& account)
+        {
+            if (_max_entries == 0) return;
+            
+            auto iter = _entries.find(nameHash);
+            if (iter != _entries.end()) this->erase(iter);
+            
+            while (_entries.size() >= _max_entries)
+            {
+                ++_stats.evictions;
+                this->erase(_entries.find(_lru.back()));
+            }
+            
+            _lru.push_front(nameHash);
+            
+            entry& e = _entries[nameHash];
+            e.found = found;
+            e.account = account;
+            e.expires = clock::now() + (found ? _ttl : _negative_ttl);
+            e.lru = _lru.begin();
+        }
+        
+        void user_cache::erase(std::unordered_map<std::string, entry>::iterator iter)
+        {
+            _lru.erase(iter->second.lru);
+            _entries.erase(iter);
+        }
+        
+    }
+}
@@ -0,0 +1,197 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__user_cache__
+#define __sopmq__user_cache__
+
+#include "user_account.h"
+
+#include <boost/noncopyable.hpp>
+#include <boost/chrono.hpp>
+
+#include <string>
+#include <functional>
+#include <unordered_map>
+#include <list>
+#include <vector>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+
+namespace sopmq {
+    namespace node {
+        
+        ///
+        /// \brief Keeps recently used user accounts in memory so logins don't all go to
+        /// storage
+        ///
+        /// Accounts are kept for a TTL and the least recently used are dropped once the
+        /// cache is full. Users that don't exist are remembered too, for a shorter time,
+        /// so repeated logins by an unknown name don't reach storage either. Lookups for
+        /// a user that is already being read from storage wait on that read instead of
+        /// starting their own.
+        ///
+        /// Safe to use from any thread. Callbacks are never called with the lock held.
+        ///
+        class user_cache : public boost::noncopyable
+        {
+        public:
+            enum fetch_status
+            {
+                FS_FOUND,
+                FS_NOT_FOUND,
+                
+                ///
+                /// Storage couldn't answer. Nothing is cached
+                ///
+                FS_ERROR
+            };
+            
+            typedef std::function<void(fetch_status, const user_account&)> fetch_callback;
+            
+            ///
+            /// Reads a user from storage by name hash. May call back from any thread
+            ///
+            typedef std::function<void(const std::string&, fetch_callback)> fetch_function;
+            
+            typedef std::function<void(bool, const user_account&)> find_callback;
+            
+            ///
+            /// Counters for how well the cache is doing
+            ///
+            struct stats
+            {
+                ///
+                /// Lookups answered with a cached account
+                ///
+                std::uint64_t hits;
+                
+                ///
+                /// Lookups answered with a cached unknown user
+                ///
+                std::uint64_t negative_hits;
+                
+                ///
+                /// Lookups that went to storage
+                ///
+                std::uint64_t misses;
+                
+                ///
+                /// Lookups that waited on a read another lookup had already started
+                ///
+                std::uint64_t merged;
+                
+                ///
+                /// Entries dropped to make room
+                ///
+                std::uint64_t evictions;
+            };
+            
+        public:
+            ///
+            /// \param maxEntries The most users held, found or not. 0 disables caching
+            /// but lookups are still merged
+            /// \param ttl How long a found user is used before it is read again
+            /// \param negativeTtl How long an unknown user is remembered
+            ///
+            user_cache(size_t maxEntries, boost::chrono::milliseconds ttl,
+                       boost::chrono::milliseconds negativeTtl, fetch_function fetch);
+            
+            ///
+            /// \brief Finds a user, from memory if we have it
+            ///
+            void find(const std::string& nameHash, find_callback callback);
+            
+            ///
+            /// \brief Forgets a user so the next lookup reads it from storage. Call
+            /// whenever a user is created or changed
+            ///
+            void invalidate(const std::string& nameHash);
+            
+            ///
+            /// \brief Forgets every user
+            ///
+            void clear();
+            
+            stats get_stats() const;
+            
+            ///
+            /// \brief The number of users held, found or not
+            ///
+            size_t size() const;
+            
+        private:
+            typedef boost::chrono::steady_clock clock;
+            
+            struct entry
+            {
+                bool found;
+                user_account account;
+                clock::time_point expires;
+                
+                ///
+                /// Our place in _lru
+                ///
+                std::list<std::string>::iterator lru;
+            };
+            
+            struct pending_lookup
+            {
+                std::vector<find_callback> callbacks;
+                
+                ///
+                /// Set when the user was invalidated during the read, so the result
+                /// may already be out of date and isn't cached
+                ///
+                bool stale;
+            };
+            
+            size_t _max_entries;
+            boost::chrono::milliseconds _ttl;
+            boost::chrono::milliseconds _negative_ttl;
+            fetch_function _fetch;
+            
+            mutable std::mutex _lock;
+            std::unordered_map<std::string, entry> _entries;
+            
+            ///
+            /// Name hashes, most recently used first
+            ///
+            std::list<std::string> _lru;
+            
+            std::unordered_map<std::string, pending_lookup> _pending;
+            
+            stats _stats;
+            
+            void on_fetched(const std::string& nameHash, fetch_status status, const user_account& account);
+            
+            ///
+            /// Adds or replaces an entry, evicting the oldest if we're full. Called
+            /// with the lock held
+            ///
+            void store(const std::string& nameHash, bool found, const user_account& account);
+            
+            ///
+            /// Called with the lock held
+            ///
+            void erase(std::unordered_map<std::string, entry>::iterator iter);
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__user_cache__) */
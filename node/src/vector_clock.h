@@ -51,9 +51,11 @@ namespace sopmq {
             }
             
             ///
-            /// Constructor to convert from a network VectorClock in a message to a server clock
+            /// Constructor to convert from a network VectorClock in a message to a server clock.
+            /// A shorter network clock leaves the rest of the positions zeroed
             ///
             vector_clock(const VectorClock& netClock)
+            : _value()
             {
                 if (netClock.clocks_size() > RF)
                 {
@@ -80,6 +82,19 @@ namespace sopmq {
             }
             */
             
+            ///
+            /// Writes this clock into a network VectorClock for a message
+            ///
+            void to_protobuf(VectorClock* netClock) const
+            {
+                netClock->clear_clocks();
+                
+                for (const auto& clock : _value)
+                {
+                    clock.to_protobuf(netClock->add_clocks());
+                }
+            }
+            
             ///
             /// Returns the clock's value
             ///
@@ -0,0 +1,227 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "buffer_pool.h"
+
+#include <utility>
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            const size_t buffer_pool::MIN_CLASS_SIZE;
+            const size_t buffer_pool::NUM_CLASSES;
+            const size_t buffer_pool::MAX_FREE_PER_CLASS;
+            const size_t buffer_pool::DEFAULT_MAX_RETAINED_BYTES;
+            const size_t buffer_pool::UNPOOLED;
+            
+            buffer_pool::buffer::buffer()
+            : _data(nullptr), _capacity(0), _size_class(UNPOOLED)
+            {
+                
+            }
+            
+            buffer_pool::buffer::buffer(ptr pool, char* data, size_t capacity, size_t sizeClass)
+            : _pool(std::move(pool)), _data(data), _capacity(capacity), _size_class(sizeClass)
+            {
+                
+            }
+            
+            buffer_pool::buffer::buffer(buffer&& other)
+            : _pool(std::move(other._pool)), _data(other._data), _capacity(other._capacity),
+            _size_class(other._size_class)
+            {
+                other._data = nullptr;
+                other._capacity = 0;
+            }
+            
+            buffer_pool::buffer& buffer_pool::buffer::operator=(buffer&& other)
+            {
+                if (this != &other)
+                {
+                    this->reset();
+                    
+                    _pool = std::move(other._pool);
+                    _data = other._data;
+                    _capacity = other._capacity;
+                    _size_class = other._size_class;
+                    
+                    other._data = nullptr;
+                    other._capacity = 0;
+                }
+                
+                return *this;
+            }
+            
+            buffer_pool::buffer::~buffer()
+            {
+                this->reset();
+            }
+            
+            char* buffer_pool::buffer::data() const
+            {
+                return _data;
+            }
+            
+            size_t buffer_pool::buffer::capacity() const
+            {
+                return _capacity;
+            }
+            
+            void buffer_pool::buffer::reset()
+            {
+                if (_data == nullptr) return;
+                
+                if (_pool)
+                {
+                    _pool->release(_data, _size_class);
+                    _pool.reset();
+                }
+                else
+                {
+                    delete [] _data;
+                }
+                
+                _data = nullptr;
+                _capacity = 0;
+            }
+            
+            
+            buffer_pool::ptr buffer_pool::create(size_t maxRetainedBytes)
+            {
+                return ptr(new buffer_pool(maxRetainedBytes));
+            }
+            
+            buffer_pool::buffer_pool(size_t maxRetainedBytes)
+            : _max_retained_bytes(maxRetainedBytes), _retained_bytes(0), _allocations(0), _reuses(0)
+            {
+                for (auto& freeList : _free)
+                {
+                    freeList.reserve(MAX_FREE_PER_CLASS);
+                }
+            }
+            
+            buffer_pool::~buffer_pool()
+            {
+                for (auto& freeList : _free)
+                {
+                    for (char* data : freeList)
+                    {
+                        delete [] data;
+                    }
+                }
+            }
+            
+            buffer_pool::buffer buffer_pool::acquire(size_t size)
+            {
+                size_t sizeClass = class_for(size);
+                
+                if (sizeClass == UNPOOLED)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(_lock);
+                        ++_allocations;
+                    }
+                    
+                    return buffer(shared_from_this(), new char[size], size, UNPOOLED);
+                }
+                
+                size_t capacity = class_size(sizeClass);
+                
+                {
+                    std::lock_guard<std::mutex> lock(_lock);
+                    
+                    auto& freeList = _free[sizeClass];
+                    if (! freeList.empty())
+                    {
+                        char* data = freeList.back();
+                        freeList.pop_back();
+                        _retained_bytes -= capacity;
+                        ++_reuses;
+                        
+                        return buffer(shared_from_this(), data, capacity, sizeClass);
+                    }
+                    
+                    ++_allocations;
+                }
+                
+                return buffer(shared_from_this(), new char[capacity], capacity, sizeClass);
+            }
+            
+            void buffer_pool::release(char* data, size_t sizeClass)
+            {
+                if (sizeClass != UNPOOLED)
+                {
+                    size_t capacity = class_size(sizeClass);
+                    
+                    std::lock_guard<std::mutex> lock(_lock);
+                    
+                    auto& freeList = _free[sizeClass];
+                    if (freeList.size() < MAX_FREE_PER_CLASS && _retained_bytes + capacity <= _max_retained_bytes)
+                    {
+                        freeList.push_back(data);
+                        _retained_bytes += capacity;
+                        return;
+                    }
+                }
+                
+                delete [] data;
+            }
+            
+            uint64_t buffer_pool::allocations() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                return _allocations;
+            }
+            
+            uint64_t buffer_pool::reuses() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                return _reuses;
+            }
+            
+            size_t buffer_pool::retained_bytes() const
+            {
+                std::lock_guard<std::mutex> lock(_lock);
+                return _retained_bytes;
+            }
+            
+            size_t buffer_pool::class_capacity(size_t size)
+            {
+                size_t sizeClass = class_for(size);
+                return sizeClass == UNPOOLED ? size : class_size(sizeClass);
+            }
+            
+            size_t buffer_pool::class_for(size_t size)
+            {
+                size_t sizeClass = 0;
+                while (sizeClass < NUM_CLASSES && class_size(sizeClass) < size)
+                {
+                    ++sizeClass;
+                }
+                
+                return sizeClass;
+            }
+            
+            size_t buffer_pool::class_size(size_t sizeClass)
+            {
+                return MIN_CLASS_SIZE << sizeClass;
+            }
+            
+        }
+    }
+}
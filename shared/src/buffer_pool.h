@@ -0,0 +1,171 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__buffer_pool__
+#define __sopmq__buffer_pool__
+
+#include <boost/noncopyable.hpp>
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <cstddef>
+#include <cstdint>
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            ///
+            /// \brief Size classed pool of receive buffers
+            ///
+            /// Each connection keeps one of these so that reading a message off the
+            /// wire reuses a buffer from an earlier message of similar size instead of
+            /// allocating a fresh one. Size classes double in size starting
+            /// at MIN_CLASS_SIZE, and only a handful of free buffers are kept per class
+            /// up to a total byte limit so idle connections don't pin much memory.
+            ///
+            class buffer_pool : public boost::noncopyable,
+                                public std::enable_shared_from_this<buffer_pool>
+            {
+            public:
+                typedef std::shared_ptr<buffer_pool> ptr;
+                
+                ///
+                /// The size of the smallest buffer class
+                ///
+                static const size_t MIN_CLASS_SIZE = 256;
+                
+                ///
+                /// The number of size classes. Requests larger than the biggest class
+                /// are allocated and freed without going through the pool
+                ///
+                static const size_t NUM_CLASSES = 16;
+                
+                ///
+                /// The number of free buffers kept for each size class
+                ///
+                static const size_t MAX_FREE_PER_CLASS = 4;
+                
+                ///
+                /// The default limit on the bytes held by free buffers
+                ///
+                static const size_t DEFAULT_MAX_RETAINED_BYTES = 8 * 1024 * 1024;
+                
+                ///
+                /// \brief A buffer checked out of the pool. Returns itself to the pool
+                /// when destroyed. Movable but not copyable
+                ///
+                class buffer
+                {
+                public:
+                    buffer();
+                    buffer(buffer&& other);
+                    buffer& operator=(buffer&& other);
+                    ~buffer();
+                    
+                    ///
+                    /// The start of the buffer or null if the buffer is empty
+                    ///
+                    char* data() const;
+                    
+                    ///
+                    /// The number of bytes that can be stored in the buffer, which
+                    /// may be more than were asked for
+                    ///
+                    size_t capacity() const;
+                    
+                    ///
+                    /// Gives the memory back to the pool early
+                    ///
+                    void reset();
+                    
+                private:
+                    friend class buffer_pool;
+                    
+                    buffer(ptr pool, char* data, size_t capacity, size_t sizeClass);
+                    buffer(const buffer&);
+                    buffer& operator=(const buffer&);
+                    
+                    ptr _pool;
+                    char* _data;
+                    size_t _capacity;
+                    size_t _size_class;
+                };
+                
+            public:
+                ///
+                /// \brief Creates a new pool. Pools must be owned by a shared_ptr since
+                /// outstanding buffers keep their pool alive
+                ///
+                static ptr create(size_t maxRetainedBytes = DEFAULT_MAX_RETAINED_BYTES);
+                
+                ~buffer_pool();
+                
+                ///
+                /// \brief Returns a buffer that can hold at least the given number of bytes
+                ///
+                buffer acquire(size_t size);
+                
+                ///
+                /// \brief The number of buffers that had to be allocated
+                ///
+                uint64_t allocations() const;
+                
+                ///
+                /// \brief The number of buffers that were served from the free lists
+                ///
+                uint64_t reuses() const;
+                
+                ///
+                /// \brief The bytes currently held by free buffers
+                ///
+                size_t retained_bytes() const;
+                
+                ///
+                /// \brief Returns the capacity of the size class that would be used for
+                /// the given request size
+                ///
+                static size_t class_capacity(size_t size);
+                
+            private:
+                ///
+                /// Marks a buffer that was allocated outside of the size classes
+                ///
+                static const size_t UNPOOLED = NUM_CLASSES;
+                
+                explicit buffer_pool(size_t maxRetainedBytes);
+                
+                static size_t class_for(size_t size);
+                static size_t class_size(size_t sizeClass);
+                
+                void release(char* data, size_t sizeClass);
+                
+                mutable std::mutex _lock;
+                std::array<std::vector<char*>, NUM_CLASSES> _free;
+                size_t _max_retained_bytes;
+                size_t _retained_bytes;
+                uint64_t _allocations;
+                uint64_t _reuses;
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__buffer_pool__) */
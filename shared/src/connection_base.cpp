@@ -18,23 +18,30 @@
 #include "connection_base.h"
 
 #include "network_operation_result.h"
+#include "network_error.h"
+#include "logging.h"
 
 #include <boost/lexical_cast.hpp>
 
 using namespace sopmq::message;
 using namespace std::placeholders;
 using sopmq::shared::net::network_operation_result;
+using sopmq::error::network_error;
 namespace ba_ip = boost::asio::ip;
 
 namespace sopmq {
     namespace shared {
         namespace net {
             
+            const size_t connection_base::FLUSH_BYTES;
+            
             connection_base::connection_base(boost::asio::io_service& ioService,
                                              const shared::net::endpoint& ep,
                                              uint32_t maxMessageSize)
             : _ioService(ioService), _endpoint(ep), _socket(ioService), _next_id(0),
-            _max_message_size(maxMessageSize)
+            _max_message_size(maxMessageSize), _receive_pool(buffer_pool::create()),
+            _frames(_receive_pool), _read_dispatcher(nullptr), _reading(false),
+            _flush_timer(ioService), _flush_delay(0), _flush_armed(false)
             {
                 
             }
@@ -42,7 +49,9 @@ namespace sopmq {
             connection_base::connection_base(boost::asio::io_service& ioService,
                                              uint32_t maxMessageSize)
             : _ioService(ioService), _endpoint(), _socket(ioService), _next_id(0),
-            _max_message_size(maxMessageSize)
+            _max_message_size(maxMessageSize), _receive_pool(buffer_pool::create()),
+            _frames(_receive_pool), _read_dispatcher(nullptr), _reading(false),
+            _flush_timer(ioService), _flush_delay(0), _flush_armed(false)
             {
                 
             }
@@ -57,6 +66,11 @@ namespace sopmq {
                 return _socket;
             }
             
+            boost::asio::io_service& connection_base::get_io_service()
+            {
+                return _ioService;
+            }
+            
             std::uint32_t connection_base::get_next_id()
             {
                 return ++_next_id;
@@ -119,17 +133,156 @@ namespace sopmq {
             void connection_base::send_message(message_type type, Message_ptr message,
                                                network_status_callback statusCb)
             {
-                messageutil::write_message(type, message, _ioService, _socket,
-                                           statusCb);
+                _writer.push(type, *message, statusCb);
+                
+                if (_writer.writing())
+                {
+                    //goes out with the next batch when the current write finishes
+                    return;
+                }
+                
+                if (_flush_delay.count() == 0 || _writer.queued_bytes() >= FLUSH_BYTES)
+                {
+                    this->flush();
+                }
+                else if (! _flush_armed)
+                {
+                    _flush_armed = true;
+                    _flush_timer.expires_from_now(std::chrono::microseconds(_flush_delay.count()));
+                    _flush_timer.async_wait(std::bind(&connection_base::after_flush_timer, this, _1));
+                }
+            }
+            
+            void connection_base::set_flush_delay(boost::chrono::microseconds flushDelay)
+            {
+                _flush_delay = flushDelay;
+            }
+            
+            void connection_base::flush()
+            {
+                if (_writer.writing() || !_writer.has_queued()) return;
+                
+                if (_flush_armed)
+                {
+                    _flush_timer.cancel();
+                    _flush_armed = false;
+                }
+                
+                boost::asio::async_write(_socket, _writer.begin_write(),
+                                         std::bind(&connection_base::after_write, this, _1, _2));
+            }
+            
+            void connection_base::after_write(const boost::system::error_code& err, std::size_t bytesTransferred)
+            {
+                _writer.end_write(err ? network_operation_result::from_error_code(err)
+                                      : network_operation_result::success());
+                
+                //anything queued during the write has already waited long enough
+                this->flush();
+            }
+            
+            void connection_base::after_flush_timer(const boost::system::error_code& err)
+            {
+                //cancelled by flush() or close(), or we're being destroyed. close()
+                //has already failed whatever was queued
+                if (err == boost::asio::error::operation_aborted) return;
+                
+                _flush_armed = false;
+                this->flush();
             }
             
             void connection_base::read_message(sopmq::message::message_dispatcher& dispatcher,
                                                sopmq::message::network_status_callback callback)
             {
-                messageutil::read_message(_ioService, _socket,
-                                          callback,
-                                          dispatcher,
-                                          _max_message_size);
+                _read_dispatcher = &dispatcher;
+                _read_callback = callback;
+                
+                //when called from inside a dispatch the loop below picks this up
+                if (_reading) return;
+                
+                this->process_frames();
+            }
+            
+            void connection_base::process_frames()
+            {
+                //the read callback holds whatever owns this connection, so keep
+                //the last one around until we're done touching members
+                network_status_callback callback;
+                
+                _reading = true;
+                
+                while (_read_callback)
+                {
+                    frame_reader::frame frame;
+                    auto result = _frames.next(frame, _max_message_size);
+                    
+                    if (result == frame_reader::NEED_MORE)
+                    {
+                        _socket.async_read_some(_frames.read_space(),
+                                                std::bind(&connection_base::after_read_some, this, _1, _2));
+                        return;
+                    }
+                    
+                    if (result == frame_reader::INVALID_TYPE)
+                    {
+                        this->read_failed(network_operation_result(ET_INVALID_TYPE,
+                                                                   network_error("Message type "
+                                                                                 + boost::lexical_cast<std::string>(frame.type)
+                                                                                 + " is invalid")));
+                        return;
+                    }
+                    
+                    if (result == frame_reader::TOO_LARGE)
+                    {
+                        LOG_SRC(error) << "message is too large (" << frame.size / 1024 << " KB)";
+                        
+                        this->read_failed(network_operation_result(ET_INVALID_TYPE,
+                                                                   network_error("Message was too large")));
+                        return;
+                    }
+                    
+                    //the request is answered by this frame. the callback will usually
+                    //ask for the next one before the message is handled
+                    callback = std::move(_read_callback);
+                    _read_callback = nullptr;
+                    
+                    messageutil::dispatch_message((message_type)frame.type, frame.body, frame.size,
+                                                  *_read_dispatcher, callback);
+                }
+                
+                _reading = false;
+            }
+            
+            void connection_base::after_read_some(const boost::system::error_code& err, std::size_t bytesTransferred)
+            {
+                if (err)
+                {
+                    this->read_failed(network_operation_result::from_error_code(err));
+                    return;
+                }
+                
+                _frames.commit(bytesTransferred);
+                this->process_frames();
+            }
+            
+            void connection_base::read_failed(const network_operation_result& error)
+            {
+                network_status_callback callback(std::move(_read_callback));
+                _read_callback = nullptr;
+                _reading = false;
+                
+                callback(error);
+                _read_dispatcher->cancel_all_with_error(error);
+            }
+            
+            const frame_reader& connection_base::reader() const
+            {
+                return _frames;
+            }
+            
+            const frame_writer& connection_base::writer() const
+            {
+                return _writer;
             }
             
             void connection_base::close()
@@ -137,6 +290,13 @@ namespace sopmq {
                 //we really don't care about errors here
                 boost::system::error_code ec;
                 _socket.close(ec);
+                _flush_timer.cancel(ec);
+                _flush_armed = false;
+                
+                //nothing queued goes out now. a batch in flight hears about it when
+                //its write completes
+                _writer.fail_queued(network_operation_result::from_error_code("connection closed",
+                                                                              boost::asio::error::operation_aborted));
             }
             
             void connection_base::resolve_connected_endpoint()
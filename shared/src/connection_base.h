@@ -23,8 +23,13 @@
 #include "message_ptrs.h"
 #include "messageutil.h"
 #include "message_dispatcher.h"
+#include "buffer_pool.h"
+#include "frame_reader.h"
+#include "frame_writer.h"
 
 #include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/chrono.hpp>
 
 #include <cstdint>
 #include <memory>
@@ -38,6 +43,13 @@ namespace sopmq {
             ///
             class connection_base
             {
+            public:
+                ///
+                /// Queued frames are written right away once they add up to this
+                /// many bytes, even if a flush delay is set
+                ///
+                static const size_t FLUSH_BYTES = 64 * 1024;
+                
             public:
                 ///
                 /// Constructor for an outbound connection
@@ -59,6 +71,11 @@ namespace sopmq {
                 ///
                 boost::asio::ip::tcp::socket& get_socket();
                 
+                ///
+                /// Returns the io_service this connection runs on
+                ///
+                boost::asio::io_service& get_io_service();
+                
                 ///
                 /// Returns the next message identifier on this connection
                 ///
@@ -80,17 +97,37 @@ namespace sopmq {
                 void connect(sopmq::message::network_status_callback ccb);
                 
                 ///
-                /// Sends a message over this connection
+                /// Sends a message over this connection. Messages are written in the
+                /// order they are sent, batched together with any others sent while
+                /// a write is in flight or the flush delay is running
                 ///
                 void send_message(sopmq::message::message_type type, Message_ptr message,
                                   sopmq::message::network_status_callback statusCb);
                 
                 ///
-                /// Reads a message from this connection
+                /// Reads a message from this connection. Messages already sitting in the
+                /// read buffer are dispatched without going back to the socket
                 ///
                 void read_message(sopmq::message::message_dispatcher& dispatcher,
                                   sopmq::message::network_status_callback callback);
                 
+                ///
+                /// Sets how long a message may wait for others to batch up with
+                /// before being written to an idle connection. Zero, the default,
+                /// writes immediately
+                ///
+                void set_flush_delay(boost::chrono::microseconds flushDelay);
+                
+                ///
+                /// Returns the frame reader for this connection's inbound messages
+                ///
+                const frame_reader& reader() const;
+                
+                ///
+                /// Returns the frame writer for this connection's outbound messages
+                ///
+                const frame_writer& writer() const;
+                
                 ///
                 /// Closes the connection
                 ///
@@ -106,11 +143,55 @@ namespace sopmq {
                 void after_connect(const boost::system::error_code& err,
                                    ::sopmq::message::network_status_callback ccb);
                 
+                ///
+                /// Dispatches buffered frames for as long as reads are being asked for,
+                /// and starts a socket read once the buffer runs dry
+                ///
+                void process_frames();
+                
+                void after_read_some(const boost::system::error_code& err, std::size_t bytesTransferred);
+                
+                void read_failed(const network_operation_result& error);
+                
+                ///
+                /// Starts writing everything queued unless a write is already in flight
+                ///
+                void flush();
+                
+                void after_write(const boost::system::error_code& err, std::size_t bytesTransferred);
+                
+                void after_flush_timer(const boost::system::error_code& err);
+                
                 boost::asio::io_service& _ioService;
                 shared::net::endpoint _endpoint;
                 boost::asio::ip::tcp::socket _socket;
                 std::uint32_t _next_id;
                 uint32_t _max_message_size;
+                
+                ///
+                /// Buffers for message bodies too large for the frame reader
+                ///
+                buffer_pool::ptr _receive_pool;
+                
+                frame_reader _frames;
+                
+                ///
+                /// The outstanding read request. Only one read can be asked for at a
+                /// time, and the callback is cleared once the request is answered
+                ///
+                sopmq::message::message_dispatcher* _read_dispatcher;
+                sopmq::message::network_status_callback _read_callback;
+                
+                ///
+                /// Set while frames are being dispatched or a socket read is pending
+                ///
+                bool _reading;
+                
+                frame_writer _writer;
+                
+                boost::asio::steady_timer _flush_timer;
+                boost::chrono::microseconds _flush_delay;
+                bool _flush_armed;
             };
             
         }
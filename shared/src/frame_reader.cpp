@@ -0,0 +1,181 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_reader.h"
+
+#include <boost/asio.hpp>
+
+#include <cstring>
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            const size_t frame_reader::HEADER_SIZE;
+            const size_t frame_reader::DEFAULT_BUFFER_SIZE;
+            
+            frame_reader::frame_reader(buffer_pool::ptr largeFramePool, size_t bufferSize)
+            : _buffer(bufferSize), _begin(0), _end(0), _large_frame_pool(largeFramePool),
+            _large_frame_type(0), _large_frame_size(0), _large_frame_filled(0),
+            _release_large_frame(false), _read_count(0), _frame_count(0)
+            {
+                
+            }
+            
+            ba::mutable_buffers_1 frame_reader::read_space()
+            {
+                if (_large_frame.data() != nullptr)
+                {
+                    return ba::buffer(_large_frame.data() + _large_frame_filled,
+                                      _large_frame_size - _large_frame_filled);
+                }
+                
+                return ba::buffer(_buffer.data() + _end, _buffer.size() - _end);
+            }
+            
+            void frame_reader::commit(size_t bytesRead)
+            {
+                ++_read_count;
+                
+                if (_large_frame.data() != nullptr)
+                {
+                    _large_frame_filled += (uint32_t)bytesRead;
+                }
+                else
+                {
+                    _end += bytesRead;
+                }
+            }
+            
+            frame_reader::result frame_reader::next(frame& out, uint32_t maxSize)
+            {
+                if (_release_large_frame)
+                {
+                    //the large frame handed out last time is done with
+                    _large_frame.reset();
+                    _release_large_frame = false;
+                }
+                
+                if (_large_frame.data() != nullptr)
+                {
+                    if (_large_frame_filled < _large_frame_size)
+                    {
+                        return NEED_MORE;
+                    }
+                    
+                    out.type = _large_frame_type;
+                    out.size = _large_frame_size;
+                    out.body = _large_frame.data();
+                    _release_large_frame = true;
+                    ++_frame_count;
+                    
+                    return FRAME_READY;
+                }
+                
+                size_t available = _end - _begin;
+                if (available < HEADER_SIZE)
+                {
+                    this->compact();
+                    return NEED_MORE;
+                }
+                
+                uint16_t netType;
+                uint32_t netSize;
+                std::memcpy(&netType, _buffer.data() + _begin, sizeof(netType));
+                std::memcpy(&netSize, _buffer.data() + _begin + sizeof(netType), sizeof(netSize));
+                
+                out.type = ba::detail::socket_ops::network_to_host_short(netType);
+                out.size = ba::detail::socket_ops::network_to_host_long(netSize);
+                out.body = nullptr;
+                
+                if (out.type <= message::MT_INVALID || out.type >= message::MT_INVALID_OUT_OF_RANGE)
+                {
+                    return INVALID_TYPE;
+                }
+                
+                if (out.size > maxSize)
+                {
+                    return TOO_LARGE;
+                }
+                
+                size_t frameSize = HEADER_SIZE + out.size;
+                if (available >= frameSize)
+                {
+                    out.body = _buffer.data() + _begin + HEADER_SIZE;
+                    
+                    //the body stays put until the next call, which is the only
+                    //thing that moves data around in the buffer
+                    _begin += frameSize;
+                    if (_begin == _end) _begin = _end = 0;
+                    
+                    ++_frame_count;
+                    return FRAME_READY;
+                }
+                
+                if (frameSize > _buffer.size())
+                {
+                    //won't ever fit, finish reading it somewhere else
+                    size_t partial = available - HEADER_SIZE;
+                    
+                    _large_frame = _large_frame_pool->acquire(out.size);
+                    _large_frame_type = out.type;
+                    _large_frame_size = out.size;
+                    _large_frame_filled = (uint32_t)partial;
+                    
+                    std::memcpy(_large_frame.data(), _buffer.data() + _begin + HEADER_SIZE, partial);
+                    _begin = _end = 0;
+                    
+                    return NEED_MORE;
+                }
+                
+                if (_begin + frameSize > _buffer.size())
+                {
+                    //not enough room left to finish the frame where it is
+                    this->compact();
+                }
+                
+                return NEED_MORE;
+            }
+            
+            size_t frame_reader::buffered() const
+            {
+                return (_end - _begin) + (_large_frame.data() != nullptr && !_release_large_frame ? _large_frame_filled : 0);
+            }
+            
+            uint64_t frame_reader::read_count() const
+            {
+                return _read_count;
+            }
+            
+            uint64_t frame_reader::frame_count() const
+            {
+                return _frame_count;
+            }
+            
+            void frame_reader::compact()
+            {
+                if (_begin == 0) return;
+                
+                std::memmove(_buffer.data(), _buffer.data() + _begin, _end - _begin);
+                _end -= _begin;
+                _begin = 0;
+            }
+        }
+    }
+}
@@ -0,0 +1,176 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__frame_reader__
+#define __sopmq__frame_reader__
+
+#include "buffer_pool.h"
+#include "message_types.h"
+
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            ///
+            /// \brief Splits the bytes read from a connection into [type][length][body] frames
+            ///
+            /// Reads go into one large buffer so a single socket read can pick up many
+            /// small frames, which are then handed out one at a time without touching
+            /// the socket again. A partial frame left at the end of the buffer is moved
+            /// back to the front when there isn't room to finish it. Frames too big for
+            /// the buffer are assembled in a buffer from the connection's pool and the
+            /// rest of their body is read straight into it.
+            ///
+            class frame_reader : public boost::noncopyable
+            {
+            public:
+                ///
+                /// The size of a frame header on the wire
+                ///
+                static const size_t HEADER_SIZE = sizeof(uint16_t) + sizeof(uint32_t);
+                
+                ///
+                /// The default size of the read buffer
+                ///
+                static const size_t DEFAULT_BUFFER_SIZE = 64 * 1024;
+                
+                enum result
+                {
+                    ///
+                    /// A complete frame was returned
+                    ///
+                    FRAME_READY,
+                    
+                    ///
+                    /// More data has to be read before the next frame is complete
+                    ///
+                    NEED_MORE,
+                    
+                    ///
+                    /// The next frame has an unknown message type
+                    ///
+                    INVALID_TYPE,
+                    
+                    ///
+                    /// The next frame is larger than the maximum message size
+                    ///
+                    TOO_LARGE
+                };
+                
+                ///
+                /// A frame taken from the reader. The body stays valid until the next
+                /// call to next()
+                ///
+                struct frame
+                {
+                    uint16_t type;
+                    uint32_t size;
+                    const char* body;
+                };
+                
+            public:
+                ///
+                /// \brief CTOR
+                /// \param largeFramePool Pool for frames that don't fit in the read buffer
+                /// \param bufferSize The size of the read buffer
+                ///
+                frame_reader(buffer_pool::ptr largeFramePool, size_t bufferSize = DEFAULT_BUFFER_SIZE);
+                
+                ///
+                /// \brief Returns the space the next socket read should go into
+                ///
+                boost::asio::mutable_buffers_1 read_space();
+                
+                ///
+                /// \brief Records that the given number of bytes were read into read_space()
+                ///
+                void commit(size_t bytesRead);
+                
+                ///
+                /// \brief Takes the next complete frame from the buffer
+                /// \param out Receives the frame. The type and size are also filled in
+                /// for INVALID_TYPE and TOO_LARGE
+                /// \param maxSize The largest body size that will be accepted
+                ///
+                result next(frame& out, uint32_t maxSize);
+                
+                ///
+                /// \brief The number of bytes buffered that haven't been returned in a frame
+                ///
+                size_t buffered() const;
+                
+                ///
+                /// \brief The number of reads committed to the reader
+                ///
+                uint64_t read_count() const;
+                
+                ///
+                /// \brief The number of complete frames handed out
+                ///
+                uint64_t frame_count() const;
+                
+            private:
+                std::vector<char> _buffer;
+                
+                ///
+                /// Start of the unconsumed bytes in the buffer
+                ///
+                size_t _begin;
+                
+                ///
+                /// End of the bytes read into the buffer
+                ///
+                size_t _end;
+                
+                buffer_pool::ptr _large_frame_pool;
+                
+                ///
+                /// Body of a frame too large for the buffer, and how much of it has
+                /// been read so far
+                ///
+                buffer_pool::buffer _large_frame;
+                uint16_t _large_frame_type;
+                uint32_t _large_frame_size;
+                uint32_t _large_frame_filled;
+                
+                ///
+                /// Set once the large frame has been handed out so it is released
+                /// on the following call to next()
+                ///
+                bool _release_large_frame;
+                
+                uint64_t _read_count;
+                uint64_t _frame_count;
+                
+                ///
+                /// Moves the unconsumed bytes to the start of the buffer
+                ///
+                void compact();
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__frame_reader__) */
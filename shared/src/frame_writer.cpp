@@ -0,0 +1,142 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "frame_writer.h"
+
+#include "frame_reader.h"
+
+#include <boost/asio.hpp>
+
+#include <cstring>
+#include <utility>
+
+namespace ba = boost::asio;
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            const size_t frame_writer::MAX_RETAINED_CAPACITY;
+            
+            frame_writer::frame_writer()
+            : _writing(false), _write_count(0), _frame_count(0)
+            {
+                
+            }
+            
+            void frame_writer::push(sopmq::message::message_type type, const google::protobuf::Message& message,
+                                    sopmq::message::network_status_callback statusCallback)
+            {
+                uint32_t size = (uint32_t)message.ByteSize();
+                
+                auto netType = ba::detail::socket_ops::host_to_network_short((uint16_t)type);
+                auto netSize = ba::detail::socket_ops::host_to_network_long(size);
+                BOOST_STATIC_ASSERT(sizeof(netType) + sizeof(netSize) == frame_reader::HEADER_SIZE);
+                
+                size_t offset = _queued.size();
+                _queued.resize(offset + frame_reader::HEADER_SIZE + size);
+                
+                char* frame = &_queued[offset];
+                std::memcpy(frame, &netType, sizeof(netType));
+                std::memcpy(frame + sizeof(netType), &netSize, sizeof(netSize));
+                
+                //uses the size cached by ByteSize() above
+                message.SerializeWithCachedSizesToArray(reinterpret_cast<uint8_t*>(frame + frame_reader::HEADER_SIZE));
+                
+                _queued_callbacks.push_back(std::move(statusCallback));
+            }
+            
+            bool frame_writer::has_queued() const
+            {
+                return ! _queued_callbacks.empty();
+            }
+            
+            size_t frame_writer::queued_bytes() const
+            {
+                return _queued.size();
+            }
+            
+            bool frame_writer::writing() const
+            {
+                return _writing;
+            }
+            
+            ba::const_buffers_1 frame_writer::begin_write()
+            {
+                BOOST_ASSERT(! _writing && this->has_queued());
+                
+                //the in flight buffers were cleared by end_write() but kept their capacity
+                _in_flight.swap(_queued);
+                _in_flight_callbacks.swap(_queued_callbacks);
+                _writing = true;
+                
+                return ba::buffer(_in_flight.data(), _in_flight.size());
+            }
+            
+            void frame_writer::end_write(const network_operation_result& result)
+            {
+                ++_write_count;
+                _frame_count += _in_flight_callbacks.size();
+                _writing = false;
+                
+                //the callbacks may queue more frames, so take them out first
+                std::vector<sopmq::message::network_status_callback> callbacks;
+                callbacks.swap(_in_flight_callbacks);
+                
+                if (_in_flight.capacity() > MAX_RETAINED_CAPACITY)
+                {
+                    std::string().swap(_in_flight);
+                }
+                else
+                {
+                    _in_flight.clear();
+                }
+                
+                for (auto& callback : callbacks)
+                {
+                    if (callback) callback(result);
+                }
+                
+                //hand the vector back so its capacity is reused
+                callbacks.clear();
+                if (_in_flight_callbacks.empty()) _in_flight_callbacks.swap(callbacks);
+            }
+            
+            void frame_writer::fail_queued(const network_operation_result& result)
+            {
+                std::vector<sopmq::message::network_status_callback> callbacks;
+                callbacks.swap(_queued_callbacks);
+                _queued.clear();
+                
+                for (auto& callback : callbacks)
+                {
+                    if (callback) callback(result);
+                }
+            }
+            
+            uint64_t frame_writer::write_count() const
+            {
+                return _write_count;
+            }
+            
+            uint64_t frame_writer::frame_count() const
+            {
+                return _frame_count;
+            }
+        }
+    }
+}
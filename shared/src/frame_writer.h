@@ -0,0 +1,129 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__frame_writer__
+#define __sopmq__frame_writer__
+
+#include "message_types.h"
+#include "messageutil.h"
+#include "network_operation_result.h"
+
+#include <google/protobuf/message.h>
+#include <boost/asio/buffer.hpp>
+#include <boost/noncopyable.hpp>
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace sopmq {
+    namespace shared {
+        namespace net {
+            
+            ///
+            /// \brief Queues outbound [type][length][body] frames so they can be written
+            /// to a connection in batches
+            ///
+            /// Messages are serialized straight into one contiguous buffer behind
+            /// their headers, so a batch of any number of frames goes out as a
+            /// single buffer without any per frame allocation or copy. Only one
+            /// batch is in flight at a time. Frames queued while it's being written
+            /// make up the next batch.
+            ///
+            class frame_writer : public boost::noncopyable
+            {
+            public:
+                ///
+                /// Write buffers with a capacity over this are released after each
+                /// batch instead of being kept for reuse
+                ///
+                static const size_t MAX_RETAINED_CAPACITY = 1024 * 1024;
+                
+            public:
+                frame_writer();
+                
+                ///
+                /// \brief Serializes the message into the queue
+                /// \param statusCallback Called once the batch holding the message
+                /// has been written
+                ///
+                void push(sopmq::message::message_type type, const google::protobuf::Message& message,
+                          sopmq::message::network_status_callback statusCallback);
+                
+                ///
+                /// \brief Whether or not there are frames waiting for the next batch
+                ///
+                bool has_queued() const;
+                
+                ///
+                /// \brief The bytes waiting for the next batch
+                ///
+                size_t queued_bytes() const;
+                
+                ///
+                /// \brief Whether or not a batch is being written
+                ///
+                bool writing() const;
+                
+                ///
+                /// \brief Moves everything queued into a new batch. There must be frames
+                /// queued and no batch in flight
+                /// \return The buffer to write
+                ///
+                boost::asio::const_buffers_1 begin_write();
+                
+                ///
+                /// \brief Completes the batch in flight and reports the result to each
+                /// of its frames
+                ///
+                void end_write(const network_operation_result& result);
+                
+                ///
+                /// \brief Drops the frames waiting for the next batch and reports the
+                /// result to each of them. A batch in flight is left alone
+                ///
+                void fail_queued(const network_operation_result& result);
+                
+                ///
+                /// \brief The number of batches written
+                ///
+                uint64_t write_count() const;
+                
+                ///
+                /// \brief The number of frames written
+                ///
+                uint64_t frame_count() const;
+                
+            private:
+                std::string _queued;
+                std::vector<sopmq::message::network_status_callback> _queued_callbacks;
+                
+                std::string _in_flight;
+                std::vector<sopmq::message::network_status_callback> _in_flight_callbacks;
+                
+                bool _writing;
+                
+                uint64_t _write_count;
+                uint64_t _frame_count;
+            };
+            
+        }
+    }
+}
+
+#endif /* defined(__sopmq__frame_writer__) */
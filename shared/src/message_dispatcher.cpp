@@ -44,12 +44,20 @@
 #include "AnswerChallengeMessage.pb.h"
 #include "AuthAckMessage.pb.h"
 #include "ChallengeResponseMessage.pb.h"
+#include "ClaimMessage.pb.h"
+#include "ClaimResponseMessage.pb.h"
+#include "ConsumeCreditMessage.pb.h"
 #include "ConsumeFromQueueMessage.pb.h"
 #include "ConsumeResponseMessage.pb.h"
+#include "DeliveryMessage.pb.h"
 #include "GetChallengeMessage.pb.h"
 #include "GossipMessage.pb.h"
+#include "ProxyPublishBatchMessage.pb.h"
+#include "ProxyPublishBatchResponseMessage.pb.h"
 #include "ProxyPublishMessage.pb.h"
 #include "ProxyPublishResponseMessage.pb.h"
+#include "PublishBatchMessage.pb.h"
+#include "PublishBatchResponseMessage.pb.h"
 #include "PublishMessage.pb.h"
 #include "PublishResponseMessage.pb.h"
 #include "StampMessage.pb.h"
@@ -58,20 +66,134 @@
 namespace sopmq {
     namespace message {
         
+        template <typename T>
+        void message_dispatcher::set_reply_handler(std::function<void(const sopmq::shared::net::network_operation_result&, std::shared_ptr<T>)> handler,
+                                                   std::uint32_t inReplyTo)
+        {
+            if (! handler)
+            {
+                _pendingReplies.erase(inReplyTo);
+                return;
+            }
+            
+            std::uint64_t timeoutTick = 0;
+            if (_replyTimer && _replyTimeout > boost::chrono::steady_clock::duration::zero())
+            {
+                timeoutTick = _replyTimeouts.schedule(inReplyTo, boost::chrono::steady_clock::now() + _replyTimeout);
+            }
+            
+            _pendingReplies.insert(inReplyTo, T::descriptor(),
+                                   [handler](const sopmq::shared::net::network_operation_result& result, Message_ptr message) {
+                                       handler(result, std::static_pointer_cast<T>(message));
+                                   },
+                                   timeoutTick);
+            
+            if (timeoutTick != 0)
+            {
+                this->arm_reply_timer();
+            }
+        }
+        
         message_dispatcher::message_dispatcher()
+        : _replyTimeout(0), _replyTimerArmedFor(boost::chrono::steady_clock::time_point::max())
         {
             
         }
         
         message_dispatcher::message_dispatcher(std::function<void(Message_ptr, const std::string&)> unhandledHandler)
-        : _unhandledHandler(unhandledHandler)
+        : _unhandledHandler(unhandledHandler),
+        _replyTimeout(0), _replyTimerArmedFor(boost::chrono::steady_clock::time_point::max())
         {
             
         }
         
         message_dispatcher::~message_dispatcher()
         {
+            if (_replyTimer)
+            {
+                boost::system::error_code ec;
+                _replyTimer->cancel(ec);
+            }
+        }
+        
+        void message_dispatcher::set_reply_timeout(boost::asio::io_service& ioService, boost::chrono::steady_clock::duration timeout)
+        {
+            //handlers already waiting keep the timeout they were given
+            _replyTimeout = timeout;
+            
+            if (! _replyTimer && timeout > boost::chrono::steady_clock::duration::zero())
+            {
+                _replyTimer = std::make_shared<boost::asio::steady_timer>(ioService);
+            }
+        }
+        
+        size_t message_dispatcher::expire_replies(boost::chrono::steady_clock::time_point now)
+        {
+            //everything due is collected before any handler runs, since handlers
+            //may well set new reply handlers
+            std::vector<reply_timeout_wheel::due_reply> due;
+            due.swap(_dueReplies);
+            _replyTimeouts.advance(now, due);
+            
+            size_t expired = 0;
+            if (! due.empty())
+            {
+                shared::net::network_operation_result timedOut(shared::net::ET_TIMEOUT,
+                                                               error::network_error("Timed out waiting for a reply"));
+                
+                for (auto& timeout : due)
+                {
+                    pending_reply_table::entry reply;
+                    if (_pendingReplies.take_expired(timeout.in_reply_to, timeout.tick, reply))
+                    {
+                        ++expired;
+                        reply.handler(timedOut, nullptr);
+                    }
+                }
+            }
+            
+            due.clear();
+            _dueReplies.swap(due);
+            
+            if (_replyTimer)
+            {
+                this->arm_reply_timer();
+            }
+            
+            return expired;
+        }
+        
+        size_t message_dispatcher::pending_replies() const
+        {
+            return _pendingReplies.size();
+        }
+        
+        void message_dispatcher::arm_reply_timer()
+        {
+            auto next = _replyTimeouts.next_expiry();
+            if (next >= _replyTimerArmedFor) return;
+            
+            _replyTimerArmedFor = next;
+            
+            auto wait = boost::chrono::duration_cast<boost::chrono::nanoseconds>(next - boost::chrono::steady_clock::now());
             
+            _replyTimer->expires_from_now(std::chrono::nanoseconds(wait.count() > 0 ? wait.count() : 0));
+            
+            std::weak_ptr<boost::asio::steady_timer> timer(_replyTimer);
+            _replyTimer->async_wait([this, timer](const boost::system::error_code& error) {
+                //the dispatcher or its timer is gone
+                if (timer.expired()) return;
+                
+                this->on_reply_timer(error);
+            });
+        }
+        
+        void message_dispatcher::on_reply_timer(const boost::system::error_code& error)
+        {
+            if (error == boost::asio::error::operation_aborted) return;
+            
+            _replyTimerArmedFor = boost::chrono::steady_clock::time_point::max();
+            this->expire_replies(boost::chrono::steady_clock::now());
         }
         
         void message_dispatcher::set_unhandled_handler(std::function<void (Message_ptr, const std::string &)> unhandledHandler)
@@ -85,71 +207,118 @@ namespace sopmq {
              for fn in fnames:
                 if "Message" in fn:
                     rawname = os.path.splitext(os.path.basename(fn))[0]
-                    cog.outl("for (auto handler : _%sHandlers)\n{" % first_lower(rawname))
-                    cog.outl("  handler.second(result, nullptr);")
+                    cog.outl("if (auto handler = _%sHandler)\n{" % first_lower(rawname))
+                    cog.outl("  (*handler)(result, nullptr);")
                     cog.outl("}\n");
              ]]]*/
-            for (auto handler : _answerChallengeMessageHandlers)
+            if (auto handler = _answerChallengeMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _authAckMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _authAckMessageHandlers)
+            if (auto handler = _challengeResponseMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _challengeResponseMessageHandlers)
+            if (auto handler = _claimMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _consumeFromQueueMessageHandlers)
+            if (auto handler = _claimResponseMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _consumeResponseMessageHandlers)
+            if (auto handler = _consumeCreditMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _getChallengeMessageHandlers)
+            if (auto handler = _consumeFromQueueMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _gossipMessageHandlers)
+            if (auto handler = _consumeResponseMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _proxyPublishMessageHandlers)
+            if (auto handler = _deliveryMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _proxyPublishResponseMessageHandlers)
+            if (auto handler = _getChallengeMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _publishMessageHandlers)
+            if (auto handler = _gossipMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _publishResponseMessageHandlers)
+            if (auto handler = _proxyPublishBatchMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
             }
 
-            for (auto handler : _stampMessageHandlers)
+            if (auto handler = _proxyPublishBatchResponseMessageHandler)
             {
-              handler.second(result, nullptr);
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _proxyPublishMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _proxyPublishResponseMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _publishBatchMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _publishBatchResponseMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _publishMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _publishResponseMessageHandler)
+            {
+              (*handler)(result, nullptr);
+            }
+
+            if (auto handler = _stampMessageHandler)
+            {
+              (*handler)(result, nullptr);
             }
 
             //[[[end]]]
+            
+            //waiting replies won't be coming now
+            _replyTimeouts.clear();
+            for (auto& reply : _pendingReplies.take_all())
+            {
+                reply.handler(result, nullptr);
+            }
         }
         
         /*[[[cog
@@ -159,80 +328,128 @@ namespace sopmq {
              cog.outl("")
              cog.outl("void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, %s_ptr %s)" % (rawname,first_lower(rawname)))
              cog.outl("{")
-             cog.outl("    do_dispatch(_%sHandlers, result, %s);" % (first_lower(rawname), first_lower(rawname)))
+             cog.outl("    do_dispatch(_%sHandler, result, %s);" % (first_lower(rawname), first_lower(rawname)))
              cog.outl("}")
              cog.outl("")
          ]]]*/
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, AnswerChallengeMessage_ptr answerChallengeMessage)
         {
-            do_dispatch(_answerChallengeMessageHandlers, result, answerChallengeMessage);
+            do_dispatch(_answerChallengeMessageHandler, result, answerChallengeMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, AuthAckMessage_ptr authAckMessage)
         {
-            do_dispatch(_authAckMessageHandlers, result, authAckMessage);
+            do_dispatch(_authAckMessageHandler, result, authAckMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ChallengeResponseMessage_ptr challengeResponseMessage)
         {
-            do_dispatch(_challengeResponseMessageHandlers, result, challengeResponseMessage);
+            do_dispatch(_challengeResponseMessageHandler, result, challengeResponseMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ClaimMessage_ptr claimMessage)
+        {
+            do_dispatch(_claimMessageHandler, result, claimMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ClaimResponseMessage_ptr claimResponseMessage)
+        {
+            do_dispatch(_claimResponseMessageHandler, result, claimResponseMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeCreditMessage_ptr consumeCreditMessage)
+        {
+            do_dispatch(_consumeCreditMessageHandler, result, consumeCreditMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeFromQueueMessage_ptr consumeFromQueueMessage)
         {
-            do_dispatch(_consumeFromQueueMessageHandlers, result, consumeFromQueueMessage);
+            do_dispatch(_consumeFromQueueMessageHandler, result, consumeFromQueueMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeResponseMessage_ptr consumeResponseMessage)
         {
-            do_dispatch(_consumeResponseMessageHandlers, result, consumeResponseMessage);
+            do_dispatch(_consumeResponseMessageHandler, result, consumeResponseMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, DeliveryMessage_ptr deliveryMessage)
+        {
+            do_dispatch(_deliveryMessageHandler, result, deliveryMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, GetChallengeMessage_ptr getChallengeMessage)
         {
-            do_dispatch(_getChallengeMessageHandlers, result, getChallengeMessage);
+            do_dispatch(_getChallengeMessageHandler, result, getChallengeMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, GossipMessage_ptr gossipMessage)
         {
-            do_dispatch(_gossipMessageHandlers, result, gossipMessage);
+            do_dispatch(_gossipMessageHandler, result, gossipMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishBatchMessage_ptr proxyPublishBatchMessage)
+        {
+            do_dispatch(_proxyPublishBatchMessageHandler, result, proxyPublishBatchMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishBatchResponseMessage_ptr proxyPublishBatchResponseMessage)
+        {
+            do_dispatch(_proxyPublishBatchResponseMessageHandler, result, proxyPublishBatchResponseMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishMessage_ptr proxyPublishMessage)
         {
-            do_dispatch(_proxyPublishMessageHandlers, result, proxyPublishMessage);
+            do_dispatch(_proxyPublishMessageHandler, result, proxyPublishMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishResponseMessage_ptr proxyPublishResponseMessage)
         {
-            do_dispatch(_proxyPublishResponseMessageHandlers, result, proxyPublishResponseMessage);
+            do_dispatch(_proxyPublishResponseMessageHandler, result, proxyPublishResponseMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, PublishBatchMessage_ptr publishBatchMessage)
+        {
+            do_dispatch(_publishBatchMessageHandler, result, publishBatchMessage);
+        }
+
+
+        void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, PublishBatchResponseMessage_ptr publishBatchResponseMessage)
+        {
+            do_dispatch(_publishBatchResponseMessageHandler, result, publishBatchResponseMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, PublishMessage_ptr publishMessage)
         {
-            do_dispatch(_publishMessageHandlers, result, publishMessage);
+            do_dispatch(_publishMessageHandler, result, publishMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, PublishResponseMessage_ptr publishResponseMessage)
         {
-            do_dispatch(_publishResponseMessageHandlers, result, publishResponseMessage);
+            do_dispatch(_publishResponseMessageHandler, result, publishResponseMessage);
         }
 
 
         void message_dispatcher::dispatch(const sopmq::shared::net::network_operation_result& result, StampMessage_ptr stampMessage)
         {
-            do_dispatch(_stampMessageHandlers, result, stampMessage);
+            do_dispatch(_stampMessageHandler, result, stampMessage);
         }
 
         //[[[end]]]
@@ -244,248 +461,400 @@ namespace sopmq {
              cog.outl("")
              cog.outl("void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, %s_ptr)> handler)" % rawname)
              cog.outl("{")
-             cog.outl("    if (handler)")
+             cog.outl("    _%sHandler = make_handler(handler);" % first_lower(rawname))
+             cog.outl("}")
+             cog.outl("")
+             cog.outl("void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, %s_ptr)> handler, std::uint32_t inReplyTo)" % rawname)
+             cog.outl("{")
+             cog.outl("    if (inReplyTo == 0)")
              cog.outl("    {")
-             cog.outl("        _%sHandlers[0] = handler;" % first_lower(rawname))
+             cog.outl("        _%sHandler = make_handler(handler);" % first_lower(rawname))
              cog.outl("    }")
              cog.outl("    else")
              cog.outl("    {")
-             cog.outl("        _%sHandlers.erase(0);" % first_lower(rawname))
+             cog.outl("        set_reply_handler(handler, inReplyTo);")
              cog.outl("    }")
              cog.outl("}")
              cog.outl("")
-             cog.outl("void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, %s_ptr)> handler, std::uint32_t inReplyTo)" % rawname)
-             cog.outl("{")
-             cog.outl("    _%sHandlers[inReplyTo] = handler;" % first_lower(rawname))
-             cog.outl("}")
-             cog.outl("")
              cog.outl("")
          ]]]*/
 
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AnswerChallengeMessage_ptr)> handler)
         {
-            if (handler)
+            _answerChallengeMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AnswerChallengeMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _answerChallengeMessageHandlers[0] = handler;
+                _answerChallengeMessageHandler = make_handler(handler);
             }
             else
             {
-                _answerChallengeMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AnswerChallengeMessage_ptr)> handler, std::uint32_t inReplyTo)
-        {
-            _answerChallengeMessageHandlers[inReplyTo] = handler;
-        }
-
 
 
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AuthAckMessage_ptr)> handler)
         {
-            if (handler)
+            _authAckMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AuthAckMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _authAckMessageHandlers[0] = handler;
+                _authAckMessageHandler = make_handler(handler);
             }
             else
             {
-                _authAckMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, AuthAckMessage_ptr)> handler, std::uint32_t inReplyTo)
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler)
+        {
+            _challengeResponseMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _authAckMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _challengeResponseMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler)
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimMessage_ptr)> handler)
         {
-            if (handler)
+            _claimMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _challengeResponseMessageHandlers[0] = handler;
+                _claimMessageHandler = make_handler(handler);
             }
             else
             {
-                _challengeResponseMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimResponseMessage_ptr)> handler)
         {
-            _challengeResponseMessageHandlers[inReplyTo] = handler;
+            _claimResponseMessageHandler = make_handler(handler);
         }
 
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
+            {
+                _claimResponseMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
+        }
 
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)> handler)
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeCreditMessage_ptr)> handler)
+        {
+            _consumeCreditMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeCreditMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            if (handler)
+            if (inReplyTo == 0)
             {
-                _consumeFromQueueMessageHandlers[0] = handler;
+                _consumeCreditMessageHandler = make_handler(handler);
             }
             else
             {
-                _consumeFromQueueMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)> handler)
+        {
+            _consumeFromQueueMessageHandler = make_handler(handler);
+        }
+
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _consumeFromQueueMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _consumeFromQueueMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
 
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> handler)
         {
-            if (handler)
+            _consumeResponseMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _consumeResponseMessageHandlers[0] = handler;
+                _consumeResponseMessageHandler = make_handler(handler);
             }
             else
             {
-                _consumeResponseMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
-        {
-            _consumeResponseMessageHandlers[inReplyTo] = handler;
-        }
 
 
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, DeliveryMessage_ptr)> handler)
+        {
+            _deliveryMessageHandler = make_handler(handler);
+        }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)> handler)
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, DeliveryMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            if (handler)
+            if (inReplyTo == 0)
             {
-                _getChallengeMessageHandlers[0] = handler;
+                _deliveryMessageHandler = make_handler(handler);
             }
             else
             {
-                _getChallengeMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)> handler)
+        {
+            _getChallengeMessageHandler = make_handler(handler);
+        }
+
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _getChallengeMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _getChallengeMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
 
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)> handler)
         {
-            if (handler)
+            _gossipMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _gossipMessageHandlers[0] = handler;
+                _gossipMessageHandler = make_handler(handler);
             }
             else
             {
-                _gossipMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)> handler, std::uint32_t inReplyTo)
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchMessage_ptr)> handler)
         {
-            _gossipMessageHandlers[inReplyTo] = handler;
+            _proxyPublishBatchMessageHandler = make_handler(handler);
         }
 
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
+            {
+                _proxyPublishBatchMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
+        }
 
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)> handler)
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchResponseMessage_ptr)> handler)
         {
-            if (handler)
+            _proxyPublishBatchResponseMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _proxyPublishMessageHandlers[0] = handler;
+                _proxyPublishBatchResponseMessageHandler = make_handler(handler);
             }
             else
             {
-                _proxyPublishMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)> handler)
+        {
+            _proxyPublishMessageHandler = make_handler(handler);
+        }
+
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _proxyPublishMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _proxyPublishMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
 
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)> handler)
         {
-            if (handler)
+            _proxyPublishResponseMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+        {
+            if (inReplyTo == 0)
             {
-                _proxyPublishResponseMessageHandlers[0] = handler;
+                _proxyPublishResponseMessageHandler = make_handler(handler);
             }
             else
             {
-                _proxyPublishResponseMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
-        {
-            _proxyPublishResponseMessageHandlers[inReplyTo] = handler;
-        }
 
 
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchMessage_ptr)> handler)
+        {
+            _publishBatchMessageHandler = make_handler(handler);
+        }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler)
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            if (handler)
+            if (inReplyTo == 0)
             {
-                _publishMessageHandlers[0] = handler;
+                _publishBatchMessageHandler = make_handler(handler);
             }
             else
             {
-                _publishMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler, std::uint32_t inReplyTo)
-        {
-            _publishMessageHandlers[inReplyTo] = handler;
-        }
 
 
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchResponseMessage_ptr)> handler)
+        {
+            _publishBatchResponseMessageHandler = make_handler(handler);
+        }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishResponseMessage_ptr)> handler)
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            if (handler)
+            if (inReplyTo == 0)
             {
-                _publishResponseMessageHandlers[0] = handler;
+                _publishBatchResponseMessageHandler = make_handler(handler);
             }
             else
             {
-                _publishResponseMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler)
+        {
+            _publishMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _publishResponseMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _publishMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
 
-        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, StampMessage_ptr)> handler)
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishResponseMessage_ptr)> handler)
+        {
+            _publishResponseMessageHandler = make_handler(handler);
+        }
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishResponseMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            if (handler)
+            if (inReplyTo == 0)
             {
-                _stampMessageHandlers[0] = handler;
+                _publishResponseMessageHandler = make_handler(handler);
             }
             else
             {
-                _stampMessageHandlers.erase(0);
+                set_reply_handler(handler, inReplyTo);
             }
         }
 
+
+
+        void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, StampMessage_ptr)> handler)
+        {
+            _stampMessageHandler = make_handler(handler);
+        }
+
         void message_dispatcher::set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, StampMessage_ptr)> handler, std::uint32_t inReplyTo)
         {
-            _stampMessageHandlers[inReplyTo] = handler;
+            if (inReplyTo == 0)
+            {
+                _stampMessageHandler = make_handler(handler);
+            }
+            else
+            {
+                set_reply_handler(handler, inReplyTo);
+            }
         }
 
 
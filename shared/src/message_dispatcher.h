@@ -20,10 +20,16 @@
 
 #include "message_ptrs.h"
 #include "network_operation_result.h"
+#include "pending_reply_table.h"
+#include "reply_timeout_wheel.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/chrono.hpp>
 
 #include <functional>
 #include <memory>
-#include <unordered_map>
+#include <vector>
 #include <cstdint>
 
 //
@@ -66,6 +72,27 @@ namespace sopmq {
             ///
             void cancel_all_with_error(const sopmq::shared::net::network_operation_result& result);
             
+            ///
+            /// \brief Times out reply handlers that have waited longer than the given
+            /// timeout, calling them with an ET_TIMEOUT result
+            ///
+            /// Applies to reply handlers set after the call. The timeouts are run from
+            /// a timer on the given io_service, which must be the one the connection
+            /// this dispatcher reads from runs on. A zero timeout waits forever
+            ///
+            void set_reply_timeout(boost::asio::io_service& ioService, boost::chrono::steady_clock::duration timeout);
+            
+            ///
+            /// \brief Times out every reply handler due at or before the given time
+            /// \return The number of handlers that timed out
+            ///
+            size_t expire_replies(boost::chrono::steady_clock::time_point now);
+            
+            ///
+            /// \brief The number of reply handlers waiting on a reply
+            ///
+            size_t pending_replies() const;
+            
             /*[[[cog
              for fn in fnames:
                if "Message" in fn:
@@ -75,12 +102,20 @@ namespace sopmq {
             void dispatch(const sopmq::shared::net::network_operation_result& result, AnswerChallengeMessage_ptr answerChallengeMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, AuthAckMessage_ptr authAckMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, ChallengeResponseMessage_ptr challengeResponseMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, ClaimMessage_ptr claimMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, ClaimResponseMessage_ptr claimResponseMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeCreditMessage_ptr consumeCreditMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeFromQueueMessage_ptr consumeFromQueueMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, ConsumeResponseMessage_ptr consumeResponseMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, DeliveryMessage_ptr deliveryMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, GetChallengeMessage_ptr getChallengeMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, GossipMessage_ptr gossipMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishBatchMessage_ptr proxyPublishBatchMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishBatchResponseMessage_ptr proxyPublishBatchResponseMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishMessage_ptr proxyPublishMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, ProxyPublishResponseMessage_ptr proxyPublishResponseMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, PublishBatchMessage_ptr publishBatchMessage);
+            void dispatch(const sopmq::shared::net::network_operation_result& result, PublishBatchResponseMessage_ptr publishBatchResponseMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, PublishMessage_ptr publishMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, PublishResponseMessage_ptr publishResponseMessage);
             void dispatch(const sopmq::shared::net::network_operation_result& result, StampMessage_ptr stampMessage);
@@ -106,24 +141,48 @@ namespace sopmq {
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
 
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimMessage_ptr)> handler, std::uint32_t inReplyTo);
+
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimResponseMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ClaimResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
+
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeCreditMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeCreditMessage_ptr)> handler, std::uint32_t inReplyTo);
+
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)> handler, std::uint32_t inReplyTo);
 
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
 
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, DeliveryMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, DeliveryMessage_ptr)> handler, std::uint32_t inReplyTo);
+
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)> handler, std::uint32_t inReplyTo);
 
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)> handler, std::uint32_t inReplyTo);
 
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchMessage_ptr)> handler, std::uint32_t inReplyTo);
+
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchResponseMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishBatchResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
+
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)> handler, std::uint32_t inReplyTo);
 
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
 
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchMessage_ptr)> handler, std::uint32_t inReplyTo);
+
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchResponseMessage_ptr)> handler);
+            void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishBatchResponseMessage_ptr)> handler, std::uint32_t inReplyTo);
+
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler);
             void set_handler(std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)> handler, std::uint32_t inReplyTo);
 
@@ -136,51 +195,113 @@ namespace sopmq {
             //[[[end]]]
             
         private:
+            ///
+            /// Persistent handlers are held through a shared_ptr so a handler can
+            /// replace itself while it is running
+            ///
+            template <typename T>
+            using handler_ptr = std::shared_ptr<const std::function<void(const sopmq::shared::net::network_operation_result&, std::shared_ptr<T>)>>;
+            
             std::function<void(Message_ptr, const std::string&)> _unhandledHandler;
             
             /*[[[cog
              for fn in fnames:
                if "Message" in fn:
                  rawname = os.path.splitext(os.path.basename(fn))[0]
-                 cog.outl("std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, %s_ptr)>> _%sHandlers;" % (rawname,first_lower(rawname)))
+                 cog.outl("handler_ptr<%s> _%sHandler;" % (rawname,first_lower(rawname)))
              ]]]*/
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, AnswerChallengeMessage_ptr)>> _answerChallengeMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, AuthAckMessage_ptr)>> _authAckMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, ChallengeResponseMessage_ptr)>> _challengeResponseMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeFromQueueMessage_ptr)>> _consumeFromQueueMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, ConsumeResponseMessage_ptr)>> _consumeResponseMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, GetChallengeMessage_ptr)>> _getChallengeMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, GossipMessage_ptr)>> _gossipMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishMessage_ptr)>> _proxyPublishMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, ProxyPublishResponseMessage_ptr)>> _proxyPublishResponseMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, PublishMessage_ptr)>> _publishMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, PublishResponseMessage_ptr)>> _publishResponseMessageHandlers;
-            std::unordered_map<std::uint32_t, std::function<void(const sopmq::shared::net::network_operation_result&, StampMessage_ptr)>> _stampMessageHandlers;
+            handler_ptr<AnswerChallengeMessage> _answerChallengeMessageHandler;
+            handler_ptr<AuthAckMessage> _authAckMessageHandler;
+            handler_ptr<ChallengeResponseMessage> _challengeResponseMessageHandler;
+            handler_ptr<ClaimMessage> _claimMessageHandler;
+            handler_ptr<ClaimResponseMessage> _claimResponseMessageHandler;
+            handler_ptr<ConsumeCreditMessage> _consumeCreditMessageHandler;
+            handler_ptr<ConsumeFromQueueMessage> _consumeFromQueueMessageHandler;
+            handler_ptr<ConsumeResponseMessage> _consumeResponseMessageHandler;
+            handler_ptr<DeliveryMessage> _deliveryMessageHandler;
+            handler_ptr<GetChallengeMessage> _getChallengeMessageHandler;
+            handler_ptr<GossipMessage> _gossipMessageHandler;
+            handler_ptr<ProxyPublishBatchMessage> _proxyPublishBatchMessageHandler;
+            handler_ptr<ProxyPublishBatchResponseMessage> _proxyPublishBatchResponseMessageHandler;
+            handler_ptr<ProxyPublishMessage> _proxyPublishMessageHandler;
+            handler_ptr<ProxyPublishResponseMessage> _proxyPublishResponseMessageHandler;
+            handler_ptr<PublishBatchMessage> _publishBatchMessageHandler;
+            handler_ptr<PublishBatchResponseMessage> _publishBatchResponseMessageHandler;
+            handler_ptr<PublishMessage> _publishMessageHandler;
+            handler_ptr<PublishResponseMessage> _publishResponseMessageHandler;
+            handler_ptr<StampMessage> _stampMessageHandler;
             //[[[end]]]
             
+            ///
+            /// One shot handlers for replies to messages we've sent, for all message types
+            ///
+            pending_reply_table _pendingReplies;
+            
+            reply_timeout_wheel _replyTimeouts;
+            boost::chrono::steady_clock::duration _replyTimeout;
+            
+            ///
+            /// Shared so a wait still pending when the dispatcher goes away can see
+            /// that it has
+            ///
+            std::shared_ptr<boost::asio::steady_timer> _replyTimer;
+            boost::chrono::steady_clock::time_point _replyTimerArmedFor;
+            
+            ///
+            /// Scratch space for timeouts that came due, reused between timer runs
+            ///
+            std::vector<reply_timeout_wheel::due_reply> _dueReplies;
+            
+            template <typename T>
+            static handler_ptr<T> make_handler(std::function<void(const sopmq::shared::net::network_operation_result&, std::shared_ptr<T>)> handler)
+            {
+                if (! handler) return handler_ptr<T>();
+                
+                return std::make_shared<const std::function<void(const sopmq::shared::net::network_operation_result&, std::shared_ptr<T>)>>(std::move(handler));
+            }
+            
+            ///
+            /// Registers a one shot handler for the reply to the given message id.
+            /// Passing an empty handler removes it
+            ///
+            template <typename T>
+            void set_reply_handler(std::function<void(const sopmq::shared::net::network_operation_result&, std::shared_ptr<T>)> handler,
+                                   std::uint32_t inReplyTo);
+            
+            ///
+            /// Arms the reply timer for the wheel's next expiry if it isn't already
+            /// set to go off before then
+            ///
+            void arm_reply_timer();
+            
+            void on_reply_timer(const boost::system::error_code& error);
+            
             ///
             /// Template function to execute the given handler if it is available, or
-            /// the unhandled handler if it is not
+            /// the unhandled handler if it is not. Replies go to the handler waiting
+            /// on them, everything else to the persistent handler for its type
             ///
-            template <typename hashmap, typename network_result, typename message>
-            void do_dispatch(hashmap h, network_result r, message m)
+            template <typename handler, typename network_result, typename message>
+            void do_dispatch(const handler& h, const network_result& r, message m)
             {
                 auto id = m->identity().in_reply_to();
-                auto iter = h.find(id);
-                
-                if (iter != h.end())
+                if (id != 0)
                 {
-                    iter->second(r, m);
-                    
-                    if (id != 0)
+                    pending_reply_table::entry reply;
+                    if (_pendingReplies.take(id, m->GetDescriptor(), reply))
                     {
-                        h.erase(iter);
+                        reply.handler(r, m);
+                        return;
                     }
                 }
-                else
+                else if (h)
                 {
-                    _unhandledHandler(std::static_pointer_cast<::google::protobuf::Message>(m), typeid(m).name());
+                    handler running(h);
+                    (*running)(r, m);
+                    return;
                 }
+                
+                _unhandledHandler(std::static_pointer_cast<::google::protobuf::Message>(m), typeid(m).name());
             }
         };
         
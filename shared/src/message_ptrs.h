@@ -55,12 +55,27 @@ typedef std::shared_ptr<AuthAckMessage> AuthAckMessage_ptr;
 class ChallengeResponseMessage;
 typedef std::shared_ptr<ChallengeResponseMessage> ChallengeResponseMessage_ptr;
 
+class ClaimMessage;
+typedef std::shared_ptr<ClaimMessage> ClaimMessage_ptr;
+
+class ClaimResponseMessage;
+typedef std::shared_ptr<ClaimResponseMessage> ClaimResponseMessage_ptr;
+
+class ConsumeCreditMessage;
+typedef std::shared_ptr<ConsumeCreditMessage> ConsumeCreditMessage_ptr;
+
 class ConsumeFromQueueMessage;
 typedef std::shared_ptr<ConsumeFromQueueMessage> ConsumeFromQueueMessage_ptr;
 
 class ConsumeResponseMessage;
 typedef std::shared_ptr<ConsumeResponseMessage> ConsumeResponseMessage_ptr;
 
+class Delivery;
+typedef std::shared_ptr<Delivery> Delivery_ptr;
+
+class DeliveryMessage;
+typedef std::shared_ptr<DeliveryMessage> DeliveryMessage_ptr;
+
 class GetChallengeMessage;
 typedef std::shared_ptr<GetChallengeMessage> GetChallengeMessage_ptr;
 
@@ -76,18 +91,36 @@ typedef std::shared_ptr<Identifier> Identifier_ptr;
 class NodeClock;
 typedef std::shared_ptr<NodeClock> NodeClock_ptr;
 
+class ProxyPublishBatchMessage;
+typedef std::shared_ptr<ProxyPublishBatchMessage> ProxyPublishBatchMessage_ptr;
+
+class ProxyPublishBatchResponseMessage;
+typedef std::shared_ptr<ProxyPublishBatchResponseMessage> ProxyPublishBatchResponseMessage_ptr;
+
 class ProxyPublishMessage;
 typedef std::shared_ptr<ProxyPublishMessage> ProxyPublishMessage_ptr;
 
 class ProxyPublishResponseMessage;
 typedef std::shared_ptr<ProxyPublishResponseMessage> ProxyPublishResponseMessage_ptr;
 
+class PublishBatchMessage;
+typedef std::shared_ptr<PublishBatchMessage> PublishBatchMessage_ptr;
+
+class PublishBatchResponseMessage;
+typedef std::shared_ptr<PublishBatchResponseMessage> PublishBatchResponseMessage_ptr;
+
 class PublishMessage;
 typedef std::shared_ptr<PublishMessage> PublishMessage_ptr;
 
 class PublishResponseMessage;
 typedef std::shared_ptr<PublishResponseMessage> PublishResponseMessage_ptr;
 
+class QueueClaim;
+typedef std::shared_ptr<QueueClaim> QueueClaim_ptr;
+
+class QueueStamp;
+typedef std::shared_ptr<QueueStamp> QueueStamp_ptr;
+
 class StampMessage;
 typedef std::shared_ptr<StampMessage> StampMessage_ptr;
 
@@ -24,9 +24,6 @@
 
 #include "messageutil.h"
 
-#include "logging.h"
-#include "netutil.h"
-
 /*[[[cog
  import cog
  import glob
@@ -44,17 +41,28 @@
 #include "AnswerChallengeMessage.pb.h"
 #include "AuthAckMessage.pb.h"
 #include "ChallengeResponseMessage.pb.h"
+#include "ClaimMessage.pb.h"
+#include "ClaimResponseMessage.pb.h"
+#include "ConsumeCreditMessage.pb.h"
 #include "ConsumeFromQueueMessage.pb.h"
 #include "ConsumeResponseMessage.pb.h"
+#include "Delivery.pb.h"
+#include "DeliveryMessage.pb.h"
 #include "GetChallengeMessage.pb.h"
 #include "GossipMessage.pb.h"
 #include "GossipNodeData.pb.h"
 #include "Identifier.pb.h"
 #include "NodeClock.pb.h"
+#include "ProxyPublishBatchMessage.pb.h"
+#include "ProxyPublishBatchResponseMessage.pb.h"
 #include "ProxyPublishMessage.pb.h"
 #include "ProxyPublishResponseMessage.pb.h"
+#include "PublishBatchMessage.pb.h"
+#include "PublishBatchResponseMessage.pb.h"
 #include "PublishMessage.pb.h"
 #include "PublishResponseMessage.pb.h"
+#include "QueueClaim.pb.h"
+#include "QueueStamp.pb.h"
 #include "StampMessage.pb.h"
 #include "VectorClock.pb.h"
 //[[[end]]]
@@ -65,126 +73,26 @@
 #include <array>
 
 
-using sopmq::error::network_error;
-
 using namespace std::placeholders;
-using namespace sopmq::util;
 namespace ba = boost::asio;
 
 namespace sopmq {
     namespace message {
         
-        const int messageutil::HEADER_SIZE = sizeof(uint16_t) + sizeof(uint32_t);
-        
-        boost::pool<> messageutil::s_mem_pool(messageutil::HEADER_SIZE);
-        
-        void messageutil::read_message(boost::asio::io_service& ioService,
-                                       boost::asio::ip::tcp::socket& socket,
-                                       network_status_callback errorCallback,
-                                       message_dispatcher& dispatcher,
-                                       uint32_t maxSize)
-        {
-            message_context_ptr ctx(std::make_shared<message_context>(dispatcher));
-            ctx->status_callback = errorCallback;
-            ctx->max_message_size = maxSize;
-            
-            //read the message type
-            netutil::read_u16(ioService, socket, std::bind(&messageutil::after_read_message_type,
-                                                           std::ref(ioService), std::ref(socket),
-                                                           ctx,
-                                                           _1, _2));
-        }
-        
-        void messageutil::after_read_message_type(boost::asio::io_service& ioService,
-                                                  boost::asio::ip::tcp::socket& socket,
-                                                  message_context_ptr ctx,
-                                                  uint16_t messageType,
-                                                  const boost::system::error_code& error)
-        {
-            if (error)
-            {
-                on_read_error(ctx, shared::net::network_operation_result::from_error_code(error));
-                return;
-            }
-            
-            //validate the message
-            if (messageType <= sopmq::message::MT_INVALID || messageType >= sopmq::message::MT_INVALID_OUT_OF_RANGE)
-            {
-                on_read_error(ctx, shared::net::network_operation_result(shared::net::ET_INVALID_TYPE,
-                                                                         network_error("Message type "
-                                                                                       + boost::lexical_cast<std::string>(messageType)
-                                                                                       + " is invalid")));
-                return;
-            }
-            
-            ctx->type = (sopmq::message::message_type)messageType;
-            
-            //read the message size
-            netutil::read_u32(ioService, socket, std::bind(&messageutil::after_read_message_size,
-                                                           std::ref(ioService), std::ref(socket),
-                                                           ctx,
-                                                           _1, _2));
-        }
-        
-        void messageutil::after_read_message_size(boost::asio::io_service& ioService,
-                                                  boost::asio::ip::tcp::socket& socket,
-                                                  message_context_ptr ctx,
-                                                  uint32_t messageSize,
-                                                  const boost::system::error_code& error)
-        {
-            if (error)
-            {
-                on_read_error(ctx, shared::net::network_operation_result::from_error_code(error));
-                return;
-            }
-            
-            //sanity check the size
-            if (messageSize > ctx->max_message_size)
-            {
-                LOG_SRC(error) << "message is too large (" << messageSize / 1024 << " MB)";
-                
-                on_read_error(ctx, shared::net::network_operation_result(shared::net::ET_INVALID_TYPE,
-                                                                         network_error("Message was too large")));
-                
-                return;
-            }
-            
-            //alloc
-            boost::shared_array<char> buffer(new char[messageSize]);
-            ctx->message_buffer = buffer;
-			ctx->message_size = messageSize;
-            
-            boost::asio::async_read(socket,
-                                    boost::asio::buffer(buffer.get(), messageSize),
-                                    std::bind(&messageutil::after_read_message_content,
-                                              std::ref(ioService),
-                                              std::ref(socket),
-                                              ctx,
-                                              _1,
-                                              _2));
-        }
-        
-        void messageutil::after_read_message_content(boost::asio::io_service& ioService,
-                                                     boost::asio::ip::tcp::socket& socket,
-                                                     message_context_ptr ctx,
-                                                     const boost::system::error_code& error,
-                                                     std::size_t bytes_transferred)
+        void messageutil::dispatch_message(message_type type,
+                                           const char* messageBuffer,
+                                           uint32_t messageSize,
+                                           message_dispatcher& dispatcher,
+                                           const network_status_callback& statusCallback)
         {
-            if (error)
-            {
-                on_read_error(ctx, shared::net::network_operation_result::from_error_code(error));
-                return;
-            }
-            
-            BOOST_ASSERT(bytes_transferred == ctx->message_size);
+            message_context ctx(dispatcher, statusCallback, type, messageBuffer, messageSize);
             
-            //we have a message, decode it
             messageutil::switch_dispatch(ctx, shared::net::network_operation_result::success());
         }
         
-        void messageutil::switch_dispatch(message_context_ptr ctx, const shared::net::network_operation_result& result)
+        void messageutil::switch_dispatch(const message_context& ctx, const shared::net::network_operation_result& result)
         {
-            switch (ctx->type)
+            switch (ctx.type)
             {
                 /*[[[cog
                  def underscore(name):
@@ -220,6 +128,18 @@ namespace sopmq {
                     messageutil::template_dispatch(ctx, result, std::make_shared<ChallengeResponseMessage>());
                     break;
 
+                case MT_CLAIM:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<ClaimMessage>());
+                    break;
+
+                case MT_CLAIM_RESPONSE:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<ClaimResponseMessage>());
+                    break;
+
+                case MT_CONSUME_CREDIT:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<ConsumeCreditMessage>());
+                    break;
+
                 case MT_CONSUME_FROM_QUEUE:
                     messageutil::template_dispatch(ctx, result, std::make_shared<ConsumeFromQueueMessage>());
                     break;
@@ -228,6 +148,10 @@ namespace sopmq {
                     messageutil::template_dispatch(ctx, result, std::make_shared<ConsumeResponseMessage>());
                     break;
 
+                case MT_DELIVERY:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<DeliveryMessage>());
+                    break;
+
                 case MT_GET_CHALLENGE:
                     messageutil::template_dispatch(ctx, result, std::make_shared<GetChallengeMessage>());
                     break;
@@ -236,6 +160,14 @@ namespace sopmq {
                     messageutil::template_dispatch(ctx, result, std::make_shared<GossipMessage>());
                     break;
 
+                case MT_PROXY_PUBLISH_BATCH:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<ProxyPublishBatchMessage>());
+                    break;
+
+                case MT_PROXY_PUBLISH_BATCH_RESPONSE:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<ProxyPublishBatchResponseMessage>());
+                    break;
+
                 case MT_PROXY_PUBLISH:
                     messageutil::template_dispatch(ctx, result, std::make_shared<ProxyPublishMessage>());
                     break;
@@ -244,6 +176,14 @@ namespace sopmq {
                     messageutil::template_dispatch(ctx, result, std::make_shared<ProxyPublishResponseMessage>());
                     break;
 
+                case MT_PUBLISH_BATCH:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<PublishBatchMessage>());
+                    break;
+
+                case MT_PUBLISH_BATCH_RESPONSE:
+                    messageutil::template_dispatch(ctx, result, std::make_shared<PublishBatchResponseMessage>());
+                    break;
+
                 case MT_PUBLISH:
                     messageutil::template_dispatch(ctx, result, std::make_shared<PublishMessage>());
                     break;
@@ -260,7 +200,7 @@ namespace sopmq {
                     
                 default:
                     throw std::runtime_error("messageutil::switch_dispatch() unhandled message type "
-                                             + boost::lexical_cast<std::string>(ctx->type));
+                                             + boost::lexical_cast<std::string>(ctx.type));
             }
         }
         
@@ -272,71 +212,5 @@ namespace sopmq {
             
             return newId;
         }
-        
-        void messageutil::write_message(sopmq::message::message_type type, Message_ptr message,
-                                        boost::asio::io_service &ioService,
-                                        boost::asio::ip::tcp::socket &socket,
-                                        network_status_callback statusCallback)
-        {
-            char* headerBuffer = static_cast<char*>(s_mem_pool.malloc());
-            header_buf_ptr headerPtr(headerBuffer, &messageutil::free_mem);
-
-            send_context_ptr ctx = std::make_shared<send_context>(std::move(headerPtr), std::string(), statusCallback);
-            
-            message->SerializeToString(&ctx->message_buf);
-            
-            auto netId = boost::asio::detail::socket_ops::host_to_network_short(type);
-            auto netSize = boost::asio::detail::socket_ops::host_to_network_long(ctx->message_buf.size());
-            BOOST_STATIC_ASSERT(sizeof(netId) == 2);
-            BOOST_STATIC_ASSERT(sizeof(netSize) == 4);
-            
-            BOOST_STATIC_ASSERT(sizeof(netId) + sizeof(netSize) == HEADER_SIZE);
-            
-            std::memcpy(ctx->header_buf.get(), &netId, sizeof(netId));
-            std::memcpy(ctx->header_buf.get() + sizeof(netId), &netSize, sizeof(netSize));
-            
-            std::array<ba::const_buffer, 2> bufs = {
-                {
-                ba::buffer(ctx->header_buf.get(), HEADER_SIZE),
-                ba::buffer(ctx->message_buf)
-                }
-            };
-            
-            ba::async_write(socket, bufs, std::bind(&messageutil::after_write_message,
-                                                    ctx, _1, _2));
-        }
-        
-        void messageutil::after_write_message(send_context_ptr ctx,
-                                              const boost::system::error_code& error,
-                                              size_t bytesTransferred)
-        {
-            if (error)
-            {
-                ctx->status_callback(shared::net::network_operation_result::from_error_code(error));
-            }
-            else
-            {
-                ctx->status_callback(shared::net::network_operation_result::success());
-            }
-        }
-        
-        void messageutil::free_mem(char *mem)
-        {
-            if (mem != nullptr)
-            {
-                s_mem_pool.free(mem);
-            }
-        }
-        
-        void messageutil::on_read_error(message_context_ptr ctx, const shared::net::network_operation_result& error)
-        {
-            ctx->status_callback(error);
-            cancel_all_with_error(ctx->dispatcher, error);
-        }
-        
-        void messageutil::cancel_all_with_error(message_dispatcher& dispatcher, const shared::net::network_operation_result& error)
-        {
-            dispatcher.cancel_all_with_error(error);
-        }
     }
 }
\ No newline at end of file
@@ -29,7 +29,6 @@
 #include <boost/shared_array.hpp>
 #include <boost/noncopyable.hpp>
 #include <boost/lexical_cast.hpp>
-#include <boost/pool/pool.hpp>
 
 #include <memory>
 #include <functional>
@@ -45,7 +44,7 @@ namespace sopmq {
         typedef std::function<void(const shared::net::network_operation_result&)> network_status_callback;
         
         ///
-        /// Context for read_message
+        /// Context for dispatching a message that has been read off the wire
         ///
         struct message_context : public boost::noncopyable
         {
@@ -55,14 +54,9 @@ namespace sopmq {
             message_dispatcher& dispatcher;
             
             ///
-            /// Callback for error conditions
+            /// Callback for the result of the read
             ///
-            network_status_callback status_callback;
-            
-            ///
-            /// The maximum size for any message
-            ///
-            uint32_t max_message_size;
+            const network_status_callback& status_callback;
             
             ///
             /// The type of message we're handling
@@ -75,44 +69,20 @@ namespace sopmq {
             uint32_t message_size;
             
             ///
-            /// Buffer for our message
+            /// The encoded message
             ///
-            boost::shared_array<char> message_buffer;
+            const char* message_buffer;
             
             
             
-            message_context(message_dispatcher& dispatcher)
-            : dispatcher(dispatcher)
+            message_context(message_dispatcher& dispatcher, const network_status_callback& statusCallback,
+                            sopmq::message::message_type type, const char* messageBuffer, uint32_t messageSize)
+            : dispatcher(dispatcher), status_callback(statusCallback), type(type),
+            message_size(messageSize), message_buffer(messageBuffer)
             {
             }
         };
         
-        typedef std::shared_ptr<message_context> message_context_ptr;
-        
-        
-        typedef std::unique_ptr<char[], void(*)(char*)> header_buf_ptr;
-
-        ///
-        /// Context when writing a message
-        ///
-        struct send_context
-		{
-			send_context(header_buf_ptr headerbuf, const std::string& messagebuf, network_status_callback status)
-				: header_buf(std::move(headerbuf)), message_buf(messagebuf), status_callback(status)
-			{
-			}
-
-			header_buf_ptr header_buf;
-            std::string message_buf;
-            network_status_callback status_callback;
-
-		private: 
-			send_context(const send_context&);
-            send_context& operator =(const send_context&);
-        };
-        
-        typedef std::shared_ptr<send_context> send_context_ptr;
-        
         ///
         /// Utility functions that deal with network messages
         ///
@@ -120,22 +90,19 @@ namespace sopmq {
         {
         public:
             ///
-            /// \brief Reads an unknown message type from the wire
+            /// \brief Decodes a message that has been read off the wire and dispatches it.
+            /// The status callback is called first so the reader can ask for the next
+            /// message before this one is handled
+            /// \param type The message type from the frame header
+            /// \param messageBuffer The encoded message. Only needs to live for the
+            /// duration of the call
+            /// \param messageSize The size of the encoded message
             ///
-            static void read_message(boost::asio::io_service& ioService,
-                                     boost::asio::ip::tcp::socket& socket,
-                                     network_status_callback statusCallback,
-                                     message_dispatcher& dispatcher,
-                                     uint32_t maxSize);
-            
-            ///
-            /// \brief Writes a message to the wire
-            ///
-            static void write_message(message_type type,
-                                      Message_ptr message,
-                                      boost::asio::io_service& ioService,
-                                      boost::asio::ip::tcp::socket& socket,
-                                      network_status_callback statusCallback);
+            static void dispatch_message(message_type type,
+                                         const char* messageBuffer,
+                                         uint32_t messageSize,
+                                         message_dispatcher& dispatcher,
+                                         const network_status_callback& statusCallback);
             
             ///
             /// \brief Builds a new identifier to tack onto a message
@@ -158,72 +125,35 @@ namespace sopmq {
             }
             
         private:
-            static const int HEADER_SIZE;
-            
-            static boost::pool<> s_mem_pool;
-            static void free_mem(char* mem);
-            
-            
-            static void after_read_message_type(boost::asio::io_service& ioService,
-                                                boost::asio::ip::tcp::socket& socket,
-                                                message_context_ptr ctx,
-                                                uint16_t messageType,
-                                                const boost::system::error_code& error);
-            
-            static void after_read_message_size(boost::asio::io_service& ioService,
-                                                boost::asio::ip::tcp::socket& socket,
-                                                message_context_ptr ctx,
-                                                uint32_t messageSize,
-                                                const boost::system::error_code& error);
-            
-            static void after_read_message_content(boost::asio::io_service& ioService,
-                                                   boost::asio::ip::tcp::socket& socket,
-                                                   message_context_ptr ctx,
-                                                   const boost::system::error_code& error,
-                                                   std::size_t bytes_transferred);
-            
-            static void after_write_message(send_context_ptr ctx, const boost::system::error_code& error,
-                                            size_t bytesTransferred);
-            
             ///
             /// Decodes the message and then dispatches it
             ///
-            static void switch_dispatch(message_context_ptr ctx, const shared::net::network_operation_result& result);
+            static void switch_dispatch(const message_context& ctx, const shared::net::network_operation_result& result);
             
             ///
             /// After the message type is decoded, we do the rest of the work here
             ///
             template <typename R, typename T>
-            static void template_dispatch(message_context_ptr ctx, R networkResult, T message)
+            static void template_dispatch(const message_context& ctx, R networkResult, T message)
             {
-                if (! message->ParseFromArray(ctx->message_buffer.get(), ctx->message_size))
+                //this is the only copy the payload goes through. bytes fields are
+                //moved from here on
+                if (! message->ParseFromArray(ctx.message_buffer, ctx.message_size))
                 {
                     auto e = sopmq::error::network_error("Unable to parse new message of type "
-                                                         + boost::lexical_cast<std::string>(ctx->type)
+                                                         + boost::lexical_cast<std::string>(ctx.type)
                                                          + " message corrupted?");
                     
                     //error
-                    ctx->status_callback(shared::net::network_operation_result(shared::net::ET_NETWORK, e));
+                    ctx.status_callback(shared::net::network_operation_result(shared::net::ET_NETWORK, e));
                 }
                 else
                 {
                     //dispatch
-                    ctx->status_callback(networkResult);
-                    ctx->dispatcher.dispatch(networkResult, message);
+                    ctx.status_callback(networkResult);
+                    ctx.dispatcher.dispatch(networkResult, message);
                 }
             }
-            
-            ///
-            /// If there is a network error during a read, this function is called. It does two things:
-            /// - calls ctx->status_callback with the error information
-            /// - calls all callbacks waiting on a dispatch with the error information
-            ///
-            static void on_read_error(message_context_ptr ctx, const shared::net::network_operation_result& error);
-            
-            ///
-            /// Cancels all callbacks waiting on a dispatch with an error
-            ///
-            static void cancel_all_with_error(message::message_dispatcher& dispatcher, const shared::net::network_operation_result& error);
         };
         
     }
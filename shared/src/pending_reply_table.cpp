@@ -0,0 +1,196 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pending_reply_table.h"
+
+#include <utility>
+
+namespace sopmq {
+    namespace message {
+        
+        const size_t pending_reply_table::MIN_CAPACITY;
+        
+        pending_reply_table::pending_reply_table()
+        : _slots(MIN_CAPACITY), _size(0), _mask(MIN_CAPACITY - 1)
+        {
+            for (auto& slot : _slots)
+            {
+                slot.in_reply_to = 0;
+                slot.type = nullptr;
+                slot.timeout_tick = 0;
+            }
+        }
+        
+        void pending_reply_table::insert(std::uint32_t inReplyTo, const google::protobuf::Descriptor* type, reply_handler handler,
+                                         std::uint64_t timeoutTick)
+        {
+            //keep the load under a half so probes stay short
+            if ((_size + 1) * 2 > _slots.size())
+            {
+                this->grow();
+            }
+            
+            size_t slot = this->find_slot(inReplyTo);
+            if (_slots[slot].in_reply_to == 0)
+            {
+                ++_size;
+            }
+            
+            entry& e = _slots[slot];
+            e.in_reply_to = inReplyTo;
+            e.type = type;
+            e.timeout_tick = timeoutTick;
+            e.handler = std::move(handler);
+        }
+        
+        bool pending_reply_table::take(std::uint32_t inReplyTo, const google::protobuf::Descriptor* type, entry& out)
+        {
+            size_t slot = this->find_slot(inReplyTo);
+            if (_slots[slot].in_reply_to == 0 || _slots[slot].type != type)
+            {
+                return false;
+            }
+            
+            out = std::move(_slots[slot]);
+            this->remove_at(slot);
+            
+            return true;
+        }
+        
+        bool pending_reply_table::take_expired(std::uint32_t inReplyTo, std::uint64_t timeoutTick, entry& out)
+        {
+            size_t slot = this->find_slot(inReplyTo);
+            
+            //a handler that was replaced since the timeout was scheduled keeps waiting
+            if (_slots[slot].in_reply_to == 0 || _slots[slot].timeout_tick != timeoutTick)
+            {
+                return false;
+            }
+            
+            out = std::move(_slots[slot]);
+            this->remove_at(slot);
+            
+            return true;
+        }
+        
+        bool pending_reply_table::erase(std::uint32_t inReplyTo)
+        {
+            size_t slot = this->find_slot(inReplyTo);
+            if (_slots[slot].in_reply_to == 0)
+            {
+                return false;
+            }
+            
+            this->remove_at(slot);
+            return true;
+        }
+        
+        std::vector<pending_reply_table::entry> pending_reply_table::take_all()
+        {
+            std::vector<entry> entries;
+            entries.reserve(_size);
+            
+            for (auto& slot : _slots)
+            {
+                if (slot.in_reply_to != 0)
+                {
+                    entries.push_back(std::move(slot));
+                    slot.in_reply_to = 0;
+                    slot.type = nullptr;
+                    slot.handler = nullptr;
+                }
+            }
+            
+            _size = 0;
+            
+            return entries;
+        }
+        
+        size_t pending_reply_table::size() const
+        {
+            return _size;
+        }
+        
+        size_t pending_reply_table::home_slot(std::uint32_t inReplyTo) const
+        {
+            //ids on a connection are handed out in sequence, so the low bits
+            //already put outstanding requests in consecutive slots
+            return inReplyTo & _mask;
+        }
+        
+        size_t pending_reply_table::find_slot(std::uint32_t inReplyTo) const
+        {
+            size_t slot = this->home_slot(inReplyTo);
+            while (_slots[slot].in_reply_to != 0 && _slots[slot].in_reply_to != inReplyTo)
+            {
+                slot = (slot + 1) & _mask;
+            }
+            
+            return slot;
+        }
+        
+        void pending_reply_table::remove_at(size_t hole)
+        {
+            --_size;
+            
+            //shift back anything after the hole that would be unreachable
+            size_t next = (hole + 1) & _mask;
+            while (_slots[next].in_reply_to != 0)
+            {
+                size_t home = this->home_slot(_slots[next].in_reply_to);
+                
+                //can the entry at next live in the hole? only if its home is not
+                //between the hole and next
+                if (((next - home) & _mask) >= ((next - hole) & _mask))
+                {
+                    _slots[hole] = std::move(_slots[next]);
+                    hole = next;
+                }
+                
+                next = (next + 1) & _mask;
+            }
+            
+            _slots[hole].in_reply_to = 0;
+            _slots[hole].type = nullptr;
+            _slots[hole].handler = nullptr;
+        }
+        
+        void pending_reply_table::grow()
+        {
+            std::vector<entry> old;
+            old.swap(_slots);
+            
+            _slots.resize(old.size() * 2);
+            for (auto& slot : _slots)
+            {
+                slot.in_reply_to = 0;
+                slot.type = nullptr;
+                slot.timeout_tick = 0;
+            }
+            
+            _mask = _slots.size() - 1;
+            
+            for (auto& e : old)
+            {
+                if (e.in_reply_to == 0) continue;
+                
+                size_t slot = this->find_slot(e.in_reply_to);
+                _slots[slot] = std::move(e);
+            }
+        }
+    }
+}
@@ -0,0 +1,132 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__pending_reply_table__
+#define __sopmq__pending_reply_table__
+
+#include "message_ptrs.h"
+#include "network_operation_result.h"
+
+#include <google/protobuf/descriptor.h>
+
+#include <functional>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+namespace sopmq {
+    namespace message {
+        
+        ///
+        /// \brief Open addressed table of one shot reply handlers keyed by the id of
+        /// the message they are waiting on a reply to
+        ///
+        /// Message ids on a connection are sequential so they are used as their own
+        /// hash. Erasing shifts the following entries back instead of leaving
+        /// tombstones, so the table never degrades however many requests go through it.
+        ///
+        class pending_reply_table
+        {
+        public:
+            typedef std::function<void(const shared::net::network_operation_result&, Message_ptr)> reply_handler;
+            
+            ///
+            /// A handler waiting for a reply
+            ///
+            struct entry
+            {
+                ///
+                /// The id of the message being replied to. Zero marks an empty slot
+                ///
+                std::uint32_t in_reply_to;
+                
+                ///
+                /// The type of message the handler accepts
+                ///
+                const google::protobuf::Descriptor* type;
+                
+                ///
+                /// The reply timeout wheel tick the handler times out on. Zero if it
+                /// waits forever
+                ///
+                std::uint64_t timeout_tick;
+                
+                reply_handler handler;
+            };
+            
+        public:
+            pending_reply_table();
+            
+            ///
+            /// \brief Adds a handler for replies to the given id, replacing any that
+            /// was already there
+            ///
+            void insert(std::uint32_t inReplyTo, const google::protobuf::Descriptor* type, reply_handler handler,
+                        std::uint64_t timeoutTick = 0);
+            
+            ///
+            /// \brief Removes the handler for the given id if there is one of the
+            /// given type
+            /// \return Whether a handler was found and moved into out
+            ///
+            bool take(std::uint32_t inReplyTo, const google::protobuf::Descriptor* type, entry& out);
+            
+            ///
+            /// \brief Removes the handler for the given id if it times out on the
+            /// given tick
+            /// \return Whether a handler was found and moved into out
+            ///
+            bool take_expired(std::uint32_t inReplyTo, std::uint64_t timeoutTick, entry& out);
+            
+            ///
+            /// \brief Removes the handler for the given id
+            /// \return Whether there was a handler to remove
+            ///
+            bool erase(std::uint32_t inReplyTo);
+            
+            ///
+            /// \brief Removes every handler and returns them
+            ///
+            std::vector<entry> take_all();
+            
+            ///
+            /// \brief The number of handlers waiting for a reply
+            ///
+            size_t size() const;
+            
+        private:
+            static const size_t MIN_CAPACITY = 16;
+            
+            std::vector<entry> _slots;
+            size_t _size;
+            size_t _mask;
+            
+            size_t home_slot(std::uint32_t inReplyTo) const;
+            
+            ///
+            /// Returns the slot holding the id or the empty slot where it would go
+            ///
+            size_t find_slot(std::uint32_t inReplyTo) const;
+            
+            void remove_at(size_t slot);
+            void grow();
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__pending_reply_table__) */
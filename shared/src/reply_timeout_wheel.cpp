@@ -0,0 +1,133 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "reply_timeout_wheel.h"
+
+#include <algorithm>
+
+namespace sopmq {
+    namespace message {
+
+        const int reply_timeout_wheel::DEFAULT_TICK_MS;
+        const size_t reply_timeout_wheel::NUM_SLOTS;
+        const std::uint64_t reply_timeout_wheel::SLOT_MASK;
+
+        reply_timeout_wheel::reply_timeout_wheel(duration tickLength)
+        : _start(boost::chrono::steady_clock::now()), _tick_length(tickLength), _current(0), _count(0)
+        {
+        }
+
+        std::uint64_t reply_timeout_wheel::schedule(std::uint32_t inReplyTo, time_point deadline)
+        {
+            std::uint64_t tick = this->tick_for(deadline);
+            if (tick < _current) tick = _current;
+
+            due_reply timeout;
+            timeout.in_reply_to = inReplyTo;
+            timeout.tick = tick;
+
+            _slots[tick & SLOT_MASK].push_back(timeout);
+            ++_count;
+
+            return tick;
+        }
+
+        void reply_timeout_wheel::advance(time_point now, std::vector<due_reply>& due)
+        {
+            if (now < _start) return;
+            std::uint64_t target = (std::uint64_t)((now - _start) / _tick_length);
+            if (target < _current) return;
+
+            //one rotation visits every slot, so there is no point going round again
+            //when we've fallen further behind than that
+            std::uint64_t last = std::min(target, _current + SLOT_MASK);
+
+            for (std::uint64_t tick = _current; tick <= last && _count != 0; ++tick)
+            {
+                std::vector<due_reply>& slot = _slots[tick & SLOT_MASK];
+
+                size_t kept = 0;
+                for (size_t i = 0; i < slot.size(); ++i)
+                {
+                    if (slot[i].tick <= target)
+                    {
+                        due.push_back(slot[i]);
+                        --_count;
+                    }
+                    else
+                    {
+                        slot[kept++] = slot[i];
+                    }
+                }
+
+                slot.resize(kept);
+            }
+
+            _current = target + 1;
+        }
+
+        reply_timeout_wheel::time_point reply_timeout_wheel::next_expiry() const
+        {
+            if (_count == 0) return time_point::max();
+
+            //the first occupied slot. its entries may belong to a later rotation,
+            //in which case advancing to it just finds nothing due
+            for (std::uint64_t tick = _current; tick <= _current + SLOT_MASK; ++tick)
+            {
+                if (! _slots[tick & SLOT_MASK].empty())
+                {
+                    return this->time_for(tick);
+                }
+            }
+
+            return time_point::max();
+        }
+
+        void reply_timeout_wheel::clear()
+        {
+            for (auto& slot : _slots)
+            {
+                slot.clear();
+            }
+
+            _count = 0;
+        }
+
+        size_t reply_timeout_wheel::size() const
+        {
+            return _count;
+        }
+
+        reply_timeout_wheel::time_point reply_timeout_wheel::time_for(std::uint64_t tick) const
+        {
+            return _start + _tick_length * (duration::rep)tick;
+        }
+
+        std::uint64_t reply_timeout_wheel::tick_for(time_point deadline) const
+        {
+            if (deadline <= _start) return 0;
+
+            //round up so replies never time out early
+            duration offset = deadline - _start;
+            std::uint64_t tick = (std::uint64_t)(offset / _tick_length);
+            if (_tick_length * (duration::rep)tick < offset) ++tick;
+
+            return tick;
+        }
+
+    }
+}
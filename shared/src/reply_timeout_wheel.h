@@ -0,0 +1,127 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__reply_timeout_wheel__
+#define __sopmq__reply_timeout_wheel__
+
+#include <boost/noncopyable.hpp>
+#include <boost/chrono.hpp>
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace sopmq {
+    namespace message {
+
+        ///
+        /// \brief Hashed timing wheel of reply timeouts for a single connection
+        ///
+        /// Only the id of the message waiting on a reply and the tick it is due on
+        /// are kept here. Timeouts are never cancelled, a reply that arrives in time
+        /// simply leaves a stale entry behind that is dropped when its slot comes
+        /// around. The caller checks whether each due id is still waiting and for
+        /// the same tick before expiring it.
+        ///
+        /// Not thread safe. A connection's wheel is only touched from its IO thread.
+        ///
+        class reply_timeout_wheel : public boost::noncopyable
+        {
+        public:
+            typedef boost::chrono::steady_clock::time_point time_point;
+            typedef boost::chrono::steady_clock::duration duration;
+
+            ///
+            /// The default resolution of the wheel
+            ///
+            static const int DEFAULT_TICK_MS = 100;
+
+            ///
+            /// A timeout that has come due
+            ///
+            struct due_reply
+            {
+                std::uint32_t in_reply_to;
+                std::uint64_t tick;
+            };
+
+        public:
+            ///
+            /// \brief CTOR
+            /// \param tickLength The resolution of the wheel. Replies never time out
+            /// early but may time out up to one tick late
+            ///
+            reply_timeout_wheel(duration tickLength = boost::chrono::milliseconds(DEFAULT_TICK_MS));
+
+            ///
+            /// \brief Schedules a timeout for the reply to the given message id
+            /// \return The tick the timeout is due on
+            ///
+            std::uint64_t schedule(std::uint32_t inReplyTo, time_point deadline);
+
+            ///
+            /// \brief Removes every timeout due at or before the given time
+            /// \param now The current time
+            /// \param due Receives the timeouts that came due
+            ///
+            void advance(time_point now, std::vector<due_reply>& due);
+
+            ///
+            /// \brief The next time advance() needs to be called, or time_point::max()
+            /// if nothing is scheduled
+            ///
+            time_point next_expiry() const;
+
+            ///
+            /// \brief Removes every scheduled timeout
+            ///
+            void clear();
+
+            ///
+            /// \brief The number of scheduled timeouts, including stale ones
+            ///
+            size_t size() const;
+
+        private:
+            static const size_t NUM_SLOTS = 64;
+            static const std::uint64_t SLOT_MASK = NUM_SLOTS - 1;
+
+            time_point _start;
+            duration _tick_length;
+
+            ///
+            /// The next tick to be processed
+            ///
+            std::uint64_t _current;
+
+            size_t _count;
+
+            ///
+            /// Timeouts further out than a rotation share slots with nearer ones and
+            /// are left in place until their own tick comes around
+            ///
+            std::array<std::vector<due_reply>, NUM_SLOTS> _slots;
+
+            time_point time_for(std::uint64_t tick) const;
+            std::uint64_t tick_for(time_point deadline) const;
+        };
+
+    }
+}
+
+#endif /* defined(__sopmq__reply_timeout_wheel__) */
@@ -55,7 +55,64 @@ namespace sopmq {
                 /// There was a network error while reading or writing to the node.
                 /// The operation should be retried
                 ///
-                PMR_NETWORK_ERROR = 6
+                PMR_NETWORK_ERROR = 6,
+                
+                ///
+                /// The message was queued on a quorum of nodes to wait for a consumer
+                ///
+                PMR_MESSAGE_QUEUED = 7
+            };
+            
+            ///
+            /// Response code to a client consume request
+            ///
+            enum ConsumeResponse {
+                ///
+                /// The node is pushing the queue's messages to us
+                ///
+                CR_OK = 1,
+                
+                ///
+                /// The connection was not authorized to make this request
+                ///
+                CR_NOT_AUTH = 2,
+                
+                ///
+                /// The node doesn't hold the queue, or isn't able to serve it
+                ///
+                CR_UNAVAILABLE = 3,
+                
+                ///
+                /// There was a network error while reading or writing to the node.
+                /// The operation should be retried
+                ///
+                CR_NETWORK_ERROR = 4
+            };
+            
+            ///
+            /// Response code to a client claim request
+            ///
+            enum ClaimResponse {
+                ///
+                /// The claim was passed on to every node holding the queue
+                ///
+                CLR_OK = 1,
+                
+                ///
+                /// The connection was not authorized to make this request
+                ///
+                CLR_NOT_AUTH = 2,
+                
+                ///
+                /// No nodes were available to take the claim
+                ///
+                CLR_UNAVAILABLE = 3,
+                
+                ///
+                /// There was a network error while reading or writing to the node.
+                /// The operation should be retried
+                ///
+                CLR_NETWORK_ERROR = 4
             };
             
         }
@@ -22,9 +22,8 @@
 #include <cryptopp/hex.h>
 #include <cryptopp/filters.h>
 #include <cryptopp/sha.h>
+#include <cryptopp/osrng.h>
 
-#include <random>
-#include <limits>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/static_assert.hpp>
 
@@ -47,17 +46,11 @@ namespace sopmq {
         
         std::string util::random_bytes(int count)
         {
+            //seeding from the OS is the expensive part, so each thread does it once
+            thread_local AutoSeededRandomPool rng;
             
-            std::random_device rng;
-            std::uniform_int_distribution<> dist(std::numeric_limits<char>::min(),
-                                                           std::numeric_limits<char>::max());
-            
-            std::string outstr;
-            outstr.reserve(count);
-            
-            for(int i = 0; i < count; ++i) {
-                outstr += (char)dist(rng);
-            }
+            std::string outstr(count, '\0');
+            rng.GenerateBlock((byte*)&outstr[0], count);
             
             return outstr;
         }
@@ -39,7 +39,7 @@ namespace sopmq {
             static std::string hex_encode(const unsigned char* input, int inputSize);
         
             ///
-            /// Generates a string of random bytes
+            /// Generates a string of cryptographically secure random bytes
             /// \param count The number of random bytes to generate
             ///
             static std::string random_bytes(int count);
@@ -0,0 +1,88 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "bench_util.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+    std::atomic<uint64_t> allocations(0);
+    bool fullRuns = false;
+}
+
+//count every allocation made by the test binary so benchmarks can report
+//allocations per operation
+void* operator new(std::size_t size)
+{
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    
+    void* p = std::malloc(size == 0 ? 1 : size);
+    if (p == nullptr) throw std::bad_alloc();
+    
+    return p;
+}
+
+void* operator new[](std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+namespace sopmq {
+    namespace test {
+        
+        uint64_t bench_util::allocation_count()
+        {
+            return allocations.load(std::memory_order_relaxed);
+        }
+        
+        void bench_util::report(const std::string& name, uint64_t ops,
+                                boost::chrono::nanoseconds elapsed, uint64_t allocations)
+        {
+            if (ops == 0) ops = 1;
+            
+            printf("[ BENCH    ] %-48s %10.1f ns/op %8.2f allocs/op (%llu ops)\n",
+                   name.c_str(),
+                   (double)elapsed.count() / ops,
+                   (double)allocations / ops,
+                   (unsigned long long)ops);
+        }
+        
+        bool bench_util::full_runs()
+        {
+            return fullRuns;
+        }
+        
+        void bench_util::set_full_runs(bool full)
+        {
+            fullRuns = full;
+        }
+    }
+}
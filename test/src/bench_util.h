@@ -0,0 +1,86 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__bench_util__
+#define __sopmq__bench_util__
+
+#include <boost/chrono.hpp>
+
+#include <cstdint>
+#include <string>
+
+namespace sopmq {
+    namespace test {
+
+        ///
+        /// Helpers for the microbenchmarks that run as part of the unit tests
+        ///
+        class bench_util
+        {
+        public:
+            ///
+            /// Returns the number of calls made to the global operator new so far
+            ///
+            static uint64_t allocation_count();
+
+            ///
+            /// Prints a single benchmark result line
+            ///
+            static void report(const std::string& name, uint64_t ops,
+                               boost::chrono::nanoseconds elapsed, uint64_t allocations);
+            
+            ///
+            /// Whether benchmarks should run at their full size. Off by default to
+            /// keep the unit test run short, enabled with bench=full on the command line
+            ///
+            static bool full_runs();
+            
+            static void set_full_runs(bool full);
+
+        private:
+            bench_util();
+        };
+
+        ///
+        /// Measures the wall time and allocations between construction and stop()
+        ///
+        class bench_timer
+        {
+        public:
+            bench_timer()
+            : _start(boost::chrono::steady_clock::now()), _start_allocs(bench_util::allocation_count())
+            {
+            }
+
+            ///
+            /// Stops the timer and reports the result for the given number of operations
+            ///
+            void stop(const std::string& name, uint64_t ops)
+            {
+                auto elapsed = boost::chrono::steady_clock::now() - _start;
+                bench_util::report(name, ops, boost::chrono::duration_cast<boost::chrono::nanoseconds>(elapsed),
+                                   bench_util::allocation_count() - _start_allocs);
+            }
+
+        private:
+            boost::chrono::steady_clock::time_point _start;
+            uint64_t _start_allocs;
+        };
+    }
+}
+
+#endif /* defined(__sopmq__bench_util__) */
@@ -0,0 +1,367 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "fake_storage_driver.h"
+
+#include <map>
+#include <set>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <functional>
+#include <cstdint>
+
+using namespace sopmq::node::storage;
+
+namespace sopmq {
+    namespace test {
+        
+        struct fake_storage_driver::state
+        {
+            mutable std::mutex lock;
+            
+            ///
+            /// sopmq.users rows by uname_hash
+            ///
+            std::map<std::string, std::vector<cql_value>> users;
+            
+            ///
+            /// sopmq.queue_data last_claimed_on by queue_key
+            ///
+            std::map<std::string, std::int64_t> queue_data;
+            
+            ///
+            /// sopmq.stored_items content by bucket_key, then stored_at and message_id
+            ///
+            std::map<std::string, std::map<std::pair<std::int64_t, std::string>, std::string>> stored_items;
+            
+            bool failing;
+            std::string fail_match;
+            bool fail_no_hosts;
+            
+            bool fail_connect;
+            bool hold_connect;
+            bool hold_query;
+            
+            std::deque<std::function<void()>> held;
+            
+            size_t connects;
+            size_t open_sessions;
+            
+            state()
+            : failing(false), fail_no_hosts(false), fail_connect(false), hold_connect(false),
+            hold_query(false), connects(0), open_sessions(0)
+            {
+            }
+            
+            ///
+            /// Runs the operation now, or later when held
+            ///
+            void submit(bool hold, std::function<void()> operation)
+            {
+                if (hold)
+                {
+                    std::lock_guard<std::mutex> lk(lock);
+                    held.push_back(std::move(operation));
+                    return;
+                }
+                
+                operation();
+            }
+            
+            ///
+            /// Applies the statements as one batch. The lock must be held
+            ///
+            void apply(const std::vector<bound_statement>& statements, const std::set<std::string>& prepared,
+                       query_result& result)
+            {
+                for (auto& statement : statements)
+                {
+                    if (failing && statement.cql.find(fail_match) != std::string::npos)
+                    {
+                        result.error.reset(new storage_error(fail_no_hosts ? "No hosts available" : "Injected failure"));
+                        result.no_hosts = fail_no_hosts;
+                        return;
+                    }
+                    
+                    if (verb(statement) != "CREATE" && prepared.count(statement.cql) == 0)
+                    {
+                        result.error.reset(new storage_error("Statement was not prepared: " + statement.cql));
+                        return;
+                    }
+                }
+                
+                for (auto& statement : statements)
+                {
+                    this->apply(statement, result);
+                }
+            }
+            
+            static std::string verb(const bound_statement& statement)
+            {
+                return statement.cql.substr(0, statement.cql.find(' '));
+            }
+            
+            void apply(const bound_statement& statement, query_result& result)
+            {
+                const std::string& cql = statement.cql;
+                const std::vector<cql_value>& p = statement.params;
+                std::string v = verb(statement);
+                
+                if (v == "CREATE") return;
+                
+                if (cql.find(".users ") != std::string::npos)
+                {
+                    if (v == "INSERT")
+                    {
+                        users[p[0].bytes] = p;
+                    }
+                    else if (v == "SELECT")
+                    {
+                        auto iter = users.find(p[0].bytes);
+                        if (iter != users.end()) result.rows.push_back(iter->second);
+                    }
+                }
+                else if (cql.find(".queue_data ") != std::string::npos)
+                {
+                    if (v == "UPDATE")
+                    {
+                        queue_data[p[1].bytes] = p[0].number;
+                    }
+                    else if (v == "SELECT")
+                    {
+                        auto iter = queue_data.find(p[0].bytes);
+                        if (iter != queue_data.end()) result.rows.push_back({ cql_value::int64(iter->second) });
+                    }
+                }
+                else if (cql.find(".stored_items ") != std::string::npos)
+                {
+                    if (v == "INSERT")
+                    {
+                        stored_items[p[0].bytes][std::make_pair(p[1].number, p[2].bytes)] = p[3].bytes;
+                    }
+                    else if (v == "DELETE")
+                    {
+                        auto iter = stored_items.find(p[0].bytes);
+                        if (iter != stored_items.end()) iter->second.erase(std::make_pair(p[1].number, p[2].bytes));
+                    }
+                    else if (v == "SELECT")
+                    {
+                        auto iter = stored_items.find(p[0].bytes);
+                        if (iter == stored_items.end()) return;
+                        
+                        for (auto& item : iter->second)
+                        {
+                            result.rows.push_back({
+                                cql_value::int64(item.first.first),
+                                cql_value::blob(item.first.second),
+                                cql_value::blob(item.second)
+                            });
+                        }
+                    }
+                }
+                else
+                {
+                    result.error.reset(new storage_error("Unknown statement: " + cql));
+                }
+            }
+        };
+        
+        class fake_storage_driver::session : public driver_session,
+                                             public std::enable_shared_from_this<fake_storage_driver::session>
+        {
+        public:
+            explicit session(std::shared_ptr<fake_storage_driver::state> state)
+            : _state(state)
+            {
+                std::lock_guard<std::mutex> lk(_state->lock);
+                ++_state->open_sessions;
+            }
+            
+            virtual ~session()
+            {
+                std::lock_guard<std::mutex> lk(_state->lock);
+                --_state->open_sessions;
+            }
+            
+            virtual void prepare(const std::string& cql, prepare_callback callback)
+            {
+                {
+                    std::lock_guard<std::mutex> lk(_state->lock);
+                    _prepared.insert(cql);
+                }
+                
+                callback(nullptr);
+            }
+            
+            virtual void execute(const bound_statement& statement, query_callback callback)
+            {
+                this->execute_batch({ statement }, callback);
+            }
+            
+            virtual void execute_batch(const std::vector<bound_statement>& statements, query_callback callback)
+            {
+                //like a real session, we stay open until the callback is done with us
+                auto self = this->shared_from_this();
+                
+                bool hold;
+                {
+                    std::lock_guard<std::mutex> lk(_state->lock);
+                    hold = _state->hold_query;
+                }
+                
+                _state->submit(hold, [self, statements, callback] {
+                    query_result result;
+                    {
+                        std::lock_guard<std::mutex> lk(self->_state->lock);
+                        self->_state->apply(statements, self->_prepared, result);
+                    }
+                    
+                    callback(result);
+                });
+            }
+        
+        private:
+            std::shared_ptr<fake_storage_driver::state> _state;
+            
+            ///
+            /// Guarded by the state's lock
+            ///
+            std::set<std::string> _prepared;
+        };
+        
+        fake_storage_driver::fake_storage_driver()
+        : _state(std::make_shared<state>())
+        {
+        }
+        
+        fake_storage_driver::~fake_storage_driver()
+        {
+        }
+        
+        void fake_storage_driver::connect(connect_callback callback)
+        {
+            bool hold;
+            {
+                std::lock_guard<std::mutex> lk(_state->lock);
+                ++_state->connects;
+                hold = _state->hold_connect;
+            }
+            
+            auto s = _state;
+            _state->submit(hold, [s, callback] {
+                bool fail;
+                {
+                    std::lock_guard<std::mutex> lk(s->lock);
+                    fail = s->fail_connect;
+                }
+                
+                if (fail)
+                {
+                    callback(std::unique_ptr<storage_error>(new storage_error("Unable to connect")), driver_session::ptr());
+                    return;
+                }
+                
+                callback(nullptr, std::make_shared<session>(s));
+            });
+        }
+        
+        void fake_storage_driver::fail_queries(const std::string& cqlPart, bool noHosts)
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            _state->failing = true;
+            _state->fail_match = cqlPart;
+            _state->fail_no_hosts = noHosts;
+        }
+        
+        void fake_storage_driver::clear_failures()
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            _state->failing = false;
+        }
+        
+        void fake_storage_driver::fail_connects(bool fail)
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            _state->fail_connect = fail;
+        }
+        
+        void fake_storage_driver::hold_connects(bool hold)
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            _state->hold_connect = hold;
+        }
+        
+        void fake_storage_driver::hold_queries(bool hold)
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            _state->hold_query = hold;
+        }
+        
+        bool fake_storage_driver::run_next()
+        {
+            std::function<void()> operation;
+            {
+                std::lock_guard<std::mutex> lk(_state->lock);
+                if (_state->held.empty()) return false;
+                
+                operation = std::move(_state->held.front());
+                _state->held.pop_front();
+            }
+            
+            operation();
+            return true;
+        }
+        
+        size_t fake_storage_driver::run_pending()
+        {
+            size_t ran = 0;
+            while (this->run_next()) ++ran;
+            
+            return ran;
+        }
+        
+        size_t fake_storage_driver::pending() const
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            return _state->held.size();
+        }
+        
+        size_t fake_storage_driver::connects() const
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            return _state->connects;
+        }
+        
+        size_t fake_storage_driver::open_sessions() const
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            return _state->open_sessions;
+        }
+        
+        size_t fake_storage_driver::stored_items() const
+        {
+            std::lock_guard<std::mutex> lk(_state->lock);
+            
+            size_t count = 0;
+            for (auto& bucket : _state->stored_items) count += bucket.second.size();
+            
+            return count;
+        }
+        
+    }
+}
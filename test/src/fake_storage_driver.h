@@ -0,0 +1,115 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __sopmq__fake_storage_driver__
+#define __sopmq__fake_storage_driver__
+
+#include "storage_driver.h"
+
+#include <memory>
+#include <string>
+#include <cstddef>
+
+namespace sopmq {
+    namespace test {
+        
+        ///
+        /// \brief Stands in for the cassandra driver, keeping the sopmq tables in memory
+        ///
+        /// Understands the statements cassandra_storage runs. Everything completes on
+        /// the calling thread unless it is held, in which case it waits for the test to
+        /// run it. Failures can be injected by matching on a statement's CQL
+        ///
+        class fake_storage_driver : public sopmq::node::storage::storage_driver
+        {
+        public:
+            fake_storage_driver();
+            virtual ~fake_storage_driver();
+            
+            virtual void connect(sopmq::node::storage::connect_callback callback);
+            
+            ///
+            /// Makes every statement whose CQL contains the text fail, along with any
+            /// batch holding one. An empty string matches everything
+            /// \param noHosts Fail the way a session with no hosts left does
+            ///
+            void fail_queries(const std::string& cqlPart, bool noHosts = false);
+            
+            ///
+            /// Stops failing statements
+            ///
+            void clear_failures();
+            
+            ///
+            /// Makes connects fail
+            ///
+            void fail_connects(bool fail);
+            
+            ///
+            /// When set connects wait for run_next() or run_pending()
+            ///
+            void hold_connects(bool hold);
+            
+            ///
+            /// When set statements and batches wait for run_next() or run_pending()
+            ///
+            void hold_queries(bool hold);
+            
+            ///
+            /// Completes the oldest held operation
+            /// \return Whether there was one
+            ///
+            bool run_next();
+            
+            ///
+            /// Completes held operations until there are none left, including any that
+            /// are started along the way
+            /// \return The number completed
+            ///
+            size_t run_pending();
+            
+            ///
+            /// The number of operations being held
+            ///
+            size_t pending() const;
+            
+            ///
+            /// The number of connects started
+            ///
+            size_t connects() const;
+            
+            ///
+            /// The number of sessions opened and not yet closed
+            ///
+            size_t open_sessions() const;
+            
+            ///
+            /// The number of messages in the stored_items table
+            ///
+            size_t stored_items() const;
+        
+        private:
+            struct state;
+            class session;
+            
+            std::shared_ptr<state> _state;
+        };
+        
+    }
+}
+
+#endif /* defined(__sopmq__fake_storage_driver__) */
@@ -18,18 +18,37 @@
 #include "gtest/gtest.h"
 
 #include "user_account.h"
+#include "user_cache.h"
 #include "settings.h"
 #include "util.h"
+#include "bench_util.h"
+#include "cassandra_storage.h"
+#include "fake_storage_driver.h"
 
 #include <cryptopp/sha.h>
+#include <boost/chrono.hpp>
+#include <boost/thread.hpp>
 #include <condition_variable>
 #include <mutex>
+#include <future>
+#include <memory>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
 
 
 
 using sopmq::node::settings;
 using sopmq::node::user_account;
+using sopmq::node::user_cache;
+using sopmq::node::storage::cassandra_storage;
+using sopmq::node::storage::storage_driver;
+using sopmq::node::storage::find_user_result;
 using sopmq::shared::util;
+using sopmq::test::bench_util;
+using sopmq::test::bench_timer;
+using sopmq::test::fake_storage_driver;
 
 TEST(AccountTest, TestCreateAccount)
 {
@@ -116,4 +135,200 @@ TEST(AccountTest, TestAccountAuthorized)
     cv.wait(lk, [&] {return returned == true;});
     
     ASSERT_EQ(true, uauthd);
-}
\ No newline at end of file
+}
+namespace
+{
+    ///
+    /// Stands in for storage, holding on to each read until the test finishes it
+    ///
+    class fake_user_store
+    {
+    public:
+        std::vector<std::pair<std::string, user_cache::fetch_callback>> reads;
+        
+        user_cache::fetch_function fetch()
+        {
+            return [this](const std::string& nameHash, user_cache::fetch_callback callback) {
+                reads.emplace_back(nameHash, callback);
+            };
+        }
+        
+        void finish(size_t index, user_cache::fetch_status status)
+        {
+            auto read = reads[index];
+            read.second(status, user_account(read.first, "user", "pw", 1));
+        }
+    };
+}
+
+TEST(AccountTest, CacheAnswersRepeatLookupsFromMemory)
+{
+    fake_user_store store;
+    user_cache cache(10, boost::chrono::seconds(60), boost::chrono::seconds(60), store.fetch());
+    
+    int found = 0;
+    auto cb = [&](bool f, const user_account& acct) { if (f) ++found; };
+    
+    cache.find("a", cb);
+    ASSERT_EQ(1, store.reads.size());
+    store.finish(0, user_cache::FS_FOUND);
+    
+    cache.find("a", cb);
+    cache.find("a", cb);
+    ASSERT_EQ(1, store.reads.size());
+    ASSERT_EQ(3, found);
+    
+    auto stats = cache.get_stats();
+    ASSERT_EQ(2, stats.hits);
+    ASSERT_EQ(1, stats.misses);
+    
+    //a changed user is read again
+    cache.invalidate("a");
+    cache.find("a", cb);
+    ASSERT_EQ(2, store.reads.size());
+}
+
+TEST(AccountTest, CacheRemembersUnknownUsers)
+{
+    fake_user_store store;
+    user_cache cache(10, boost::chrono::seconds(60), boost::chrono::milliseconds(1), store.fetch());
+    
+    bool found = true;
+    auto cb = [&](bool f, const user_account& acct) { found = f; };
+    
+    cache.find("nobody", cb);
+    store.finish(0, user_cache::FS_NOT_FOUND);
+    ASSERT_FALSE(found);
+    
+    //the negative entry expires on its own
+    boost::this_thread::sleep_for(boost::chrono::milliseconds(5));
+    cache.find("nobody", cb);
+    ASSERT_EQ(2, store.reads.size());
+    
+    //storage errors aren't remembered at all
+    store.finish(1, user_cache::FS_ERROR);
+    ASSERT_FALSE(found);
+    cache.find("nobody", cb);
+    ASSERT_EQ(3, store.reads.size());
+}
+
+TEST(AccountTest, CacheMergesConcurrentLookups)
+{
+    fake_user_store store;
+    user_cache cache(10, boost::chrono::seconds(60), boost::chrono::seconds(60), store.fetch());
+    
+    int answered = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        cache.find("a", [&](bool f, const user_account& acct) { ASSERT_TRUE(f); ++answered; });
+    }
+    
+    ASSERT_EQ(1, store.reads.size());
+    ASSERT_EQ(0, answered);
+    
+    store.finish(0, user_cache::FS_FOUND);
+    ASSERT_EQ(100, answered);
+    ASSERT_EQ(99, cache.get_stats().merged);
+}
+
+TEST(AccountTest, CacheEvictsLeastRecentlyUsed)
+{
+    fake_user_store store;
+    user_cache cache(2, boost::chrono::seconds(60), boost::chrono::seconds(60), store.fetch());
+    
+    auto cb = [](bool f, const user_account& acct) {};
+    
+    cache.find("a", cb);
+    store.finish(0, user_cache::FS_FOUND);
+    cache.find("b", cb);
+    store.finish(1, user_cache::FS_FOUND);
+    
+    //a is now the more recent of the two
+    cache.find("a", cb);
+    
+    cache.find("c", cb);
+    store.finish(2, user_cache::FS_FOUND);
+    ASSERT_EQ(2, cache.size());
+    ASSERT_EQ(1, cache.get_stats().evictions);
+    
+    cache.find("a", cb);
+    ASSERT_EQ(3, store.reads.size());
+    cache.find("b", cb);
+    ASSERT_EQ(4, store.reads.size());
+}
+
+TEST(AccountTest, CacheDropsReadsInvalidatedInFlight)
+{
+    fake_user_store store;
+    user_cache cache(10, boost::chrono::seconds(60), boost::chrono::seconds(60), store.fetch());
+    
+    auto cb = [](bool f, const user_account& acct) {};
+    
+    cache.find("a", cb);
+    cache.invalidate("a");
+    store.finish(0, user_cache::FS_FOUND);
+    
+    //what was read may predate the change
+    ASSERT_EQ(0, cache.size());
+}
+
+namespace
+{
+    ///
+    /// Times lookups made one at a time, the way a login waits on them
+    ///
+    void bench_lookups(user_cache& cache, const std::string& nameHash, const std::string& name, int lookups)
+    {
+        std::vector<std::int64_t> latencies;
+        latencies.reserve(lookups);
+        
+        bench_timer timer;
+        
+        for (int i = 0; i < lookups; ++i)
+        {
+            auto start = boost::chrono::steady_clock::now();
+            
+            std::promise<bool> found;
+            cache.find(nameHash, [&] (bool f, const user_account& acct) { found.set_value(f); });
+            ASSERT_TRUE(found.get_future().get());
+            
+            latencies.push_back(boost::chrono::duration_cast<boost::chrono::microseconds>(
+                boost::chrono::steady_clock::now() - start).count());
+        }
+        
+        timer.stop(name, lookups);
+        
+        std::sort(latencies.begin(), latencies.end());
+        printf("[ BENCH    ] %-48s %10lld us p50 %10lld us p99\n", (name + " latency").c_str(),
+               (long long)latencies[latencies.size() / 2], (long long)latencies[latencies.size() * 99 / 100]);
+    }
+}
+
+TEST(AccountTest, BenchmarkLoginLookup)
+{
+    const char* const USERNAME = "test user";
+    const int LOOKUPS = bench_util::full_runs() ? 10000 : 1000;
+    
+    cassandra_storage storage((std::unique_ptr<storage_driver>(new fake_storage_driver())));
+    storage.init();
+    storage.connect();
+    
+    std::string nameHash = util::sha256_hex_string(USERNAME);
+    storage.create_user(nameHash, USERNAME, util::sha256_hex_string("password"), 1);
+    
+    //the same path user_account takes to storage
+    auto fetch = [&storage](const std::string& hash, user_cache::fetch_callback callback) {
+        storage.find_user(hash, [callback](const find_user_result& fur) {
+            if (fur.error) callback(user_cache::FS_ERROR, user_account());
+            else if (fur.user_found) callback(user_cache::FS_FOUND, fur.account);
+            else callback(user_cache::FS_NOT_FOUND, user_account());
+        });
+    };
+    
+    user_cache uncached(0, boost::chrono::seconds(60), boost::chrono::seconds(60), fetch);
+    bench_lookups(uncached, nameHash, "login user lookup from storage", LOOKUPS);
+    
+    user_cache cached(10, boost::chrono::seconds(60), boost::chrono::seconds(60), fetch);
+    bench_lookups(cached, nameHash, "login user lookup", LOOKUPS);
+    ASSERT_EQ(LOOKUPS - 1, cached.get_stats().hits);
+}
@@ -0,0 +1,204 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "buffer_pool.h"
+#include "messageutil.h"
+#include "queued_message.h"
+#include "util.h"
+#include "bench_util.h"
+
+#include "PublishMessage.pb.h"
+
+#include <boost/shared_array.hpp>
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <memory>
+
+using namespace sopmq::shared::net;
+using namespace sopmq::shared;
+using namespace sopmq::node;
+using namespace sopmq::test;
+using sopmq::message::messageutil;
+
+namespace
+{
+    std::string make_wire_message(size_t payloadSize)
+    {
+        auto message = messageutil::make_message<PublishMessage>(1, 0);
+        message->set_allocated_message_id(util::uuid_to_bytes(util::random_uuid()));
+        message->set_queue_id("bench.queue");
+        message->set_ttl(60);
+        message->set_content(std::string(payloadSize, 'x'));
+        
+        return message->SerializeAsString();
+    }
+    
+    ///
+    /// Runs a received message through the same steps as the server's read path
+    /// and returns the payload bytes copied in user space
+    ///
+    template <typename GetBuffer>
+    uint64_t receive_publish(const std::string& wire, GetBuffer getBuffer)
+    {
+        auto buffer = getBuffer(wire.size());
+        
+        //stands in for the socket read
+        std::memcpy(buffer.first, wire.data(), wire.size());
+        
+        auto message = std::make_shared<PublishMessage>();
+        bool parsed = message->ParseFromArray(buffer.first, (int)wire.size());
+        buffer.second();
+        
+        EXPECT_TRUE(parsed);
+        
+        uint64_t copied = message->content().size();
+        const char* parsedBytes = message->content().data();
+        
+        auto queued = std::make_shared<queued_message<3>>(util::random_uuid(), message->mutable_content(), 60);
+        if (queued->data().data() != parsedBytes) copied += queued->data().size();
+        
+        return copied;
+    }
+    
+    void run_receive_benchmark(size_t payloadSize, size_t ops)
+    {
+        std::string wire = make_wire_message(payloadSize);
+        std::string label = std::to_string(payloadSize) + "B publish";
+        
+        uint64_t copied = 0;
+        
+        {
+            bench_timer timer;
+            for (size_t i = 0; i < ops; ++i)
+            {
+                boost::shared_array<char> fresh;
+                copied += receive_publish(wire, [&](size_t size) {
+                    fresh.reset(new char[size]);
+                    return std::make_pair(fresh.get(), [&]() { fresh.reset(); });
+                });
+            }
+            
+            timer.stop("fresh buffer " + label, ops);
+        }
+        
+        printf("[ BENCH    ] %-48s %10.1f bytes copied/op\n", ("fresh buffer " + label).c_str(), (double)copied / ops);
+        
+        auto pool = buffer_pool::create();
+        copied = 0;
+        
+        {
+            bench_timer timer;
+            for (size_t i = 0; i < ops; ++i)
+            {
+                buffer_pool::buffer pooled;
+                copied += receive_publish(wire, [&](size_t size) {
+                    pooled = pool->acquire(size);
+                    return std::make_pair(pooled.data(), [&]() { pooled.reset(); });
+                });
+            }
+            
+            timer.stop("pooled buffer " + label, ops);
+        }
+        
+        printf("[ BENCH    ] %-48s %10.1f bytes copied/op\n", ("pooled buffer " + label).c_str(), (double)copied / ops);
+        
+        //the payload is only copied once, out of the receive buffer
+        ASSERT_EQ(payloadSize, copied / ops);
+        ASSERT_EQ(1, pool->allocations());
+    }
+}
+
+TEST(BufferPoolTest, ReusesBuffersBySizeClass)
+{
+    auto pool = buffer_pool::create();
+    
+    char* first;
+    {
+        auto buffer = pool->acquire(100);
+        ASSERT_EQ(buffer_pool::MIN_CLASS_SIZE, buffer.capacity());
+        first = buffer.data();
+    }
+    
+    ASSERT_EQ(buffer_pool::MIN_CLASS_SIZE, pool->retained_bytes());
+    
+    //anything in the same class gets the same memory back
+    {
+        auto buffer = pool->acquire(buffer_pool::MIN_CLASS_SIZE);
+        ASSERT_EQ(first, buffer.data());
+        ASSERT_EQ(0, pool->retained_bytes());
+    }
+    
+    //the next class up is twice as big
+    {
+        auto buffer = pool->acquire(buffer_pool::MIN_CLASS_SIZE + 1);
+        ASSERT_EQ(buffer_pool::MIN_CLASS_SIZE * 2, buffer.capacity());
+    }
+    
+    ASSERT_EQ(2, pool->allocations());
+    ASSERT_EQ(1, pool->reuses());
+}
+
+TEST(BufferPoolTest, LimitsRetainedBuffers)
+{
+    auto pool = buffer_pool::create(4096);
+    
+    {
+        std::vector<buffer_pool::buffer> buffers;
+        for (size_t i = 0; i < buffer_pool::MAX_FREE_PER_CLASS + 2; ++i)
+        {
+            buffers.push_back(pool->acquire(10));
+        }
+    }
+    
+    ASSERT_EQ(buffer_pool::MAX_FREE_PER_CLASS * buffer_pool::MIN_CLASS_SIZE, pool->retained_bytes());
+    
+    //over the byte limit so it is freed rather than kept
+    {
+        auto buffer = pool->acquire(8000);
+        ASSERT_EQ(8192, buffer.capacity());
+    }
+    
+    ASSERT_EQ(buffer_pool::MAX_FREE_PER_CLASS * buffer_pool::MIN_CLASS_SIZE, pool->retained_bytes());
+}
+
+TEST(BufferPoolTest, BuffersOutliveThePool)
+{
+    buffer_pool::buffer buffer;
+    
+    {
+        auto pool = buffer_pool::create();
+        buffer = pool->acquire(1000);
+    }
+    
+    std::memset(buffer.data(), 0, buffer.capacity());
+    buffer.reset();
+    
+    ASSERT_EQ(nullptr, buffer.data());
+}
+
+TEST(BufferPoolTest, BenchmarkReceivePath)
+{
+    const size_t scale = bench_util::full_runs() ? 10 : 1;
+    
+    run_receive_benchmark(64, 100000 * scale);
+    run_receive_benchmark(4096, 20000 * scale);
+    run_receive_benchmark(1024 * 1024, 100 * scale);
+}
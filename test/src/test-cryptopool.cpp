@@ -0,0 +1,147 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "crypto_pool.h"
+#include "util.h"
+#include "bench_util.h"
+
+#include <boost/asio.hpp>
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <algorithm>
+
+using sopmq::node::crypto_pool;
+using sopmq::shared::util;
+using sopmq::test::bench_util;
+using sopmq::test::bench_timer;
+
+namespace ba = boost::asio;
+
+TEST(CryptoPoolTest, ResultsComeBackOnTheCallersIoService)
+{
+    ba::io_service ioService;
+    crypto_pool pool(1);
+    
+    std::string challenge(util::random_bytes(32));
+    std::string goodAnswer(util::sha256_hex_string("ringkey" + challenge));
+    
+    std::thread::id ioThread;
+    std::thread::id checkThread;
+    int passed = 0;
+    int failed = 0;
+    
+    auto verify = [&](const std::string& answer) {
+        pool.check(ioService,
+                   [&, answer] {
+                       checkThread = std::this_thread::get_id();
+                       return answer == util::sha256_hex_string("ringkey" + challenge);
+                   },
+                   [&](bool ok) {
+                       EXPECT_EQ(ioThread, std::this_thread::get_id());
+                       if (ok) ++passed;
+                       else ++failed;
+                   });
+    };
+    
+    verify(goodAnswer);
+    verify("not the answer");
+    
+    std::thread runner([&] {
+        ioThread = std::this_thread::get_id();
+        //keep going until both answers have been posted back
+        while (passed + failed < 2)
+        {
+            ioService.run_one();
+        }
+    });
+    runner.join();
+    
+    ASSERT_EQ(1, passed);
+    ASSERT_EQ(1, failed);
+    ASSERT_NE(ioThread, checkThread);
+}
+
+TEST(CryptoPoolTest, FinishesPostedJobsBeforeShuttingDown)
+{
+    std::atomic<int> ran(0);
+    
+    {
+        crypto_pool pool(3);
+        for (int i = 0; i < 100; ++i)
+        {
+            pool.post([&ran] { ++ran; });
+        }
+    }
+    
+    ASSERT_EQ(100, ran.load());
+}
+
+TEST(CryptoPoolTest, BenchmarkLoginChecks)
+{
+    //each login costs one SHA-256 over the stored hash and the challenge. run
+    //them through pools of different sizes to see how checks scale per thread
+    const int CHECKS = bench_util::full_runs() ? 400000 : 20000;
+    
+    std::string pwHash(util::sha256_hex_string("password"));
+    std::string challenge(util::random_bytes(32));
+    std::string answer(util::sha256_hex_string(pwHash + challenge));
+    
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    
+    for (size_t threads = 1; threads <= cores; threads *= 2)
+    {
+        ba::io_service ioService;
+        std::atomic<int> passed(0);
+        
+        bench_timer timer;
+        {
+            crypto_pool pool(threads);
+            for (int i = 0; i < CHECKS; ++i)
+            {
+                pool.check(ioService,
+                           [&] { return answer == util::sha256_hex_string(pwHash + challenge); },
+                           [&passed](bool ok) { if (ok) ++passed; });
+            }
+        }
+        
+        ioService.run();
+        
+        timer.stop("login checks, " + std::to_string(threads) + " crypto threads", CHECKS);
+        
+        ASSERT_EQ(CHECKS, passed.load());
+    }
+}
+
+TEST(CryptoPoolTest, BenchmarkRandomBytes)
+{
+    const int CHALLENGES = bench_util::full_runs() ? 1000000 : 50000;
+    
+    size_t total = 0;
+    
+    bench_timer timer;
+    for (int i = 0; i < CHALLENGES; ++i)
+    {
+        total += util::random_bytes(32).size();
+    }
+    timer.stop("random_bytes(32)", CHALLENGES);
+    
+    ASSERT_EQ(CHALLENGES * 32, (int)total);
+}
@@ -0,0 +1,273 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "frame_reader.h"
+#include "buffer_pool.h"
+#include "connection_base.h"
+#include "message_dispatcher.h"
+#include "messageutil.h"
+#include "bench_util.h"
+
+#include "PublishMessage.pb.h"
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <memory>
+
+using namespace sopmq::shared::net;
+using namespace sopmq::message;
+using namespace sopmq::test;
+using namespace std::placeholders;
+
+namespace ba = boost::asio;
+
+namespace
+{
+    const uint32_t MAX_SIZE = 10 * 1024 * 1024;
+    
+    std::string encode_frame(uint16_t type, const std::string& body)
+    {
+        auto netType = ba::detail::socket_ops::host_to_network_short(type);
+        auto netSize = ba::detail::socket_ops::host_to_network_long((uint32_t)body.size());
+        
+        std::string frame((const char*)&netType, sizeof(netType));
+        frame.append((const char*)&netSize, sizeof(netSize));
+        frame.append(body);
+        
+        return frame;
+    }
+    
+    std::string presence_frame(uint32_t id)
+    {
+        auto message = messageutil::make_message<PublishMessage>(id, 0);
+        message->set_message_id(std::string(16, 'i'));
+        message->set_queue_id("presence.user");
+        message->set_ttl(30);
+        message->set_content("online");
+        
+        return encode_frame(MT_PUBLISH, message->SerializeAsString());
+    }
+    
+    ///
+    /// Copies the data into the reader in chunks of the given size
+    ///
+    void feed(frame_reader& reader, const std::string& data, size_t& pos, size_t chunk)
+    {
+        auto space = reader.read_space();
+        size_t count = std::min(std::min(chunk, ba::buffer_size(space)), data.size() - pos);
+        
+        std::memcpy(ba::buffer_cast<char*>(space), data.data() + pos, count);
+        reader.commit(count);
+        pos += count;
+    }
+    
+    ///
+    /// Reads frames off a loopback socket the same way the node does, re-arming
+    /// the read from the status callback
+    ///
+    struct frame_counter
+    {
+        connection_base& conn;
+        message_dispatcher dispatcher;
+        size_t expected;
+        size_t received;
+        
+        frame_counter(connection_base& conn, size_t expected)
+        : conn(conn), expected(expected), received(0)
+        {
+            std::function<void(const network_operation_result&, PublishMessage_ptr)> handler
+                = [this](const network_operation_result&, PublishMessage_ptr) { ++received; };
+            
+            dispatcher.set_handler(handler);
+        }
+        
+        void read()
+        {
+            conn.read_message(dispatcher, std::bind(&frame_counter::after_read, this, _1));
+        }
+        
+        void after_read(const network_operation_result& result)
+        {
+            ASSERT_TRUE(result.was_successful());
+            if (received + 1 < expected) this->read();
+        }
+    };
+}
+
+TEST(FrameReaderTest, DrainsManyFramesFromOneRead)
+{
+    frame_reader reader(buffer_pool::create());
+    
+    std::string data;
+    for (uint32_t i = 0; i < 100; ++i) data += presence_frame(i);
+    
+    size_t pos = 0;
+    feed(reader, data, pos, data.size());
+    ASSERT_EQ(data.size(), pos);
+    
+    frame_reader::frame frame;
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(frame_reader::FRAME_READY, reader.next(frame, MAX_SIZE));
+        ASSERT_EQ(MT_PUBLISH, frame.type);
+        
+        PublishMessage message;
+        ASSERT_TRUE(message.ParseFromArray(frame.body, frame.size));
+        ASSERT_EQ(i, message.identity().id());
+    }
+    
+    ASSERT_EQ(frame_reader::NEED_MORE, reader.next(frame, MAX_SIZE));
+    ASSERT_EQ(0, reader.buffered());
+    ASSERT_EQ(1, reader.read_count());
+    ASSERT_EQ(100, reader.frame_count());
+}
+
+TEST(FrameReaderTest, ReassemblesSplitFrames)
+{
+    //a small buffer forces partial frames to wrap back to the front
+    frame_reader reader(buffer_pool::create(), 100);
+    
+    std::string data;
+    for (uint32_t i = 0; i < 50; ++i) data += presence_frame(i);
+    
+    size_t pos = 0;
+    uint32_t next = 0;
+    frame_reader::frame frame;
+    
+    while (next < 50)
+    {
+        auto result = reader.next(frame, MAX_SIZE);
+        if (result == frame_reader::NEED_MORE)
+        {
+            ASSERT_LT(pos, data.size());
+            feed(reader, data, pos, 7);
+            continue;
+        }
+        
+        ASSERT_EQ(frame_reader::FRAME_READY, result);
+        
+        PublishMessage message;
+        ASSERT_TRUE(message.ParseFromArray(frame.body, frame.size));
+        ASSERT_EQ(next++, message.identity().id());
+    }
+    
+    ASSERT_EQ(data.size(), pos);
+}
+
+TEST(FrameReaderTest, LargeFramesUseThePool)
+{
+    auto pool = buffer_pool::create();
+    frame_reader reader(pool, 1024);
+    
+    std::string body(100000, 'b');
+    std::string data = encode_frame(MT_PUBLISH, body) + presence_frame(1);
+    
+    size_t pos = 0;
+    frame_reader::frame frame;
+    
+    while (reader.next(frame, MAX_SIZE) == frame_reader::NEED_MORE)
+    {
+        feed(reader, data, pos, 4096);
+    }
+    
+    ASSERT_EQ(body.size(), frame.size);
+    ASSERT_EQ(body, std::string(frame.body, frame.size));
+    ASSERT_EQ(1, pool->allocations());
+    
+    while (reader.next(frame, MAX_SIZE) == frame_reader::NEED_MORE)
+    {
+        feed(reader, data, pos, 4096);
+    }
+    
+    ASSERT_EQ(MT_PUBLISH, frame.type);
+    ASSERT_NE(0, pool->retained_bytes());
+}
+
+TEST(FrameReaderTest, RejectsBadHeaders)
+{
+    frame_reader::frame frame;
+    
+    {
+        frame_reader reader(buffer_pool::create());
+        std::string data = encode_frame(MT_INVALID_OUT_OF_RANGE, "x");
+        size_t pos = 0;
+        feed(reader, data, pos, data.size());
+        
+        ASSERT_EQ(frame_reader::INVALID_TYPE, reader.next(frame, MAX_SIZE));
+    }
+    
+    {
+        frame_reader reader(buffer_pool::create());
+        std::string data = encode_frame(MT_PUBLISH, std::string(100, 'x'));
+        size_t pos = 0;
+        feed(reader, data, pos, data.size());
+        
+        ASSERT_EQ(frame_reader::TOO_LARGE, reader.next(frame, 99));
+        ASSERT_EQ(100, frame.size);
+    }
+}
+
+TEST(FrameReaderTest, BenchmarkLoopbackPresenceMessages)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 1000000 : 100000;
+    
+    ba::io_service ioService;
+    ba::ip::tcp::acceptor acceptor(ioService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+    
+    connection_base in(ioService, MAX_SIZE);
+    ba::ip::tcp::socket out(ioService);
+    
+    out.connect(acceptor.local_endpoint());
+    acceptor.accept(in.get_socket());
+    
+    std::string batch;
+    for (uint32_t i = 0; i < 1000; ++i) batch += presence_frame(i);
+    
+    frame_counter counter(in, NUM_MESSAGES);
+    counter.read();
+    
+    bench_timer timer;
+    
+    //the writer runs alongside the reader so the reads see whatever has
+    //arrived, like a busy client connection would
+    size_t written = 0;
+    std::function<void(const boost::system::error_code&, size_t)> write_more
+        = [&](const boost::system::error_code& error, size_t) {
+            ASSERT_FALSE(error);
+            if (written >= NUM_MESSAGES) return;
+            
+            written += 1000;
+            ba::async_write(out, ba::buffer(batch), write_more);
+        };
+    
+    write_more(boost::system::error_code(), 0);
+    ioService.run();
+    
+    timer.stop("frame reader presence messages", NUM_MESSAGES);
+    
+    ASSERT_EQ(NUM_MESSAGES, counter.received);
+    
+    printf("[ BENCH    ] %-48s %10.1f frames/read (%llu reads)\n", "frame reader presence messages",
+           (double)in.reader().frame_count() / in.reader().read_count(),
+           (unsigned long long)in.reader().read_count());
+}
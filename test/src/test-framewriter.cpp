@@ -0,0 +1,257 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "frame_writer.h"
+#include "frame_reader.h"
+#include "buffer_pool.h"
+#include "connection_base.h"
+#include "message_dispatcher.h"
+#include "messageutil.h"
+#include "bench_util.h"
+
+#include "PublishMessage.pb.h"
+
+#include <boost/asio.hpp>
+
+#include <cstring>
+#include <cstdio>
+#include <string>
+#include <memory>
+
+using namespace sopmq::shared::net;
+using namespace sopmq::message;
+using namespace sopmq::test;
+using namespace std::placeholders;
+
+namespace ba = boost::asio;
+
+namespace
+{
+    PublishMessage_ptr make_publish(uint32_t id)
+    {
+        auto message = messageutil::make_message<PublishMessage>(id, 0);
+        message->set_message_id(std::string(16, 'i'));
+        message->set_queue_id("bench.queue");
+        message->set_ttl(30);
+        message->set_content(std::string(100, 'c'));
+        
+        return message;
+    }
+    
+    ///
+    /// A connected pair of connections over loopback
+    ///
+    struct loopback_pair
+    {
+        ba::io_service ioService;
+        connection_base out;
+        connection_base in;
+        message_dispatcher dispatcher;
+        
+        size_t expected;
+        std::vector<uint32_t> received;
+        
+        loopback_pair()
+        : out(ioService, 1024 * 1024), in(ioService, 1024 * 1024), expected(0)
+        {
+            ba::ip::tcp::acceptor acceptor(ioService, ba::ip::tcp::endpoint(ba::ip::address_v4::loopback(), 0));
+            out.get_socket().connect(acceptor.local_endpoint());
+            acceptor.accept(in.get_socket());
+            
+            std::function<void(const network_operation_result&, PublishMessage_ptr)> handler
+                = [this](const network_operation_result&, PublishMessage_ptr message) {
+                    received.push_back(message->identity().id());
+                };
+            
+            dispatcher.set_handler(handler);
+        }
+        
+        void receive(size_t count)
+        {
+            expected = count;
+            this->read();
+        }
+        
+        void read()
+        {
+            in.read_message(dispatcher, std::bind(&loopback_pair::after_read, this, _1));
+        }
+        
+        void after_read(const network_operation_result& result)
+        {
+            ASSERT_TRUE(result.was_successful());
+            if (received.size() + 1 < expected) this->read();
+        }
+    };
+    
+    void run_publish_benchmark(size_t inFlight, size_t numMessages)
+    {
+        loopback_pair pair;
+        pair.receive(numMessages);
+        
+        auto message = make_publish(1);
+        size_t sent = 0;
+        
+        std::function<void(const network_operation_result&)> on_sent;
+        auto send_one = [&]() {
+            ++sent;
+            pair.out.send_message(MT_PUBLISH, message, on_sent);
+        };
+        
+        on_sent = [&](const network_operation_result& result) {
+            ASSERT_TRUE(result.was_successful());
+            if (sent < numMessages) send_one();
+        };
+        
+        bench_timer timer;
+        
+        for (size_t i = 0; i < inFlight && sent < numMessages; ++i)
+        {
+            send_one();
+        }
+        
+        pair.ioService.run();
+        
+        std::string name = "publish with " + std::to_string(inFlight) + " in flight";
+        timer.stop(name, numMessages);
+        
+        ASSERT_EQ(numMessages, pair.received.size());
+        
+        printf("[ BENCH    ] %-48s %10.1f frames/write (%llu writes)\n", name.c_str(),
+               (double)pair.out.writer().frame_count() / pair.out.writer().write_count(),
+               (unsigned long long)pair.out.writer().write_count());
+    }
+}
+
+TEST(FrameWriterTest, BatchesFramesQueuedDuringAWrite)
+{
+    frame_writer writer;
+    
+    int completed = 0;
+    auto callback = [&](const network_operation_result& result) {
+        ASSERT_TRUE(result.was_successful());
+        ++completed;
+    };
+    
+    writer.push(MT_PUBLISH, *make_publish(1), callback);
+    auto first = writer.begin_write();
+    ASSERT_TRUE(writer.writing());
+    ASSERT_FALSE(writer.has_queued());
+    
+    //these queue up behind the write in flight
+    writer.push(MT_PUBLISH, *make_publish(2), callback);
+    writer.push(MT_PUBLISH, *make_publish(3), callback);
+    ASSERT_TRUE(writer.has_queued());
+    
+    std::string data(ba::buffer_cast<const char*>(first), ba::buffer_size(first));
+    
+    writer.end_write(network_operation_result::success());
+    ASSERT_EQ(1, completed);
+    ASSERT_FALSE(writer.writing());
+    
+    auto second = writer.begin_write();
+    data.append(ba::buffer_cast<const char*>(second), ba::buffer_size(second));
+    writer.end_write(network_operation_result::success());
+    
+    ASSERT_EQ(3, completed);
+    ASSERT_EQ(2, writer.write_count());
+    ASSERT_EQ(3, writer.frame_count());
+    
+    //everything written reads back in order
+    frame_reader reader(buffer_pool::create());
+    auto space = reader.read_space();
+    std::memcpy(ba::buffer_cast<char*>(space), data.data(), data.size());
+    reader.commit(data.size());
+    
+    frame_reader::frame frame;
+    for (uint32_t id = 1; id <= 3; ++id)
+    {
+        ASSERT_EQ(frame_reader::FRAME_READY, reader.next(frame, 1024 * 1024));
+        
+        PublishMessage message;
+        ASSERT_TRUE(message.ParseFromArray(frame.body, frame.size));
+        ASSERT_EQ(id, message.identity().id());
+    }
+}
+
+TEST(FrameWriterTest, FlushDelayBatchesSends)
+{
+    loopback_pair pair;
+    pair.out.set_flush_delay(boost::chrono::milliseconds(20));
+    pair.receive(100);
+    
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        pair.out.send_message(MT_PUBLISH, make_publish(i), [](const network_operation_result&) {});
+    }
+    
+    pair.ioService.run();
+    
+    ASSERT_EQ(1, pair.out.writer().write_count());
+    ASSERT_EQ(100, pair.received.size());
+    
+    for (uint32_t i = 0; i < 100; ++i)
+    {
+        ASSERT_EQ(i, pair.received[i]);
+    }
+}
+
+TEST(FrameWriterTest, ReportsWriteErrors)
+{
+    loopback_pair pair;
+    pair.out.set_flush_delay(boost::chrono::milliseconds(20));
+    
+    bool failed = false;
+    pair.out.send_message(MT_PUBLISH, make_publish(1), [&](const network_operation_result& result) {
+        failed = ! result.was_successful();
+    });
+    
+    pair.out.close();
+    pair.ioService.run();
+    
+    ASSERT_TRUE(failed);
+}
+
+TEST(FrameWriterTest, CloseFailsQueuedFrames)
+{
+    ba::io_service ioService;
+    std::unique_ptr<connection_base> conn(new connection_base(ioService, 1024 * 1024));
+    conn->set_flush_delay(boost::chrono::milliseconds(20));
+    
+    bool failed = false;
+    conn->send_message(MT_PUBLISH, make_publish(1), [&](const network_operation_result& result) {
+        failed = ! result.was_successful();
+    });
+    
+    //nothing waits for the flush timer, which is only left to run after we're gone
+    conn->close();
+    ASSERT_TRUE(failed);
+    ASSERT_FALSE(conn->writer().has_queued());
+    
+    conn.reset();
+    ioService.run();
+}
+
+TEST(FrameWriterTest, BenchmarkInFlightPublishes)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 1000000 : 100000;
+    
+    run_publish_benchmark(1, NUM_MESSAGES / 10);
+    run_publish_benchmark(1000, NUM_MESSAGES);
+}
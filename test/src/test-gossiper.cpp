@@ -0,0 +1,482 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "gossiper.h"
+#include "connection_out.h"
+#include "ring.h"
+#include "node.h"
+#include "endpoint.h"
+#include "messageutil.h"
+#include "bench_util.h"
+
+#include "GossipMessage.pb.h"
+#include "GossipNodeData.pb.h"
+#include "NodeClock.pb.h"
+#include "Identifier.pb.h"
+
+#include <boost/asio.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace sopmq::node;
+using namespace sopmq::shared::net;
+
+using sopmq::message::messageutil;
+using sopmq::test::bench_util;
+
+namespace
+{
+    ///
+    /// A ring of nodes where every node runs its own gossiper over its own view
+    /// of the ring. Messages are handed over on one io_service, and a round is
+    /// every up node ticking once and everything that sets off being delivered
+    ///
+    class gossip_cluster
+    {
+    public:
+        gossip_cluster(size_t size, size_t fanout)
+        : bytes(0), messages(0), _down(size, false)
+        {
+            for (size_t i = 0; i < size; ++i)
+            {
+                std::unique_ptr<ring> view(new ring());
+                for (size_t j = 0; j < size; ++j)
+                {
+                    view->add_node(std::make_shared<sopmq::node::node>(j + 1, (j + 1) * 1000,
+                        endpoint("sopmq1://localhost:" + std::to_string(j + 1))));
+                }
+
+                auto exchange = [this](const node::ptr& peer, GossipMessage_ptr message,
+                                       std::function<void(GossipMessage_ptr)> replied) {
+                    this->count(*message);
+
+                    size_t target = peer->node_id() - 1;
+                    _ioService.post([this, target, message, replied] {
+                        if (_down[target])
+                        {
+                            replied(GossipMessage_ptr());
+                            return;
+                        }
+
+                        GossipMessage_ptr reply = _gossipers[target]->handle_gossip(*message);
+                        this->count(*reply);
+
+                        _ioService.post([replied, reply] { replied(reply); });
+                    });
+                };
+
+                auto push = [this](const node::ptr& peer, GossipMessage_ptr message) {
+                    this->count(*message);
+
+                    size_t target = peer->node_id() - 1;
+                    _ioService.post([this, target, message] {
+                        if (! _down[target]) _gossipers[target]->handle_gossip(*message);
+                    });
+                };
+
+                node::ptr self = view->find_node(i + 1);
+                _gossipers.push_back(std::make_shared<gossiper>(_ioService, *view, self, fanout, exchange, push));
+                _views.push_back(std::move(view));
+            }
+        }
+
+        void round()
+        {
+            for (size_t i = 0; i < _gossipers.size(); ++i)
+            {
+                if (! _down[i]) _gossipers[i]->tick();
+            }
+
+            this->deliver();
+        }
+
+        void deliver()
+        {
+            _ioService.run();
+            _ioService.reset();
+        }
+
+        ///
+        /// Shuts the node down the way the server does and stops it answering
+        ///
+        void shut_down(size_t index)
+        {
+            _gossipers[index]->stop();
+            this->deliver();
+
+            _down[index] = true;
+        }
+
+        ///
+        /// How the observer sees the node
+        ///
+        node::ptr view_of(size_t observer, size_t index) const
+        {
+            return _views[observer]->find_node(index + 1);
+        }
+
+        ///
+        /// How many beats behind the observer is on the node
+        ///
+        std::uint64_t lag(size_t observer, size_t index) const
+        {
+            node_clock actual = this->view_of(index, index)->heartbeat_clock();
+            node_clock seen = this->view_of(observer, index)->heartbeat_clock();
+
+            if (seen.generation != actual.generation) return actual.clock + 1;
+            return actual.clock - seen.clock;
+        }
+
+        ///
+        /// Whether every up node has heard a heartbeat from every other
+        ///
+        bool all_heard() const
+        {
+            for (size_t observer = 0; observer < _views.size(); ++observer)
+            {
+                for (size_t index = 0; index < _views.size(); ++index)
+                {
+                    if (_down[observer] || _down[index]) continue;
+
+                    if (this->view_of(observer, index)->heartbeat_clock().generation
+                        != this->view_of(index, index)->heartbeat_clock().generation) return false;
+                }
+            }
+
+            return true;
+        }
+
+        std::uint64_t max_lag() const
+        {
+            std::uint64_t worst = 0;
+            for (size_t observer = 0; observer < _views.size(); ++observer)
+            {
+                if (_down[observer]) continue;
+
+                for (size_t index = 0; index < _views.size(); ++index)
+                {
+                    if (! _down[index]) worst = std::max(worst, this->lag(observer, index));
+                }
+            }
+
+            return worst;
+        }
+
+        size_t size() const
+        {
+            return _views.size();
+        }
+
+        std::uint64_t bytes;
+        std::uint64_t messages;
+
+    private:
+        boost::asio::io_service _ioService;
+        std::vector<std::unique_ptr<ring>> _views;
+        std::vector<gossiper::ptr> _gossipers;
+        std::vector<bool> _down;
+
+        void count(const GossipMessage& message)
+        {
+            bytes += message.ByteSize();
+            ++messages;
+        }
+    };
+
+    GossipNodeData* add_heartbeat(GossipMessage& message, std::uint32_t nodeId, std::uint32_t generation,
+                                  std::uint64_t clock)
+    {
+        GossipNodeData* data = message.add_data();
+        data->mutable_clock()->set_node_id(nodeId);
+        data->mutable_clock()->set_generation(generation);
+        data->mutable_clock()->set_clock(clock);
+
+        return data;
+    }
+}
+
+TEST(GossiperTest, TestRoundTradesHeartbeats)
+{
+    gossip_cluster cluster(2, 1);
+
+    cluster.round();
+
+    //each side heard the other's newest beat
+    ASSERT_EQ(0u, cluster.max_lag());
+}
+
+TEST(GossiperTest, TestSettledRingOnlyTradesDigests)
+{
+    boost::asio::io_service ioService;
+    ring view;
+
+    node::ptr self = std::make_shared<sopmq::node::node>(1, 1000, endpoint("sopmq1://localhost:1"));
+    node::ptr peer = std::make_shared<sopmq::node::node>(2, 2000, endpoint("sopmq1://localhost:2"));
+    view.add_node(self);
+    view.add_node(peer);
+
+    auto g = std::make_shared<gossiper>(ioService, view, self, 1,
+        [](const node::ptr&, GossipMessage_ptr, std::function<void(GossipMessage_ptr)>) {},
+        [](const node::ptr&, GossipMessage_ptr) {});
+
+    node_clock selfBeat = self->heartbeat_clock();
+
+    node_clock peerBeat = peer->heartbeat_clock();
+    peerBeat.generation = 7;
+    peerBeat.clock = 3;
+    ASSERT_TRUE(peer->observe_heartbeat(peerBeat));
+
+    //the same heartbeats we have get nothing back
+    GossipMessage digests;
+    selfBeat.to_protobuf(digests.add_digests());
+    peerBeat.to_protobuf(digests.add_digests());
+
+    GossipMessage_ptr reply = g->handle_gossip(digests);
+    ASSERT_TRUE((bool)reply);
+    ASSERT_EQ(0, reply->data_size());
+    ASSERT_EQ(0, reply->digests_size());
+
+    //an older one gets ours back
+    digests.mutable_digests(1)->set_clock(1);
+
+    //and one newer than our own is nonsense, not something to ask for
+    digests.mutable_digests(0)->set_clock(selfBeat.clock + 5);
+
+    reply = g->handle_gossip(digests);
+    ASSERT_EQ(1, reply->data_size());
+    ASSERT_EQ(2u, reply->data(0).clock().node_id());
+    ASSERT_EQ(3u, reply->data(0).clock().clock());
+
+    ASSERT_EQ(0, reply->digests_size());
+
+    //a newer one gets asked for
+    digests.mutable_digests(1)->set_clock(9);
+
+    reply = g->handle_gossip(digests);
+    ASSERT_EQ(0, reply->data_size());
+    ASSERT_EQ(1, reply->digests_size());
+    ASSERT_EQ(2u, reply->digests(0).node_id());
+    ASSERT_EQ(3u, reply->digests(0).clock());
+}
+
+TEST(GossiperTest, TestPushIsNotAnswered)
+{
+    boost::asio::io_service ioService;
+    ring view;
+
+    node::ptr self = std::make_shared<sopmq::node::node>(1, 1000, endpoint("sopmq1://localhost:1"));
+    node::ptr peer = std::make_shared<sopmq::node::node>(2, 2000, endpoint("sopmq1://localhost:2"));
+    view.add_node(self);
+    view.add_node(peer);
+
+    auto g = std::make_shared<gossiper>(ioService, view, self, 1,
+        [](const node::ptr&, GossipMessage_ptr, std::function<void(GossipMessage_ptr)>) {},
+        [](const node::ptr&, GossipMessage_ptr) {});
+
+    GossipMessage push;
+    add_heartbeat(push, 2, 7, 4);
+    add_heartbeat(push, 99, 7, 4);
+
+    ASSERT_FALSE((bool)g->handle_gossip(push));
+    ASSERT_EQ(4u, peer->heartbeat_clock().clock);
+}
+
+TEST(GossiperTest, TestPiggybackedHeartbeatRevivesNode)
+{
+    boost::asio::io_service ioService;
+    ring view;
+
+    node::ptr self = std::make_shared<sopmq::node::node>(1, 1000, endpoint("sopmq1://localhost:1"));
+    node::ptr peer = std::make_shared<sopmq::node::node>(2, 2000, endpoint("sopmq1://localhost:2"));
+    view.add_node(self);
+    view.add_node(peer);
+
+    auto g = std::make_shared<gossiper>(ioService, view, self, 1,
+        [](const node::ptr&, GossipMessage_ptr, std::function<void(GossipMessage_ptr)>) {},
+        [](const node::ptr&, GossipMessage_ptr) {});
+
+    peer->set_failed();
+    ASSERT_FALSE(peer->is_alive());
+
+    //messages without one change nothing
+    Identifier identity;
+    g->note_heartbeat(identity);
+    ASSERT_FALSE(peer->is_alive());
+
+    identity.mutable_heartbeat()->set_node_id(2);
+    identity.mutable_heartbeat()->set_generation(7);
+    identity.mutable_heartbeat()->set_clock(1);
+    g->note_heartbeat(identity);
+
+    ASSERT_TRUE(peer->is_alive());
+    ASSERT_EQ(1u, peer->heartbeat_clock().clock);
+
+    //the same beat again isn't news
+    ASSERT_FALSE(peer->observe_heartbeat(peer->heartbeat_clock()));
+}
+
+TEST(GossiperTest, TestHeartbeatRidesOncePerBeatPerConnection)
+{
+    boost::asio::io_service ioService;
+    auto conn = std::make_shared<connection::connection_out>(ioService, endpoint("sopmq1://localhost:1"));
+
+    ASSERT_TRUE(conn->heartbeat_due(1));
+    ASSERT_FALSE(conn->heartbeat_due(1));
+    ASSERT_TRUE(conn->heartbeat_due(2));
+    ASSERT_FALSE(conn->heartbeat_due(1));
+}
+
+TEST(GossiperTest, TestShutdownMarksNodeDownUntilRestart)
+{
+    boost::asio::io_service ioService;
+    ring view;
+
+    node::ptr self = std::make_shared<sopmq::node::node>(1, 1000, endpoint("sopmq1://localhost:1"));
+    node::ptr peer = std::make_shared<sopmq::node::node>(2, 2000, endpoint("sopmq1://localhost:2"));
+    view.add_node(self);
+    view.add_node(peer);
+
+    auto g = std::make_shared<gossiper>(ioService, view, self, 1,
+        [](const node::ptr&, GossipMessage_ptr, std::function<void(GossipMessage_ptr)>) {},
+        [](const node::ptr&, GossipMessage_ptr) {});
+
+    GossipMessage push;
+    add_heartbeat(push, 2, 7, 10)->set_status(GossipNodeData_Status_SHUTDOWN);
+    g->handle_gossip(push);
+
+    ASSERT_FALSE(peer->is_alive());
+
+    bool shuttingDown = false;
+    peer->heartbeat_clock(&shuttingDown);
+    ASSERT_TRUE(shuttingDown);
+
+    //coming back starts a new generation
+    GossipMessage restart;
+    add_heartbeat(restart, 2, 8, 0);
+    g->handle_gossip(restart);
+
+    ASSERT_TRUE(peer->is_alive());
+}
+
+TEST(GossiperTest, TestFanoutIsBounded)
+{
+    boost::asio::io_service ioService;
+    ring view;
+
+    for (uint32_t i = 1; i <= 10; ++i)
+    {
+        view.add_node(std::make_shared<sopmq::node::node>(i, i * 1000, endpoint("sopmq1://localhost:" + std::to_string(i))));
+    }
+
+    std::vector<std::uint32_t> sentTo;
+    auto g = std::make_shared<gossiper>(ioService, view, view.find_node(1), 3,
+        [&sentTo](const node::ptr& peer, GossipMessage_ptr message, std::function<void(GossipMessage_ptr)>) {
+            //every digest goes out, ours first
+            ASSERT_EQ(10, message->digests_size());
+            ASSERT_EQ(1u, message->digests(0).node_id());
+
+            sentTo.push_back(peer->node_id());
+        },
+        [](const node::ptr&, GossipMessage_ptr) {});
+
+    for (int round = 0; round < 50; ++round)
+    {
+        sentTo.clear();
+        g->tick();
+
+        ASSERT_EQ(3u, sentTo.size());
+        ASSERT_EQ(sentTo.end(), std::find(sentTo.begin(), sentTo.end(), 1u));
+
+        std::sort(sentTo.begin(), sentTo.end());
+        ASSERT_EQ(sentTo.end(), std::unique(sentTo.begin(), sentTo.end()));
+    }
+
+    ASSERT_EQ(50u, view.find_node(1)->heartbeat_clock().clock);
+}
+
+TEST(GossiperTest, SimulateConvergence)
+{
+    const size_t NODES = 100;
+    const int ROUNDS = bench_util::full_runs() ? 200 : 40;
+
+    for (size_t fanout = 1; fanout <= 3; ++fanout)
+    {
+        gossip_cluster cluster(NODES, fanout);
+
+        //a ring that has only just started knows nothing about anyone
+        int startup = 0;
+        while (! cluster.all_heard() && startup < ROUNDS)
+        {
+            cluster.round();
+            ++startup;
+        }
+
+        ASSERT_LT(startup, ROUNDS);
+
+        //then heartbeats keep flowing. how far behind the furthest node is on
+        //the furthest heartbeat is how long news takes to get everywhere
+        std::uint64_t worst = 0;
+        std::uint64_t startBytes = cluster.bytes;
+        std::uint64_t startMessages = cluster.messages;
+
+        for (int i = 0; i < ROUNDS; ++i)
+        {
+            cluster.round();
+            worst = std::max(worst, cluster.max_lag());
+        }
+
+        ASSERT_LT(worst, 16u);
+
+        double bytesPerNodeSecond = (double)(cluster.bytes - startBytes) / ROUNDS / NODES
+            * 1000.0 / gossiper::GOSSIP_INTERVAL_MS;
+        double messagesPerNodeSecond = (double)(cluster.messages - startMessages) / ROUNDS / NODES
+            * 1000.0 / gossiper::GOSSIP_INTERVAL_MS;
+
+        //a shutdown has to reach everyone through gossip too
+        cluster.shut_down(0);
+
+        int shutdown = 0;
+        auto everyoneKnows = [&cluster] {
+            for (size_t observer = 1; observer < cluster.size(); ++observer)
+            {
+                if (cluster.view_of(observer, 0)->is_alive()) return false;
+            }
+
+            return true;
+        };
+
+        while (! everyoneKnows() && shutdown < ROUNDS)
+        {
+            cluster.round();
+            ++shutdown;
+        }
+
+        ASSERT_LT(shutdown, ROUNDS);
+
+        std::string name = std::to_string(NODES) + " node gossip, fanout " + std::to_string(fanout);
+        printf("[ BENCH    ] %-48s %4d rounds to start %4llu rounds behind at most %4d rounds to spread a shutdown\n",
+               name.c_str(), startup, (unsigned long long)worst, shutdown);
+        printf("[ BENCH    ] %-48s %10.0f bytes/s %6.1f messages/s per node\n",
+               name.c_str(), bytesPerNodeSecond, messagesPerNodeSecond);
+    }
+}
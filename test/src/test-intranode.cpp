@@ -0,0 +1,249 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "gtest/gtest.h"
+
+#include "server.h"
+#include "node.h"
+#include "settings.h"
+#include "endpoint.h"
+#include "util.h"
+#include "messageutil.h"
+#include "remote_node_operations.h"
+#include "bench_util.h"
+
+#include "PublishMessage.pb.h"
+#include "ProxyPublishResponseMessage.pb.h"
+
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
+
+#include <memory>
+#include <functional>
+#include <string>
+
+using namespace sopmq::shared::net;
+using namespace sopmq::test;
+using sopmq::node::settings;
+using sopmq::node::intra::operation_result;
+using sopmq::node::intra::remote_node_operations;
+using sopmq::message::messageutil;
+using sopmq::shared::util;
+
+namespace bc = boost::chrono;
+
+namespace
+{
+    const unsigned short PEER_PORT = 8482;
+    
+    PublishMessage_ptr make_publish(uint32_t id)
+    {
+        auto message = messageutil::make_message<PublishMessage>(id, 0);
+        message->set_allocated_message_id(util::uuid_to_bytes(util::random_uuid()));
+        message->set_queue_id("intranode.queue");
+        message->set_ttl(30);
+        message->set_flags(0);
+        message->set_content(std::string(100, 'c'));
+        
+        return message;
+    }
+    
+    ///
+    /// Creates a node in our ring that is reached over the network on the given port
+    ///
+    sopmq::node::node::ptr make_peer(boost::asio::io_service& ioService, unsigned short port)
+    {
+        auto peer = std::make_shared<sopmq::node::node>(settings::instance().nodeId + 1, uint128(1),
+                                                          endpoint("127.0.0.1", port));
+        peer->init_remote_operations(ioService);
+        
+        return peer;
+    }
+}
+
+///
+/// Runs a node on loopback for another node in this process to talk to
+///
+class IntraNodeTest : public ::testing::Test
+{
+protected:
+    sopmq::node::io_service_pool* serverIoServices;
+    sopmq::node::server* s;
+    
+    virtual void SetUp()
+    {
+        serverIoServices = new sopmq::node::io_service_pool(2);
+        s = new sopmq::node::server(*serverIoServices, PEER_PORT);
+        s->start();
+        
+        serverIoServices->start();
+    }
+    
+    virtual void TearDown()
+    {
+        s->stop();
+        serverIoServices->stop();
+        
+        delete s;
+        delete serverIoServices;
+    }
+};
+
+TEST_F(IntraNodeTest, TestProxyPublish)
+{
+    boost::asio::io_service ioService;
+    auto peer = make_peer(ioService, PEER_PORT);
+    
+    bool answered = false;
+    peer->operations().send_proxy_publish(make_publish(1), [&](operation_result<ProxyPublishResponseMessage_ptr>& result) {
+        answered = true;
+        
+        ASSERT_NO_THROW(result.rethrow_error());
+        ASSERT_EQ(ProxyPublishResponseMessage_Status_QUEUED, result.message()->status());
+        ASSERT_TRUE(result.message()->has_clock());
+        
+        ioService.stop();
+    });
+    
+    ioService.run();
+    
+    ASSERT_TRUE(answered);
+}
+
+TEST_F(IntraNodeTest, TestUnreachableNodeFailsFast)
+{
+    boost::asio::io_service ioService;
+    
+    //nothing listens here
+    auto peer = make_peer(ioService, PEER_PORT + 1);
+    
+    int failed = 0;
+    std::function<void(operation_result<ProxyPublishResponseMessage_ptr>&)> onResult
+        = [&](operation_result<ProxyPublishResponseMessage_ptr>& result) {
+            ASSERT_THROW(result.rethrow_error(), std::runtime_error);
+            
+            //the node is now known to be down, so the next request shouldn't wait
+            //on it at all
+            if (++failed == 1)
+            {
+                peer->operations().send_proxy_publish(make_publish(2), onResult);
+                ASSERT_EQ(2, failed);
+                
+                ioService.stop();
+            }
+        };
+    
+    auto start = bc::steady_clock::now();
+    peer->operations().send_proxy_publish(make_publish(1), onResult);
+    
+    ioService.run();
+    
+    ASSERT_EQ(2, failed);
+    ASSERT_LT(bc::steady_clock::now() - start, bc::seconds(1));
+}
+
+TEST_F(IntraNodeTest, TestInFlightLimit)
+{
+    boost::asio::io_service ioService;
+    auto peer = make_peer(ioService, PEER_PORT);
+    auto& ops = static_cast<remote_node_operations&>(peer->operations());
+    
+    const size_t COUNT = sopmq::node::connection::connection_pool::DEFAULT_MAX_IN_FLIGHT * 4;
+    
+    size_t answered = 0;
+    size_t mostInFlight = 0;
+    for (size_t i = 0; i < COUNT; ++i)
+    {
+        ops.send_proxy_publish(make_publish((uint32_t)i + 1), [&](operation_result<ProxyPublishResponseMessage_ptr>& result) {
+            ASSERT_NO_THROW(result.rethrow_error());
+            
+            mostInFlight = std::max(mostInFlight, ops.pool().in_flight());
+            if (++answered == COUNT) ioService.stop();
+        });
+    }
+    
+    //nothing is connected yet, so everything waits
+    ASSERT_EQ(COUNT, ops.pool().queued());
+    
+    ioService.run();
+    
+    ASSERT_EQ(COUNT, answered);
+    ASSERT_LE(mostInFlight, sopmq::node::connection::connection_pool::DEFAULT_MAX_IN_FLIGHT);
+    ASSERT_EQ(0, ops.pool().queued());
+    ASSERT_EQ(0, ops.pool().in_flight());
+}
+
+TEST_F(IntraNodeTest, BenchmarkProxyPublish)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 100000 : 5000;
+    
+    boost::asio::io_service ioService;
+    auto peer = make_peer(ioService, PEER_PORT);
+    auto& ops = peer->operations();
+    
+    //warm up the connections so the benchmarks don't include the handshake
+    ops.send_proxy_publish(make_publish(1), [&](operation_result<ProxyPublishResponseMessage_ptr>&) { ioService.stop(); });
+    ioService.run();
+    ioService.reset();
+    
+    //latency: one request at a time
+    {
+        size_t answered = 0;
+        std::function<void(operation_result<ProxyPublishResponseMessage_ptr>&)> onResult
+            = [&](operation_result<ProxyPublishResponseMessage_ptr>& result) {
+                ASSERT_NO_THROW(result.rethrow_error());
+                
+                if (++answered == NUM_MESSAGES) ioService.stop();
+                else ops.send_proxy_publish(make_publish((uint32_t)answered + 1), onResult);
+            };
+        
+        bench_timer timer;
+        ops.send_proxy_publish(make_publish(1), onResult);
+        ioService.run();
+        ioService.reset();
+        
+        timer.stop("proxy publish 1 in flight", NUM_MESSAGES);
+        ASSERT_EQ(NUM_MESSAGES, answered);
+    }
+    
+    //throughput: keep the pipeline full
+    {
+        const size_t WINDOW = 1000;
+        
+        size_t sent = 0;
+        size_t answered = 0;
+        std::function<void(operation_result<ProxyPublishResponseMessage_ptr>&)> onResult
+            = [&](operation_result<ProxyPublishResponseMessage_ptr>& result) {
+                ASSERT_NO_THROW(result.rethrow_error());
+                
+                if (++answered == NUM_MESSAGES) ioService.stop();
+                else if (sent < NUM_MESSAGES) ops.send_proxy_publish(make_publish((uint32_t)++sent), onResult);
+            };
+        
+        bench_timer timer;
+        for (; sent < WINDOW && sent < NUM_MESSAGES; )
+        {
+            ops.send_proxy_publish(make_publish((uint32_t)++sent), onResult);
+        }
+        
+        ioService.run();
+        
+        timer.stop("proxy publish 1000 in flight", NUM_MESSAGES);
+        ASSERT_EQ(NUM_MESSAGES, answered);
+    }
+}
@@ -0,0 +1,219 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "io_service_pool.h"
+#include "ring.h"
+#include "node.h"
+#include "queue_manager.h"
+#include "util.h"
+#include "messageutil.h"
+#include "bench_util.h"
+
+#include "PublishMessage.pb.h"
+#include "ProxyPublishResponseMessage.pb.h"
+
+#include <boost/asio.hpp>
+#include <boost/uuid/uuid.hpp>
+
+#include <algorithm>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace sopmq::node;
+using namespace sopmq::shared::net;
+
+using sopmq::message::messageutil;
+using sopmq::shared::util;
+using sopmq::test::bench_timer;
+using sopmq::test::bench_util;
+
+namespace
+{
+    ///
+    /// Counts down callbacks from any thread so the test can wait on them
+    ///
+    class countdown
+    {
+    public:
+        explicit countdown(size_t count)
+        : _count(count)
+        {
+        }
+        
+        void done()
+        {
+            std::lock_guard<std::mutex> lock(_lock);
+            if (--_count == 0) _zero.notify_all();
+        }
+        
+        void wait()
+        {
+            std::unique_lock<std::mutex> lock(_lock);
+            _zero.wait(lock, [this] { return _count == 0; });
+        }
+        
+    private:
+        std::mutex _lock;
+        std::condition_variable _zero;
+        size_t _count;
+    };
+    
+    PublishMessage_ptr make_publish(const std::string& queueName)
+    {
+        auto message = messageutil::make_message<PublishMessage>(0, 0);
+        message->set_queue_id(queueName);
+        message->set_allocated_message_id(util::uuid_to_bytes(util::random_uuid()));
+        message->set_content(std::string(64, 'x'));
+        message->set_ttl(600);
+        
+        return message;
+    }
+}
+
+TEST(IoServicePoolTest, NextHandsOutEveryService)
+{
+    io_service_pool pool(4);
+    
+    std::set<boost::asio::io_service*> seen;
+    for (int i = 0; i < 8; ++i)
+    {
+        seen.insert(&pool.next());
+    }
+    
+    ASSERT_EQ(4, pool.size());
+    ASSERT_EQ(4, seen.size());
+}
+
+TEST(IoServicePoolTest, QueueWorkRunsOnTheOwningThread)
+{
+    io_service_pool pool(4);
+    pool.start();
+    
+    ring r;
+    queue_manager3 queueManager;
+    node::ptr self(new sopmq::node::node(1, 0, endpoint("sopmq1://localhost:1")));
+    r.add_node(self);
+    self->init_local_operations(r, queueManager, &pool);
+    
+    const int QUEUES = 64;
+    const int PER_QUEUE = 20;
+    
+    std::mutex lock;
+    std::map<std::string, std::set<std::thread::id>> threadsByQueue;
+    int queued = 0;
+    countdown remaining(QUEUES * PER_QUEUE);
+    
+    for (int i = 0; i < PER_QUEUE; ++i)
+    {
+        for (int q = 0; q < QUEUES; ++q)
+        {
+            std::string queueName("queue" + std::to_string(q));
+            
+            self->operations().send_proxy_publish(make_publish(queueName),
+                [&, queueName](intra::operation_result<ProxyPublishResponseMessage_ptr>& result) {
+                    {
+                        std::lock_guard<std::mutex> l(lock);
+                        threadsByQueue[queueName].insert(std::this_thread::get_id());
+                        
+                        if (result.message()->status() == ProxyPublishResponseMessage_Status_QUEUED) ++queued;
+                    }
+                    
+                    remaining.done();
+                });
+        }
+    }
+    
+    remaining.wait();
+    
+    std::set<std::thread::id> allThreads;
+    for (auto& entry : threadsByQueue)
+    {
+        ASSERT_EQ(1, entry.second.size()) << entry.first << " ran on more than one thread";
+        allThreads.insert(*entry.second.begin());
+    }
+    
+    ASSERT_EQ(QUEUES, threadsByQueue.size());
+    ASSERT_LT(1, allThreads.size());
+    ASSERT_EQ(QUEUES * PER_QUEUE, queued);
+}
+
+TEST(IoServicePoolTest, BenchmarkPublishScaling)
+{
+    //producers run on the pool the way connections do, each publishing to queues
+    //spread over every thread
+    const int PUBLISHES = bench_util::full_runs() ? 1000000 : 40000;
+    const int QUEUES = 256;
+    
+    std::vector<std::string> queueNames;
+    for (int q = 0; q < QUEUES; ++q)
+    {
+        queueNames.push_back("queue" + std::to_string(q));
+    }
+    
+    size_t cores = std::max(1u, std::thread::hardware_concurrency());
+    
+    for (size_t threads = 1; ; threads = std::min(threads * 2, cores))
+    {
+        io_service_pool pool(threads);
+        pool.start();
+        
+        ring r;
+        queue_manager3 queueManager;
+        node::ptr self(new sopmq::node::node(1, 0, endpoint("sopmq1://localhost:1")));
+        r.add_node(self);
+        self->init_local_operations(r, queueManager, &pool);
+        
+        //built up front so only the publishing is timed
+        std::vector<std::vector<PublishMessage_ptr>> perProducer(threads);
+        for (int i = 0; i < PUBLISHES; ++i)
+        {
+            perProducer[i % threads].push_back(make_publish(queueNames[i % QUEUES]));
+        }
+        
+        countdown remaining(PUBLISHES);
+        auto& operations = self->operations();
+        
+        bench_timer timer;
+        
+        for (auto& messages : perProducer)
+        {
+            auto* producerMessages = &messages;
+            pool.next().post([&operations, &remaining, producerMessages] {
+                for (auto& message : *producerMessages)
+                {
+                    operations.send_proxy_publish(message,
+                        [&remaining](intra::operation_result<ProxyPublishResponseMessage_ptr>& result) {
+                            remaining.done();
+                        });
+                }
+            });
+        }
+        
+        remaining.wait();
+        
+        timer.stop("publishes, " + std::to_string(threads) + " io threads", PUBLISHES);
+        
+        if (threads == cores) break;
+    }
+}
@@ -1,10 +1,13 @@
 #include "gtest/gtest.h"
 
 #include "settings.h"
+#include "cassandra_storage.h"
+#include "bench_util.h"
 
 #include <string>
 
 using sopmq::node::settings;
+using sopmq::node::storage::cassandra_storage;
 
 int main(int argc, char **argv) {
     printf("Running main() from test-main.cpp\n");
@@ -21,12 +24,26 @@ int main(int argc, char **argv) {
             printf("Cassandra seed specified: %s\n", seed.c_str());
             settings::instance().cassandraSeeds.push_back(seed);
         }
+        
+        if (argstr == "bench=full")
+        {
+            //run benchmarks at their full size
+            printf("Running full size benchmarks\n");
+            sopmq::test::bench_util::set_full_runs(true);
+        }
     }
     
     const char* const USERNAME = "unittest";
     settings::instance().unitTestUsername = USERNAME;
     settings::instance().nodeId = 0;
     
+    //like the node, everything that uses storage expects to be connected up front
+    if (! settings::instance().cassandraSeeds.empty())
+    {
+        cassandra_storage::instance().init();
+        cassandra_storage::instance().connect();
+    }
+    
     return RUN_ALL_TESTS();
 }
 
@@ -19,12 +19,111 @@
 
 #include "message_dispatcher.h"
 #include "GetChallengeMessage.pb.h"
+#include "PublishMessage.pb.h"
+#include "PublishResponseMessage.pb.h"
 #include "network_operation_result.h"
+#include "bench_util.h"
+
+#include <boost/asio.hpp>
+#include <boost/chrono.hpp>
 
 #include <memory>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <unordered_map>
 
 using namespace sopmq::message;
 using namespace sopmq::shared::net;
+using namespace sopmq::test;
+
+namespace bc = boost::chrono;
+
+namespace
+{
+    ///
+    /// The dispatcher as it was before replies moved into a flat table. The handler
+    /// map was taken by value so every dispatch copied it
+    ///
+    class legacy_dispatcher
+    {
+    public:
+        std::unordered_map<std::uint32_t, std::function<void(const network_operation_result&, PublishMessage_ptr)>> publishHandlers;
+        std::unordered_map<std::uint32_t, std::function<void(const network_operation_result&, PublishResponseMessage_ptr)>> publishResponseHandlers;
+        
+        void dispatch(const network_operation_result& result, PublishMessage_ptr message)
+        {
+            do_dispatch(publishHandlers, result, message);
+        }
+        
+        void dispatch(const network_operation_result& result, PublishResponseMessage_ptr message)
+        {
+            do_dispatch(publishResponseHandlers, result, message);
+        }
+        
+    private:
+        template <typename hashmap, typename network_result, typename message>
+        void do_dispatch(hashmap h, network_result r, message m)
+        {
+            auto id = m->identity().in_reply_to();
+            auto iter = h.find(id);
+            if (iter != h.end())
+            {
+                iter->second(r, m);
+                if (id != 0)
+                {
+                    h.erase(iter);
+                }
+            }
+        }
+    };
+    
+    template <typename D>
+    void run_dispatch_benchmark(const std::string& name, D& dispatcher,
+                                std::function<void(D&, std::function<void(const network_operation_result&, PublishResponseMessage_ptr)>, uint32_t)> setReply,
+                                size_t numMessages)
+    {
+        size_t handled = 0;
+        
+        auto publish = std::make_shared<PublishMessage>();
+        publish->mutable_identity()->set_id(1);
+        publish->mutable_identity()->set_in_reply_to(0);
+        
+        auto response = std::make_shared<PublishResponseMessage>();
+        
+        std::function<void(const network_operation_result&, PublishResponseMessage_ptr)> onReply
+            = [&](const network_operation_result&, PublishResponseMessage_ptr) { ++handled; };
+        
+        {
+            bench_timer timer;
+            for (size_t i = 0; i < numMessages; ++i)
+            {
+                dispatcher.dispatch(network_operation_result::success(), publish);
+            }
+            
+            timer.stop(name + " persistent", numMessages);
+        }
+        
+        //keep 64 requests outstanding like a busy client would
+        {
+            bench_timer timer;
+            for (uint32_t id = 1; id <= numMessages + 64; ++id)
+            {
+                if (id <= numMessages) setReply(dispatcher, onReply, id);
+                
+                if (id > 64)
+                {
+                    response->mutable_identity()->set_in_reply_to(id - 64);
+                    dispatcher.dispatch(network_operation_result::success(), response);
+                }
+            }
+            
+            timer.stop(name + " request/reply", numMessages);
+        }
+        
+        ASSERT_EQ(numMessages, handled);
+    }
+}
 
 TEST(MessageDispatcherTest, TestUnhandledHandler)
 {
@@ -105,4 +204,318 @@ TEST(MessageDispatcherTest, TestRegisteredHandlerUnhandledReplyTo)
     ASSERT_FALSE(called);
     ASSERT_TRUE(unhandled);
     
-}
\ No newline at end of file
+}
+
+TEST(MessageDispatcherTest, TestReplyHandlersAreOneShot)
+{
+    int unhandled = 0;
+    int called = 0;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { ++unhandled; });
+    
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result&, GetChallengeMessage_ptr msg) { ++called; };
+    md.set_handler(func, 5);
+    
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    gcm->mutable_identity()->set_in_reply_to(5);
+    
+    md.dispatch(network_operation_result::success(), gcm);
+    md.dispatch(network_operation_result::success(), gcm);
+    
+    ASSERT_EQ(1, called);
+    ASSERT_EQ(1, unhandled);
+}
+
+TEST(MessageDispatcherTest, TestReplyOfTheWrongTypeIsUnhandled)
+{
+    int unhandled = 0;
+    int called = 0;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { ++unhandled; });
+    
+    std::function<void(const network_operation_result&, PublishResponseMessage_ptr)> func
+        = [&](const network_operation_result&, PublishResponseMessage_ptr msg) { ++called; };
+    md.set_handler(func, 5);
+    
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    gcm->mutable_identity()->set_in_reply_to(5);
+    md.dispatch(network_operation_result::success(), gcm);
+    
+    ASSERT_EQ(0, called);
+    ASSERT_EQ(1, unhandled);
+    
+    //the handler is still waiting for the right reply
+    PublishResponseMessage_ptr prm = std::make_shared<PublishResponseMessage>();
+    prm->mutable_identity()->set_in_reply_to(5);
+    md.dispatch(network_operation_result::success(), prm);
+    
+    ASSERT_EQ(1, called);
+}
+
+TEST(MessageDispatcherTest, TestCancelAllFailsPendingReplies)
+{
+    int unhandled = 0;
+    int cancelled = 0;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { ++unhandled; });
+    
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) {
+            ASSERT_FALSE(result.was_successful());
+            ASSERT_FALSE(msg);
+            ++cancelled;
+        };
+    
+    md.set_handler(func, 1);
+    md.set_handler(func, 2);
+    
+    md.cancel_all_with_error(network_operation_result(ET_NETWORK, sopmq::error::network_error("gone")));
+    ASSERT_EQ(2, cancelled);
+    
+    //they are gone once they've been told
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    gcm->mutable_identity()->set_in_reply_to(1);
+    md.dispatch(network_operation_result::success(), gcm);
+    
+    ASSERT_EQ(2, cancelled);
+    ASSERT_EQ(1, unhandled);
+}
+
+TEST(MessageDispatcherTest, TestHandlerCanReplaceItself)
+{
+    int first = 0;
+    int second = 0;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { });
+    
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> replacement
+        = [&](const network_operation_result&, GetChallengeMessage_ptr msg) { ++second; };
+    
+    std::string captured("kept alive while running");
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&, captured](const network_operation_result&, GetChallengeMessage_ptr msg) {
+            md.set_handler(replacement);
+            ASSERT_EQ("kept alive while running", captured);
+            ++first;
+        };
+    
+    md.set_handler(func);
+    
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    md.dispatch(network_operation_result::success(), gcm);
+    md.dispatch(network_operation_result::success(), gcm);
+    
+    ASSERT_EQ(1, first);
+    ASSERT_EQ(1, second);
+}
+
+TEST(MessageDispatcherTest, TestManyOutstandingReplies)
+{
+    const uint32_t COUNT = 10000;
+    
+    int unhandled = 0;
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { ++unhandled; });
+    
+    std::vector<int> calls(COUNT + 1, 0);
+    for (uint32_t id = 1; id <= COUNT; ++id)
+    {
+        std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+            = [&calls, id](const network_operation_result&, GetChallengeMessage_ptr msg) { ++calls[id]; };
+        
+        md.set_handler(func, id);
+    }
+    
+    //replies come back in any order
+    std::vector<uint32_t> order;
+    for (uint32_t id = 1; id <= COUNT; ++id) order.push_back(id);
+    std::shuffle(order.begin(), order.end(), std::default_random_engine(3));
+    
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    for (auto id : order)
+    {
+        gcm->mutable_identity()->set_in_reply_to(id);
+        md.dispatch(network_operation_result::success(), gcm);
+    }
+    
+    for (uint32_t id = 1; id <= COUNT; ++id)
+    {
+        ASSERT_EQ(1, calls[id]);
+    }
+    
+    ASSERT_EQ(0, unhandled);
+}
+
+TEST(MessageDispatcherTest, TestReplyHandlersTimeOut)
+{
+    boost::asio::io_service ioService;
+    
+    int unhandled = 0;
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { ++unhandled; });
+    md.set_reply_timeout(ioService, bc::seconds(5));
+    
+    int timedOut = 0;
+    int answered = 0;
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) {
+            if (msg)
+            {
+                ++answered;
+            }
+            else
+            {
+                ASSERT_EQ(ET_TIMEOUT, result.get_error_type());
+                ++timedOut;
+            }
+        };
+    
+    auto start = bc::steady_clock::now();
+    md.set_handler(func, 1);
+    md.set_handler(func, 2);
+    
+    GetChallengeMessage_ptr gcm = std::make_shared<GetChallengeMessage>();
+    gcm->mutable_identity()->set_in_reply_to(2);
+    md.dispatch(network_operation_result::success(), gcm);
+    
+    //never early
+    ASSERT_EQ(0, md.expire_replies(start + bc::milliseconds(4900)));
+    ASSERT_EQ(1, md.pending_replies());
+    
+    ASSERT_EQ(1, md.expire_replies(start + bc::milliseconds(5200)));
+    ASSERT_EQ(0, md.pending_replies());
+    ASSERT_EQ(1, timedOut);
+    ASSERT_EQ(1, answered);
+    
+    //a reply turning up late is a protocol violation like any other
+    gcm->mutable_identity()->set_in_reply_to(1);
+    md.dispatch(network_operation_result::success(), gcm);
+    ASSERT_EQ(1, unhandled);
+}
+
+TEST(MessageDispatcherTest, TestReplacedReplyHandlerKeepsItsOwnTimeout)
+{
+    boost::asio::io_service ioService;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { });
+    
+    int timedOut = 0;
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) { ++timedOut; };
+    
+    auto start = bc::steady_clock::now();
+    md.set_reply_timeout(ioService, bc::seconds(1));
+    md.set_handler(func, 1);
+    
+    md.set_reply_timeout(ioService, bc::seconds(10));
+    md.set_handler(func, 1);
+    
+    ASSERT_EQ(0, md.expire_replies(start + bc::seconds(2)));
+    ASSERT_EQ(1, md.expire_replies(start + bc::seconds(11)));
+    ASSERT_EQ(1, timedOut);
+}
+
+TEST(MessageDispatcherTest, TestReplyTimeoutsRunFromTheTimer)
+{
+    boost::asio::io_service ioService;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { });
+    md.set_reply_timeout(ioService, bc::milliseconds(50));
+    
+    int timedOut = 0;
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) {
+            ASSERT_EQ(ET_TIMEOUT, result.get_error_type());
+            
+            //waiting again from inside a timeout is fine
+            if (++timedOut == 1) md.set_handler(func, 2);
+        };
+    
+    md.set_handler(func, 1);
+    
+    auto start = bc::steady_clock::now();
+    ioService.run();
+    
+    ASSERT_EQ(2, timedOut);
+    ASSERT_EQ(0, md.pending_replies());
+    ASSERT_GE(bc::steady_clock::now() - start, bc::milliseconds(100));
+}
+
+TEST(MessageDispatcherTest, TestPendingWaitOutlivesDispatcher)
+{
+    boost::asio::io_service ioService;
+    
+    {
+        message_dispatcher md([&](Message_ptr msg, const std::string&) { });
+        md.set_reply_timeout(ioService, bc::seconds(5));
+        
+        std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+            = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) { FAIL(); };
+        md.set_handler(func, 1);
+    }
+    
+    //the aborted wait must not touch the dispatcher
+    ioService.run();
+}
+
+TEST(MessageDispatcherTest, TestUnansweredRepliesStayBounded)
+{
+    boost::asio::io_service ioService;
+    
+    message_dispatcher md([&](Message_ptr msg, const std::string&) { });
+    md.set_reply_timeout(ioService, bc::milliseconds(500));
+    
+    std::function<void(const network_operation_result&, GetChallengeMessage_ptr)> func
+        = [&](const network_operation_result& result, GetChallengeMessage_ptr msg) { };
+    
+    //a node that stopped answering while requests keep coming at 1 per ms
+    auto now = bc::steady_clock::now();
+    size_t mostPending = 0;
+    for (uint32_t id = 1; id <= 10000; ++id)
+    {
+        md.set_handler(func, id);
+        
+        now += bc::milliseconds(1);
+        md.expire_replies(now);
+        
+        mostPending = std::max(mostPending, md.pending_replies());
+    }
+    
+    //the timeout plus a tick of slack
+    ASSERT_LE(mostPending, 600);
+}
+
+TEST(MessageDispatcherTest, BenchmarkDispatch)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 1000000 : 100000;
+    
+    std::function<void(const network_operation_result&, PublishMessage_ptr)> onPublish
+        = [](const network_operation_result&, PublishMessage_ptr) { };
+    
+    //the old dispatcher with a handful of requests that were never answered,
+    //which it used to leak
+    legacy_dispatcher legacy;
+    legacy.publishHandlers[0] = onPublish;
+    for (uint32_t id = 1; id <= 16; ++id)
+    {
+        legacy.publishResponseHandlers[1000000000 + id] = [](const network_operation_result&, PublishResponseMessage_ptr) { };
+    }
+    
+    //answered requests are never removed so every dispatch copies a bigger
+    //table, keep this run small
+    const size_t LEGACY_MESSAGES = 2000;
+    
+    run_dispatch_benchmark<legacy_dispatcher>("legacy dispatch", legacy,
+        [](legacy_dispatcher& d, std::function<void(const network_operation_result&, PublishResponseMessage_ptr)> h, uint32_t id) {
+            d.publishResponseHandlers[id] = h;
+        }, LEGACY_MESSAGES);
+    
+    ASSERT_EQ(16 + LEGACY_MESSAGES, legacy.publishResponseHandlers.size());
+    
+    message_dispatcher md([](Message_ptr msg, const std::string&) { });
+    md.set_handler(onPublish);
+    
+    run_dispatch_benchmark<message_dispatcher>("message_dispatcher dispatch", md,
+        [](message_dispatcher& d, std::function<void(const network_operation_result&, PublishResponseMessage_ptr)> h, uint32_t id) {
+            d.set_handler(h, id);
+        }, NUM_MESSAGES);
+}
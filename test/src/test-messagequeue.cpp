@@ -22,22 +22,52 @@
 #include "node_clock.h"
 #include "util.h"
 #include "queue_manager.h"
+#include "queue_subscription.h"
+#include "expiry_scheduler.h"
+#include "bench_util.h"
 
 #include "MurmurHash3/MurmurHash3.h"
 
+#include "DeliveryMessage.pb.h"
+#include "Delivery.pb.h"
+
 #include <boost/uuid/uuid.hpp>
 #include <boost/thread.hpp>
+#include <boost/asio.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/multiprecision/cpp_int.hpp>
+#include <boost/functional/hash.hpp>
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <random>
+#include <thread>
 
 using namespace sopmq::node;
 namespace bmp = boost::multiprecision;
 
 using sopmq::shared::util;
+using sopmq::test::bench_timer;
+using sopmq::test::bench_util;
 
 static const char* const QUEUE_NAME = "abcde";
 static const int QUEUE_LEN = 5;
 
+static vector_clock3 make_clock(uint64_t value)
+{
+    vector_clock3 clock;
+    for (int i = 0; i < 3; ++i)
+    {
+        node_clock nc = {(uint32_t)i + 1, 1, value};
+        clock.set(i, nc);
+    }
+    
+    return clock;
+}
+
 TEST(MessageQueueTest, MessageQueueBasicOrdering)
 {
     message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
@@ -224,3 +254,728 @@ TEST(MessageQueueTest, TestQueueManager)
     ASSERT_EQ("message1", msgs[0]->data());
 }
 
+TEST(MessageQueueTest, OutOfOrderStampsAreSorted)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    
+    std::vector<uint64_t> order;
+    for (uint64_t i = 1; i <= 200; ++i) order.push_back(i);
+    std::shuffle(order.begin(), order.end(), std::default_random_engine(42));
+    
+    std::unordered_map<boost::uuids::uuid, uint64_t, boost::hash<boost::uuids::uuid>> ids;
+    for (auto value : order)
+    {
+        auto id = util::random_uuid();
+        ids[id] = value;
+        
+        std::string content("message");
+        mq.enqueue(id, &content, 5);
+        ASSERT_TRUE(mq.stamp(id, make_clock(value)));
+    }
+    
+    auto messages = mq.peekAll();
+    ASSERT_EQ(200, messages.size());
+    
+    for (size_t i = 0; i < messages.size(); ++i)
+    {
+        ASSERT_EQ(i + 1, ids[messages[i]->id()]);
+    }
+}
+
+TEST(MessageQueueTest, ClaimRemovesMessages)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    
+    std::vector<boost::uuids::uuid> ids;
+    for (uint64_t i = 1; i <= 100; ++i)
+    {
+        auto id = util::random_uuid();
+        ids.push_back(id);
+        
+        std::string content("message");
+        mq.enqueue(id, &content, 5);
+        mq.stamp(id, make_clock(i));
+    }
+    
+    auto fullSize = mq.memory_size();
+    
+    //claim every other message, then the rest backwards
+    for (size_t i = 0; i < ids.size(); i += 2)
+    {
+        ASSERT_TRUE(mq.claim(ids[i]));
+    }
+    
+    ASSERT_FALSE(mq.claim(ids[0]));
+    ASSERT_EQ(50, mq.total_count());
+    ASSERT_EQ(fullSize / 2, mq.memory_size());
+    
+    auto messages = mq.peekAll();
+    ASSERT_EQ(50, messages.size());
+    ASSERT_EQ(ids[1], messages[0]->id());
+    ASSERT_EQ(ids[99], messages[49]->id());
+    
+    for (size_t i = ids.size() - 1; i < ids.size(); i -= 2)
+    {
+        ASSERT_TRUE(mq.claim(ids[i]));
+    }
+    
+    ASSERT_EQ(0, mq.total_count());
+    ASSERT_EQ(0, mq.memory_size());
+    ASSERT_EQ(0, mq.peekAll().size());
+}
+
+TEST(MessageQueueTest, PeekReturnsMessagesAfterClock)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    
+    std::vector<boost::uuids::uuid> ids;
+    for (uint64_t i = 1; i <= 10; ++i)
+    {
+        auto id = util::random_uuid();
+        ids.push_back(id);
+        
+        std::string content("message");
+        mq.enqueue(id, &content, 5);
+        mq.stamp(id, make_clock(i));
+    }
+    
+    auto messages = mq.peek(make_clock(7));
+    ASSERT_EQ(3, messages.size());
+    ASSERT_EQ(ids[7], messages[0]->id());
+    ASSERT_EQ(ids[9], messages[2]->id());
+}
+
+TEST(MessageQueueTest, BoundedPeekWalksTheQueue)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    
+    //two messages share clock 5
+    std::vector<uint64_t> values = { 1, 2, 3, 4, 5, 5, 6, 7 };
+    std::vector<boost::uuids::uuid> ids;
+    for (auto value : values)
+    {
+        auto id = util::random_uuid();
+        ids.push_back(id);
+        
+        std::string content("message");
+        mq.enqueue(id, &content, 5);
+        mq.stamp(id, make_clock(value));
+    }
+    
+    auto messages = mq.peek(nullptr, 3, 1000);
+    ASSERT_EQ(3, messages.size());
+    ASSERT_EQ(ids[0], messages[0]->id());
+    
+    //stopping inside a run of equal clocks would strand the rest of the run
+    vector_clock3 cursor = messages.back()->clock();
+    messages = mq.peek(&cursor, 2, 1000);
+    ASSERT_EQ(3, messages.size());
+    ASSERT_EQ(ids[3], messages[0]->id());
+    ASSERT_EQ(ids[5], messages[2]->id());
+    
+    //the byte limit always lets one message through
+    cursor = messages.back()->clock();
+    messages = mq.peek(&cursor, 10, 1);
+    ASSERT_EQ(1, messages.size());
+    ASSERT_EQ(ids[6], messages[0]->id());
+    
+    cursor = messages.back()->clock();
+    messages = mq.peek(&cursor, 10, 1000);
+    ASSERT_EQ(1, messages.size());
+    ASSERT_EQ(ids[7], messages[0]->id());
+    
+    cursor = messages.back()->clock();
+    ASSERT_EQ(0, mq.peek(&cursor, 10, 1000).size());
+    
+    vector_clock3 back;
+    ASSERT_TRUE(mq.back_clock(back));
+    ASSERT_EQ(make_clock(7), back);
+}
+
+TEST(MessageQueueTest, ClaimsInBatches)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    
+    std::vector<boost::uuids::uuid> ids;
+    for (uint64_t value = 1; value <= 6; ++value)
+    {
+        auto id = util::random_uuid();
+        ids.push_back(id);
+        
+        std::string content("message");
+        mq.enqueue(id, &content, 5);
+        mq.stamp(id, make_clock(value));
+    }
+    
+    //ids that are already gone are skipped
+    std::vector<boost::uuids::uuid> batch = { ids[1], ids[2], util::random_uuid() };
+    ASSERT_EQ(2, mq.claim(batch));
+    ASSERT_EQ(4, mq.total_count());
+    
+    vector_clock3 cursor;
+    ASSERT_FALSE(mq.claim_cursor(cursor));
+    
+    //everything up to and including 4 goes in one pass
+    ASSERT_EQ(2, mq.claim_through(make_clock(4)));
+    ASSERT_EQ(2, mq.total_count());
+    ASSERT_TRUE(mq.claim_cursor(cursor));
+    ASSERT_EQ(make_clock(4), cursor);
+    
+    //an older cursor doesn't move it back
+    ASSERT_EQ(0, mq.claim_through(make_clock(2)));
+    ASSERT_TRUE(mq.claim_cursor(cursor));
+    ASSERT_EQ(make_clock(4), cursor);
+    
+    auto messages = mq.peek(nullptr, 10, 1000);
+    ASSERT_EQ(2, messages.size());
+    ASSERT_EQ(ids[4], messages[0]->id());
+    ASSERT_EQ(ids[5], messages[1]->id());
+}
+
+TEST(MessageQueueTest, BenchmarkClaimThrough)
+{
+    const size_t numMessages = bench_util::full_runs() ? 1000000 : 100000;
+    const size_t batchSize = 64;
+    
+    auto fill = [&](message_queue3& mq, std::vector<boost::uuids::uuid>& ids) {
+        for (size_t i = 0; i < numMessages; ++i)
+        {
+            auto id = util::random_uuid();
+            ids.push_back(id);
+            
+            std::string content("message");
+            mq.enqueue(id, &content, 60);
+            mq.stamp(id, make_clock(i + 1));
+        }
+    };
+    
+    {
+        message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+        std::vector<boost::uuids::uuid> ids;
+        fill(mq, ids);
+        
+        bench_timer timer;
+        for (auto& id : ids) mq.claim(id);
+        timer.stop("claim one at a time", numMessages);
+        
+        ASSERT_EQ(0, mq.total_count());
+    }
+    
+    {
+        message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+        std::vector<boost::uuids::uuid> ids;
+        fill(mq, ids);
+        
+        bench_timer timer;
+        for (size_t i = batchSize; i <= numMessages; i += batchSize)
+        {
+            mq.claim_through(make_clock(i));
+        }
+        mq.claim_through(make_clock(numMessages));
+        timer.stop("claim through every " + std::to_string(batchSize), numMessages);
+        
+        ASSERT_EQ(0, mq.total_count());
+    }
+}
+
+TEST(MessageQueueTest, QueueManagerNotifiesSubscribers)
+{
+    queue_manager3 qm;
+    auto queueId = util::murmur_hash3(QUEUE_NAME, QUEUE_LEN);
+    
+    std::vector<boost::uuids::uuid> seen;
+    size_t listener = qm.subscribe(queueId, [&](const queue_manager3::queued_message_ptr& message) {
+        seen.push_back(message->id());
+    });
+    
+    auto m1id = util::random_uuid();
+    std::string m1content("message1");
+    qm.enqueue_message(queueId, m1id, &m1content, 10);
+    ASSERT_EQ(0, seen.size());
+    
+    qm.stamp_message(queueId, m1id, make_clock(1));
+    ASSERT_EQ(1, seen.size());
+    ASSERT_EQ(m1id, seen[0]);
+    
+    //the subscription survives the queue being emptied and removed
+    qm.expire_due(boost::chrono::steady_clock::now() + boost::chrono::seconds(20));
+    ASSERT_EQ(0, qm.queue_count());
+    
+    auto m2id = util::random_uuid();
+    std::string m2content("message2");
+    qm.enqueue_message(queueId, m2id, &m2content, 10);
+    qm.stamp_message(queueId, m2id, make_clock(2));
+    ASSERT_EQ(2, seen.size());
+    
+    qm.unsubscribe(queueId, listener);
+    
+    auto m3id = util::random_uuid();
+    std::string m3content("message3");
+    qm.enqueue_message(queueId, m3id, &m3content, 10);
+    qm.stamp_message(queueId, m3id, make_clock(3));
+    ASSERT_EQ(2, seen.size());
+    
+    ASSERT_EQ(2, qm.peek(queueId, nullptr, 10, 1000).size());
+    ASSERT_EQ(0, qm.peek(util::murmur_hash3("nope", 4), nullptr, 10, 1000).size());
+    
+    ASSERT_TRUE(qm.claim_message(queueId, m2id));
+    ASSERT_FALSE(qm.claim_message(queueId, m2id));
+    
+    auto messages = qm.peek(queueId, nullptr, 10, 1000);
+    ASSERT_EQ(1, messages.size());
+    ASSERT_EQ(m3id, messages[0]->id());
+}
+
+TEST(MessageQueueTest, SubscriptionRespectsCredit)
+{
+    boost::asio::io_service ioService;
+    queue_manager3 qm;
+    auto queueId = util::murmur_hash3(QUEUE_NAME, QUEUE_LEN);
+    
+    std::vector<std::string> ids;
+    auto publish = [&](uint64_t value) {
+        auto id = util::random_uuid();
+        std::unique_ptr<std::string> idBytes(util::uuid_to_bytes(id));
+        ids.push_back(*idBytes);
+        
+        std::string content("message");
+        qm.enqueue_message(queueId, id, &content, 10);
+        qm.stamp_message(queueId, id, make_clock(value));
+    };
+    
+    //already on the queue when the subscription starts
+    publish(1);
+    publish(2);
+    
+    std::vector<std::string> received;
+    auto subscription = std::make_shared<queue_subscription>(ioService, qm, queueId, 42, false, true,
+        [&](DeliveryMessage_ptr frame) {
+            ASSERT_EQ(42, frame->subscription_id());
+            for (auto& delivery : frame->messages())
+            {
+                received.push_back(delivery.message_id());
+            }
+        });
+    
+    subscription->start(queue_subscription::SP_OLDEST, 3, 1000);
+    ASSERT_EQ(2, received.size());
+    ASSERT_EQ(ids[0], received[0]);
+    
+    //new messages are pushed until the credit runs out
+    publish(3);
+    publish(4);
+    ioService.poll();
+    ASSERT_EQ(3, received.size());
+    ASSERT_EQ(ids[2], received[2]);
+    
+    subscription->add_credit(10, 1000);
+    ASSERT_EQ(4, received.size());
+    ASSERT_EQ(ids[3], received[3]);
+    
+    //a stamp behind the cursor isn't skipped
+    publish(1);
+    ioService.reset();
+    ioService.poll();
+    ASSERT_EQ(5, received.size());
+    ASSERT_EQ(ids[4], received[4]);
+    
+    //the new messages were claimed, the backlog and the late stamp were only peeked
+    ASSERT_EQ(3, qm.peek(queueId, nullptr, 10, 1000).size());
+    
+    subscription.reset();
+    publish(5);
+    ioService.reset();
+    ioService.poll();
+    ASSERT_EQ(5, received.size());
+}
+
+TEST(MessageQueueTest, StoppedSubscriptionSendsNothing)
+{
+    boost::asio::io_service ioService;
+    queue_manager3 qm;
+    auto queueId = util::murmur_hash3(QUEUE_NAME, QUEUE_LEN);
+    
+    auto publish = [&](uint64_t value) {
+        auto id = util::random_uuid();
+        std::string content("message");
+        qm.enqueue_message(queueId, id, &content, 10);
+        qm.stamp_message(queueId, id, make_clock(value));
+    };
+    
+    size_t received = 0;
+    auto subscription = std::make_shared<queue_subscription>(ioService, qm, queueId, 42, false, false,
+        [&](DeliveryMessage_ptr frame) {
+            received += frame->messages_size();
+        });
+    
+    subscription->start(queue_subscription::SP_NEW, 10, 1000);
+    publish(1);
+    ioService.poll();
+    ASSERT_EQ(1, received);
+    
+    //still held by whoever stopped it, but not listening or sending anymore
+    subscription->stop();
+    publish(2);
+    ioService.reset();
+    ioService.poll();
+    
+    subscription->add_credit(10, 1000);
+    subscription->add_stored(std::vector<sopmq::node::storage::stored_message>(1));
+    ASSERT_EQ(1, received);
+}
+
+TEST(MessageQueueTest, SubscriptionSendsStoredMessagesFirst)
+{
+    boost::asio::io_service ioService;
+    queue_manager3 qm;
+    auto queueId = util::murmur_hash3(QUEUE_NAME, QUEUE_LEN);
+    
+    auto id = util::random_uuid();
+    std::string content("queued");
+    qm.enqueue_message(queueId, id, &content, 10);
+    qm.stamp_message(queueId, id, make_clock(1));
+    
+    std::vector<std::string> received;
+    std::vector<bool> hasClock;
+    auto subscription = std::make_shared<queue_subscription>(ioService, qm, queueId, 7, false, false,
+        [&](DeliveryMessage_ptr frame) {
+            for (auto& delivery : frame->messages())
+            {
+                received.push_back(delivery.content());
+                hasClock.push_back(delivery.has_clock());
+            }
+        });
+    
+    //no credit yet, so the stored messages get to the front of the line
+    subscription->start(queue_subscription::SP_OLDEST, 0, 0);
+    ASSERT_EQ(0, received.size());
+    
+    std::vector<sopmq::node::storage::stored_message> stored(2);
+    stored[0].message_id = "stored1";
+    stored[0].content = "stored1";
+    stored[1].message_id = "stored2";
+    stored[1].content = "stored2";
+    subscription->add_stored(std::move(stored));
+    ASSERT_EQ(0, received.size());
+    
+    subscription->add_credit(10, 1000);
+    ASSERT_EQ(3, received.size());
+    ASSERT_EQ("stored1", received[0]);
+    ASSERT_EQ("stored2", received[1]);
+    ASSERT_EQ("queued", received[2]);
+    
+    //only queued messages can be claimed through
+    ASSERT_FALSE(hasClock[0]);
+    ASSERT_TRUE(hasClock[2]);
+}
+
+TEST(MessageQueueTest, NextExpiry)
+{
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    ASSERT_EQ(boost::chrono::steady_clock::time_point::max(), mq.next_expiry());
+    
+    auto before = boost::chrono::steady_clock::now();
+    
+    auto id = util::random_uuid();
+    std::string content("message");
+    mq.enqueue(id, &content, 5);
+    
+    auto expiry = mq.next_expiry();
+    ASSERT_GE(expiry, before + boost::chrono::seconds(5));
+    ASSERT_LE(expiry, boost::chrono::steady_clock::now() + boost::chrono::seconds(5));
+    
+    mq.stamp(id, make_clock(1));
+    ASSERT_GE(mq.next_expiry(), expiry);
+}
+
+namespace
+{
+    ///
+    /// The std::multimap layout message_queue used to store stamped messages in,
+    /// kept here as a baseline for the benchmark below
+    ///
+    class multimap_queue
+    {
+    public:
+        void enqueue(boost::uuids::uuid id, std::string* data)
+        {
+            _unstamped.insert(std::make_pair(id, queued_message<3>(id, data)));
+        }
+        
+        void stamp(boost::uuids::uuid id, const vector_clock3& clock)
+        {
+            auto iter = _unstamped.find(id);
+            auto message = std::make_shared<queued_message<3>>(std::move(iter->second));
+            message->update_local_timestamp();
+            
+            auto pos = _queued.insert(std::make_pair(clock, message));
+            _index.insert(std::make_pair(id, pos));
+            _unstamped.erase(iter);
+        }
+        
+        void claim(boost::uuids::uuid id)
+        {
+            auto iter = _index.find(id);
+            _queued.erase(iter->second);
+            _index.erase(iter);
+        }
+        
+    private:
+        typedef boost::hash<boost::uuids::uuid> hash_t;
+        typedef std::multimap<vector_clock3, queued_message<3>::ptr> queue_t;
+        
+        std::unordered_map<boost::uuids::uuid, queued_message<3>, hash_t> _unstamped;
+        queue_t _queued;
+        std::unordered_map<boost::uuids::uuid, queue_t::iterator, hash_t> _index;
+    };
+    
+    ///
+    /// Stamps and claims the given messages with every 50th stamp arriving
+    /// out of order
+    ///
+    template <typename Queue>
+    void run_queue_benchmark(const std::string& name, Queue& queue,
+                             const std::vector<boost::uuids::uuid>& ids,
+                             const std::vector<vector_clock3>& clocks)
+    {
+        std::vector<std::string> contents(ids.size(), std::string(64, 'x'));
+        
+        bench_timer timer;
+        
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            queue.enqueue(ids[i], &contents[i], 60);
+            queue.stamp(ids[i], clocks[i]);
+        }
+        
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            queue.claim(ids[i]);
+        }
+        
+        timer.stop(name, ids.size());
+    }
+}
+
+TEST(MessageQueueTest, BenchmarkAgainstMultimap)
+{
+    const size_t NUM_MESSAGES = 100000;
+    
+    std::vector<boost::uuids::uuid> ids;
+    std::vector<vector_clock3> clocks;
+    for (size_t i = 0; i < NUM_MESSAGES; ++i)
+    {
+        ids.push_back(util::random_uuid());
+        clocks.push_back(make_clock(i % 50 == 49 ? i - 25 : i));
+    }
+    
+    struct legacy_adapter
+    {
+        multimap_queue q;
+        void enqueue(boost::uuids::uuid id, std::string* data, uint32_t) { q.enqueue(id, data); }
+        void stamp(boost::uuids::uuid id, const vector_clock3& clock) { q.stamp(id, clock); }
+        void claim(boost::uuids::uuid id) { q.claim(id); }
+    } legacy;
+    
+    run_queue_benchmark("multimap enqueue/stamp/claim", legacy, ids, clocks);
+    
+    message_queue3 mq( util::murmur_hash3(QUEUE_NAME, QUEUE_LEN) );
+    run_queue_benchmark("message_queue enqueue/stamp/claim", mq, ids, clocks);
+    
+    ASSERT_EQ(0, mq.total_count());
+}
+
+TEST(MessageQueueTest, QueueManagerShards)
+{
+    queue_manager3 qm(10);
+    ASSERT_EQ(16, qm.shard_count());
+    
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto queueId = util::murmur_hash3(std::to_string(i));
+        auto messageId = util::random_uuid();
+        std::string content("message");
+        
+        qm.enqueue_message(queueId, messageId, &content, 5);
+        qm.stamp_message(queueId, messageId, make_clock(1));
+    }
+    
+    ASSERT_EQ(1000, qm.queue_count());
+    ASSERT_EQ(1, qm.get_queue(util::murmur_hash3(std::string("500"))).total_count());
+}
+
+TEST(MessageQueueTest, QueueManagerExpiresDueQueues)
+{
+    queue_manager3 qm;
+    ASSERT_EQ(queue_manager3::time_point::max(), qm.next_deadline());
+    
+    for (int i = 0; i < 3; ++i)
+    {
+        std::string content("message");
+        qm.enqueue_message(util::murmur_hash3(std::to_string(i)), util::random_uuid(), &content, 0);
+    }
+    
+    std::string content("message");
+    auto liveQueue = util::murmur_hash3(std::string("live"));
+    qm.enqueue_message(liveQueue, util::random_uuid(), &content, 60);
+    
+    ASSERT_EQ(4, qm.queue_count());
+    
+    ASSERT_EQ(4, qm.scheduled_count());
+    
+    //expiry runs at the resolution of the wheel
+    auto now = boost::chrono::steady_clock::now() + boost::chrono::milliseconds(200);
+    ASSERT_LE(qm.next_deadline(), now);
+    
+    auto next = qm.expire_due(now);
+    ASSERT_EQ(1, qm.queue_count());
+    ASSERT_EQ(1, qm.scheduled_count());
+    ASSERT_EQ(1, qm.get_queue(liveQueue).total_count());
+    ASSERT_GT(next, now);
+    ASSERT_LT(next, queue_manager3::time_point::max());
+}
+
+TEST(MessageQueueTest, QueueManagerHonorsPerMessageTtl)
+{
+    queue_manager3 qm;
+    auto queueId = util::murmur_hash3(QUEUE_NAME, QUEUE_LEN);
+    
+    //a short lived message enqueued after a long lived one on the same queue
+    auto longId = util::random_uuid();
+    std::string longContent("long");
+    qm.enqueue_message(queueId, longId, &longContent, 30 * 24 * 60 * 60);
+    qm.stamp_message(queueId, longId, make_clock(1));
+    
+    auto shortId = util::random_uuid();
+    std::string shortContent("short");
+    qm.enqueue_message(queueId, shortId, &shortContent, 1);
+    qm.stamp_message(queueId, shortId, make_clock(2));
+    
+    auto claimedId = util::random_uuid();
+    std::string claimedContent("claimed");
+    qm.enqueue_message(queueId, claimedId, &claimedContent, 1);
+    qm.stamp_message(queueId, claimedId, make_clock(3));
+    
+    ASSERT_EQ(3, qm.scheduled_count());
+    ASSERT_TRUE(qm.get_queue(queueId).claim(claimedId));
+    ASSERT_EQ(2, qm.scheduled_count());
+    
+    auto now = boost::chrono::steady_clock::now();
+    qm.expire_due(now + boost::chrono::milliseconds(500));
+    ASSERT_EQ(2, qm.get_queue(queueId).total_count());
+    
+    qm.expire_due(now + boost::chrono::milliseconds(1200));
+    
+    auto messages = qm.get_queue(queueId).peekAll();
+    ASSERT_EQ(1, messages.size());
+    ASSERT_EQ(longId, messages[0]->id());
+    ASSERT_EQ(1, qm.scheduled_count());
+    
+    qm.expire_due(now + boost::chrono::hours(24 * 30 + 1));
+    ASSERT_EQ(0, qm.queue_count());
+    ASSERT_EQ(0, qm.scheduled_count());
+}
+
+TEST(MessageQueueTest, ExpirySchedulerRemovesExpiredQueues)
+{
+    boost::asio::io_service ioService;
+    queue_manager3 qm;
+    expiry_scheduler3 scheduler(ioService, qm);
+    
+    std::string content("message");
+    qm.enqueue_message(util::murmur_hash3(std::string("live")), util::random_uuid(), &content, 60);
+    
+    scheduler.start();
+    
+    boost::asio::io_service::work work(ioService);
+    boost::thread runner([&]() { ioService.run(); });
+    
+    //queues that pick up an earlier deadline after the timer is armed
+    for (int i = 0; i < 10; ++i)
+    {
+        std::string content("message");
+        qm.enqueue_message(util::murmur_hash3(std::to_string(i)), util::random_uuid(), &content, 0);
+    }
+    
+    for (int i = 0; i < 50 && qm.queue_count() > 1; ++i)
+    {
+        boost::this_thread::sleep(boost::posix_time::milliseconds(20));
+    }
+    
+    ASSERT_EQ(1, qm.queue_count());
+    
+    scheduler.stop();
+    ioService.stop();
+    runner.join();
+}
+
+namespace
+{
+    ///
+    /// Runs enqueue and stamp operations from the given number of threads spread
+    /// evenly over the given number of queues
+    ///
+    void run_queue_manager_benchmark(size_t shards, size_t numThreads, size_t numQueues, size_t totalOps)
+    {
+        queue_manager3 qm(shards);
+        
+        std::vector<uint128> queueIds;
+        for (size_t i = 0; i < numQueues; ++i)
+        {
+            queueIds.push_back(util::murmur_hash3(std::to_string(i)));
+            qm.get_queue(queueIds.back());
+        }
+        
+        size_t opsPerThread = totalOps / numThreads;
+        std::vector<std::vector<boost::uuids::uuid>> messageIds(numThreads);
+        for (auto& ids : messageIds)
+        {
+            for (size_t i = 0; i < opsPerThread; ++i) ids.push_back(util::random_uuid());
+        }
+        
+        vector_clock3 clock = make_clock(1);
+        
+        bench_timer timer;
+        
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < numThreads; ++t)
+        {
+            threads.emplace_back([&, t]() {
+                for (size_t i = 0; i < opsPerThread; ++i)
+                {
+                    const uint128& queueId = queueIds[(t * opsPerThread + i) % numQueues];
+                    std::string content("message");
+                    
+                    qm.enqueue_message(queueId, messageIds[t][i], &content, 60);
+                    qm.stamp_message(queueId, messageIds[t][i], clock);
+                }
+            });
+        }
+        
+        for (auto& thread : threads) thread.join();
+        
+        timer.stop("queue_manager shards=" + std::to_string(shards) + " threads=" + std::to_string(numThreads)
+                   + " queues=" + std::to_string(numQueues), opsPerThread * numThreads);
+    }
+}
+
+TEST(MessageQueueTest, BenchmarkQueueManagerContention)
+{
+    const bool full = bench_util::full_runs();
+    
+    std::vector<size_t> threadCounts = full ? std::vector<size_t>{1, 2, 4, 8, 16, 32, 64}
+                                            : std::vector<size_t>{1, 4, 16, 64};
+    std::vector<size_t> queueCounts = full ? std::vector<size_t>{1, 100, 1000000}
+                                           : std::vector<size_t>{1, 100, 10000};
+    const size_t totalOps = full ? 1024000 : 64000;
+    
+    for (auto numQueues : queueCounts)
+    {
+        for (auto numThreads : threadCounts)
+        {
+            //a single shard behaves like the old global list lock
+            run_queue_manager_benchmark(1, numThreads, numQueues, totalOps);
+            run_queue_manager_benchmark(queue_manager3::DEFAULT_SHARD_COUNT, numThreads, numQueues, totalOps);
+        }
+    }
+}
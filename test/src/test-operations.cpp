@@ -23,24 +23,34 @@
 #include "settings.h"
 #include "user_account.h"
 #include "session.h"
+#include "util.h"
+#include "bench_util.h"
 
 #include <boost/asio.hpp>
 #include <boost/thread.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/uuid/uuid_io.hpp>
 
 #include <memory>
 #include <functional>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
 
 using namespace sopmq::client;
 using namespace sopmq::shared::net;
 using sopmq::node::settings;
 using sopmq::node::user_account;
+using sopmq::test::bench_util;
+using sopmq::test::bench_timer;
 
 class OperationsTest : public ::testing::Test
 {
 protected:
     boost::thread* thread;
-    boost::asio::io_service* ioService;
+    sopmq::node::io_service_pool* ioServices;
     sopmq::node::server* s;
     
     virtual void SetUp()
@@ -53,12 +63,13 @@ protected:
     
     void do_run()
     {
-        ioService = new boost::asio::io_service();
-        s = new sopmq::node::server(*ioService, 8481);
+        ioServices = new sopmq::node::io_service_pool(2);
+        s = new sopmq::node::server(*ioServices, 8481);
         
         s->start();
         
-        ioService->run();
+        ioServices->start();
+        ioServices->join();
     }
     
     virtual void TearDown()
@@ -202,6 +213,7 @@ TEST_F(OperationsTest, TestEnqueueMessage)
     {
         clientIoService.stop();
         authRan = true;
+        ASSERT_EQ(sopmq::shared::message::PMR_MESSAGE_QUEUED, pmr);
     };
     
     auto authCb = [&](bool authd)
@@ -227,3 +239,379 @@ TEST_F(OperationsTest, TestEnqueueMessage)
     
     ASSERT_TRUE(authRan);
 }
+
+TEST_F(OperationsTest, TestPublishBatch)
+{
+    boost::asio::io_service clientIoService;
+    cluster_builder builder;
+    builder.add_endpoint(endpoint("sopmq1://127.0.0.1:8481"));
+    
+    auto clstr = builder.build();
+    
+    bool publishRan = false;
+    
+    std::vector<publish_entry> entries;
+    for (int i = 0; i < 3; ++i)
+    {
+        publish_entry entry;
+        entry.queue_id = "batch" + std::to_string(i);
+        entry.store_if_cant_pipe = false;
+        entry.ttl = 10;
+        entry.data = "Data";
+        
+        entries.push_back(entry);
+    }
+    
+    sopmq::client::session::ptr mSession;
+    auto publishCb = [&](const std::vector<sopmq::shared::message::PublishMessageResponse>& statuses)
+    {
+        clientIoService.stop();
+        publishRan = true;
+        
+        ASSERT_EQ(entries.size(), statuses.size());
+        for (auto status : statuses)
+        {
+            ASSERT_EQ(sopmq::shared::message::PMR_MESSAGE_QUEUED, status);
+        }
+    };
+    
+    auto authCb = [&](bool authd)
+    {
+        ASSERT_TRUE(authd);
+        
+        mSession->publish_batch(entries, publishCb);
+    };
+    
+    auto connHandler = [&](sopmq::client::session::ptr session, const sopmq::error::connection_error& e)
+    {
+        ASSERT_TRUE(session != nullptr) << e.what();
+        
+        //make sure session stays in scope for the tests
+        mSession = session;
+        session->authenticate(settings::instance().unitTestUsername, "", authCb);
+    };
+    
+    clstr->connect(clientIoService, connHandler);
+    
+    boost::asio::io_service::work work(clientIoService);
+    clientIoService.run();
+    
+    ASSERT_TRUE(publishRan);
+}
+
+TEST_F(OperationsTest, BenchmarkPublishBatch)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 65536 : 4096;
+    const size_t WINDOW = 4096;
+    
+    boost::asio::io_service clientIoService;
+    cluster_builder builder;
+    builder.add_endpoint(endpoint("sopmq1://127.0.0.1:8481"));
+    
+    auto clstr = builder.build();
+    
+    sopmq::client::session::ptr mSession;
+    auto connHandler = [&](sopmq::client::session::ptr session, const sopmq::error::connection_error& e)
+    {
+        ASSERT_TRUE(session != nullptr) << e.what();
+        
+        mSession = session;
+        session->authenticate(settings::instance().unitTestUsername, "", [&](bool authd) {
+            ASSERT_TRUE(authd);
+            clientIoService.stop();
+        });
+    };
+    
+    clstr->connect(clientIoService, connHandler);
+    clientIoService.run();
+    clientIoService.reset();
+    
+    ASSERT_TRUE(mSession != nullptr);
+    
+    boost::asio::io_service::work work(clientIoService);
+    
+    for (size_t batchSize : { 1, 16, 256 })
+    {
+        //the same notice posted to a different member's queue each time
+        std::vector<publish_entry> batch(batchSize);
+        for (size_t i = 0; i < batchSize; ++i)
+        {
+            batch[i].queue_id = boost::lexical_cast<std::string>(sopmq::shared::util::random_uuid()) + "/GroupNotice";
+            batch[i].store_if_cant_pipe = false;
+            batch[i].ttl = 10;
+            batch[i].data = std::string(256, 'n');
+        }
+        
+        size_t sent = 0;
+        size_t answered = 0;
+        size_t queued = 0;
+        
+        publish_batch_callback onResult = [&](const std::vector<sopmq::shared::message::PublishMessageResponse>& statuses) {
+            answered += statuses.size();
+            queued += std::count(statuses.begin(), statuses.end(), sopmq::shared::message::PMR_MESSAGE_QUEUED);
+            
+            if (answered >= NUM_MESSAGES) clientIoService.stop();
+            else if (sent < NUM_MESSAGES)
+            {
+                sent += batchSize;
+                mSession->publish_batch(batch, onResult);
+            }
+        };
+        
+        bench_timer timer;
+        while (sent < WINDOW && sent < NUM_MESSAGES)
+        {
+            sent += batchSize;
+            mSession->publish_batch(batch, onResult);
+        }
+        
+        clientIoService.run();
+        clientIoService.reset();
+        
+        timer.stop("publish batch of " + std::to_string(batchSize), answered);
+        ASSERT_EQ(answered, queued);
+    }
+}
+
+TEST_F(OperationsTest, TestConsume)
+{
+    boost::asio::io_service clientIoService;
+    cluster_builder builder;
+    builder.add_endpoint(endpoint("sopmq1://127.0.0.1:8481"));
+    
+    auto clstr = builder.build();
+    
+    std::vector<std::string> received;
+    
+    sopmq::client::session::ptr mSession;
+    auto messageCb = [&](const sopmq::client::delivered_message& message)
+    {
+        received.push_back(message.data);
+        if (received.size() == 3) clientIoService.stop();
+    };
+    
+    auto publishCb = [&](sopmq::shared::message::PublishMessageResponse pmr)
+    {
+        ASSERT_EQ(sopmq::shared::message::PMR_MESSAGE_QUEUED, pmr);
+    };
+    
+    auto consumeCb = [&](sopmq::shared::message::ConsumeResponse status)
+    {
+        ASSERT_EQ(sopmq::shared::message::CR_OK, status);
+        
+        //a window of one still gets everything through
+        mSession->publish_message("consumed", false, 10, "Data2", publishCb);
+        mSession->publish_message("consumed", false, 10, "Data3", publishCb);
+    };
+    
+    auto authCb = [&](bool authd)
+    {
+        ASSERT_TRUE(authd);
+        
+        //one message is waiting before we start consuming
+        mSession->publish_message("consumed", false, 10, "Data1", [&](sopmq::shared::message::PublishMessageResponse pmr) {
+            ASSERT_EQ(sopmq::shared::message::PMR_MESSAGE_QUEUED, pmr);
+            mSession->consume("consumed", true, 1, 1024, messageCb, consumeCb);
+        });
+    };
+    
+    auto connHandler = [&](sopmq::client::session::ptr session, const sopmq::error::connection_error& e)
+    {
+        ASSERT_TRUE(session != nullptr) << e.what();
+        
+        //make sure session stays in scope for the tests
+        mSession = session;
+        session->authenticate(settings::instance().unitTestUsername, "", authCb);
+    };
+    
+    clstr->connect(clientIoService, connHandler);
+    
+    boost::asio::io_service::work work(clientIoService);
+    clientIoService.run();
+    
+    ASSERT_EQ(3, received.size());
+    ASSERT_EQ("Data1", received[0]);
+    ASSERT_EQ("Data2", received[1]);
+    ASSERT_EQ("Data3", received[2]);
+}
+
+TEST_F(OperationsTest, TestClaimThrough)
+{
+    boost::asio::io_service clientIoService;
+    cluster_builder builder;
+    builder.add_endpoint(endpoint("sopmq1://127.0.0.1:8481"));
+    
+    auto clstr = builder.build();
+    
+    std::vector<std::string> peeked;
+    std::vector<std::string> afterClaim;
+    
+    sopmq::client::session::ptr mSession;
+    
+    auto publishCb = [&](sopmq::shared::message::PublishMessageResponse pmr)
+    {
+        ASSERT_EQ(sopmq::shared::message::PMR_MESSAGE_QUEUED, pmr);
+    };
+    
+    auto secondCb = [&](const sopmq::client::delivered_message& message)
+    {
+        afterClaim.push_back(message.data);
+        clientIoService.stop();
+    };
+    
+    auto claimCb = [&](sopmq::shared::message::ClaimResponse status)
+    {
+        ASSERT_EQ(sopmq::shared::message::CLR_OK, status);
+        
+        //a new consumer starts past everything that was claimed
+        mSession->consume("claimed", false, 16, 1024, secondCb, [&](sopmq::shared::message::ConsumeResponse status) {
+            ASSERT_EQ(sopmq::shared::message::CR_OK, status);
+            mSession->publish_message("claimed", false, 10, "Data4", publishCb);
+        });
+    };
+    
+    auto firstCb = [&](const sopmq::client::delivered_message& message)
+    {
+        peeked.push_back(message.data);
+        
+        //one request takes out all three
+        if (peeked.size() == 3) mSession->claim_through("claimed", message.cursor, claimCb);
+    };
+    
+    auto authCb = [&](bool authd)
+    {
+        ASSERT_TRUE(authd);
+        
+        mSession->publish_message("claimed", false, 10, "Data1", publishCb);
+        mSession->publish_message("claimed", false, 10, "Data2", publishCb);
+        mSession->publish_message("claimed", false, 10, "Data3", publishCb);
+        
+        mSession->consume("claimed", false, 16, 1024, firstCb, [&](sopmq::shared::message::ConsumeResponse status) {
+            ASSERT_EQ(sopmq::shared::message::CR_OK, status);
+        });
+    };
+    
+    auto connHandler = [&](sopmq::client::session::ptr session, const sopmq::error::connection_error& e)
+    {
+        ASSERT_TRUE(session != nullptr) << e.what();
+        
+        //make sure session stays in scope for the tests
+        mSession = session;
+        session->authenticate(settings::instance().unitTestUsername, "", authCb);
+    };
+    
+    clstr->connect(clientIoService, connHandler);
+    
+    boost::asio::io_service::work work(clientIoService);
+    clientIoService.run();
+    
+    ASSERT_EQ(3, peeked.size());
+    ASSERT_EQ(1, afterClaim.size());
+    ASSERT_EQ("Data4", afterClaim[0]);
+}
+
+TEST_F(OperationsTest, BenchmarkConsume)
+{
+    const size_t NUM_MESSAGES = bench_util::full_runs() ? 65536 : 4096;
+    const size_t PUBLISH_WINDOW = 1024;
+    const size_t BATCH_SIZE = 16;
+    const size_t MESSAGE_SIZE = 256;
+    
+    boost::asio::io_service clientIoService;
+    cluster_builder builder;
+    builder.add_endpoint(endpoint("sopmq1://127.0.0.1:8481"));
+    
+    auto clstr = builder.build();
+    
+    //one session publishes, the other consumes
+    sopmq::client::session::ptr producer;
+    sopmq::client::session::ptr consumer;
+    int authenticated = 0;
+    
+    auto connHandler = [&](sopmq::client::session::ptr session, const sopmq::error::connection_error& e)
+    {
+        ASSERT_TRUE(session != nullptr) << e.what();
+        
+        if (! producer) producer = session;
+        else consumer = session;
+        
+        session->authenticate(settings::instance().unitTestUsername, "", [&](bool authd) {
+            ASSERT_TRUE(authd);
+            if (++authenticated == 2) clientIoService.stop();
+        });
+    };
+    
+    clstr->connect(clientIoService, connHandler);
+    clstr->connect(clientIoService, connHandler);
+    clientIoService.run();
+    clientIoService.reset();
+    
+    ASSERT_TRUE(producer != nullptr);
+    ASSERT_TRUE(consumer != nullptr);
+    
+    boost::asio::io_service::work work(clientIoService);
+    
+    typedef boost::chrono::steady_clock clock;
+    std::string queueId = boost::lexical_cast<std::string>(sopmq::shared::util::random_uuid()) + "/Bench";
+    
+    //each message carries the time it was published
+    auto makeBatch = [&]() {
+        std::vector<publish_entry> batch(BATCH_SIZE);
+        std::int64_t now = clock::now().time_since_epoch().count();
+        
+        for (auto& entry : batch)
+        {
+            entry.queue_id = queueId;
+            entry.store_if_cant_pipe = false;
+            entry.ttl = 60;
+            entry.data = std::string(MESSAGE_SIZE, 'c');
+            std::copy((const char*)&now, (const char*)&now + sizeof(now), entry.data.begin());
+        }
+        
+        return batch;
+    };
+    
+    size_t sent = 0;
+    size_t received = 0;
+    std::vector<std::int64_t> latencies;
+    latencies.reserve(NUM_MESSAGES);
+    
+    publish_batch_callback onPublished = [&](const std::vector<sopmq::shared::message::PublishMessageResponse>& statuses) {
+        if (sent < NUM_MESSAGES)
+        {
+            sent += BATCH_SIZE;
+            producer->publish_batch(makeBatch(), onPublished);
+        }
+    };
+    
+    auto onMessage = [&](const sopmq::client::delivered_message& message) {
+        std::int64_t published;
+        std::copy(message.data.begin(), message.data.begin() + sizeof(published), (char*)&published);
+        latencies.push_back(clock::now().time_since_epoch().count() - published);
+        
+        if (++received == NUM_MESSAGES) clientIoService.stop();
+    };
+    
+    bench_timer timer;
+    
+    consumer->consume(queueId, true, 256, 256 * MESSAGE_SIZE, onMessage, [&](sopmq::shared::message::ConsumeResponse status) {
+        ASSERT_EQ(sopmq::shared::message::CR_OK, status);
+        
+        while (sent < PUBLISH_WINDOW && sent < NUM_MESSAGES)
+        {
+            sent += BATCH_SIZE;
+            producer->publish_batch(makeBatch(), onPublished);
+        }
+    });
+    
+    clientIoService.run();
+    clientIoService.reset();
+    
+    timer.stop("one producer to one consumer", received);
+    ASSERT_EQ(NUM_MESSAGES, received);
+    
+    std::sort(latencies.begin(), latencies.end());
+    printf("[ BENCH    ] %-48s %10.1f us p50 %10.1f us p99\n", "publish to delivery latency",
+           boost::chrono::duration_cast<boost::chrono::nanoseconds>(clock::duration(latencies[latencies.size() / 2])).count() / 1000.0,
+           boost::chrono::duration_cast<boost::chrono::nanoseconds>(clock::duration(latencies[latencies.size() * 99 / 100])).count() / 1000.0);
+}
@@ -0,0 +1,343 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "quorum_logic.h"
+#include "hedge_policy.h"
+#include "node.h"
+#include "endpoint.h"
+#include "bench_util.h"
+
+#include <boost/asio.hpp>
+#include <boost/asio/steady_timer.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace sopmq::node;
+using namespace sopmq::shared::net;
+
+using sopmq::test::bench_util;
+
+namespace
+{
+    struct no_context
+    {
+    };
+    
+    typedef quorum_logic<3, no_context> quorum3;
+    
+    std::array<node::ptr, 3> three_nodes()
+    {
+        std::array<node::ptr, 3> nodes;
+        for (uint32_t i = 0; i < nodes.size(); ++i)
+        {
+            nodes[i].reset(new sopmq::node::node(i + 1, (i + 1) * 10, endpoint("sopmq1://localhost:" + std::to_string(i + 1))));
+        }
+        
+        return nodes;
+    }
+}
+
+TEST(QuorumLogicTest, SendsToAQuorumFirst)
+{
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    
+    std::vector<node::ptr> sent;
+    logic->set_function([&](node::ptr n) { sent.push_back(n); });
+    logic->set_fail_function([] { FAIL(); });
+    logic->run();
+    
+    ASSERT_EQ(2u, sent.size());
+    ASSERT_FALSE(logic->node_success(nodes[0]));
+    ASSERT_TRUE(logic->node_success(nodes[1]));
+    ASSERT_TRUE(logic->completed());
+}
+
+TEST(QuorumLogicTest, FailedNodeIsReplaced)
+{
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    
+    std::vector<node::ptr> sent;
+    int failures = 0;
+    logic->set_function([&](node::ptr n) { sent.push_back(n); });
+    logic->set_fail_function([&] { ++failures; });
+    logic->run();
+    
+    logic->node_failed(nodes[0]);
+    ASSERT_EQ(3u, sent.size());
+    ASSERT_EQ(nodes[2], sent[2]);
+    ASSERT_EQ(0, failures);
+    
+    logic->node_failed(nodes[1]);
+    ASSERT_EQ(1, failures);
+}
+
+TEST(QuorumLogicTest, DuplicateNodesMakeASmallerQuorum)
+{
+    auto nodes = three_nodes();
+    std::array<node::ptr, 3> single = {{ nodes[0], nullptr, nullptr }};
+    auto logic = std::make_shared<quorum3>(single);
+    
+    std::vector<node::ptr> sent;
+    logic->set_function([&](node::ptr n) { sent.push_back(n); });
+    logic->run();
+    
+    ASSERT_EQ(1u, sent.size());
+    ASSERT_TRUE(logic->node_success(nodes[0]));
+}
+
+TEST(QuorumLogicTest, SlowQuorumIsHedged)
+{
+    boost::asio::io_service ioService;
+    
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    
+    std::vector<node::ptr> sent;
+    int failures = 0;
+    logic->set_function([&](node::ptr n) { sent.push_back(n); });
+    logic->set_fail_function([&] { ++failures; });
+    logic->set_hedge(ioService, std::chrono::milliseconds(1));
+    logic->run();
+    
+    ASSERT_EQ(2u, sent.size());
+    
+    ioService.run();
+    ASSERT_EQ(3u, sent.size());
+    ASSERT_EQ(1u, logic->hedged());
+    
+    //the hedge and one of the first two make the quorum, the slow one is late
+    ASSERT_FALSE(logic->node_success(nodes[0]));
+    ASSERT_TRUE(logic->node_success(nodes[2]));
+    ASSERT_FALSE(logic->node_success(nodes[1]));
+    
+    logic->node_failed(nodes[1]);
+    ASSERT_EQ(0, failures);
+    ASSERT_EQ(2u, logic->successful_nodes().size());
+}
+
+TEST(QuorumLogicTest, HedgedQuorumFailsOnceItCantBeReached)
+{
+    boost::asio::io_service ioService;
+    
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    
+    int failures = 0;
+    logic->set_function([](node::ptr n) {});
+    logic->set_fail_function([&] { ++failures; });
+    logic->set_hedge(ioService, std::chrono::milliseconds(1));
+    logic->run();
+    ioService.run();
+    
+    //two still answering could make the quorum
+    logic->node_failed(nodes[0]);
+    ASSERT_EQ(0, failures);
+    
+    logic->node_failed(nodes[2]);
+    ASSERT_EQ(1, failures);
+}
+
+TEST(QuorumLogicTest, QuorumInTimeIsNotHedged)
+{
+    boost::asio::io_service ioService;
+    
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    
+    std::vector<node::ptr> sent;
+    logic->set_function([&](node::ptr n) { sent.push_back(n); });
+    logic->set_hedge(ioService, std::chrono::milliseconds(1));
+    logic->run();
+    
+    logic->node_success(nodes[0]);
+    logic->node_success(nodes[1]);
+    ioService.run();
+    
+    ASSERT_EQ(2u, sent.size());
+    ASSERT_EQ(0u, logic->hedged());
+}
+
+TEST(QuorumLogicTest, FunctionsAreLetGoOnceComplete)
+{
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    std::weak_ptr<quorum3> wlogic(logic);
+    
+    //like the publish path, the functions hold on to the logic running them
+    logic->set_function([logic](node::ptr n) {});
+    logic->set_fail_function([logic] {});
+    logic->run();
+    
+    logic->node_success(nodes[0]);
+    ASSERT_TRUE(logic->node_success(nodes[1]));
+    
+    logic.reset();
+    ASSERT_EQ(0, wlogic.use_count());
+}
+
+TEST(QuorumLogicTest, FunctionsAreLetGoOnceFailed)
+{
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    std::weak_ptr<quorum3> wlogic(logic);
+    
+    int failures = 0;
+    logic->set_function([logic](node::ptr n) {});
+    logic->set_fail_function([logic, &failures] { ++failures; });
+    logic->run();
+    
+    logic->node_failed(nodes[0]);
+    logic->node_failed(nodes[1]);
+    logic->node_failed(nodes[2]);
+    ASSERT_EQ(1, failures);
+    
+    logic.reset();
+    ASSERT_EQ(0, wlogic.use_count());
+}
+
+TEST(QuorumLogicTest, QuorumReachedWhileSendingStopsSending)
+{
+    auto nodes = three_nodes();
+    auto logic = std::make_shared<quorum3>(nodes);
+    std::weak_ptr<quorum3> wlogic(logic);
+    
+    //a function that answers right away completes the quorum from inside itself
+    std::vector<node::ptr> sent;
+    logic->set_function([logic, &sent](node::ptr n) {
+        sent.push_back(n);
+        logic->node_success(n);
+    });
+    logic->run();
+    
+    ASSERT_EQ(2u, sent.size());
+    ASSERT_TRUE(logic->completed());
+    
+    logic.reset();
+    ASSERT_EQ(0, wlogic.use_count());
+}
+
+TEST(HedgePolicyTest, FollowsThePercentileOnceWarm)
+{
+    hedge_policy policy(std::chrono::milliseconds(10), 0.95);
+    ASSERT_TRUE(policy.enabled());
+    
+    for (int i = 0; i < 95; ++i)
+    {
+        policy.record(std::chrono::microseconds(1000));
+    }
+    
+    //not enough replies yet
+    ASSERT_EQ(std::chrono::microseconds(std::chrono::milliseconds(10)), policy.delay());
+    
+    for (int i = 0; i < 905; ++i)
+    {
+        policy.record(std::chrono::microseconds(i % 20 == 0 ? 50000 : 1000));
+    }
+    
+    auto delay = policy.delay();
+    ASSERT_GE(delay.count(), 1000);
+    ASSERT_LT(delay.count(), 1500);
+}
+
+TEST(HedgePolicyTest, ZeroDelayIsOff)
+{
+    hedge_policy policy(std::chrono::microseconds(0), 0.95);
+    ASSERT_FALSE(policy.enabled());
+}
+
+namespace
+{
+    ///
+    /// Runs quorum operations against replicas that now and then stall and
+    /// returns the time each took to reach its quorum, sorted
+    ///
+    std::vector<std::int64_t> simulate_quorums(int operations, bool hedge)
+    {
+        const double STALL_CHANCE = 0.05;
+        
+        boost::asio::io_service ioService;
+        std::mt19937 rng(42);
+        std::uniform_int_distribution<int> normal(500, 1500);
+        std::bernoulli_distribution stall(STALL_CHANCE);
+        
+        auto nodes = three_nodes();
+        std::vector<std::int64_t> latencies;
+        
+        //spread the operations out so they aren't waiting on each other
+        auto first = std::chrono::steady_clock::now();
+        
+        for (int op = 0; op < operations; ++op)
+        {
+            auto logic = std::make_shared<quorum3>(nodes);
+            auto start = first + std::chrono::microseconds(op * 100);
+            std::weak_ptr<quorum3> wlogic(logic);
+            
+            //the pending replies hold the operation until they're all in
+            logic->set_function([&, wlogic, start](node::ptr n) {
+                int replyUs = stall(rng) ? 20000 : normal(rng);
+                auto logic = wlogic.lock();
+                
+                auto timer = std::make_shared<boost::asio::steady_timer>(ioService, std::chrono::microseconds(replyUs));
+                timer->async_wait([&, logic, start, timer, n](const boost::system::error_code&) {
+                    if (logic->node_success(n))
+                    {
+                        latencies.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                            std::chrono::steady_clock::now() - start).count());
+                    }
+                });
+            });
+            
+            if (hedge) logic->set_hedge(ioService, std::chrono::milliseconds(3));
+            
+            auto startTimer = std::make_shared<boost::asio::steady_timer>(ioService, start);
+            startTimer->async_wait([logic, startTimer](const boost::system::error_code&) { logic->run(); });
+        }
+        
+        ioService.run();
+        
+        std::sort(latencies.begin(), latencies.end());
+        return latencies;
+    }
+}
+
+TEST(QuorumLogicTest, SimulateHedgedTailLatency)
+{
+    const int OPERATIONS = bench_util::full_runs() ? 20000 : 2000;
+    
+    auto plain = simulate_quorums(OPERATIONS, false);
+    auto hedged = simulate_quorums(OPERATIONS, true);
+    
+    ASSERT_EQ((size_t)OPERATIONS, plain.size());
+    ASSERT_EQ((size_t)OPERATIONS, hedged.size());
+    
+    printf("[ BENCH    ] %-48s %10lld us p50 %10lld us p99\n", "quorum of 3 with 5% replica stalls",
+           (long long)plain[plain.size() / 2], (long long)plain[plain.size() * 99 / 100]);
+    printf("[ BENCH    ] %-48s %10lld us p50 %10lld us p99\n", "quorum of 3 with 5% stalls, hedged at 3ms",
+           (long long)hedged[hedged.size() / 2], (long long)hedged[hedged.size() * 99 / 100]);
+    
+    ASSERT_LT(hedged[hedged.size() * 99 / 100], plain[plain.size() * 99 / 100]);
+}
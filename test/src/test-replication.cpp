@@ -0,0 +1,160 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "replication.h"
+#include "ring.h"
+#include "settings.h"
+#include "endpoint.h"
+#include "unavailable_error.h"
+#include "local_node_operations.h"
+#include "queue_manager.h"
+#include "messageutil.h"
+#include "util.h"
+
+#include "PublishMessage.pb.h"
+#include "ProxyPublishResponseMessage.pb.h"
+#include "QueueStamp.pb.h"
+#include "VectorClock.pb.h"
+
+#include <string>
+#include <memory>
+
+using namespace sopmq::node;
+using namespace sopmq::shared::net;
+
+using sopmq::message::messageutil;
+using sopmq::shared::util;
+
+namespace
+{
+    ///
+    /// Sets the single replica prefixes for the life of the object
+    ///
+    struct prefixes_setting
+    {
+        std::vector<std::string> previous;
+        
+        explicit prefixes_setting(std::vector<std::string> prefixes)
+        : previous(settings::instance().singleReplicaPrefixes)
+        {
+            settings::instance().singleReplicaPrefixes = prefixes;
+        }
+        
+        ~prefixes_setting()
+        {
+            settings::instance().singleReplicaPrefixes = previous;
+        }
+    };
+}
+
+TEST(ReplicationTest, QueuesDefaultToThreeReplicas)
+{
+    prefixes_setting prefixes({});
+    
+    ASSERT_EQ(3u, replication::factor_for_queue("im.user.1234"));
+    ASSERT_EQ(3u, replication::factor_for_queue(""));
+}
+
+TEST(ReplicationTest, PrefixedQueuesHaveOneReplica)
+{
+    prefixes_setting prefixes({ "groupchat.", "presence." });
+    
+    ASSERT_EQ(1u, replication::factor_for_queue("groupchat.room.99"));
+    ASSERT_EQ(1u, replication::factor_for_queue("presence.user.1234"));
+    ASSERT_EQ(3u, replication::factor_for_queue("im.user.1234"));
+    ASSERT_EQ(3u, replication::factor_for_queue("groupchat"));
+}
+
+TEST(ReplicationTest, SingleReplicaQuorumIsThePrimary)
+{
+    ring r;
+    
+    node::ptr node1(new sopmq::node::node(1, 10, endpoint("sopmq1://localhost:1")));
+    node::ptr node2(new sopmq::node::node(2, 20, endpoint("sopmq1://localhost:2")));
+    node::ptr node3(new sopmq::node::node(3, 30, endpoint("sopmq1://localhost:3")));
+    r.add_node(node1);
+    r.add_node(node2);
+    r.add_node(node3);
+    
+    auto quorum = r.find_quorum_for_operation<1>(25);
+    ASSERT_EQ(node2, quorum[0]);
+    
+    //the other replicas being down doesn't matter to it
+    node1->set_failed();
+    node3->set_failed();
+    ASSERT_EQ(node2, r.find_quorum_for_operation<1>(25)[0]);
+    ASSERT_THROW(r.find_quorum_for_operation<3>(25), sopmq::error::unavailable_error);
+    
+    node2->set_failed();
+    ASSERT_THROW(r.find_quorum_for_operation<1>(25), sopmq::error::unavailable_error);
+}
+
+TEST(ReplicationTest, SingleReplicaQueueStampsInOrder)
+{
+    prefixes_setting prefixes({ "groupchat." });
+    
+    ring r;
+    node::ptr self(new sopmq::node::node(1, 10, endpoint("sopmq1://localhost:1")));
+    r.add_node(self);
+    
+    queue_manager3 queues;
+    intra::local_node_operations ops(r, *self, self->clock(), queues);
+    
+    const std::string QUEUE = "groupchat.room.99";
+    const int COUNT = 5;
+    
+    for (int i = 0; i < COUNT; ++i)
+    {
+        auto message = messageutil::make_message<PublishMessage>(i + 1, 0);
+        message->set_queue_id(QUEUE);
+        message->set_allocated_message_id(util::uuid_to_bytes(util::random_uuid()));
+        message->set_ttl(30);
+        message->set_content("message " + std::to_string(i));
+        
+        ProxyPublishResponseMessage_ptr response;
+        ops.send_proxy_publish(message, [&](intra::operation_result<ProxyPublishResponseMessage_ptr>& result) {
+            response = result.message();
+        });
+        
+        //the proxy only hears about the one replica
+        ASSERT_TRUE((bool)response);
+        ASSERT_EQ(1, response->clock().clocks_size());
+        
+        QueueStamp stamp;
+        stamp.set_queue_id(QUEUE);
+        stamp.set_message_id(message->message_id());
+        *stamp.mutable_clock() = response->clock();
+        
+        ops.send_stamp(stamp);
+    }
+    
+    auto messages = queues.peek(util::murmur_hash3(QUEUE), nullptr, COUNT * 2, 1024 * 1024);
+    ASSERT_EQ((size_t)COUNT, messages.size());
+    
+    node_clock empty = node_clock();
+    for (int i = 0; i < COUNT; ++i)
+    {
+        ASSERT_EQ("message " + std::to_string(i), messages[i]->data());
+        
+        auto& clock = messages[i]->clock().value();
+        ASSERT_EQ(1u, clock[0].node_id);
+        ASSERT_EQ(empty, clock[1]);
+        ASSERT_EQ(empty, clock[2]);
+    }
+}
@@ -24,10 +24,23 @@
 #include "unavailable_error.h"
 #include "util.h"
 #include "settings.h"
+#include "bench_util.h"
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <thread>
+#include <vector>
 
 using namespace sopmq::node;
 using namespace sopmq::shared::net;
 
+using sopmq::shared::util;
+using sopmq::test::bench_timer;
+using sopmq::test::bench_util;
+
 TEST(RingTest, TestEmptyRingFind)
 {
     ring r;
@@ -279,7 +292,7 @@ TEST(RingTest, TestAvailableQuorum)
     r.add_node(node2);
     r.add_node(node3);
     
-    auto quorum = r.find_quorum_for_operation(40);
+    auto quorum = r.find_quorum_for_operation<3>(40);
     ASSERT_TRUE(quorum[0] == node1 || quorum[0] == node2 || quorum[0] == node3);
     ASSERT_TRUE(quorum[0] != nullptr);
     ASSERT_TRUE(quorum[1] != nullptr);
@@ -300,5 +313,396 @@ TEST(RingTest, TestUnavailableQuorum)
     node1->set_failed();
     node2->set_failed();
     
-    ASSERT_THROW(r.find_quorum_for_operation(40), sopmq::error::unavailable_error);
-}
\ No newline at end of file
+    ASSERT_THROW(r.find_quorum_for_operation<3>(40), sopmq::error::unavailable_error);
+}
+
+TEST(RingTest, TestNodeLatencyEstimate)
+{
+    node::ptr n(new sopmq::node::node(1, 10, endpoint("sopmq1://localhost:1")));
+    ASSERT_EQ(0u, n->latency_estimate());
+    
+    n->request_started();
+    n->request_started();
+    ASSERT_EQ(2u, n->in_flight());
+    
+    n->request_finished(std::chrono::microseconds(800));
+    ASSERT_EQ(800u, n->latency_estimate());
+    
+    n->request_finished(std::chrono::microseconds(1600));
+    ASSERT_EQ(900u, n->latency_estimate());
+    ASSERT_EQ(0u, n->in_flight());
+}
+
+namespace
+{
+    void answer_in(const node::ptr& n, std::chrono::microseconds latency)
+    {
+        for (int i = 0; i < 32; ++i)
+        {
+            n->request_started();
+            n->request_finished(latency);
+        }
+    }
+}
+
+TEST(RingTest, TestQuorumPrefersFasterNodes)
+{
+    ring r;
+    
+    node::ptr node1(new sopmq::node::node(1, 10, endpoint("sopmq1://localhost:1")));
+    node::ptr node2(new sopmq::node::node(2, 20, endpoint("sopmq1://localhost:2")));
+    node::ptr node3(new sopmq::node::node(3, 30, endpoint("sopmq1://localhost:3")));
+    r.add_node(node1);
+    r.add_node(node2);
+    r.add_node(node3);
+    
+    answer_in(node1, std::chrono::milliseconds(50));
+    answer_in(node2, std::chrono::milliseconds(1));
+    answer_in(node3, std::chrono::milliseconds(1));
+    
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto quorum = r.find_quorum_for_operation<3>(40);
+        
+        ASSERT_NE(node1, quorum[0]);
+        ASSERT_NE(node1, quorum[1]);
+        ASSERT_EQ(node1, quorum[2]);
+    }
+    
+    //a fast node with enough waiting on it is passed over too. it costs more
+    //than either of the others, so it loses every pairing
+    for (int i = 0; i < 100; ++i)
+    {
+        node2->request_started();
+    }
+    
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto quorum = r.find_quorum_for_operation<3>(40);
+        ASSERT_EQ(node2, quorum[2]);
+    }
+}
+
+TEST(RingTest, TestQuorumAvoidsNodesThatFailFast)
+{
+    ring r;
+    
+    node::ptr node1(new sopmq::node::node(1, 10, endpoint("sopmq1://localhost:1")));
+    node::ptr node2(new sopmq::node::node(2, 20, endpoint("sopmq1://localhost:2")));
+    node::ptr node3(new sopmq::node::node(3, 30, endpoint("sopmq1://localhost:3")));
+    r.add_node(node1);
+    r.add_node(node2);
+    r.add_node(node3);
+    
+    answer_in(node1, std::chrono::milliseconds(5));
+    answer_in(node2, std::chrono::milliseconds(5));
+    answer_in(node3, std::chrono::milliseconds(5));
+    
+    //a refused connection comes back right away, which must not make the node
+    //look like the quickest
+    for (int i = 0; i < 4; ++i)
+    {
+        node2->request_started();
+        node2->request_failed();
+    }
+    
+    ASSERT_EQ(0u, node2->in_flight());
+    ASSERT_GT(node2->latency_estimate(), node1->latency_estimate());
+    
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto quorum = r.find_quorum_for_operation<3>(40);
+        ASSERT_EQ(node2, quorum[2]);
+    }
+}
+
+TEST(RingTest, TestQuorumSpreadsOverEqualNodes)
+{
+    ring r;
+    
+    std::vector<node::ptr> nodes;
+    for (uint32_t i = 1; i <= 3; ++i)
+    {
+        nodes.emplace_back(new sopmq::node::node(i, i * 10, endpoint("sopmq1://localhost:" + std::to_string(i))));
+        r.add_node(nodes.back());
+    }
+    
+    std::map<node::ptr, int> firsts;
+    for (int i = 0; i < 3000; ++i)
+    {
+        ++firsts[r.find_quorum_for_operation<3>(40)[0]];
+    }
+    
+    for (auto& n : nodes)
+    {
+        ASSERT_GT(firsts[n], 500);
+    }
+}
+
+namespace
+{
+    ///
+    /// A range start spread over the top of the key space
+    ///
+    uint128 range_at(uint32_t index)
+    {
+        uint128 start(index);
+        start <<= 120;
+        
+        return start;
+    }
+}
+
+TEST(RingTest, TestLookupsWhileNodesAreAdded)
+{
+    ring r;
+    
+    node::ptr first(new sopmq::node::node(1, 0, endpoint("sopmq1://localhost:1")));
+    r.add_node(first);
+    
+    std::atomic<bool> done(false);
+    std::atomic<int> badLookups(0);
+    
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t)
+    {
+        readers.emplace_back([&r, &done, &badLookups, t] {
+            uint64_t key = t;
+            while (! done)
+            {
+                //every replica set is whole no matter which snapshot we see
+                auto nodes = r.find_nodes_for_key(util::murmur_hash3(&key, sizeof(key)));
+                if (! nodes[0] || ! nodes[1] || ! nodes[2]) ++badLookups;
+                
+                key += 4;
+            }
+        });
+    }
+    
+    std::vector<node::ptr> added;
+    for (uint32_t i = 2; i <= 64; ++i)
+    {
+        node::ptr n(new sopmq::node::node(i, range_at(i), endpoint("sopmq1://localhost:" + std::to_string(i))));
+        added.push_back(n);
+        r.add_node(n);
+    }
+    
+    done = true;
+    for (auto& reader : readers)
+    {
+        reader.join();
+    }
+    
+    ASSERT_EQ(0, badLookups.load());
+    
+    auto nodes = r.find_nodes_for_key(range_at(5));
+    ASSERT_EQ(added[3], nodes[0]);
+    ASSERT_EQ(added[4], nodes[1]);
+    ASSERT_EQ(added[5], nodes[2]);
+}
+
+TEST(RingTest, ReplacedSnapshotsAreFreed)
+{
+    ring r;
+    
+    node::ptr first(new sopmq::node::node(1, 0, endpoint("sopmq1://localhost:1")));
+    r.add_node(first);
+    
+    for (uint32_t i = 2; i <= 64; ++i)
+    {
+        r.add_node(node::ptr(new sopmq::node::node(i, range_at(i), endpoint("sopmq1://localhost:" + std::to_string(i)))));
+    }
+    
+    //ours, plus the current snapshot's node list, id map and replica sets
+    ASSERT_LE(first.use_count(), (long)(3 + ring::MAX_REPLICATION_FACTOR * first->tokens().size()));
+}
+
+TEST(RingTest, BenchmarkFindNodesForKey)
+{
+    const int LOOKUPS = bench_util::full_runs() ? 10000000 : 1000000;
+    
+    ring r;
+    for (uint32_t i = 1; i <= 32; ++i)
+    {
+        r.add_node(node::ptr(new sopmq::node::node(i, range_at(i), endpoint("sopmq1://localhost:" + std::to_string(i)))));
+    }
+    
+    std::vector<uint128> keys;
+    for (uint64_t i = 0; i < 1024; ++i)
+    {
+        keys.push_back(util::murmur_hash3(&i, sizeof(i)));
+    }
+    
+    uint32_t sum = 0;
+    
+    bench_timer timer;
+    for (int i = 0; i < LOOKUPS; ++i)
+    {
+        sum += r.find_nodes_for_key(keys[i & 1023])[0]->node_id();
+    }
+    timer.stop("ring find_nodes_for_key, 32 nodes", LOOKUPS);
+    
+    ASSERT_NE(0u, sum);
+}
+
+namespace
+{
+    ///
+    /// Sets the number of tokens new nodes are given for the life of the object
+    ///
+    struct vnodes_setting
+    {
+        uint32_t previous;
+        
+        explicit vnodes_setting(uint32_t vnodes)
+        : previous(settings::instance().vnodes)
+        {
+            settings::instance().vnodes = vnodes;
+        }
+        
+        ~vnodes_setting()
+        {
+            settings::instance().vnodes = previous;
+        }
+    };
+    
+    node::ptr hashed_node(uint32_t id)
+    {
+        return node::ptr(new sopmq::node::node(id, util::murmur_hash3(&id, sizeof(id)),
+                                               endpoint("sopmq1://localhost:" + std::to_string(id))));
+    }
+}
+
+TEST(RingTest, TestVnodeTokensAreStable)
+{
+    vnodes_setting vnodes(16);
+    
+    node::ptr a(new sopmq::node::node(1, 1000, endpoint("sopmq1://localhost:1")));
+    node::ptr b(new sopmq::node::node(1, 1000, endpoint("sopmq1://localhost:1")));
+    
+    ASSERT_EQ(16u, a->tokens().size());
+    ASSERT_EQ(uint128(1000), a->tokens()[0]);
+    ASSERT_EQ(a->tokens(), b->tokens());
+}
+
+TEST(RingTest, TestVnodeReplicasAreDistinctNodes)
+{
+    vnodes_setting vnodes(64);
+    
+    ring r;
+    for (uint32_t i = 1; i <= 5; ++i)
+    {
+        r.add_node(hashed_node(i));
+    }
+    
+    for (uint64_t i = 0; i < 10000; ++i)
+    {
+        auto nodes = r.find_nodes_for_key(util::murmur_hash3(&i, sizeof(i)));
+        
+        ASSERT_NE(nodes[0], nodes[1]);
+        ASSERT_NE(nodes[1], nodes[2]);
+        ASSERT_NE(nodes[0], nodes[2]);
+    }
+}
+
+TEST(RingTest, TestVnodeRingSmallerThanReplicaSet)
+{
+    vnodes_setting vnodes(64);
+    
+    ring r;
+    node::ptr node1 = hashed_node(1);
+    node::ptr node2 = hashed_node(2);
+    r.add_node(node1);
+    r.add_node(node2);
+    
+    //like a single token ring, the primary is doubled up as the tertiary
+    for (uint64_t i = 0; i < 1000; ++i)
+    {
+        auto nodes = r.find_nodes_for_key(util::murmur_hash3(&i, sizeof(i)));
+        
+        ASSERT_NE(nodes[0], nodes[1]);
+        ASSERT_EQ(nodes[0], nodes[2]);
+    }
+}
+
+TEST(RingTest, TestVnodeTokenConflict)
+{
+    ring r;
+    
+    node::ptr node1(new sopmq::node::node(1, 100, endpoint("sopmq1://localhost:1")));
+    r.add_node(node1);
+    
+    vnodes_setting vnodes(8);
+    
+    //its first token is the range start the other node already owns
+    node::ptr node2(new sopmq::node::node(2, 100, endpoint("sopmq1://localhost:2")));
+    ASSERT_THROW(r.add_node(node2), sopmq::error::range_conflict_error);
+}
+
+TEST(RingTest, SimulateVnodeLoadDistribution)
+{
+    const uint64_t KEYS = bench_util::full_runs() ? 1000000 : 100000;
+    
+    for (uint32_t vnodeCount : { 1, 16, 64, 256 })
+    {
+        vnodes_setting vnodes(vnodeCount);
+        
+        for (uint32_t nodeCount : { 3, 5, 10, 25, 50, 100 })
+        {
+            ring r;
+            for (uint32_t i = 1; i <= nodeCount; ++i)
+            {
+                r.add_node(hashed_node(i));
+            }
+            
+            std::vector<uint64_t> keysPerNode(nodeCount + 1);
+            for (uint64_t i = 0; i < KEYS; ++i)
+            {
+                ++keysPerNode[r.find_primary_node_for_key(util::murmur_hash3(&i, sizeof(i)))->node_id()];
+            }
+            
+            double mean = (double)KEYS / nodeCount;
+            double ratio = *std::max_element(keysPerNode.begin(), keysPerNode.end()) / mean;
+            
+            printf("[ BENCH    ] %-48s %10.2f max/mean keys per node\n",
+                   ("ring load, " + std::to_string(nodeCount) + " nodes, "
+                    + std::to_string(vnodeCount) + " vnodes").c_str(),
+                   ratio);
+            
+            //a node's share is the sum of many small ranges, so it stays near its
+            //fair share
+            if (vnodeCount >= 256)
+            {
+                ASSERT_LT(ratio, 1.5);
+            }
+        }
+    }
+}
+
+TEST(RingTest, BenchmarkFindQuorumForOperation)
+{
+    const int LOOKUPS = bench_util::full_runs() ? 10000000 : 1000000;
+    
+    ring r;
+    for (uint32_t i = 1; i <= 32; ++i)
+    {
+        r.add_node(node::ptr(new sopmq::node::node(i, range_at(i), endpoint("sopmq1://localhost:" + std::to_string(i)))));
+    }
+    
+    std::vector<uint128> keys;
+    for (uint64_t i = 0; i < 1024; ++i)
+    {
+        keys.push_back(util::murmur_hash3(&i, sizeof(i)));
+    }
+    
+    uint32_t sum = 0;
+    
+    bench_timer timer;
+    for (int i = 0; i < LOOKUPS; ++i)
+    {
+        sum += r.find_quorum_for_operation<3>(keys[i & 1023])[0]->node_id();
+    }
+    timer.stop("ring find_quorum_for_operation, 32 nodes", LOOKUPS);
+    
+    ASSERT_NE(0u, sum);
+}
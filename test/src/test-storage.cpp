@@ -0,0 +1,393 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "cassandra_storage.h"
+#include "day_buckets.h"
+#include "util.h"
+#include "bench_util.h"
+#include "fake_storage_driver.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+
+using sopmq::node::storage::cassandra_storage;
+using sopmq::node::storage::storage_driver;
+using sopmq::node::storage::day_buckets;
+using sopmq::node::storage::stored_message;
+using sopmq::node::storage::store_messages_result;
+using sopmq::node::storage::claim_stored_result;
+using sopmq::shared::util;
+using sopmq::test::bench_util;
+using sopmq::test::bench_timer;
+using sopmq::test::fake_storage_driver;
+
+namespace
+{
+    ///
+    /// Blocks until the storage callback has run
+    ///
+    class waiter
+    {
+    public:
+        waiter() : _done(false) {}
+        
+        void done()
+        {
+            std::lock_guard<std::mutex> lk(_m);
+            _done = true;
+            _cv.notify_one();
+        }
+        
+        void wait()
+        {
+            std::unique_lock<std::mutex> lk(_m);
+            _cv.wait(lk, [this] { return _done; });
+            _done = false;
+        }
+        
+    private:
+        std::mutex _m;
+        std::condition_variable _cv;
+        bool _done;
+    };
+    
+    std::vector<stored_message> make_messages(const std::string& queueId, size_t count, size_t size)
+    {
+        std::vector<stored_message> messages(count);
+        for (auto& message : messages)
+        {
+            std::unique_ptr<std::string> id(util::uuid_to_bytes(util::random_uuid()));
+            
+            message.queue_id = queueId;
+            message.message_id = *id;
+            message.content = std::string(size, 'x');
+        }
+        
+        return messages;
+    }
+    
+    std::string random_queue(const std::string& prefix)
+    {
+        std::unique_ptr<std::string> queueBytes(util::uuid_to_bytes(util::random_uuid()));
+        return prefix + util::hex_encode((const unsigned char*)queueBytes->data(), (int)queueBytes->size());
+    }
+    
+    ///
+    /// \return The error the store failed with, empty if it worked
+    ///
+    std::string try_store(cassandra_storage& storage, const std::vector<stored_message>& messages)
+    {
+        waiter w;
+        std::string error;
+        
+        storage.store_messages(messages, [&](const store_messages_result& result) {
+            if (result.error) error = result.error->what();
+            w.done();
+        });
+        
+        w.wait();
+        return error;
+    }
+    
+    void store(cassandra_storage& storage, const std::vector<stored_message>& messages)
+    {
+        ASSERT_EQ("", try_store(storage, messages));
+    }
+    
+    ///
+    /// Claims the queue handing back the whole result, errors and all
+    ///
+    void try_claim(cassandra_storage& storage, const std::string& queueId, bool remove, claim_stored_result& out)
+    {
+        waiter w;
+        
+        storage.claim_stored_messages(queueId, remove, [&](claim_stored_result& result) {
+            out.error = std::move(result.error);
+            out.cleanup_error = std::move(result.cleanup_error);
+            out.messages = std::move(result.messages);
+            w.done();
+        });
+        
+        w.wait();
+    }
+    
+    std::vector<stored_message> claim(cassandra_storage& storage, const std::string& queueId, bool remove)
+    {
+        claim_stored_result result;
+        try_claim(storage, queueId, remove, result);
+        
+        EXPECT_FALSE((bool)result.error);
+        EXPECT_FALSE((bool)result.cleanup_error);
+        
+        return std::move(result.messages);
+    }
+    
+    ///
+    /// Storage running on the fake driver, set up the way the node sets it up
+    ///
+    struct fake_storage
+    {
+        fake_storage_driver* driver;
+        cassandra_storage storage;
+        
+        fake_storage()
+        : driver(new fake_storage_driver()), storage(std::unique_ptr<storage_driver>(driver))
+        {
+            storage.init();
+            storage.connect();
+        }
+    };
+}
+
+TEST(StorageTest, ClaimWindowStartsAtLastClaim)
+{
+    auto days = day_buckets::claim_window(100, 103);
+    ASSERT_EQ(4, days.size());
+    ASSERT_EQ(100, days.front());
+    ASSERT_EQ(103, days.back());
+}
+
+TEST(StorageTest, ClaimWindowIsLimitedToLookback)
+{
+    auto days = day_buckets::claim_window(day_buckets::NEVER_CLAIMED, 1000);
+    ASSERT_EQ(day_buckets::MAX_LOOKBACK_DAYS + 1, days.size());
+    ASSERT_EQ(1000 - day_buckets::MAX_LOOKBACK_DAYS, days.front());
+    
+    days = day_buckets::claim_window(10, 1000);
+    ASSERT_EQ(day_buckets::MAX_LOOKBACK_DAYS + 1, days.size());
+    
+    //a last claim in the future still reads today
+    days = day_buckets::claim_window(1005, 1000);
+    ASSERT_EQ(1, days.size());
+    ASSERT_EQ(1000, days.front());
+}
+
+TEST(StorageTest, BucketKeysDifferByQueueAndDay)
+{
+    ASSERT_EQ(0, day_buckets::day_of(day_buckets::SECONDS_PER_DAY - 1));
+    ASSERT_EQ(1, day_buckets::day_of(day_buckets::SECONDS_PER_DAY));
+    
+    std::set<std::string> keys = {
+        day_buckets::queue_key("queue"),
+        day_buckets::bucket_key("queue", 1),
+        day_buckets::bucket_key("queue", 2),
+        day_buckets::bucket_key("queue2", 1)
+    };
+    
+    ASSERT_EQ(4, keys.size());
+    ASSERT_EQ(16, day_buckets::bucket_key("queue", 1).size());
+    ASSERT_EQ(day_buckets::bucket_key("queue", 1), day_buckets::bucket_key("queue", 1));
+}
+
+TEST(StorageTest, StoredMessagesAreClaimedOnce)
+{
+    fake_storage fake;
+    std::string queueId = random_queue("test/");
+    
+    auto messages = make_messages(queueId, 3, 16);
+    store(fake.storage, messages);
+    ASSERT_EQ(3, fake.driver->stored_items());
+    
+    //peeking leaves them where they are
+    ASSERT_EQ(3, claim(fake.storage, queueId, false).size());
+    
+    auto claimed = claim(fake.storage, queueId, true);
+    ASSERT_EQ(3, claimed.size());
+    ASSERT_EQ(0, fake.driver->stored_items());
+    
+    std::set<std::string> ids;
+    for (auto& message : claimed) ids.insert(message.message_id);
+    for (auto& message : messages) ASSERT_EQ(1, ids.count(message.message_id));
+    
+    ASSERT_EQ(0, claim(fake.storage, queueId, true).size());
+}
+
+TEST(StorageTest, FailedStoreIsReported)
+{
+    fake_storage fake;
+    std::string queueId = random_queue("test/");
+    
+    fake.driver->fail_queries("INSERT INTO sopmq.stored_items");
+    ASSERT_NE("", try_store(fake.storage, make_messages(queueId, 3, 16)));
+    ASSERT_EQ(0, fake.driver->stored_items());
+}
+
+TEST(StorageTest, FailedReadRemovesNothing)
+{
+    fake_storage fake;
+    std::string queueId = random_queue("test/");
+    
+    store(fake.storage, make_messages(queueId, 3, 16));
+    
+    fake.driver->fail_queries("SELECT stored_at");
+    claim_stored_result result;
+    try_claim(fake.storage, queueId, true, result);
+    
+    ASSERT_TRUE((bool)result.error);
+    ASSERT_FALSE((bool)result.cleanup_error);
+    ASSERT_EQ(3, fake.driver->stored_items());
+    
+    //the claim can be tried again once storage is back
+    fake.driver->clear_failures();
+    ASSERT_EQ(3, claim(fake.storage, queueId, true).size());
+    ASSERT_EQ(0, fake.driver->stored_items());
+}
+
+TEST(StorageTest, FailedCleanupStillDeliversMessages)
+{
+    fake_storage fake;
+    std::string queueId = random_queue("test/");
+    
+    store(fake.storage, make_messages(queueId, 3, 16));
+    
+    fake.driver->fail_queries("DELETE");
+    claim_stored_result result;
+    try_claim(fake.storage, queueId, true, result);
+    
+    ASSERT_FALSE((bool)result.error);
+    ASSERT_TRUE((bool)result.cleanup_error);
+    ASSERT_EQ(3, result.messages.size());
+    
+    //they weren't removed, so the next claim hands them out again
+    fake.driver->clear_failures();
+    ASSERT_EQ(3, claim(fake.storage, queueId, true).size());
+    ASSERT_EQ(0, fake.driver->stored_items());
+}
+
+TEST(StorageTest, BenchmarkStoreAndClaim)
+{
+    fake_storage fake;
+    
+    const size_t numMessages = bench_util::full_runs() ? 100000 : 10000;
+    const size_t batchSize = 100;
+    
+    std::string queueId = random_queue("bench/");
+    auto batch = make_messages(queueId, batchSize, 256);
+    
+    bench_timer timer;
+    for (size_t stored = 0; stored < numMessages; stored += batchSize)
+    {
+        //new ids each round, the content can stay the same
+        for (auto& message : batch)
+        {
+            std::unique_ptr<std::string> id(util::uuid_to_bytes(util::random_uuid()));
+            message.message_id = *id;
+        }
+        
+        store(fake.storage, batch);
+    }
+    timer.stop("store in batches of " + std::to_string(batchSize), numMessages);
+    
+    bench_timer claimTimer;
+    auto claimed = claim(fake.storage, queueId, true);
+    claimTimer.stop("claim stored messages", numMessages);
+    
+    ASSERT_EQ(numMessages, claimed.size());
+}
+
+TEST(StorageTest, RequestsFailFastWhileDisconnected)
+{
+    fake_storage_driver* driver = new fake_storage_driver();
+    cassandra_storage storage((std::unique_ptr<storage_driver>(driver)));
+    std::string queueId = random_queue("test/");
+    
+    //the first request starts a reconnect but doesn't wait on it
+    driver->hold_connects(true);
+    ASSERT_NE("", try_store(storage, make_messages(queueId, 1, 16)));
+    ASSERT_EQ(1, driver->connects());
+    ASSERT_EQ(1, driver->pending());
+    
+    //nor does anything after it start another
+    claim_stored_result result;
+    try_claim(storage, queueId, true, result);
+    ASSERT_TRUE((bool)result.error);
+    ASSERT_EQ(1, driver->connects());
+    
+    driver->run_pending();
+    ASSERT_TRUE(storage.is_connected());
+    
+    store(storage, make_messages(queueId, 1, 16));
+    ASSERT_EQ(1, driver->connects());
+}
+
+TEST(StorageTest, ReconnectsAreRateLimited)
+{
+    fake_storage_driver* driver = new fake_storage_driver();
+    cassandra_storage storage((std::unique_ptr<storage_driver>(driver)));
+    std::string queueId = random_queue("test/");
+    
+    driver->fail_connects(true);
+    ASSERT_NE("", try_store(storage, make_messages(queueId, 1, 16)));
+    ASSERT_EQ(1, driver->connects());
+    
+    //a storage cluster that stays down isn't asked again right away
+    for (int i = 0; i < 10; ++i)
+    {
+        ASSERT_NE("", try_store(storage, make_messages(queueId, 1, 16)));
+    }
+    
+    ASSERT_EQ(1, driver->connects());
+    ASSERT_FALSE(storage.is_connected());
+}
+
+TEST(StorageTest, LostHostsReconnectOnceAndKeepTheOldSession)
+{
+    fake_storage fake;
+    size_t connects = fake.driver->connects();
+    ASSERT_EQ(1, fake.driver->open_sessions());
+    
+    std::string queueId = random_queue("test/");
+    store(fake.storage, make_messages(queueId, 3, 16));
+    
+    //two requests on the first session, still running when its hosts go away
+    fake.driver->hold_queries(true);
+    
+    std::vector<std::string> errors;
+    for (int i = 0; i < 2; ++i)
+    {
+        fake.storage.store_messages(make_messages(queueId, 1, 16), [&](const store_messages_result& result) {
+            errors.push_back(result.error ? result.error->what() : "");
+        });
+    }
+    
+    fake.driver->fail_queries("", true);
+    
+    //the first failure replaces the session. the second request keeps the old one open
+    ASSERT_TRUE(fake.driver->run_next());
+    ASSERT_EQ(connects + 1, fake.driver->connects());
+    ASSERT_EQ(2, fake.driver->open_sessions());
+    
+    //and its failure doesn't reconnect again, the session it ran on is already gone
+    ASSERT_TRUE(fake.driver->run_next());
+    ASSERT_EQ(connects + 1, fake.driver->connects());
+    ASSERT_EQ(1, fake.driver->open_sessions());
+    
+    ASSERT_EQ(2, errors.size());
+    ASSERT_NE("", errors[0]);
+    ASSERT_NE("", errors[1]);
+    
+    //the new session works
+    fake.driver->clear_failures();
+    fake.driver->hold_queries(false);
+    ASSERT_EQ(3, claim(fake.storage, queueId, true).size());
+}
@@ -0,0 +1,142 @@
+/*
+ * SOPMQ - Scalable optionally persistent message queue
+ * Copyright 2014 InWorldz, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "gtest/gtest.h"
+
+#include "timing_wheel.h"
+
+#include <boost/chrono.hpp>
+
+#include <vector>
+#include <random>
+#include <cstdint>
+
+using namespace sopmq::node;
+
+namespace bc = boost::chrono;
+
+namespace
+{
+    struct wheel_item : public timing_wheel_hook
+    {
+        int id;
+        bc::steady_clock::time_point deadline;
+        bool expired;
+    };
+    
+    typedef timing_wheel<wheel_item> test_wheel;
+}
+
+TEST(TimingWheelTest, ExpiresInOrderAndNeverEarly)
+{
+    test_wheel wheel(bc::milliseconds(100));
+    auto start = bc::steady_clock::now();
+    
+    //spread items from a fraction of a second out to 60 days so every level is used
+    std::default_random_engine rng(7);
+    std::uniform_int_distribution<int64_t> dist(0, 60LL * 24 * 60 * 60 * 1000);
+    
+    std::vector<wheel_item> items(2000);
+    for (size_t i = 0; i < items.size(); ++i)
+    {
+        items[i].id = (int)i;
+        items[i].deadline = start + bc::milliseconds(i < 100 ? (int64_t)i * 37 : dist(rng));
+        items[i].expired = false;
+        wheel.schedule(&items[i], items[i].deadline);
+    }
+    
+    ASSERT_EQ(items.size(), wheel.size());
+    
+    size_t expiredCount = 0;
+    auto now = start;
+    while (wheel.size() > 0)
+    {
+        auto next = wheel.next_expiry();
+        ASSERT_LT(next, test_wheel::time_point::max());
+        
+        //the wheel must not ask to be woken after something it holds is due
+        for (auto& item : items)
+        {
+            if (! item.expired)
+            {
+                ASSERT_LE(next, item.deadline + bc::milliseconds(100));
+            }
+        }
+        
+        now = std::max(now, next);
+        
+        expiredCount += wheel.advance(now, [&](wheel_item* item) {
+            ASSERT_FALSE(item->expired);
+            ASSERT_LE(item->deadline, now);
+            ASSERT_GT(item->deadline + bc::milliseconds(200), now);
+            item->expired = true;
+        });
+    }
+    
+    ASSERT_EQ(items.size(), expiredCount);
+    ASSERT_EQ(test_wheel::time_point::max(), wheel.next_expiry());
+}
+
+TEST(TimingWheelTest, CancelAndReschedule)
+{
+    test_wheel wheel(bc::milliseconds(100));
+    auto start = bc::steady_clock::now();
+    
+    wheel_item a, b, c;
+    a.id = 1; b.id = 2; c.id = 3;
+    
+    wheel.schedule(&a, start + bc::seconds(1));
+    wheel.schedule(&b, start + bc::seconds(1));
+    wheel.schedule(&c, start + bc::hours(1));
+    ASSERT_TRUE(a.is_scheduled());
+    
+    wheel.cancel(&a);
+    ASSERT_FALSE(a.is_scheduled());
+    
+    //move c up and b out
+    wheel.schedule(&c, start + bc::milliseconds(500));
+    wheel.schedule(&b, start + bc::hours(2));
+    ASSERT_EQ(2, wheel.size());
+    
+    std::vector<int> expired;
+    wheel.advance(start + bc::seconds(2), [&](wheel_item* item) { expired.push_back(item->id); });
+    ASSERT_EQ(1, expired.size());
+    ASSERT_EQ(3, expired[0]);
+    
+    wheel.advance(start + bc::hours(2) + bc::seconds(1), [&](wheel_item* item) { expired.push_back(item->id); });
+    ASSERT_EQ(2, expired.size());
+    ASSERT_EQ(2, expired[1]);
+    ASSERT_EQ(0, wheel.size());
+}
+
+TEST(TimingWheelTest, ItemsPastTheSpanStillExpire)
+{
+    test_wheel wheel(bc::milliseconds(1));
+    auto start = bc::steady_clock::now();
+    
+    //with 1ms ticks the wheel spans a little over 18 hours
+    wheel_item item;
+    item.id = 1;
+    wheel.schedule(&item, start + bc::hours(40));
+    
+    bool fired = false;
+    wheel.advance(start + bc::hours(39), [&](wheel_item*) { fired = true; });
+    ASSERT_FALSE(fired);
+    
+    wheel.advance(start + bc::hours(40) + bc::milliseconds(2), [&](wheel_item*) { fired = true; });
+    ASSERT_TRUE(fired);
+}